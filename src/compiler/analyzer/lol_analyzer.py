@@ -1,9 +1,12 @@
-from typing import Any, Dict, List, Optional, Union
+from enum import Enum, auto, unique
+from typing import Any, Dict, List, Optional, Set, Tuple, Union
 
 import compiler.parser.lol_parser as parser_types
 from compiler.parser.lol_parser import (
     # Generic
     LolParserLiteralType,
+    LolParserAssertLevel,
+    LolParserBranchHint,
 
     # Generic Expressions
     LolParserTypeExpression,
@@ -23,25 +26,38 @@ from compiler.parser.lol_parser import (
     LolParserParameterDefinition,
     LolParserVariableModification,
     LolParserFunctionDefinition,
+    LolParserBenchDefinition,
     LolParserReturnStatement,
     LolParserIfStatement,
+    LolParserAssertStatement,
+    LolParserSpawnExpression,
+    LolParserSyncStatement,
+    LolParserProbeStatement,
 )
 
 ################################################################################
 ### LOL ANALYSIS INTERMEDIATE REPRESENTATION
 ################################################################################
 LolIRExpression = Union["LolIRFunctionCallExpression", "LolIROperatorExpression", "LolIRLiteralExpression", "LolAnalysisVariable"]
-LolIRStatement = Union["LolIRDefinitionStatement", "LolIRSetStatement", "LolIRFunctionCallStatement", "LolIRIfStatement", "LolIRReturnStatement"]
+LolIRStatement = Union["LolIRDefinitionStatement", "LolIRSetStatement", "LolIRFunctionCallStatement", "LolIRIfStatement", "LolIRReturnStatement", "LolIRAssertStatement", "LolIRPropagateErrorStatement", "LolIRSpawnStatement", "LolIRSyncStatement", "LolIRProbeStatement"]
 
 
 ### Expressions
 class LolIRFunctionCallExpression:
-    def __init__(self, function: "LolAnalysisFunction", arguments: List["LolAnalysisVariable"]):
+    def __init__(
+        self,
+        function: "LolAnalysisFunction",
+        arguments: List["LolAnalysisVariable"],
+        line_number: int = 0,
+    ):
         assert isinstance(function, LolAnalysisFunction)
         assert isinstance(arguments, list)
         assert all(isinstance(arg, LolAnalysisVariable) for arg in arguments)
         self.function = function
         self.arguments = arguments
+        # The line of the call in the Do source, for the emitted source map
+        # (0 for calls that the compiler made up)
+        self.line_number = line_number
 
     def __str__(self):
         return f"{self.function.name}{tuple(arg.name for arg in self.arguments)}"
@@ -69,7 +85,14 @@ class LolIRLiteralExpression:
 
 ### Statements
 class LolIRDefinitionStatement:
-    def __init__(self, name: str, type: "LolAnalysisDataType", value: LolIRExpression):
+    def __init__(
+        self,
+        name: str,
+        type: "LolAnalysisDataType",
+        value: LolIRExpression,
+        *,
+        mutable: bool = False,
+    ):
         assert isinstance(name, str)
         # TODO(dchu): This is true for now, but will have to be generalized in
         #  future to allow different types.
@@ -77,9 +100,13 @@ class LolIRDefinitionStatement:
         self.name: str = name
         self.type: "LolAnalysisDataType" = type
         self.value = value
+        # Only `let mut` variables may be set after their definition. The
+        # temporaries that the analyzer creates are never mutable.
+        self.mutable = mutable
 
     def __str__(self):
-        return f"let {self.name}: {str(self.type)} = {str(self.value)};"
+        mut = "mut " if self.mutable else ""
+        return f"let {mut}{self.name}: {str(self.type)} = {str(self.value)};"
 
 
 class LolIRSetStatement:
@@ -88,7 +115,7 @@ class LolIRSetStatement:
         self.value = value
 
     def __str__(self):
-        return f"let {self.name} = {str(self.value)};"
+        return f"{self.name} = {str(self.value)};"
 
 
 class LolIRFunctionCallStatement:
@@ -100,10 +127,17 @@ class LolIRFunctionCallStatement:
 
 
 class LolIRIfStatement:
-    def __init__(self, if_cond: "LolAnalysisVariable", if_body: List[LolIRStatement], else_body: List[LolIRStatement]):
+    def __init__(
+        self,
+        if_cond: "LolAnalysisVariable",
+        if_body: List[LolIRStatement],
+        else_body: List[LolIRStatement],
+        hint: LolParserBranchHint = LolParserBranchHint.NONE,
+    ):
         self.if_cond = if_cond
         self.if_body = if_body
         self.else_body = else_body
+        self.hint = hint
 
     def __str__(self):
         return f"if ({str(self.if_cond)}) {{...}} else {{...}}"
@@ -117,6 +151,91 @@ class LolIRReturnStatement:
         return f"return {str(self.ret_var)}"
 
 
+class LolIRPropagateErrorStatement:
+    def __init__(self, result: "LolAnalysisVariable"):
+        # If the result is an error (i.e. negative), return it.
+        self.result = result
+
+    def __str__(self):
+        return f"{str(self.result)}?;"
+
+
+class LolIRAssertStatement:
+    def __init__(
+        self,
+        level: LolParserAssertLevel,
+        cond_body: List[LolIRStatement],
+        cond: "LolAnalysisVariable",
+        message: str,
+    ):
+        # The condition is computed in its own block so that the emitter can
+        # skip computing it when the assertion is not checked.
+        self.level = level
+        self.cond_body = cond_body
+        self.cond = cond
+        self.message = message
+
+    def __str__(self):
+        return f"assert[{self.level.name.lower()}] {str(self.cond)};"
+
+
+class LolIRSpawnStatement:
+    def __init__(
+        self,
+        name: Optional[str],
+        type: "LolAnalysisDataType",
+        call: LolIRFunctionCallExpression,
+        frame: str,
+        *,
+        mutable: bool = False,
+    ):
+        # The call may run on another thread until the matching sync, which
+        # defines the variable (if any) from the result. The frame holds the
+        # arguments and the result in the caller's stack frame, so spawning
+        # does not allocate.
+        self.name = name
+        self.type = type
+        self.call = call
+        self.frame = frame
+        self.mutable = mutable
+
+    def __str__(self):
+        name = f"let {self.name}: {str(self.type)} = " if self.name is not None else ""
+        return f"{name}spawn {str(self.call)};"
+
+
+class LolIRSyncStatement:
+    def __init__(self, spawns: List[LolIRSpawnStatement], *, bind_results: bool):
+        # Wait for the spawned calls. An implicit sync before a return only
+        # waits; it does not define the spawned variables.
+        self.spawns = spawns
+        self.bind_results = bind_results
+
+    def __str__(self):
+        return "sync;"
+
+
+# The most arguments that a probe may have (see LOL_USDT_MAX_ARGUMENTS)
+PROBE_MAX_ARGUMENTS = 6
+
+
+class LolIRProbeStatement:
+    def __init__(
+        self,
+        name: str,
+        arguments: List["LolAnalysisVariable"],
+        line_number: int = 0,
+    ):
+        # A USDT probe (see src/runtime/lol_usdt.h), which the tracer sees
+        # with these arguments.
+        self.name = name
+        self.arguments = arguments
+        self.line_number = line_number
+
+    def __str__(self):
+        return f"probe {self.name}{tuple(arg.name for arg in self.arguments)};"
+
+
 ################################################################################
 ### LOL ANALYSIS TYPES
 ################################################################################
@@ -152,9 +271,25 @@ def optional_names(obj: Optional[Dict[str, LolAnalysisSymbol]]):
 class LolAnalysisBuiltinType:
     # TODO(dchu): Make the object of the ops into a function so that we can
     #  specify the parameter types and the pointer types.
-    def __init__(self, name: str, ops: Dict[str, "LolAnalysisBuiltinType"]):
+    def __init__(
+        self,
+        name: str,
+        ops: Dict[str, "LolAnalysisBuiltinType"],
+        *,
+        size: int = 0,
+        align: int = 1,
+        is_reference: bool = False,
+        nullable: bool = False,
+    ):
         self.name = name
         self.ops = ops
+        # The size and alignment of the C type, in bytes, on the target.
+        self.size = size
+        self.align = align
+        # References are C pointers. Only optional references (e.g. `cstr?`)
+        # may be null.
+        self.is_reference = is_reference
+        self.nullable = nullable
 
     def __str__(self):
         return self.name
@@ -167,10 +302,156 @@ class LolAnalysisBuiltinType:
             metatype=self.__class__.__name__,
             name=self.name,
             ops={op: dt.name for op, dt in self.ops.items()},
+            size=self.size,
+            align=self.align,
+            is_reference=self.is_reference,
+            nullable=self.nullable,
             id=id(self),
         )
 
 
+################################################################################
+### PARAMETER PASSING
+################################################################################
+# The largest aggregate that the target's C ABI passes in registers. Both the
+# x86-64 System V and the AArch64 (AAPCS64) ABIs pass anything bigger in
+# memory, i.e. as a hidden copy on the stack.
+ABI_POINTER_SIZE = 8
+ABI_MAX_REGISTER_AGGREGATE_SIZE = 2 * ABI_POINTER_SIZE
+
+
+@unique
+class LolAnalysisPassingStrategy(Enum):
+    # Copy the value (into registers, for small types)
+    BY_VALUE = auto()
+    # Pass a `const T *restrict` instead of copying. Do values are immutable,
+    # so the callee cannot tell the difference.
+    BY_REFERENCE = auto()
+
+
+def get_passing_strategy(type: "LolAnalysisDataType") -> LolAnalysisPassingStrategy:
+    if type.size > ABI_MAX_REGISTER_AGGREGATE_SIZE:
+        return LolAnalysisPassingStrategy.BY_REFERENCE
+    return LolAnalysisPassingStrategy.BY_VALUE
+
+
+################################################################################
+### VALUE RANGE ANALYSIS
+################################################################################
+# An inclusive [lo, hi] range of values that an i32 variable may take.
+LolAnalysisValueRange = Tuple[int, int]
+I32_VALUE_RANGE: LolAnalysisValueRange = (-(2 ** 31), 2 ** 31 - 1)
+# E.g. `0 < x` is `x > 0`
+MIRRORED_COMPARISONS = {"<": ">", "<=": ">=", ">": "<", ">=": "<=", "==": "=="}
+
+
+def intersect_value_ranges(
+    a: Dict[str, LolAnalysisValueRange], b: Dict[str, LolAnalysisValueRange]
+) -> Dict[str, LolAnalysisValueRange]:
+    result = dict(a)
+    for name, (lo, hi) in b.items():
+        old_lo, old_hi = result.get(name, I32_VALUE_RANGE)
+        result[name] = (max(lo, old_lo), min(hi, old_hi))
+    return result
+
+
+def get_implied_value_ranges(
+    cond: LolParserExpression,
+) -> Dict[str, LolAnalysisValueRange]:
+    """
+    Get the ranges of the variables that are implied if the condition is true.
+
+    We only understand comparisons between a variable and an integer literal,
+    joined by `and`. E.g. `x >= 0 and x < 10` implies x is in [0, 9].
+    """
+    if not isinstance(cond, LolParserOperatorExpression):
+        return {}
+    if cond.operator == "and":
+        lhs, rhs = cond.operands
+        return intersect_value_ranges(
+            get_implied_value_ranges(lhs), get_implied_value_ranges(rhs)
+        )
+    if cond.operator not in MIRRORED_COMPARISONS:
+        return {}
+
+    def is_int_literal(x: LolParserExpression) -> bool:
+        return (
+            isinstance(x, LolParserLiteral)
+            and x.type == LolParserLiteralType.INTEGER
+        )
+
+    lhs, rhs = cond.operands
+    if isinstance(lhs, LolParserIdentifier) and is_int_literal(rhs):
+        name, op, value = lhs.name, cond.operator, rhs.value
+    elif is_int_literal(lhs) and isinstance(rhs, LolParserIdentifier):
+        name, op, value = rhs.name, MIRRORED_COMPARISONS[cond.operator], lhs.value
+    else:
+        return {}
+    lo, hi = I32_VALUE_RANGE
+    if op == "<":
+        hi = value - 1
+    elif op == "<=":
+        hi = value
+    elif op == ">":
+        lo = value + 1
+    elif op == ">=":
+        lo = value
+    elif op == "==":
+        lo, hi = value, value
+    return {name: (lo, hi)}
+
+
+################################################################################
+### NULL ANALYSIS
+################################################################################
+def is_null_literal(x: LolParserExpression) -> bool:
+    return isinstance(x, LolParserLiteral) and x.type == LolParserLiteralType.NULL
+
+
+def get_null_comparison(cond: LolParserExpression) -> Optional[Tuple[str, str]]:
+    """Return (name, op) if the condition is `name == null` or `name != null`."""
+    if not isinstance(cond, LolParserOperatorExpression) or cond.operator not in {"==", "!="}:
+        return None
+    lhs, rhs = cond.operands
+    if isinstance(lhs, LolParserIdentifier) and is_null_literal(rhs):
+        return lhs.name, cond.operator
+    elif is_null_literal(lhs) and isinstance(rhs, LolParserIdentifier):
+        return rhs.name, cond.operator
+    return None
+
+
+def get_implied_non_null(cond: LolParserExpression, truth: bool) -> Set[str]:
+    """
+    Get the names of the references that cannot be null if the condition has
+    the given truth value.
+
+    E.g. `x != null and y != null` implies that x and y are non-null if true.
+    """
+    if isinstance(cond, LolParserOperatorExpression) and cond.operator == "and":
+        if not truth:
+            return set()
+        lhs, rhs = cond.operands
+        return get_implied_non_null(lhs, truth) | get_implied_non_null(rhs, truth)
+    comparison = get_null_comparison(cond)
+    if comparison is None:
+        return set()
+    name, op = comparison
+    if (op == "!=") == truth:
+        return {name}
+    return set()
+
+
+def always_returns(block: List[LolParserFunctionLevelStatement]) -> bool:
+    if len(block) == 0:
+        return False
+    last = block[-1]
+    if isinstance(last, LolParserReturnStatement):
+        return True
+    if isinstance(last, LolParserIfStatement):
+        return always_returns(last.if_block) and always_returns(last.else_block)
+    return False
+
+
 def get_type(
     type_ast: LolParserTypeExpression,
     module_symbol_table: Dict[str, LolAnalysisSymbol]
@@ -187,6 +468,14 @@ def get_type(
     return type_symbol
 
 
+def contains_function_call(x: LolParserExpression) -> bool:
+    if isinstance(x, LolParserFunctionCall):
+        return True
+    elif isinstance(x, LolParserOperatorExpression):
+        return any(contains_function_call(y) for y in x.operands)
+    return False
+
+
 class LolAnalysisVariable:
     def __init__(
         self,
@@ -201,6 +490,12 @@ class LolAnalysisVariable:
         self.ast_definition_node = ast_definition_node
 
         self.type: Optional[LolAnalysisDataType] = type
+        # How a parameter is passed; every other variable is held by value.
+        self.passing = LolAnalysisPassingStrategy.BY_VALUE
+        self.mutable: bool = (
+            isinstance(ast_definition_node, LolParserVariableDefinition)
+            and ast_definition_node.mutable
+        )
 
     def __str__(self):
         return f"{self.name}: {str(self.type)}"
@@ -242,6 +537,7 @@ class LolAnalysisFunction:
         return_types: Optional[LolAnalysisDataType] = None,
         parameter_types: Optional[List[LolAnalysisDataType]] = None,
         parameter_names: Optional[List[str]] = None,
+        parameter_passing: Optional[List[LolAnalysisPassingStrategy]] = None,
         # Function Body
         symbol_table: Optional[Dict[str, LolAnalysisSymbol]] = None,
         body: Optional[List[LolIRStatement]] = None,
@@ -252,9 +548,35 @@ class LolAnalysisFunction:
         self.return_types: Optional[LolAnalysisDataType] = return_types
         self.parameter_types: Optional[List[LolAnalysisDataType]] = parameter_types
         self.parameter_names: Optional[List[str]] = parameter_names
+        # We only choose how to pass Do functions' parameters. Other functions
+        # have fixed C prototypes, so they take everything by value.
+        self.parameter_passing: Optional[List[LolAnalysisPassingStrategy]] = (
+            parameter_passing
+            if parameter_passing is not None or parameter_types is None
+            else [LolAnalysisPassingStrategy.BY_VALUE for _ in parameter_types]
+        )
 
         self.symbol_table: Optional[Dict[str, LolAnalysisSymbol]] = symbol_table
         self.body: Optional[List[LolIRStatement]] = body
+        # What we know about the values of local variables at the current
+        # point in the body (e.g. from `assert[assume] x >= 0;`).
+        self.value_ranges: Dict[str, LolAnalysisValueRange] = {}
+        # Optional references that are known not to be null at the current
+        # point in the body (e.g. inside `if x != null {...}`).
+        self.non_null_names: Set[str] = set()
+        # The mutable variables that have been set so far. Facts about them
+        # from before the assignment no longer hold.
+        self.assigned_names: Set[str] = set()
+        # Whether calling this function means that we are on a rare path (e.g.
+        # reporting an error).
+        self.is_cold: bool = False
+        # Rarely executed blocks that were outlined from this function's body
+        # (see compiler/analyzer/lol_outliner.py).
+        self.cold_functions: List["LolAnalysisFunction"] = []
+        # The calls that were spawned since the last sync. Their variables
+        # may not be used until the next sync.
+        self.pending_spawns: List[LolIRSpawnStatement] = []
+        self.spawn_count: int = 0
 
     def __str__(self):
         parameters = ", ".join(
@@ -282,6 +604,9 @@ class LolAnalysisFunction:
         self.parameter_names = [
             t.get_name_as_str() for t in self.ast_definition_node.parameters
         ]
+        self.parameter_passing = [
+            get_passing_strategy(t) for t in self.parameter_types
+        ]
 
     def _get_temporary_variable_name(self) -> str:
         # NOTE: this is a complete hack!
@@ -316,18 +641,125 @@ class LolAnalysisFunction:
         op_name: str,
         operands: List["LolAnalysisVariable"]
     ) -> Optional[LolAnalysisDataType]:
+        if op_name in {*MIRRORED_COMPARISONS, "!=", "and", "or"}:
+            return module_symbol_table["i32"]
         first_operand, *_ = operands
         hacky_ret_type = self._get_symbol(module_symbol_table, first_operand.name).type
         return hacky_ret_type
 
+    def _is_non_null(self, var: "LolAnalysisVariable") -> bool:
+        return not var.type.nullable or var.name in self.non_null_names
+
+    def _check_non_null(
+        self,
+        expected_type: LolAnalysisDataType,
+        var: "LolAnalysisVariable",
+        context: str,
+    ):
+        """Check that a value may be used where a non-null reference is
+        expected. This is the only place where we check for null."""
+        if expected_type.is_reference and not expected_type.nullable and not self._is_non_null(var):
+            if var.name.startswith("%"):
+                raise ValueError(f"{context}: expected {str(expected_type)}, got {str(var.type)}")
+            raise ValueError(
+                f"{context}: {var.name} has type {str(var.type)}, so it may be "
+                f"null; check it with `if {var.name} != null` first"
+            )
+
+    def _forget_facts(self, names: Set[str]):
+        """Forget what we know about the values of these variables."""
+        self.value_ranges = {
+            name: r for name, r in self.value_ranges.items() if name not in names
+        }
+        self.non_null_names = self.non_null_names - names
+
+    def _fold_null_comparison(
+        self,
+        module_symbol_table: Dict[str, LolAnalysisSymbol],
+        x: LolParserOperatorExpression,
+    ) -> Optional[int]:
+        """Return 1 or 0 if the comparison is against a non-null reference."""
+        comparison = get_null_comparison(x)
+        if comparison is None:
+            return None
+        name, op = comparison
+        var = self._get_symbol(module_symbol_table, name)
+        if not isinstance(var, LolAnalysisVariable) or not self._is_non_null(var):
+            return None
+        return int(op == "!=")
+
+    def _add_value_ranges(
+        self,
+        module_symbol_table: Dict[str, LolAnalysisSymbol],
+        ranges: Dict[str, LolAnalysisValueRange],
+    ):
+        i32 = module_symbol_table["i32"]
+        ranges = {
+            name: r for name, r in ranges.items()
+            if isinstance(self.symbol_table.get(name), LolAnalysisVariable)
+            and self.symbol_table[name].type is i32
+        }
+        self.value_ranges = intersect_value_ranges(self.value_ranges, ranges)
+
+    def _fold_comparison(self, x: LolParserOperatorExpression) -> Optional[int]:
+        """Return 1 or 0 if the known value ranges decide the comparison."""
+        implied = get_implied_value_ranges(x)
+        if x.operator not in MIRRORED_COMPARISONS or len(implied) != 1:
+            return None
+        (name, (lo, hi)), = implied.items()
+        if name not in self.value_ranges:
+            return None
+        known_lo, known_hi = self.value_ranges[name]
+        if lo <= known_lo and known_hi <= hi:
+            return 1
+        if known_hi < lo or hi < known_lo:
+            return 0
+        return None
+
     def _parse_expression_recursively(
         self,
         x: LolParserExpression,
         module_symbol_table: Dict[str, LolAnalysisSymbol],
         *,
         body_block: List[LolIRStatement],
-    ) -> str:
-        if isinstance(x, LolParserOperatorExpression):
+        value_required: bool = True,
+    ) -> Optional[str]:
+        if isinstance(x, LolParserOperatorExpression) and (
+            self._fold_comparison(x) is not None
+            or self._fold_null_comparison(module_symbol_table, x) is not None
+        ):
+            folded = self._fold_comparison(x)
+            if folded is None:
+                folded = self._fold_null_comparison(module_symbol_table, x)
+            ret = self._get_temporary_variable_name()
+            ret_type = module_symbol_table["i32"]
+            stmt = LolIRDefinitionStatement(
+                ret, ret_type, LolIRLiteralExpression(folded)
+            )
+            body_block.append(stmt)
+            self.symbol_table[ret] = LolAnalysisVariable(ret, None, type=ret_type)
+            return ret
+        elif isinstance(x, LolParserOperatorExpression) and x.operator == "?":
+            i32 = module_symbol_table["i32"]
+            if self.return_types is not i32:
+                raise ValueError(
+                    f"'?' returns the error from {self.name}, so it must return i32"
+                )
+            if self.pending_spawns:
+                raise ValueError(
+                    f"'?' may return from {self.name} before its spawned calls finish; sync first"
+                )
+            ret = self._parse_expression_recursively(x.operands[0], module_symbol_table, body_block=body_block)
+            result = self._get_symbol(module_symbol_table, ret)
+            if result.type is not i32:
+                raise ValueError(f"'?' expects an i32 result, got {str(result)}")
+            body_block.append(LolIRPropagateErrorStatement(result))
+            # Past this point, the result is not an error
+            self.value_ranges = intersect_value_ranges(
+                self.value_ranges, {ret: (0, I32_VALUE_RANGE[1])}
+            )
+            return ret
+        elif isinstance(x, LolParserOperatorExpression):
             op_name: str = x.operator
             operands: List["LolAnalysisVariable"] = [
                 self._get_symbol(
@@ -355,6 +787,15 @@ class LolAnalysisFunction:
                 body_block.append(stmt)
                 self.symbol_table[ret] = LolAnalysisVariable(ret, None, type=ret_type)
                 return ret
+            elif x.type == LolParserLiteralType.NULL:
+                ret = self._get_temporary_variable_name()
+                ret_type = module_symbol_table["cstr?"]
+                stmt = LolIRDefinitionStatement(
+                    ret, ret_type, LolIRLiteralExpression(None)
+                )
+                body_block.append(stmt)
+                self.symbol_table[ret] = LolAnalysisVariable(ret, None, type=ret_type)
+                return ret
             elif x.type == LolParserLiteralType.STRING:
                 ret = self._get_temporary_variable_name()
                 ret_type = module_symbol_table["cstr"]
@@ -377,34 +818,135 @@ class LolAnalysisFunction:
                 )
                 for y in x.arguments
             ]
-            ret: str = self._get_temporary_variable_name()
+            for i, (param_type, arg) in enumerate(zip(func.parameter_types, args)):
+                self._check_non_null(param_type, arg, f"argument {i + 1} of {func_name}")
             ret_type = func.return_types
+            if ret_type is module_symbol_table["void"]:
+                if value_required:
+                    raise ValueError(f"{func_name} returns void, so its call cannot be used as a value")
+                # There is no value to store, so call it as a statement
+                stmt = LolIRFunctionCallStatement(
+                    LolIRFunctionCallExpression(func, args, x.line_number)
+                )
+                body_block.append(stmt)
+                return None
+            ret: str = self._get_temporary_variable_name()
             stmt = LolIRDefinitionStatement(
-                ret, ret_type, LolIRFunctionCallExpression(func, args)
+                ret, ret_type, LolIRFunctionCallExpression(func, args, x.line_number)
             )
             body_block.append(stmt)
             self.symbol_table[ret] = LolAnalysisVariable(ret, None, type=ret_type)
             return ret
         elif isinstance(x, LolParserReturnStatement):
             ret = self._parse_expression_recursively(x.value, module_symbol_table, body_block=body_block)
-            stmt = LolIRReturnStatement(self._get_symbol(module_symbol_table, ret))
+            ret_var = self._get_symbol(module_symbol_table, ret)
+            self._check_non_null(self.return_types, ret_var, f"return value of {self.name}")
+            if self.pending_spawns:
+                # We must not return while a spawned call uses our stack frame
+                body_block.append(LolIRSyncStatement(list(self.pending_spawns), bind_results=False))
+            stmt = LolIRReturnStatement(ret_var)
             body_block.append(stmt)
         elif isinstance(x, LolParserIfStatement):
             if_cond_name = self._parse_expression_recursively(x.if_condition, module_symbol_table, body_block=body_block)
             if_cond = self._get_symbol(module_symbol_table, if_cond_name)
+            # Facts learned inside a block do not hold after it, and neither
+            # do the definitions that shadow a variable in it.
+            outer_value_ranges = self.value_ranges
+            outer_non_null_names = self.non_null_names
+            outer_assigned_names = self.assigned_names
+            outer_symbol_table = dict(self.symbol_table)
             if_block = []
+            self._add_value_ranges(
+                module_symbol_table, get_implied_value_ranges(x.if_condition)
+            )
+            self.non_null_names = outer_non_null_names | get_implied_non_null(x.if_condition, True)
+            # Collect each block's assignments on their own, since a block may
+            # set a variable that was already set before the if statement.
+            self.assigned_names = set()
             for y in x.if_block:
                 self._parse_statement(module_symbol_table, y, body_block=if_block)
+            self.value_ranges = outer_value_ranges
+            self.symbol_table.update(outer_symbol_table)
+            if_assigned_names = self.assigned_names
+            self.assigned_names = set()
             else_block = []
+            self.non_null_names = outer_non_null_names | get_implied_non_null(x.if_condition, False)
             for y in x.else_block:
                 self._parse_statement(module_symbol_table, y, body_block=else_block)
-            stmt = LolIRIfStatement(if_cond, if_block, else_block)
+            self.value_ranges = outer_value_ranges
+            self.symbol_table.update(outer_symbol_table)
+            self.non_null_names = outer_non_null_names
+            else_assigned_names = self.assigned_names
+            self.assigned_names = outer_assigned_names | if_assigned_names | else_assigned_names
+            # Either block may have set a variable
+            self._forget_facts(if_assigned_names | else_assigned_names)
+            # E.g. after `if x == null { return ...; }`, x is not null, unless
+            # the block that falls through set it.
+            if always_returns(x.if_block) and not always_returns(x.else_block):
+                self.non_null_names = self.non_null_names | (
+                    get_implied_non_null(x.if_condition, False) - else_assigned_names
+                )
+            elif always_returns(x.else_block) and not always_returns(x.if_block):
+                self.non_null_names = self.non_null_names | (
+                    get_implied_non_null(x.if_condition, True) - if_assigned_names
+                )
+            stmt = LolIRIfStatement(if_cond, if_block, else_block, x.hint)
             body_block.append(stmt)
         elif isinstance(x, LolParserIdentifier):
+            if any(spawn.name == x.name for spawn in self.pending_spawns):
+                raise ValueError(f"{x.name} is spawned, so it cannot be used before the next sync")
             return x.name
+        elif isinstance(x, LolParserSpawnExpression):
+            raise ValueError(
+                "spawn must be the whole value of a definition or a statement, e.g. `let x: i32 = spawn f();`"
+            )
         else:
             raise NotImplementedError
 
+    def _parse_spawn(
+        self,
+        module_symbol_table: Dict[str, LolAnalysisSymbol],
+        x: LolParserSpawnExpression,
+        definition: Optional[LolParserVariableDefinition],
+        *,
+        body_block: List[LolIRStatement],
+    ):
+        if body_block is not self.body:
+            # Otherwise, a spawn could be pending on some paths but not others
+            raise ValueError(f"spawn must be at the top level of {self.name}, not in a block")
+        func_name: str = x.call.get_name_as_str()
+        func = self._get_symbol(module_symbol_table, func_name)
+        if not isinstance(func, LolAnalysisFunction):
+            raise ValueError(f"cannot spawn {func_name}: it is not a function")
+        args: List["LolAnalysisVariable"] = [
+            self._get_symbol(
+                module_symbol_table,
+                self._parse_expression_recursively(y, module_symbol_table, body_block=body_block)
+            )
+            for y in x.call.arguments
+        ]
+        for i, (param_type, arg) in enumerate(zip(func.parameter_types, args)):
+            self._check_non_null(param_type, arg, f"argument {i + 1} of {func_name}")
+        if definition is None:
+            name, mutable = None, False
+        else:
+            name, mutable = definition.get_name_as_str(), definition.mutable
+            data_type = self._get_symbol(module_symbol_table, definition.type.name)
+            if func.return_types is not data_type:
+                raise ValueError(
+                    f"cannot define {name} of type {str(data_type)} from {func_name}, "
+                    f"which returns {str(func.return_types)}"
+                )
+            self.symbol_table[name] = LolAnalysisVariable.init_local_variable(name, definition, module_symbol_table)
+        frame = f"LOLframe_{self.spawn_count}"
+        self.spawn_count += 1
+        stmt = LolIRSpawnStatement(
+            name, func.return_types, LolIRFunctionCallExpression(func, args, x.call.line_number), frame,
+            mutable=mutable,
+        )
+        body_block.append(stmt)
+        self.pending_spawns.append(stmt)
+
     def _parse_statement(
         self,
         module_symbol_table: Dict[str, LolAnalysisSymbol],
@@ -412,22 +954,105 @@ class LolAnalysisFunction:
         *,
         body_block: List[LolIRStatement],
     ):
-        if isinstance(x, LolParserVariableDefinition):
+        if isinstance(x, LolParserVariableDefinition) and isinstance(x.value, LolParserSpawnExpression):
+            self._parse_spawn(module_symbol_table, x.value, x, body_block=body_block)
+        elif isinstance(x, LolParserSpawnExpression):
+            self._parse_spawn(module_symbol_table, x, None, body_block=body_block)
+        elif isinstance(x, LolParserSyncStatement):
+            if body_block is not self.body:
+                raise ValueError(f"sync must be at the top level of {self.name}, not in a block")
+            body_block.append(LolIRSyncStatement(self.pending_spawns, bind_results=True))
+            self.pending_spawns = []
+        elif isinstance(x, LolParserProbeStatement):
+            name = x.call.get_name_as_str()
+            if len(x.call.arguments) > PROBE_MAX_ARGUMENTS:
+                raise ValueError(
+                    f"probe {name} has {len(x.call.arguments)} arguments; "
+                    f"the most that a tracer can read is {PROBE_MAX_ARGUMENTS}"
+                )
+            args: List["LolAnalysisVariable"] = [
+                self._get_symbol(
+                    module_symbol_table,
+                    self._parse_expression_recursively(y, module_symbol_table, body_block=body_block)
+                )
+                for y in x.call.arguments
+            ]
+            body_block.append(LolIRProbeStatement(name, args, x.call.line_number))
+        elif isinstance(x, LolParserVariableDefinition):
             name = x.get_name_as_str()
             ast_data_type = x.type
             assert isinstance(ast_data_type, LolParserIdentifier)
             data_type = self._get_symbol(module_symbol_table, ast_data_type.name)
             value = self._parse_expression_recursively(x.value, module_symbol_table, body_block=body_block)
+            self._check_non_null(data_type, self._get_symbol(module_symbol_table, value), f"definition of {name}")
+            value_var = self._get_symbol(module_symbol_table, value)
+            value_range = self.value_ranges.get(value)
+            value_non_null = self._is_non_null(value_var)
             self.symbol_table[name] = LolAnalysisVariable.init_local_variable(name, x, module_symbol_table)
+            # The definition may shadow (or redefine) a variable of the same
+            # name, and nothing that we know about that one holds for this one.
+            self._forget_facts({name})
+            if value_range is not None:
+                self.value_ranges = intersect_value_ranges(self.value_ranges, {name: value_range})
+            if data_type.nullable and value_non_null:
+                self.non_null_names = self.non_null_names | {name}
             stmt = LolIRDefinitionStatement(
-                name, data_type, self._get_symbol(module_symbol_table, value)
+                name, data_type, value_var,
+                mutable=x.mutable,
             )
             body_block.append(stmt)
         elif isinstance(x, LolParserVariableModification):
-            # I'm not even sure that the parser supports modification nodes
-            raise NotImplementedError
+            name = x.name.name
+            var = self.symbol_table.get(name)
+            if not isinstance(var, LolAnalysisVariable):
+                raise ValueError(f"cannot assign to {name}: it is not a local variable")
+            if not var.mutable:
+                raise ValueError(
+                    f"cannot assign to immutable variable {name}; declare it with `let mut {name}`"
+                )
+            if any(spawn.name == name for spawn in self.pending_spawns):
+                # The sync would overwrite it with the spawned call's result
+                raise ValueError(f"{name} is spawned, so it cannot be assigned before the next sync")
+            value = self._parse_expression_recursively(x.value, module_symbol_table, body_block=body_block)
+            value_var = self._get_symbol(module_symbol_table, value)
+            if value_var.type is not var.type and not (
+                var.type.nullable and value_var.type.is_reference
+            ):
+                raise ValueError(
+                    f"cannot assign {str(value_var.type)} to {name} of type {str(var.type)}"
+                )
+            self._check_non_null(var.type, value_var, f"assignment to {name}")
+            self._forget_facts({name})
+            self.assigned_names = self.assigned_names | {name}
+            if value in self.value_ranges:
+                self._add_value_ranges(module_symbol_table, {name: self.value_ranges[value]})
+            if var.type.nullable and self._is_non_null(value_var):
+                self.non_null_names = self.non_null_names | {name}
+            body_block.append(LolIRSetStatement(name, value_var))
+        elif isinstance(x, LolParserAssertStatement):
+            if x.level == LolParserAssertLevel.ASSUME and contains_function_call(x.condition):
+                raise ValueError(
+                    f"line {x.line_number}: an assumption is never evaluated, "
+                    f"so it cannot call functions: {x.condition_text}"
+                )
+            cond_block = []
+            cond_name = self._parse_expression_recursively(x.condition, module_symbol_table, body_block=cond_block)
+            stmt = LolIRAssertStatement(
+                x.level,
+                cond_block,
+                self._get_symbol(module_symbol_table, cond_name),
+                f"line {x.line_number}: {x.condition_text}",
+            )
+            body_block.append(stmt)
+            # Past a checked assertion or an assumption, the condition holds.
+            if x.level != LolParserAssertLevel.DEBUG:
+                self._add_value_ranges(
+                    module_symbol_table, get_implied_value_ranges(x.condition)
+                )
         else:
-            _unused_return_variable = self._parse_expression_recursively(x, module_symbol_table, body_block=body_block)
+            _unused_return_variable = self._parse_expression_recursively(
+                x, module_symbol_table, body_block=body_block, value_required=False
+            )
 
     def complete_body(self, module_symbol_table: Dict[str, LolAnalysisSymbol]):
         assert self.symbol_table is None
@@ -439,9 +1064,14 @@ class LolAnalysisFunction:
                 )
             for t in self.ast_definition_node.parameters
         }
+        for name, passing in zip(self.parameter_names, self.parameter_passing):
+            self.symbol_table[name].passing = passing
         self.body = []
         for statement in self.ast_definition_node.body:
             self._parse_statement(module_symbol_table, statement, body_block=self.body)
+        if self.pending_spawns and not isinstance(self.body[-1], LolIRReturnStatement):
+            self.body.append(LolIRSyncStatement(self.pending_spawns, bind_results=False))
+            self.pending_spawns = []
 
     def to_dict(self):
         return dict(
@@ -455,11 +1085,38 @@ class LolAnalysisFunction:
         )
 
 
+# The C functions that each importable library exposes to Do. Each prototype
+# is (name, return type, [(parameter name, parameter type), ...]).
+# TODO(dchu): parse these out of the headers instead of hard-coding them.
+LIBRARY_PROTOTYPES: Dict[str, List[Tuple[str, str, List[Tuple[str, str]]]]] = {
+    "\"stdio.h\"": [
+        ("printf", "i32", [("format", "cstr")]),
+        ("perror", "void", [("s", "cstr")]),
+    ],
+    # The Do runtime (see src/runtime/)
+    "\"lol_random.h\"": [
+        ("lol_random_seed", "void", [("seed", "i32")]),
+        ("lol_random_range_i32", "i32", [("lo", "i32"), ("hi", "i32")]),
+    ],
+    "\"lol_timer.h\"": [
+        ("lol_sleep_ms", "void", [("ms", "i32")]),
+        ("lol_timeout_start", "i32", [("ms", "i32")]),
+        ("lol_timeout_expired", "i32", [("handle", "i32")]),
+        ("lol_timeout_cancel", "void", [("handle", "i32")]),
+    ],
+}
+
+# Library functions that are only called on rare paths, like error reporting.
+COLD_LIBRARY_FUNCTIONS = {"perror"}
+
+
 class LolAnalysisModule:
     def __init__(self, name: str, caller_module: Optional["LolAnalysisModule"] = None):
         self.name = name
         self.intermediate_repr: List[Any] = []
         self.module_symbol_table: Dict[str, LolAnalysisSymbol] = {}
+        # Benchmarks are not callable, so they live outside the symbol table.
+        self.benchmarks: Dict[str, LolAnalysisFunction] = {}
 
         self.add_builtin_types(caller_module)
 
@@ -470,21 +1127,30 @@ class LolAnalysisModule:
 
     def add_builtin_types(self, caller_module: Optional["LolAnalysisModule"]):
         if caller_module is None:
-            i32 = LolAnalysisBuiltinType("i32", {})
+            i32 = LolAnalysisBuiltinType("i32", {}, size=4, align=4)
             i32.ops["+"] = i32
             i32.ops["-"] = i32
             i32.ops["*"] = i32
             i32.ops["/"] = i32
-            cstr = LolAnalysisBuiltinType("cstr", {})
+            cstr = LolAnalysisBuiltinType(
+                "cstr", {}, size=ABI_POINTER_SIZE, align=ABI_POINTER_SIZE,
+                is_reference=True,
+            )
+            optional_cstr = LolAnalysisBuiltinType(
+                "cstr?", {}, size=ABI_POINTER_SIZE, align=ABI_POINTER_SIZE,
+                is_reference=True, nullable=True,
+            )
             void = LolAnalysisBuiltinType("void", {})
         else:
             # We want all of the built-in objects to be identical objects with
             # even the pointers matching (so module_a's i32 is module_b's i32)
             i32 = caller_module.module_symbol_table["i32"]
             cstr = caller_module.module_symbol_table["cstr"]
+            optional_cstr = caller_module.module_symbol_table["cstr?"]
             void = caller_module.module_symbol_table["void"]
         self.add_to_module_symbol_table("i32", i32)
         self.add_to_module_symbol_table("cstr", cstr)
+        self.add_to_module_symbol_table("cstr?", optional_cstr)
         self.add_to_module_symbol_table("void", void)
 
     def to_dict(self):
@@ -503,6 +1169,12 @@ class LolAnalysisModule:
         symbol = LolAnalysisFunction(name, ast_definition)
         self.add_to_module_symbol_table(name, symbol)
 
+    def _add_bench_name(self, ast_definition: LolParserBenchDefinition):
+        name = ast_definition.get_name_as_str()
+        if name in self.benchmarks:
+            raise ValueError(f"bench {name} already defined")
+        self.benchmarks[name] = LolAnalysisFunction(name, ast_definition)
+
     def _add_variable_name(self, ast_definition: LolParserVariableDefinition):
         name = ast_definition.get_name_as_str()
         symbol = LolAnalysisVariable.init_local_variable(name, ast_definition)
@@ -512,20 +1184,24 @@ class LolAnalysisModule:
     def _add_import_name(self, ast_definition: LolParserImportStatement):
         alias = ast_definition.get_alias_as_str()
         library = ast_definition.get_library_name_as_str()
-        if library == "\"stdio.h\"":
-            module = LolAnalysisModule(library, caller_module=self)
-            i32: LolAnalysisBuiltinType = self.module_symbol_table["i32"]
-            cstr: LolAnalysisBuiltinType = self.module_symbol_table["cstr"]
-            printf_func = LolAnalysisFunction(
-                "printf",
+        if library not in LIBRARY_PROTOTYPES:
+            raise NotImplementedError(
+                f"library {library} is not supported! Supported libraries: "
+                f"{', '.join(LIBRARY_PROTOTYPES)}"
+            )
+        module = LolAnalysisModule(library, caller_module=self)
+        for func_name, ret_type, params in LIBRARY_PROTOTYPES[library]:
+            func = LolAnalysisFunction(
+                func_name,
                 None,
-                return_types=i32,
-                parameter_types=[cstr],
-                parameter_names=["format"],
+                return_types=self.module_symbol_table[ret_type],
+                parameter_types=[
+                    self.module_symbol_table[t] for _, t in params
+                ],
+                parameter_names=[n for n, _ in params],
             )
-            module.add_to_module_symbol_table("printf", printf_func)
-        else:
-            raise NotImplementedError("only stdio.h library is supported!")
+            func.is_cold = func_name in COLD_LIBRARY_FUNCTIONS
+            module.add_to_module_symbol_table(func_name, func)
         self.add_to_module_symbol_table(alias, module)
 
     def get_module_names(self, ast_nodes: List[LolParserModuleLevelStatement]):
@@ -538,7 +1214,10 @@ class LolAnalysisModule:
         1. Add struct/enum/monad
         """
         for i, node in enumerate(ast_nodes):
-            if isinstance(node, LolParserFunctionDefinition):
+            # N.B. a bench definition is also a function definition
+            if isinstance(node, LolParserBenchDefinition):
+                self._add_bench_name(node)
+            elif isinstance(node, LolParserFunctionDefinition):
                 self._add_function_name(node)
             elif isinstance(node, LolParserVariableDefinition):
                 self._add_variable_name(node)
@@ -556,6 +1235,10 @@ class LolAnalysisModule:
         func: LolAnalysisFunction = self.module_symbol_table[name]
         func.complete_prototype(self.module_symbol_table)
 
+    def add_bench_prototype(self, ast_definition: LolParserBenchDefinition):
+        name = ast_definition.get_name_as_str()
+        self.benchmarks[name].complete_prototype(self.module_symbol_table)
+
     def add_variable_prototype(self, ast_definition: LolParserVariableDefinition):
         name = ast_definition.get_name_as_str()
         var: LolAnalysisVariable = self.module_symbol_table[name]
@@ -568,7 +1251,9 @@ class LolAnalysisModule:
     def get_module_prototypes(self, ast_nodes: List[LolParserModuleLevelStatement]):
         """Get function and variable prototypes."""
         for i, node in enumerate(ast_nodes):
-            if isinstance(node, LolParserFunctionDefinition):
+            if isinstance(node, LolParserBenchDefinition):
+                self.add_bench_prototype(node)
+            elif isinstance(node, LolParserFunctionDefinition):
                 self.add_function_prototype(node)
             elif isinstance(node, LolParserVariableDefinition):
                 self.add_variable_prototype(node)
@@ -584,6 +1269,10 @@ class LolAnalysisModule:
         func: LolAnalysisFunction = self.module_symbol_table[name]
         func.complete_body(self.module_symbol_table)
 
+    def add_bench_body(self, ast_definition: LolParserBenchDefinition):
+        name = ast_definition.get_name_as_str()
+        self.benchmarks[name].complete_body(self.module_symbol_table)
+
     def add_variable_body(self, ast_definition: LolParserVariableDefinition):
         # Intentionally do nothing
         pass
@@ -594,7 +1283,9 @@ class LolAnalysisModule:
 
     def get_module_bodies(self, ast_nodes: List[LolParserModuleLevelStatement]):
         for i, node in enumerate(ast_nodes):
-            if isinstance(node, LolParserFunctionDefinition):
+            if isinstance(node, LolParserBenchDefinition):
+                self.add_bench_body(node)
+            elif isinstance(node, LolParserFunctionDefinition):
                 self.add_function_body(node)
             elif isinstance(node, LolParserVariableDefinition):
                 self.add_variable_body(node)
@@ -7,39 +7,140 @@ TODO
 1. Minimal Viable Product
 2. Correct indentation
 """
-from typing import List
+from typing import Dict, List, Optional
 
 from compiler.analyzer.lol_analyzer import (
     LolAnalysisModule, LolAnalysisFunction, LolAnalysisBuiltinType,
     LolIRReturnStatement, LolIRFunctionCallStatement, LolIRDefinitionStatement,
-    LolIRSetStatement, LolIRIfStatement,
+    LolIRSetStatement, LolIRIfStatement, LolIRAssertStatement,
+    LolIRPropagateErrorStatement, LolIRSpawnStatement, LolIRSyncStatement,
+    LolIRProbeStatement, PROBE_MAX_ARGUMENTS,
     LolIRExpression, LolIRStatement,
     LolIRFunctionCallExpression, LolIROperatorExpression,
-    LolIRLiteralExpression, LolAnalysisVariable
+    LolIRLiteralExpression, LolAnalysisVariable, LolAnalysisPassingStrategy,
 )
+from compiler.parser.lol_parser import LolParserAssertLevel, LolParserBranchHint
 
 
-lol_to_c_types = {"cstr": "char *", "i32": "int", "void": "void"}
+# Do strings are immutable, so the characters are const.
+lol_to_c_types = {"cstr": "const char *", "cstr?": "const char *", "i32": "int", "void": "void"}
+# Importable runtime headers that need POSIX extensions (threads, clocks, epoll)
+posix_libraries = {"\"lol_timer.h\""}
+
+# Functions that use the '?' operator share one cold block that returns the
+# error, which sits after the function's hot code.
+ERROR_VAR_NAME = "LOLerror"
+ERROR_LABEL_NAME = "LOLerror_return"
+
+# Ends a function whose lines map to the Do source. emit_c() replaces it with
+# a #line directive that maps the following lines back to the C file.
+END_OF_SOURCE_MAP = "#line LOLend_of_source_map"
 
 
 def mangle_var_name(var_name: str) -> str:
     return var_name.replace("%", "LOLvar_")
 
 
+def emit_variable(var: LolAnalysisVariable) -> str:
+    """Emit a use of a variable's value."""
+    if var.passing == LolAnalysisPassingStrategy.BY_REFERENCE:
+        return f"(*{mangle_var_name(var.name)})"
+    return mangle_var_name(var.name)
+
+
+def emit_argument(var: LolAnalysisVariable, passing: LolAnalysisPassingStrategy) -> str:
+    if passing == LolAnalysisPassingStrategy.BY_VALUE:
+        return emit_variable(var)
+    # We can forward a reference without making a copy
+    if var.passing == LolAnalysisPassingStrategy.BY_REFERENCE:
+        return mangle_var_name(var.name)
+    return f"&{mangle_var_name(var.name)}"
+
+
+def emit_declaration(type: LolAnalysisBuiltinType, name: str, *, mutable: bool) -> str:
+    """Emit a variable declaration. Immutable variables are const, so that
+    the C compiler may assume that they do not change."""
+    c_type = lol_to_c_types[type.name]
+    if mutable:
+        return f"{c_type} {name}"
+    elif c_type.endswith("*"):
+        return f"{c_type}const {name}"
+    return f"const {c_type} {name}"
+
+
+def emit_parameter(
+    type: LolAnalysisBuiltinType, name: str, passing: LolAnalysisPassingStrategy
+) -> str:
+    if passing == LolAnalysisPassingStrategy.BY_REFERENCE:
+        return f"const {lol_to_c_types[type.name]} *restrict {mangle_var_name(name)}"
+    # Do parameters are immutable
+    return emit_declaration(type, mangle_var_name(name), mutable=False)
+
+
+def emit_c_string(text: str) -> str:
+    escaped = text.replace("\\", "\\\\").replace("\"", "\\\"")
+    return f"\"{escaped}\""
+
+
+def walk_statements(ir_statements: List[LolIRStatement]):
+    """Yield every statement, including those nested in other statements."""
+    for stmt in ir_statements:
+        yield stmt
+        if isinstance(stmt, LolIRIfStatement):
+            yield from walk_statements(stmt.if_body)
+            yield from walk_statements(stmt.else_body)
+        elif isinstance(stmt, LolIRAssertStatement):
+            yield from walk_statements(stmt.cond_body)
+
+
+def get_line_number(stmt: LolIRStatement) -> int:
+    """Get the Do line of the call that a statement makes, or 0."""
+    if isinstance(stmt, LolIRDefinitionStatement) and isinstance(stmt.value, LolIRFunctionCallExpression):
+        return stmt.value.line_number
+    elif isinstance(stmt, LolIRFunctionCallStatement):
+        return stmt.func_call.line_number
+    elif isinstance(stmt, LolIRSpawnStatement):
+        return stmt.call.line_number
+    elif isinstance(stmt, LolIRProbeStatement):
+        return stmt.line_number
+    return 0
+
+
+def get_block_line_numbers(ir_statements: List[LolIRStatement]) -> List[int]:
+    """
+    Get the Do line of each statement in a block. We only know the lines of
+    calls, so a statement without one gets the line of the next call in the
+    block (whose arguments it likely computes), or else of the previous one.
+    """
+    line_numbers = [get_line_number(stmt) for stmt in ir_statements]
+    for i in reversed(range(len(line_numbers) - 1)):
+        if line_numbers[i] == 0:
+            line_numbers[i] = line_numbers[i + 1]
+    for i in range(1, len(line_numbers)):
+        if line_numbers[i] == 0:
+            line_numbers[i] = line_numbers[i - 1]
+    return line_numbers
+
+
 def emit_expr(expr: LolIRExpression) -> str:
     if isinstance(expr, LolIRFunctionCallExpression):
         func_name = expr.function.name
-        func_args = [mangle_var_name(arg.name) for arg in expr.arguments]
+        # Variadic arguments (e.g. printf's) are passed by value
+        passing = [
+            *expr.function.parameter_passing,
+            *(LolAnalysisPassingStrategy.BY_VALUE for _ in expr.arguments),
+        ]
+        func_args = [emit_argument(arg, p) for arg, p in zip(expr.arguments, passing)]
         return f"{func_name}({', '.join(func_args)})"
     elif isinstance(expr, LolIROperatorExpression):
         if len(expr.operands) == 1:
-            return f"{expr.op}{mangle_var_name(expr.operands[0].name)}"
+            return f"{expr.op}{emit_variable(expr.operands[0])}"
         elif len(expr.operands) == 2:
             if expr.op in {"or", "and"}:
                 expr_op = {"or": "||", "and": "&&"}.get(expr.op)
             else:
                 expr_op = expr.op
-            return f"{mangle_var_name(expr.operands[0].name)} {expr_op} {mangle_var_name(expr.operands[1].name)}"
+            return f"{emit_variable(expr.operands[0])} {expr_op} {emit_variable(expr.operands[1])}"
         else:
             raise ValueError("only 1 or 2 operands accepted!")
     elif isinstance(expr, LolIRLiteralExpression):
@@ -48,22 +149,76 @@ def emit_expr(expr: LolIRExpression) -> str:
             return f"\"{literal}\""
         elif isinstance(literal, int):
             return f"{expr.literal}"
+        elif literal is None:
+            return "NULL"
     elif isinstance(expr, LolAnalysisVariable):
-        return f"{mangle_var_name(expr.name)}"
+        return emit_variable(expr)
+
+
+def emit_probe(name: str, arguments: List[LolAnalysisVariable]) -> str:
+    """
+    Emit a USDT probe (see src/runtime/lol_usdt.h). The tracer reads each
+    argument by its size in bytes, which is negative for signed integers.
+    """
+    probe_args = [name]
+    for arg in arguments:
+        size = arg.type.size if arg.type.is_reference else -arg.type.size
+        probe_args.extend([str(size), emit_variable(arg)])
+    return f"LOL_USDT_PROBE{len(arguments)}({', '.join(probe_args)});"
+
+
+def mangle_task_name(c_name: str, spawn: LolIRSpawnStatement) -> str:
+    """Get the name of the task frame's struct for a spawn in a function."""
+    return f"LOLtask_{c_name}_{spawn.frame}"
+
+
+def emit_spawn(spawn: LolIRSpawnStatement, task_name: str, indentation: str) -> List[str]:
+    """
+    Spawn the call if another worker may run it; otherwise, make the call
+    right away (see src/runtime/lol_task.h).
+    """
+    frame = spawn.frame
+    call = spawn.call
+    returns_void = call.function.return_types.name == "void"
+    set_args = [
+        f"{indentation}    {frame}.arg{i} = {emit_variable(arg)};"
+        for i, arg in enumerate(call.arguments)
+    ]
+    direct_call = emit_expr(call) if returns_void else f"{frame}.result = {emit_expr(call)}"
+    return [
+        f"{indentation}struct {task_name} {frame};",
+        f"{indentation}if (lol_task_should_spawn()) {{",
+        *set_args,
+        f"{indentation}    lol_task_spawn(&{frame}.task, {task_name}_run);",
+        f"{indentation}}} else {{",
+        f"{indentation}    {direct_call};",
+        f"{indentation}    lol_task_skip(&{frame}.task);",
+        f"{indentation}}}",
+    ]
 
 
 def emit_statements(
     ir_statements: List[LolIRStatement],
     *,
-    indentation: str = "    "
+    c_name: str,
+    indentation: str = "    ",
+    source_file: Optional[str] = None,
+    return_probe: Optional[str] = None,
 ) -> List[str]:
+    """
+    Emit a block. If `source_file` is the Do source's path, each statement is
+    preceded by a #line directive, so that debuggers and profilers show the Do
+    line that the statement came from. If `return_probe` is a probe's name, it
+    fires with the return value before each return.
+    """
     statements: List[str] = []
-    for stmt in ir_statements:
+    for stmt, line_number in zip(ir_statements, get_block_line_numbers(ir_statements)):
+        start = len(statements)
         if isinstance(stmt, LolIRDefinitionStatement):
             var_name = mangle_var_name(stmt.name)
-            var_type = lol_to_c_types[stmt.type.name]
+            declaration = emit_declaration(stmt.type, var_name, mutable=stmt.mutable)
             var_value = emit_expr(stmt.value)
-            statements.append(indentation + f"{var_type} {var_name} = {var_value};")
+            statements.append(indentation + f"{declaration} = {var_value};")
         elif isinstance(stmt, LolIRSetStatement):
             var_name = mangle_var_name(stmt.name)
             var_value = emit_expr(stmt.value)
@@ -72,47 +227,341 @@ def emit_statements(
             code = emit_expr(stmt.func_call)
             statements.append(indentation + f"{code};")
         elif isinstance(stmt, LolIRReturnStatement):
-            name = mangle_var_name(stmt.ret_var.name)
-            statements.append(indentation + f"return {name};")
+            if return_probe is not None:
+                statements.append(indentation + emit_probe(return_probe, [stmt.ret_var]))
+            statements.append(indentation + f"return {emit_variable(stmt.ret_var)};")
         elif isinstance(stmt, LolIRIfStatement):
-            statements.append(indentation + f"if ({mangle_var_name(stmt.if_cond.name)}) {{")
-            statements.extend(emit_statements(stmt.if_body, indentation=indentation + "    "))
+            if_cond = emit_variable(stmt.if_cond)
+            if stmt.hint == LolParserBranchHint.LIKELY:
+                if_cond = f"LOL_LIKELY({if_cond})"
+            elif stmt.hint == LolParserBranchHint.UNLIKELY:
+                if_cond = f"LOL_UNLIKELY({if_cond})"
+            statements.append(indentation + f"if ({if_cond}) {{")
+            statements.extend(emit_statements(stmt.if_body, c_name=c_name, indentation=indentation + "    ", source_file=source_file, return_probe=return_probe))
             statements.append(indentation + "} else {")
-            statements.extend(emit_statements(stmt.else_body, indentation=indentation + "    "))
+            statements.extend(emit_statements(stmt.else_body, c_name=c_name, indentation=indentation + "    ", source_file=source_file, return_probe=return_probe))
             statements.append(indentation + "}")
+        elif isinstance(stmt, LolIRAssertStatement):
+            # See src/runtime/lol_assert.h
+            macro = "LOL_ASSUME" if stmt.level == LolParserAssertLevel.ASSUME else "LOL_ASSERT"
+            if stmt.level == LolParserAssertLevel.DEBUG:
+                statements.append("#ifndef NDEBUG")
+            statements.append(indentation + "{")
+            statements.extend(emit_statements(stmt.cond_body, c_name=c_name, indentation=indentation + "    ", source_file=source_file, return_probe=return_probe))
+            statements.append(
+                indentation + f"    {macro}({emit_variable(stmt.cond)}, {emit_c_string(stmt.message)});"
+            )
+            statements.append(indentation + "}")
+            if stmt.level == LolParserAssertLevel.DEBUG:
+                statements.append("#endif /* NDEBUG */")
+        elif isinstance(stmt, LolIRPropagateErrorStatement):
+            result = emit_variable(stmt.result)
+            statements.append(indentation + f"if (LOL_UNLIKELY({result} < 0)) {{")
+            statements.append(indentation + f"    {ERROR_VAR_NAME} = {result};")
+            statements.append(indentation + f"    goto {ERROR_LABEL_NAME};")
+            statements.append(indentation + "}")
+        elif isinstance(stmt, LolIRSpawnStatement):
+            statements.extend(emit_spawn(stmt, mangle_task_name(c_name, stmt), indentation))
+        elif isinstance(stmt, LolIRSyncStatement):
+            # The runtime expects the newest task to be synced first
+            for spawn in reversed(stmt.spawns):
+                statements.append(indentation + f"lol_task_sync(&{spawn.frame}.task);")
+            for spawn in stmt.spawns:
+                if stmt.bind_results and spawn.name is not None:
+                    declaration = emit_declaration(spawn.type, mangle_var_name(spawn.name), mutable=spawn.mutable)
+                    statements.append(indentation + f"{declaration} = {spawn.frame}.result;")
+        elif isinstance(stmt, LolIRProbeStatement):
+            statements.append(indentation + emit_probe(stmt.name, stmt.arguments))
         else:
             raise ValueError("unrecognized statement type (maybe if statement?)")
+        if source_file is not None and line_number != 0:
+            directive = f"#line {line_number} {emit_c_string(source_file)}"
+            if isinstance(stmt, (LolIRIfStatement, LolIRAssertStatement)):
+                # The nested blocks have their own directives
+                statements.insert(start, directive)
+            else:
+                # Each C line would otherwise count as the next Do line
+                statements[start:] = [x for line in statements[start:] for x in (directive, line)]
     return statements
 
-def emit_function(func: LolAnalysisFunction):
-    prototype = (
-        f"{lol_to_c_types[func.return_types.name]}\n"
-        f"{func.name}({', '.join((f'{lol_to_c_types[arg_type.name]} {arg_name}' for arg_type, arg_name in zip(func.parameter_types, func.parameter_names)))})\n"
+def mangle_bench_name(bench_name: str) -> str:
+    return f"LOLbench_{bench_name}"
+
+
+def get_non_null_positions(func: LolAnalysisFunction) -> List[str]:
+    """Get the 1-based positions of the C pointer parameters that are never
+    null."""
+    return [
+        str(i + 1)
+        for i, (param_type, passing) in enumerate(zip(func.parameter_types, func.parameter_passing))
+        if (param_type.is_reference and not param_type.nullable)
+        or passing == LolAnalysisPassingStrategy.BY_REFERENCE
+    ]
+
+
+def emit_prototype(func: LolAnalysisFunction, c_name: str, specifiers: str) -> str:
+    # Let the C compiler drop null checks on (and warn about null arguments
+    # for) the parameters that the analyzer proved are non-null.
+    non_null_positions = get_non_null_positions(func)
+    if non_null_positions:
+        specifiers = f"{specifiers}LOL_NONNULL({', '.join(non_null_positions)}) "
+    return (
+        f"{specifiers}{lol_to_c_types[func.return_types.name]}\n"
+        f"{c_name}({', '.join(emit_parameter(*x) for x in zip(func.parameter_types, func.parameter_names, func.parameter_passing))})"
+    )
+
+
+def emit_task(spawn: LolIRSpawnStatement, task_name: str) -> str:
+    """
+    Emit the frame of a spawned call and the function that a worker runs to
+    make the call. The frame holds copies of the arguments, so the call does
+    not depend on the spawning function's variables.
+    """
+    callee = spawn.call.function
+    passing = [
+        *callee.parameter_passing,
+        *(LolAnalysisPassingStrategy.BY_VALUE for _ in spawn.call.arguments),
+    ]
+    fields = ["    struct lol_task task;"]
+    args = []
+    for i, (arg, p) in enumerate(zip(spawn.call.arguments, passing)):
+        fields.append(f"    {lol_to_c_types[arg.type.name]} arg{i};")
+        args.append(f"&frame->arg{i}" if p == LolAnalysisPassingStrategy.BY_REFERENCE else f"frame->arg{i}")
+    call = f"{callee.name}({', '.join(args)})"
+    if callee.return_types.name != "void":
+        fields.append(f"    {lol_to_c_types[callee.return_types.name]} result;")
+        call = f"frame->result = {call}"
+    # The callee may be defined after the spawning function (or be it)
+    prototype = emit_prototype(callee, callee.name, "") + ";\n" if callee.body is not None else ""
+    return (
+        f"{prototype}"
+        f"struct {task_name} {{\n" + "\n".join(fields) + "\n};\n"
+        f"static void\n"
+        f"{task_name}_run(struct lol_task *task)\n"
+        f"{{\n"
+        f"    struct {task_name} *frame = (struct {task_name} *)task;\n"
+        f"    {call};\n"
+        f"}}\n"
+    )
+
+
+def emit_function(
+    func: LolAnalysisFunction,
+    *,
+    c_name: Optional[str] = None,
+    specifiers: str = "",
+    source_file: Optional[str] = None,
+    usdt: bool = False,
+):
+    """
+    Emit a function. With `usdt`, it has the probes `<name>__entry`, with (up
+    to 6 of) its parameters, and `<name>__return`, with its return value.
+    """
+    c_name = func.name if c_name is None else c_name
+    prototype = emit_prototype(func, c_name, specifiers) + "\n"
+    return_probe = f"{c_name}__return" if usdt else None
+    statements = emit_statements(
+        func.body, c_name=c_name, source_file=source_file, return_probe=return_probe
     )
-    statements = emit_statements(func.body)
+    if usdt:
+        parameters = [func.symbol_table[name] for name in func.parameter_names]
+        statements.insert(0, "    " + emit_probe(f"{c_name}__entry", parameters[:PROBE_MAX_ARGUMENTS]))
+        if func.return_types.name == "void":
+            statements.append("    " + emit_probe(return_probe, []))
+    if any(isinstance(stmt, LolIRPropagateErrorStatement) for stmt in walk_statements(func.body)):
+        error_var = LolAnalysisVariable(ERROR_VAR_NAME, None, type=func.return_types)
+        statements = [
+            f"    int {ERROR_VAR_NAME} = 0;",
+            *statements,
+            f"{ERROR_LABEL_NAME}: LOL_COLD_LABEL;",
+            *(["    " + emit_probe(return_probe, [error_var])] if usdt else []),
+            f"    return {ERROR_VAR_NAME};",
+        ]
 
-    return prototype + "{\n" + "\n".join(statements) + "\n}\n"
+    # The blocks that were outlined from this function must be declared first
+    cold_functions = [
+        emit_function(cold_func, specifiers="static LOL_COLD ", source_file=source_file)
+        for cold_func in func.cold_functions
+    ]
+    # So must the frames of the calls that it spawns
+    tasks = [
+        emit_task(stmt, mangle_task_name(c_name, stmt))
+        for stmt in walk_statements(func.body)
+        if isinstance(stmt, LolIRSpawnStatement)
+    ]
+    end = f"{END_OF_SOURCE_MAP}\n" if source_file is not None else ""
+    return "".join(cold_functions + tasks) + prototype + "{\n" + "\n".join(statements) + "\n}\n" + end
 
 
 def emit_import(include: LolAnalysisModule):
     return f"#include <{include.name[1:-1]}>"
 
 
-def emit_c(analysis_module: LolAnalysisModule):
+def emit_benchmarks(benchmarks: Dict[str, LolAnalysisFunction], source_file: Optional[str] = None) -> str:
+    """
+    Emit the benchmark runner (see src/runtime/lol_bench.h). It replaces the
+    program's main function when the C code is compiled with -DLOL_BENCH.
+    """
+    bench_functions = []
+    bench_table = []
+    for name, bench in benchmarks.items():
+        c_name = mangle_bench_name(name)
+        bench_functions.append(
+            emit_function(
+                bench,
+                c_name=c_name,
+                specifiers="static LOL_BENCH_NOINLINE ",
+                source_file=source_file,
+            )
+        )
+        if bench.return_types.name == "void":
+            iteration = f"        {c_name}();"
+        else:
+            iteration = (
+                f"        {lol_to_c_types[bench.return_types.name]} result = {c_name}();\n"
+                f"        LOL_BENCH_DO_NOT_OPTIMIZE(result);"
+            )
+        bench_functions.append(
+            f"static void\n"
+            f"{c_name}_run(uint64_t iterations)\n"
+            f"{{\n"
+            f"    uint64_t i = 0;\n"
+            f"    for (i = 0; i < iterations; ++i) {{\n"
+            f"{iteration}\n"
+            f"    }}\n"
+            f"}}\n"
+        )
+        bench_table.append(f"    {{\"{name}\", {c_name}_run}},")
+    return "\n".join(
+        [
+            "#ifdef LOL_BENCH",
+            "#include <lol_bench.h>",
+            *bench_functions,
+            "static const struct lol_bench LOLbench_all[] = {",
+            *bench_table,
+            "};\n",
+            "int\nmain(int argc, char **argv)\n{",
+            "    return lol_bench_main(LOLbench_all, sizeof LOLbench_all / sizeof *LOLbench_all, argc, argv);",
+            "}",
+            "#endif /* LOL_BENCH */",
+        ]
+    )
+
+
+def emit_source_map_ends(code: str, output_file: str) -> str:
+    """Map the lines after each function with a source map back to the C
+    file."""
+    lines = code.split("\n")
+    return "\n".join(
+        # A #line directive gives the number of the line after it
+        f"#line {i + 2} {emit_c_string(output_file)}" if line == END_OF_SOURCE_MAP else line
+        for i, line in enumerate(lines)
+    )
+
+
+def emit_c(
+    analysis_module: LolAnalysisModule,
+    *,
+    heap_profile: bool = False,
+    usdt: bool = False,
+    source_file: Optional[str] = None,
+    output_file: Optional[str] = None,
+):
+    """
+    Emit the C code for a module. With `heap_profile`, the program samples its
+    allocations (see src/runtime/lol_heap_profile.h), and the Do source's path
+    `source_file` is needed for the source map, as is the path `output_file`
+    that the C code will be saved to. With `usdt`, every function has entry
+    and return probes (see src/runtime/lol_usdt.h).
+    """
+    preamble = []
     import_statements = []
     func_statements = []
+    has_benchmarks = len(analysis_module.benchmarks) != 0
+    has_spawns = any(
+        isinstance(stmt, LolIRSpawnStatement)
+        for func in [
+            *analysis_module.module_symbol_table.values(),
+            *analysis_module.benchmarks.values(),
+        ]
+        if isinstance(func, LolAnalysisFunction) and func.body is not None
+        for stmt in walk_statements(func.body)
+    )
+    imports_posix = any(
+        isinstance(symbol, LolAnalysisModule) and symbol.name in posix_libraries
+        for symbol in analysis_module.module_symbol_table.values()
+    )
+    if has_spawns or heap_profile or imports_posix:
+        # The task runtime needs POSIX threads and CPU counts, the heap
+        # profiler needs signals and stack traces, the timers need epoll (and
+        # the benchmark runner, if any, needs POSIX clocks).
+        preamble.append("#define _GNU_SOURCE")
+    elif has_benchmarks:
+        # The benchmark runner needs POSIX clocks, which must be requested
+        # before the first system header is included.
+        preamble.append("#ifdef LOL_BENCH\n#define _GNU_SOURCE\n#endif")
     # Emit modules
     for name, s in analysis_module.module_symbol_table.items():
         if isinstance(s, LolAnalysisModule):
             import_statements.append(emit_import(s))
         elif isinstance(s, LolAnalysisFunction):
-            func_statements.append(emit_function(s))
+            code = emit_function(s, source_file=source_file if heap_profile else None, usdt=usdt)
+            if has_benchmarks and s.name == "main":
+                code = f"#ifndef LOL_BENCH\n{code}#endif /* LOL_BENCH */\n"
+            func_statements.append(code)
         elif isinstance(s, LolAnalysisBuiltinType):
             # Obviously, we don't need to define built-in types
             continue
         else:
             raise ValueError("unrecognized statement type")
 
-    statements = import_statements + func_statements
+    # Include the runtime headers that the emitted code itself relies on
+    functions = [
+        func
+        for func in [
+            *analysis_module.module_symbol_table.values(),
+            *analysis_module.benchmarks.values(),
+        ]
+        if isinstance(func, LolAnalysisFunction) and func.body is not None
+    ]
+    has_cold_functions = any(len(func.cold_functions) != 0 for func in functions)
+    has_non_null_parameters = any(
+        len(get_non_null_positions(f)) != 0
+        for func in functions
+        for f in [func, *func.cold_functions]
+    )
+    bodies = [
+        stmt
+        for func in functions
+        for body in [func.body, *(f.body for f in func.cold_functions)]
+        for stmt in walk_statements(body)
+    ]
+    if any(
+        isinstance(stmt, LolIRDefinitionStatement)
+        and isinstance(stmt.value, LolIRLiteralExpression)
+        and stmt.value.literal is None
+        for stmt in bodies
+    ):
+        import_statements.append("#include <stddef.h>")
+    if any(isinstance(stmt, LolIRAssertStatement) for stmt in bodies):
+        import_statements.append("#include <lol_assert.h>")
+    if has_spawns:
+        import_statements.append("#include <lol_task.h>")
+    if heap_profile:
+        import_statements.append("#include <lol_heap_profile.h>")
+    if usdt or any(isinstance(stmt, LolIRProbeStatement) for stmt in bodies):
+        import_statements.append("#include <lol_usdt.h>")
+    if has_cold_functions or has_non_null_parameters or any(
+        isinstance(stmt, LolIRPropagateErrorStatement)
+        or (isinstance(stmt, LolIRIfStatement) and stmt.hint != LolParserBranchHint.NONE)
+        for stmt in bodies
+    ):
+        import_statements.append("#include <lol_hints.h>")
+
+    statements = preamble + import_statements + func_statements
+    if has_benchmarks:
+        statements.append(emit_benchmarks(analysis_module.benchmarks, source_file if heap_profile else None))
     code = "\n".join(statements)
+    if heap_profile:
+        code = emit_source_map_ends(code, output_file)
     return code
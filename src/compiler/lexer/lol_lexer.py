@@ -17,7 +17,7 @@ We use white-space as the delimiter because CSVs are well formed.
 The accepted tokens are (ASCII):
 
 1. identifiers : [A-Za-z_][A-Za-z0-9_]*
-    - Keywords: if, else, while, function, return, let, namespace
+    - Keywords: if, else, while, function, bench, return, assert, let, namespace
 2. decimal integers : [1-9][0-9]*
 3. strings : ["](\"|[^"])*["]
 4. parentheses : "(" or ")"
@@ -67,10 +67,16 @@ class Lexer:
             "if": TokenType.IF,
             "else": TokenType.ELSE,
             "let": TokenType.LET,
+            "mut": TokenType.MUT,
             "while": TokenType.WHILE,
             "for": TokenType.FOR,
             "function": TokenType.FUNCTION,
+            "bench": TokenType.BENCH,
             "return": TokenType.RETURN,
+            "assert": TokenType.ASSERT,
+            "spawn": TokenType.SPAWN,
+            "sync": TokenType.SYNC,
+            "probe": TokenType.PROBE,
             "namespace": TokenType.NAMESPACE,
             "module": TokenType.MODULE,
             "import": TokenType.IMPORT,
@@ -79,6 +85,7 @@ class Lexer:
             "and": TokenType.AND,
             "or": TokenType.OR,
             "not": TokenType.NOT,
+            "null": TokenType.NULL,
         }
         token_type = key_words.get(identifier, TokenType.IDENTIFIER)
         return token_type
@@ -37,7 +37,7 @@ class TokenType(Enum):
     MINUS = auto()  # -
     SLASH = auto()  # /
 
-    QUESTION = auto(), NOT_YET_IMPLEMENTED  # ?
+    QUESTION = auto()  # ?
     VBAR = auto(), NOT_YET_IMPLEMENTED  # |
 
     GREATER = auto()  # >
@@ -50,7 +50,7 @@ class TokenType(Enum):
     GREATER_EQUAL = auto(), NOT_YET_IMPLEMENTED  # >=
     LESSER_EQUAL = auto(), NOT_YET_IMPLEMENTED  # <=
     EQUAL_EQUAL = auto(), NOT_YET_IMPLEMENTED  # ==
-    NOT_EQUAL = auto(), NOT_YET_IMPLEMENTED  # !=
+    NOT_EQUAL = auto()  # !=
 
     # Unimplemented in tokenizer (no plan to implement these yet)
     STAR_STAR = auto(), WONT_BE_IMPLEMENTED  # **
@@ -87,8 +87,14 @@ class TokenType(Enum):
     WHILE = auto()
     FOR = auto()
     FUNCTION = auto()
+    BENCH = auto()
     RETURN = auto()
+    ASSERT = auto()
+    SPAWN = auto()
+    SYNC = auto()
+    PROBE = auto()
     LET = auto()
+    MUT = auto()
     NAMESPACE = auto()
     MODULE = auto()
     IMPORT = auto()
@@ -97,6 +103,7 @@ class TokenType(Enum):
     AND = auto()
     OR = auto()
     NOT = auto()
+    NULL = auto()
 
 
 SYMBOL_CONTROL: Dict[Optional[str], Union[Dict, TokenType]] = {
@@ -110,7 +117,7 @@ SYMBOL_CONTROL: Dict[Optional[str], Union[Dict, TokenType]] = {
     ".": {None: TokenType.DOT},
     ";": {None: TokenType.SEMICOLON},
     "?": {None: TokenType.QUESTION},
-    "|": {None: TokenType.QUESTION},
+    "|": {None: TokenType.VBAR},
     "&": {None: TokenType.AMPERSAND},
     "^": {None: TokenType.CIRCUMFLEX},
     "@": {None: TokenType.AT},
@@ -8,6 +8,9 @@ from compiler.analyzer.lol_analyzer import analyze, LolAnalysisModule
 from compiler.emitter.lol_emitter import emit_c
 from compiler.lexer.lol_lexer import tokenize
 from compiler.lexer.lol_lexer_types import Token
+from compiler.optimizer.lol_cse import eliminate_common_subexpressions
+from compiler.optimizer.lol_outliner import outline_cold_blocks
+from compiler.optimizer.lol_parallelizer import parallelize_pure_calls
 from compiler.parser.lol_parser import parse, LolParserModuleLevelStatement
 from compiler.parser.lol_parser_token_stream import TokenStream
 
@@ -27,12 +30,20 @@ class LolModule:
         *,
         input_file: str,
         output_dir: str,
+        auto_parallel: bool = False,
+        heap_profile: bool = False,
+        usdt: bool = False,
     ):
         # Metadata
         self.input_file = input_file
         self.output_dir = output_dir
         prefix, ext = os.path.splitext(os.path.basename(input_file))
         self.output_prefix = prefix
+        # Optimizations that change the emitted program's threading
+        self.auto_parallel = auto_parallel
+        # Instrumentation of the emitted program
+        self.heap_profile = heap_profile
+        self.usdt = usdt
 
         self.text: str = ""
         self.tokens: List[Token] = []
@@ -40,6 +51,7 @@ class LolModule:
         self.module: Optional[LolAnalysisModule] = None
         self.code: Optional[str] = None
         self.output_language: Optional[str] = None
+        self.output_file: Optional[str] = None
 
     def read_input_file(self):
         with open(self.input_file) as f:
@@ -93,6 +105,17 @@ class LolModule:
         with open(file_name, "w") as f:
             json.dump({"analyzer-output": {x: y.to_dict() for x, y in self.module.module_symbol_table.items()}}, f, indent=4)
 
+    ############################################################################
+    ### OPTIMIZER
+    ############################################################################
+
+    def run_optimizer(self):
+        assert isinstance(self.module, LolAnalysisModule)
+        eliminate_common_subexpressions(self.module)
+        outline_cold_blocks(self.module)
+        if self.auto_parallel:
+            parallelize_pure_calls(self.module)
+
     ############################################################################
     ### EMITTER
     ############################################################################
@@ -100,13 +123,20 @@ class LolModule:
     def run_emitter(self):
         # TODO: Make this in the __init__function
         assert self.code is None and self.output_language is None
-        self.code = emit_c(self.module)
+        # The source map refers to the C file by name, so name it first
+        self.output_file = f"{self.output_dir}/{self.output_prefix}-{time.time()}-emitter-output-only.c"
+        self.code = emit_c(
+            self.module,
+            heap_profile=self.heap_profile,
+            usdt=self.usdt,
+            source_file=self.input_file,
+            output_file=self.output_file,
+        )
         self.output_language = "c"
 
     def save_emitter_output_only(self):
         assert isinstance(self.code, str) and self.output_language == "c"
-        file_name: str = f"{self.output_dir}/{self.output_prefix}-{time.time()}-emitter-output-only.c"
-        with open(file_name, "w") as f:
+        with open(self.output_file, "w") as f:
             f.write(self.code)
 
 
@@ -120,14 +150,35 @@ def main() -> None:
     parser.add_argument(
         "-o", "--output", type=str, default=".", help="Output directory name"
     )
+    parser.add_argument(
+        "-fauto-parallel", dest="auto_parallel", action="store_true",
+        help="Run independent calls to pure functions in parallel"
+    )
+    parser.add_argument(
+        "-fheap-profile", dest="heap_profile", action="store_true",
+        help="Sample allocations by Do source line (set LOL_HEAP_PROFILE=file when running)"
+    )
+    parser.add_argument(
+        "-fusdt", dest="usdt", action="store_true",
+        help="Add USDT probes at the entry and return of every function (for bpftrace, perf, etc.)"
+    )
     args = parser.parse_args()
 
     # I explicitly extract the names because otherwise one may be tempted to
     # pass the 'args' namespace, which is always confusing.
     input_file = args.input
     output_dir = args.output
-
-    module = LolModule(input_file=input_file, output_dir=output_dir)
+    auto_parallel = args.auto_parallel
+    heap_profile = args.heap_profile
+    usdt = args.usdt
+
+    module = LolModule(
+        input_file=input_file,
+        output_dir=output_dir,
+        auto_parallel=auto_parallel,
+        heap_profile=heap_profile,
+        usdt=usdt,
+    )
     module.read_input_file()
     module.setup_output_dir()
 
@@ -137,6 +188,7 @@ def main() -> None:
     module.save_parser_output_only()
     module.run_analyzer()
     module.save_analyzer_output_only()
+    module.run_optimizer()
     module.run_emitter()
     module.save_emitter_output_only()
 
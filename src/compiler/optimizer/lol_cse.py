@@ -0,0 +1,123 @@
+"""
+Common subexpression elimination.
+
+The analyzer gives every subexpression a fresh temporary, so `x * y + x * y`
+computes `x * y` twice. Operators are pure and Do variables are immutable
+unless declared `let mut`, so an operator over the same operands always
+has the same value. We replace the repeated computation with a copy of the
+first result, which the C compiler then folds away.
+
+An expression is available in the block that computed it and in the blocks
+nested inside it. It is forgotten when one of its operands is set or
+redefined, e.g. by a `let` in a nested block that shadows it.
+"""
+from typing import Dict, List, Set, Tuple
+
+from compiler.analyzer.lol_analyzer import (
+    LolAnalysisModule, LolAnalysisFunction, LolAnalysisVariable,
+    LolIRStatement,
+    LolIRDefinitionStatement, LolIRSetStatement, LolIRIfStatement,
+    LolIRAssertStatement,
+    LolIROperatorExpression,
+)
+
+# The order of the operands does not matter for these.
+COMMUTATIVE_OPERATORS = {"+", "*", "==", "!=", "and", "or"}
+
+LolCSEKey = Tuple[str, Tuple[str, ...]]
+
+
+def get_key(expr: LolIROperatorExpression, copies: Dict[str, str]) -> LolCSEKey:
+    operands = tuple(copies.get(x.name, x.name) for x in expr.operands)
+    if expr.op in COMMUTATIVE_OPERATORS:
+        operands = tuple(sorted(operands))
+    return expr.op, operands
+
+
+def get_assigned_names(block: List[LolIRStatement]) -> Set[str]:
+    names = set()
+    for stmt in block:
+        if isinstance(stmt, LolIRSetStatement):
+            names.add(stmt.name)
+        elif isinstance(stmt, LolIRIfStatement):
+            names |= get_assigned_names(stmt.if_body)
+            names |= get_assigned_names(stmt.else_body)
+    return names
+
+
+def forget(available: Dict[LolCSEKey, LolAnalysisVariable], names: Set[str]):
+    for key in [key for key in available if any(x in names for x in key[1])]:
+        del available[key]
+
+
+def forget_definition(
+    available: Dict[LolCSEKey, LolAnalysisVariable],
+    copies: Dict[str, str],
+    name: str,
+):
+    """Forget everything that refers to the variable that a definition of
+    `name` replaces (or, in a nested block, shadows)."""
+    forget(available, {name})
+    for key in [key for key, var in available.items() if var.name == name]:
+        del available[key]
+    for copy in [copy for copy, source in copies.items() if name in (copy, source)]:
+        del copies[copy]
+
+
+def eliminate_block(
+    func: LolAnalysisFunction,
+    block: List[LolIRStatement],
+    available: Dict[LolCSEKey, LolAnalysisVariable],
+    copies: Dict[str, str],
+):
+    """
+    Eliminate the expressions in the block that are already available.
+
+    An immutable variable that is a copy of another immutable variable maps to
+    the original in `copies`, so that `let a = x * y; let b = a + 1;` and
+    `let c = x * y; let d = c + 1;` share `a + 1`.
+    """
+    # Expressions computed in this block are not available after it
+    available = dict(available)
+    copies = dict(copies)
+    for i, stmt in enumerate(block):
+        key = None
+        if isinstance(stmt, LolIRDefinitionStatement) and isinstance(stmt.value, LolIROperatorExpression):
+            key = get_key(stmt.value, copies)
+            # In C, `int p = p;` in a nested block would read the new p
+            if key in available and available[key].name != stmt.name:
+                stmt = LolIRDefinitionStatement(
+                    stmt.name, stmt.type, available[key], mutable=stmt.mutable
+                )
+                block[i] = stmt
+        if isinstance(stmt, LolIRDefinitionStatement):
+            # The value refers to the variables from before the definition
+            source = stmt.value
+            source_name = None
+            if isinstance(source, LolAnalysisVariable) and not source.mutable:
+                source_name = copies.get(source.name, source.name)
+            forget_definition(available, copies, stmt.name)
+            if key is not None and key not in available and not stmt.mutable and stmt.name not in key[1]:
+                available[key] = func.symbol_table[stmt.name]
+            if source_name is not None and source_name != stmt.name and not stmt.mutable:
+                copies[stmt.name] = source_name
+        elif isinstance(stmt, LolIRSetStatement):
+            forget(available, {stmt.name})
+        elif isinstance(stmt, LolIRIfStatement):
+            eliminate_block(func, stmt.if_body, available, copies)
+            eliminate_block(func, stmt.else_body, available, copies)
+            forget(available, get_assigned_names([stmt]))
+        elif isinstance(stmt, LolIRAssertStatement):
+            # The condition is not computed if the assertion is not checked,
+            # so nothing after the assertion may reuse it.
+            eliminate_block(func, stmt.cond_body, available, copies)
+
+
+def eliminate_common_subexpressions(module: LolAnalysisModule):
+    functions = [
+        *module.module_symbol_table.values(),
+        *module.benchmarks.values(),
+    ]
+    for func in functions:
+        if isinstance(func, LolAnalysisFunction) and func.body is not None:
+            eliminate_block(func, func.body, {}, {})
@@ -0,0 +1,308 @@
+"""
+Hot/cold splitting.
+
+Error handling and diagnostics are interleaved with the code that does the real
+work, so they bloat the hot function and push it across more cache lines. This
+pass finds the rarely executed side of each if statement and:
+
+1. tells the C compiler which side is unlikely (so it lays out the hot side as
+the fall-through), and
+2. if the cold block is big enough to matter, moves it into a separate
+`static LOL_COLD` function (i.e. `__attribute__((cold, noinline))`), which the
+C compiler places in .text.unlikely, away from the hot code.
+
+A block is cold if:
+
+- the programmer said so, i.e. `if[unlikely] cond {...}` or `if[likely]`;
+- it returns an error, i.e. a negative constant (see docs/STANDARD_LIBRARY.md);
+- or it calls a cold function (e.g. `perror`).
+
+We do not read profiles ourselves; compile the C code with GCC's
+-fprofile-generate/-fprofile-use for that.
+"""
+from typing import Dict, List, Optional, Set
+
+from compiler.analyzer.lol_analyzer import (
+    LolAnalysisModule, LolAnalysisFunction, LolAnalysisVariable,
+    LolIRStatement, LolIRExpression,
+    LolIRDefinitionStatement, LolIRSetStatement, LolIRFunctionCallStatement,
+    LolIRIfStatement, LolIRReturnStatement, LolIRAssertStatement,
+    LolIRPropagateErrorStatement, LolIRSpawnStatement, LolIRSyncStatement,
+    LolIRProbeStatement,
+    LolIRFunctionCallExpression, LolIROperatorExpression, LolIRLiteralExpression,
+)
+from compiler.parser.lol_parser import LolParserBranchHint
+
+# Cold blocks with fewer statements than this are only hinted, because the
+# call would cost about as much as the code that it replaces. Function calls
+# are always worth outlining, since they need their arguments set up.
+OUTLINE_MIN_STATEMENTS = 8
+COLD_FUNCTION_PREFIX = "LOLcold_"
+
+
+def get_expression_variables(expr: LolIRExpression) -> List[LolAnalysisVariable]:
+    if isinstance(expr, LolIRFunctionCallExpression):
+        return list(expr.arguments)
+    elif isinstance(expr, LolIROperatorExpression):
+        return list(expr.operands)
+    elif isinstance(expr, LolAnalysisVariable):
+        return [expr]
+    return []
+
+
+def walk_block(block: List[LolIRStatement]):
+    for stmt in block:
+        yield stmt
+        if isinstance(stmt, LolIRIfStatement):
+            yield from walk_block(stmt.if_body)
+            yield from walk_block(stmt.else_body)
+        elif isinstance(stmt, LolIRAssertStatement):
+            yield from walk_block(stmt.cond_body)
+
+
+def fold_constants(block: List[LolIRStatement]) -> Dict[str, int]:
+    """Get the integer constants defined at the top level of a block."""
+    constants: Dict[str, int] = {}
+    for stmt in block:
+        if not isinstance(stmt, LolIRDefinitionStatement):
+            continue
+        value = stmt.value
+        if isinstance(value, LolIRLiteralExpression) and isinstance(value.literal, int):
+            constants[stmt.name] = value.literal
+        elif (
+            isinstance(value, LolIROperatorExpression)
+            and len(value.operands) == 2
+            and value.op in {"+", "-", "*"}
+            and all(x.name in constants for x in value.operands)
+        ):
+            lhs, rhs = (constants[x.name] for x in value.operands)
+            constants[stmt.name] = {"+": lhs + rhs, "-": lhs - rhs, "*": lhs * rhs}[value.op]
+    return constants
+
+
+def is_cold_block(block: List[LolIRStatement]) -> bool:
+    if len(block) == 0:
+        return False
+    last = block[-1]
+    if isinstance(last, LolIRReturnStatement):
+        value = fold_constants(block).get(last.ret_var.name)
+        if value is not None and value < 0:
+            return True
+    for stmt in walk_block(block):
+        if isinstance(stmt, LolIRFunctionCallStatement):
+            call = stmt.func_call
+        elif isinstance(stmt, LolIRDefinitionStatement) and isinstance(stmt.value, LolIRFunctionCallExpression):
+            call = stmt.value
+        else:
+            continue
+        if call.function.is_cold:
+            return True
+    return False
+
+
+def always_returns(block: List[LolIRStatement]) -> bool:
+    if len(block) == 0:
+        return False
+    last = block[-1]
+    if isinstance(last, LolIRReturnStatement):
+        return True
+    if isinstance(last, LolIRIfStatement):
+        return always_returns(last.if_body) and always_returns(last.else_body)
+    return False
+
+
+def never_returns(block: List[LolIRStatement]) -> bool:
+    return not any(isinstance(stmt, LolIRReturnStatement) for stmt in walk_block(block))
+
+
+def is_worth_outlining(block: List[LolIRStatement]) -> bool:
+    statements = list(walk_block(block))
+    has_call = any(
+        isinstance(stmt, LolIRFunctionCallStatement)
+        or (isinstance(stmt, LolIRDefinitionStatement) and isinstance(stmt.value, LolIRFunctionCallExpression))
+        for stmt in statements
+    )
+    return has_call or len(statements) >= OUTLINE_MIN_STATEMENTS
+
+
+def get_free_variables(block: List[LolIRStatement]) -> List[str]:
+    """Get the names of the variables that a block uses but does not define, in
+    the order in which they are first used."""
+    free: Dict[str, None] = {}
+
+    def use(variables: List[LolAnalysisVariable], defined: Set[str]):
+        for var in variables:
+            if var.name not in defined:
+                free[var.name] = None
+
+    def visit(block: List[LolIRStatement], defined: Set[str]):
+        # Definitions in a nested block are not visible after it.
+        defined = set(defined)
+        for stmt in block:
+            if isinstance(stmt, LolIRDefinitionStatement):
+                use(get_expression_variables(stmt.value), defined)
+                defined.add(stmt.name)
+            elif isinstance(stmt, LolIRSetStatement):
+                use(get_expression_variables(stmt.value), defined)
+            elif isinstance(stmt, LolIRFunctionCallStatement):
+                use(get_expression_variables(stmt.func_call), defined)
+            elif isinstance(stmt, LolIRReturnStatement):
+                use([stmt.ret_var], defined)
+            elif isinstance(stmt, LolIRIfStatement):
+                use([stmt.if_cond], defined)
+                visit(stmt.if_body, defined)
+                visit(stmt.else_body, defined)
+            elif isinstance(stmt, LolIRAssertStatement):
+                visit(stmt.cond_body, defined)
+                # The condition is defined inside the condition block
+                use([stmt.cond], defined | {
+                    x.name for x in stmt.cond_body
+                    if isinstance(x, LolIRDefinitionStatement)
+                })
+            elif isinstance(stmt, LolIRPropagateErrorStatement):
+                use([stmt.result], defined)
+            elif isinstance(stmt, LolIRProbeStatement):
+                use(stmt.arguments, defined)
+
+    visit(block, set())
+    return list(free)
+
+
+def get_parameters(func: LolAnalysisFunction) -> Dict[str, LolAnalysisVariable]:
+    """Get a function's parameters, as they are in scope at its first statement."""
+    parameters: Dict[str, LolAnalysisVariable] = {}
+    for name, type, passing in zip(func.parameter_names, func.parameter_types, func.parameter_passing):
+        var = LolAnalysisVariable(name, None, type=type)
+        var.passing = passing
+        parameters[name] = var
+    return parameters
+
+
+def get_defined_variable(stmt: LolIRStatement) -> Optional[LolAnalysisVariable]:
+    """Get the variable that a statement defines, if any."""
+    if isinstance(stmt, (LolIRDefinitionStatement, LolIRSpawnStatement)) and stmt.name is not None:
+        var = LolAnalysisVariable(stmt.name, None, type=stmt.type)
+        var.mutable = stmt.mutable
+        return var
+    return None
+
+
+class LolOutliner:
+    def __init__(self, module: LolAnalysisModule):
+        self.module = module
+        self.cold_function_count = 0
+
+    def _get_cold_function_name(self) -> str:
+        name = f"{COLD_FUNCTION_PREFIX}{self.cold_function_count}"
+        self.cold_function_count += 1
+        return name
+
+    def _outline(
+        self,
+        func: LolAnalysisFunction,
+        block: List[LolIRStatement],
+        scope: Dict[str, LolAnalysisVariable],
+    ) -> Optional[List[LolIRStatement]]:
+        """
+        Move a block into a new cold function and return the block that calls
+        it, or None if the block cannot be moved. `scope` has the variables
+        that are in scope at the block.
+        """
+        void = self.module.module_symbol_table["void"]
+        if any(
+            # These jump to or write to something that only the original
+            # function can see (including the spawned calls' frames).
+            isinstance(stmt, (
+                LolIRPropagateErrorStatement, LolIRSetStatement,
+                LolIRSpawnStatement, LolIRSyncStatement,
+            ))
+            for stmt in walk_block(block)
+        ):
+            return None
+        if always_returns(block) and func.return_types is not void:
+            return_type = func.return_types
+        elif never_returns(block):
+            return_type = void
+        else:
+            return None
+
+        free_names = get_free_variables(block)
+        # Not func.symbol_table, which has the last definition of each name,
+        # while a shadowed variable may have another type or passing.
+        free_variables = [scope[name] for name in free_names]
+        cold_func = LolAnalysisFunction(
+            self._get_cold_function_name(),
+            None,
+            return_types=return_type,
+            parameter_types=[var.type for var in free_variables],
+            parameter_names=free_names,
+            # Pass each variable the way that this function holds it, since
+            # the outlined body refers to the same variables.
+            parameter_passing=[var.passing for var in free_variables],
+            symbol_table=func.symbol_table,
+            body=list(block),
+        )
+        cold_func.is_cold = True
+        func.cold_functions.append(cold_func)
+
+        call = LolIRFunctionCallExpression(cold_func, free_variables)
+        if return_type is void:
+            return [LolIRFunctionCallStatement(call)]
+        ret = func._get_temporary_variable_name()
+        func.symbol_table[ret] = LolAnalysisVariable(ret, None, type=return_type)
+        return [
+            LolIRDefinitionStatement(ret, return_type, call),
+            LolIRReturnStatement(func.symbol_table[ret]),
+        ]
+
+    def _split_block(
+        self,
+        func: LolAnalysisFunction,
+        block: List[LolIRStatement],
+        scope: Dict[str, LolAnalysisVariable],
+    ):
+        # Definitions in this block are not visible after it.
+        scope = dict(scope)
+        for stmt in block:
+            var = get_defined_variable(stmt)
+            if var is not None:
+                scope[var.name] = var
+            if not isinstance(stmt, LolIRIfStatement):
+                continue
+            if stmt.hint == LolParserBranchHint.NONE:
+                if_cold = is_cold_block(stmt.if_body)
+                else_cold = is_cold_block(stmt.else_body)
+                if if_cold and not else_cold:
+                    stmt.hint = LolParserBranchHint.UNLIKELY
+                elif else_cold and not if_cold:
+                    stmt.hint = LolParserBranchHint.LIKELY
+
+            if stmt.hint == LolParserBranchHint.UNLIKELY:
+                cold_body, hot_body = stmt.if_body, stmt.else_body
+            elif stmt.hint == LolParserBranchHint.LIKELY:
+                cold_body, hot_body = stmt.else_body, stmt.if_body
+            else:
+                cold_body, hot_body = None, None
+
+            if cold_body is None:
+                self._split_block(func, stmt.if_body, scope)
+                self._split_block(func, stmt.else_body, scope)
+                continue
+            self._split_block(func, hot_body, scope)
+            if is_worth_outlining(cold_body):
+                call_block = self._outline(func, cold_body, scope)
+                if call_block is not None:
+                    cold_body[:] = call_block
+
+    def run(self):
+        functions = [
+            *self.module.module_symbol_table.values(),
+            *self.module.benchmarks.values(),
+        ]
+        for func in functions:
+            if isinstance(func, LolAnalysisFunction) and func.body is not None:
+                self._split_block(func, func.body, get_parameters(func))
+
+
+def outline_cold_blocks(module: LolAnalysisModule):
+    LolOutliner(module).run()
@@ -0,0 +1,190 @@
+"""
+Automatic parallelization (-fauto-parallel).
+
+Spawn a pure call when another expensive call can run while it does, e.g. in
+`fibonacci(n - 1) + fibonacci(n - 2)`, as if the programmer had written:
+
+```
+let a: i32 = spawn fibonacci(n - 1);
+let b: i32 = fibonacci(n - 2);
+sync;
+return a + b;
+```
+
+A function is pure if it only computes its result: it calls no impure
+functions and has no checked assertions (which may abort). C library
+functions are impure, since we cannot see what they do. Running a pure call
+on another worker cannot change what the program does, only when the result
+is ready.
+
+Spawning costs about as much as a few dozen statements, so we only spawn a
+call if the callee is recursive or its estimated cost is at least
+`AUTO_PARALLEL_MIN_COST`. The cost of a recursive function depends on its
+recursion depth, which we do not know; the runtime stops spawning once the
+other workers have enough work (see src/runtime/lol_task.h), which bounds the
+depth at which we spawn.
+"""
+from typing import Dict, List, Optional, Set
+
+from compiler.analyzer.lol_analyzer import (
+    LolAnalysisModule, LolAnalysisFunction,
+    LolIRStatement,
+    LolIRDefinitionStatement, LolIRFunctionCallStatement, LolIRIfStatement,
+    LolIRAssertStatement, LolIRSpawnStatement, LolIRSyncStatement,
+    LolIRFunctionCallExpression,
+)
+from compiler.optimizer.lol_outliner import walk_block, get_expression_variables
+from compiler.parser.lol_parser import LolParserAssertLevel
+
+# The estimated cost (in IR statements) above which a call is worth spawning.
+AUTO_PARALLEL_MIN_COST = 200
+# Calls to functions that we cannot see into (e.g. C library functions).
+LIBRARY_CALL_COST = 20
+RECURSIVE_COST = float("inf")
+
+
+def get_calls(func: LolAnalysisFunction) -> List[LolIRFunctionCallExpression]:
+    calls = []
+    for stmt in walk_block(func.body):
+        if isinstance(stmt, LolIRFunctionCallStatement):
+            calls.append(stmt.func_call)
+        elif isinstance(stmt, LolIRDefinitionStatement) and isinstance(stmt.value, LolIRFunctionCallExpression):
+            calls.append(stmt.value)
+        elif isinstance(stmt, LolIRSpawnStatement):
+            calls.append(stmt.call)
+    return calls
+
+
+def get_pure_functions(functions: List[LolAnalysisFunction]) -> Set[str]:
+    """Get the names of the pure functions, i.e. those with no side effects."""
+    # Assume that every Do function is pure (so that recursive functions may
+    # be), then rule out impure ones until nothing changes.
+    pure = {
+        func.name
+        for func in functions
+        if not any(
+            isinstance(stmt, LolIRAssertStatement) and stmt.level != LolParserAssertLevel.ASSUME
+            for stmt in walk_block(func.body)
+        )
+    }
+    changed = True
+    while changed:
+        changed = False
+        for func in functions:
+            if func.name in pure and any(call.function.name not in pure for call in get_calls(func)):
+                pure.remove(func.name)
+                changed = True
+    return pure
+
+
+def estimate_costs(functions: List[LolAnalysisFunction]) -> Dict[str, float]:
+    """Estimate how many statements a call to each function runs, assuming that
+    both sides of every if statement run."""
+    costs: Dict[str, float] = {}
+    visiting: Set[str] = set()
+    by_name = {func.name: func for func in functions}
+
+    def visit(func: LolAnalysisFunction) -> float:
+        if func.name in costs:
+            return costs[func.name]
+        if func.name in visiting:
+            # We are in a cycle of calls, so we cannot bound the cost
+            return RECURSIVE_COST
+        visiting.add(func.name)
+        cost: float = len(list(walk_block(func.body)))
+        for call in get_calls(func):
+            callee = by_name.get(call.function.name)
+            cost += LIBRARY_CALL_COST if callee is None else visit(callee)
+        visiting.remove(func.name)
+        costs[func.name] = cost
+        return cost
+
+    for func in functions:
+        visit(func)
+    return costs
+
+
+class LolParallelizer:
+    def __init__(self, module: LolAnalysisModule):
+        self.module = module
+        self.functions = [
+            func
+            for func in [
+                *module.module_symbol_table.values(),
+                *module.benchmarks.values(),
+            ]
+            if isinstance(func, LolAnalysisFunction) and func.body is not None
+        ]
+        self.pure_functions = get_pure_functions(self.functions)
+        self.costs = estimate_costs(self.functions)
+
+    def _get_spawnable_call(self, stmt: LolIRStatement) -> Optional[LolIRFunctionCallExpression]:
+        if not (
+            isinstance(stmt, LolIRDefinitionStatement)
+            and not stmt.mutable
+            and isinstance(stmt.value, LolIRFunctionCallExpression)
+        ):
+            return None
+        callee = stmt.value.function
+        if callee.name not in self.pure_functions:
+            return None
+        if self.costs.get(callee.name, 0) < AUTO_PARALLEL_MIN_COST:
+            return None
+        return stmt.value
+
+    def _get_window_end(self, block: List[LolIRStatement], start: int, name: str) -> int:
+        """Get the index of the first statement after `start` that must not
+        run before the call at `start` finishes."""
+        for i in range(start + 1, len(block)):
+            stmt = block[i]
+            # Anything but a definition might leave the block (or contains
+            # statements that might), so the call must be done by then.
+            if not isinstance(stmt, LolIRDefinitionStatement):
+                return i
+            if any(var.name == name for var in get_expression_variables(stmt.value)):
+                return i
+        return len(block)
+
+    def _parallelize_block(self, func: LolAnalysisFunction, block: List[LolIRStatement]):
+        for stmt in block:
+            if isinstance(stmt, LolIRIfStatement):
+                self._parallelize_block(func, stmt.if_body)
+                self._parallelize_block(func, stmt.else_body)
+
+        # The index of each call that we spawn, and of the statement before
+        # which it must be synced
+        sync_indices: Dict[int, int] = {}
+        for i, stmt in enumerate(block):
+            call = self._get_spawnable_call(stmt)
+            if call is None:
+                continue
+            end = self._get_window_end(block, i, stmt.name)
+            # Only spawn if there is another expensive call to make meanwhile
+            if not any(self._get_spawnable_call(block[j]) is not None for j in range(i + 1, end)):
+                continue
+            frame = f"LOLframe_{func.spawn_count}"
+            func.spawn_count += 1
+            block[i] = LolIRSpawnStatement(stmt.name, stmt.type, call, frame)
+            sync_indices[i] = end
+
+        # Where one task must be synced, sync every pending task. This keeps
+        # the syncs in the reverse of the spawn order, as lol_task_sync needs.
+        syncs: Dict[int, List[LolIRSpawnStatement]] = {}
+        pending: List[int] = []
+        for i in range(len(block) + 1):
+            if any(sync_indices[j] == i for j in pending):
+                syncs[i] = [block[j] for j in pending]
+                pending = []
+            if i in sync_indices:
+                pending.append(i)
+        # Insert from the back, so that the indices stay valid
+        for i in sorted(syncs, reverse=True):
+            block.insert(i, LolIRSyncStatement(syncs[i], bind_results=True))
+
+    def run(self):
+        for func in self.functions:
+            self._parallelize_block(func, func.body)
+
+
+def parallelize_pure_calls(module: LolAnalysisModule):
+    LolParallelizer(module).run()
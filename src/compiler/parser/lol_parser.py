@@ -34,12 +34,33 @@ class LolParserOperatorType(Enum):
     BINARY_INFIX = auto()
 
 
+@unique
+class LolParserAssertLevel(Enum):
+    # Checked unless the C code is compiled with NDEBUG
+    DEBUG = auto()
+    # Always checked
+    RELEASE = auto()
+    # Never checked; the C compiler may assume that it holds
+    ASSUME = auto()
+
+
+@unique
+class LolParserBranchHint(Enum):
+    # Let the compiler decide (the default)
+    NONE = auto()
+    # The if block is usually taken
+    LIKELY = auto()
+    # The if block is rarely taken, so it may be moved out of the hot path
+    UNLIKELY = auto()
+
+
 @unique
 class LolParserLiteralType(Enum):
     INTEGER = auto()
     BOOLEAN = auto()
     STRING = auto()
     FLOAT = auto()
+    NULL = auto()
 
 
 ################################################################################
@@ -53,7 +74,7 @@ LolParserExpression = Union[LolParserValueExpression, LolParserTypeExpression]
 @frozen_dataclass
 class LolParserLiteral(LolParserGeneric):
     type: LolParserLiteralType
-    value: Union[int, bool, float, str]
+    value: Union[int, bool, float, str, None]
 
     def to_dict(self):
         return dict(
@@ -112,6 +133,8 @@ class LolParserParameterDefinition(LolParserGeneric):
 class LolParserFunctionCall(LolParserGeneric):
     name: LolParserIdentifier
     arguments: List[LolParserExpression]
+    # For the source map of the emitted C (0 if unknown)
+    line_number: int = 0
 
     def get_name_as_str(self):
         return self.name.name
@@ -121,6 +144,7 @@ class LolParserFunctionCall(LolParserGeneric):
             metatype=self.__class__.__name__,
             name=self.name.to_dict(),
             arguments=[a.to_dict() for a in self.arguments],
+            line_number=self.line_number,
         )
 
 
@@ -129,6 +153,8 @@ class LolParserVariableDefinition(LolParserGeneric):
     name: LolParserIdentifier
     type: LolParserTypeExpression
     value: LolParserValueExpression
+    # Variables are immutable unless declared with `let mut`
+    mutable: bool = False
 
     def get_name_as_str(self) -> str:
         return self.name.name
@@ -139,6 +165,7 @@ class LolParserVariableDefinition(LolParserGeneric):
             name=self.name.to_dict(),
             type=self.type.to_dict(),
             value=self.value.to_dict(),
+            mutable=self.mutable,
         )
 
 
@@ -195,6 +222,17 @@ class LolParserFunctionDefinition(LolParserGeneric):
         )
 
 
+@frozen_dataclass
+class LolParserBenchDefinition(LolParserFunctionDefinition):
+    """
+    A benchmark is declared like a function, but with the `bench` keyword and
+    no parameters. The compiler collects them into a benchmark runner instead
+    of making them callable.
+
+    E.g. `bench fibonacci_20() -> i32 { return fibonacci(20); }`
+    """
+
+
 @frozen_dataclass
 class LolParserVariableModification(LolParserGeneric):
     name: LolParserIdentifier
@@ -208,12 +246,50 @@ class LolParserVariableModification(LolParserGeneric):
         )
 
 
+@frozen_dataclass
+class LolParserSpawnExpression(LolParserGeneric):
+    # The call may run in parallel with the rest of the function until the
+    # next `sync;`.
+    call: "LolParserFunctionCall"
+
+    def to_dict(self):
+        return dict(
+            metatype=self.__class__.__name__,
+            call=self.call.to_dict(),
+        )
+
+
+@frozen_dataclass
+class LolParserSyncStatement(LolParserGeneric):
+    def to_dict(self):
+        return dict(metatype=self.__class__.__name__)
+
+
+@frozen_dataclass
+class LolParserProbeStatement(LolParserGeneric):
+    """
+    A tracepoint that a tracer (e.g. bpftrace) may attach to while the program
+    runs. It is written like a call, but the name is the probe's, and the
+    arguments are what the tracer sees.
+
+    E.g. `probe request_done(id, status);`
+    """
+    call: "LolParserFunctionCall"
+
+    def to_dict(self):
+        return dict(
+            metatype=self.__class__.__name__,
+            call=self.call.to_dict(),
+        )
+
+
 @frozen_dataclass
 class LolParserIfStatement(LolParserGeneric):
     if_condition: LolParserValueExpression
     # NOTE These may only be inside a function.
     if_block: List[LolParserFunctionLevelStatement]
     else_block: List[LolParserFunctionLevelStatement]
+    hint: LolParserBranchHint = LolParserBranchHint.NONE
 
     def to_dict(self):
         return dict(
@@ -221,6 +297,7 @@ class LolParserIfStatement(LolParserGeneric):
             if_condition=self.if_condition.to_dict(),
             if_block=[s.to_dict() for s in self.if_block],
             else_block=[s.to_dict() for s in self.else_block],
+            hint=self.hint.name,
         )
 
 
@@ -243,6 +320,24 @@ class LolParserBreakStatement(LolParserGeneric):
         )
 
 
+@frozen_dataclass
+class LolParserAssertStatement(LolParserGeneric):
+    level: LolParserAssertLevel
+    condition: LolParserValueExpression
+    # For the failure message
+    line_number: int
+    condition_text: str
+
+    def to_dict(self):
+        return dict(
+            metatype=self.__class__.__name__,
+            level=self.level.name,
+            condition=self.condition.to_dict(),
+            line_number=self.line_number,
+            condition_text=self.condition_text,
+        )
+
+
 @frozen_dataclass
 class LolParserReturnStatement(LolParserGeneric):
     value: LolParserValueExpression
@@ -257,7 +352,7 @@ class LolParserReturnStatement(LolParserGeneric):
 ################################################################################
 ### PARSER
 ################################################################################
-LITERAL_TOKENS: Set[TokenType] = {TokenType.INTEGER, TokenType.STRING}
+LITERAL_TOKENS: Set[TokenType] = {TokenType.INTEGER, TokenType.STRING, TokenType.NULL}
 
 
 def eat_token(stream: TokenStream, expected_type: TokenType) -> Token:
@@ -284,6 +379,9 @@ class Parser:
         elif token.is_type(TokenType.INTEGER):
             lit_type = LolParserLiteralType.INTEGER
             lit_value = int(token.as_str())
+        elif token.is_type(TokenType.NULL):
+            lit_type = LolParserLiteralType.NULL
+            lit_value = None
         else:
             raise ValueError(f"unexpected token type: {repr(token)}")
         stream.next_token()
@@ -299,7 +397,7 @@ class Parser:
 
     @staticmethod
     def parse_func_call_args(
-        stream: TokenStream, func_identifier: LolParserIdentifier
+        stream: TokenStream, func_identifier: LolParserIdentifier, line_number: int = 0
     ) -> LolParserFunctionCall:
         eat_token(stream, TokenType.LPAREN)
         args: List[LolParserValueExpression] = []
@@ -307,7 +405,7 @@ class Parser:
         # Check if empty set of arguments
         if token.is_type(TokenType.RPAREN):
             eat_token(stream, TokenType.RPAREN)
-            return LolParserFunctionCall(func_identifier, args)
+            return LolParserFunctionCall(func_identifier, args, line_number)
         # At this point, we have at least one argument (or error)
         while True:
             expr = Parser.parse_value_expression(stream)
@@ -321,7 +419,7 @@ class Parser:
                 continue
             else:
                 raise ValueError("Expected COMMA or RPAREN")
-        return LolParserFunctionCall(func_identifier, args)
+        return LolParserFunctionCall(func_identifier, args, line_number)
 
     @staticmethod
     def parse_identifier_with_namespace_separator(
@@ -371,7 +469,9 @@ class Parser:
                 )
         token = stream.get_token()
         if token.is_type(TokenType.LPAREN):
-            return Parser.parse_func_call_args(stream, identifier_leaf)
+            line_and_column = id_token.get_line_and_column_numbers()
+            line_number = 0 if line_and_column is None else line_and_column[0]
+            return Parser.parse_func_call_args(stream, identifier_leaf, line_number)
         elif token.is_type(TokenType.LSQB):
             raise ValueError("accesses not supported yet... i.e. `x[100]`")
         else:
@@ -379,7 +479,22 @@ class Parser:
 
     @staticmethod
     def parse_if(stream: TokenStream) -> LolParserIfStatement:
+        """
+        Parse an if statement, with an optional branch hint in square brackets.
+
+        E.g. `if x == 0 {...}` or `if[unlikely] x == 0 {...}`
+        """
         eat_token(stream, TokenType.IF)
+        hint = LolParserBranchHint.NONE
+        if stream.get_token().is_type(TokenType.LSQB):
+            eat_token(stream, TokenType.LSQB)
+            hint_name = eat_token(stream, TokenType.IDENTIFIER).as_str()
+            if hint_name.upper() not in {"LIKELY", "UNLIKELY"}:
+                raise ValueError(
+                    f"unknown branch hint '{hint_name}', expected likely or unlikely"
+                )
+            hint = LolParserBranchHint[hint_name.upper()]
+            eat_token(stream, TokenType.RSQB)
         if_cond = Parser.parse_value_expression(stream)
         if_block = Parser.parse_block_body(stream)
         token = stream.get_token()
@@ -387,20 +502,89 @@ class Parser:
         if token.is_type(TokenType.ELSE):
             eat_token(stream, TokenType.ELSE)
             else_block = Parser.parse_block_body(stream)
-        return LolParserIfStatement(if_cond, if_block, else_block)
+        return LolParserIfStatement(if_cond, if_block, else_block, hint)
+
+    @staticmethod
+    def parse_assert(stream: TokenStream) -> LolParserAssertStatement:
+        """
+        Parse an assertion, with an optional level in square brackets.
+
+        E.g. `assert x > 0;` or `assert[assume] x > 0;`
+        """
+        assert_token = eat_token(stream, TokenType.ASSERT)
+        line_number, _ = assert_token.get_line_and_column_numbers()
+        level = LolParserAssertLevel.DEBUG
+        if stream.get_token().is_type(TokenType.LSQB):
+            eat_token(stream, TokenType.LSQB)
+            level_name = eat_token(stream, TokenType.IDENTIFIER).as_str()
+            if level_name.upper() not in LolParserAssertLevel.__members__:
+                raise ValueError(
+                    f"unknown assertion level '{level_name}', expected one of "
+                    f"{', '.join(x.lower() for x in LolParserAssertLevel.__members__)}"
+                )
+            level = LolParserAssertLevel[level_name.upper()]
+            eat_token(stream, TokenType.RSQB)
+        condition_start = stream.get_token().start_position
+        condition = Parser.parse_value_expression(stream)
+        condition_end = stream.get_token().start_position
+        eat_token(stream, TokenType.SEMICOLON)
+        condition_text = stream.get_text()[condition_start:condition_end].strip()
+        return LolParserAssertStatement(
+            level, condition, line_number, condition_text
+        )
+
+    @staticmethod
+    def parse_probe(stream: TokenStream) -> LolParserProbeStatement:
+        """E.g. `probe request_done(id, status);`"""
+        eat_token(stream, TokenType.PROBE)
+        id_token = eat_token(stream, TokenType.IDENTIFIER)
+        line_number, _ = id_token.get_line_and_column_numbers()
+        call = Parser.parse_func_call_args(
+            stream, LolParserIdentifier(id_token.as_str()), line_number
+        )
+        eat_token(stream, TokenType.SEMICOLON)
+        return LolParserProbeStatement(call)
 
     @staticmethod
     def parse_primary(stream: TokenStream) -> LolParserExpression:
         token = stream.get_token()
-        if token.is_type(TokenType.IDENTIFIER):
-            return Parser.parse_leading_identifier(stream)
+        if token.is_type(TokenType.SPAWN):
+            # E.g. `spawn f(x)`
+            eat_token(stream, TokenType.SPAWN)
+            call = Parser.parse_primary(stream)
+            if not isinstance(call, LolParserFunctionCall):
+                raise ValueError(f"expected a function call after spawn, got {call}")
+            return LolParserSpawnExpression(call)
+        elif token.is_type(TokenType.IDENTIFIER):
+            primary = Parser.parse_leading_identifier(stream)
         elif token.get_token_type() in LITERAL_TOKENS:
-            return Parser.parse_literal(stream)
+            primary = Parser.parse_literal(stream)
         elif token.is_type(TokenType.LPAREN):
-            return Parser.parse_parenthetic_expression(stream)
+            primary = Parser.parse_parenthetic_expression(stream)
         else:
             error_msg = f"unrecognized primary {token}"
             raise ValueError(error_msg)
+        return Parser.parse_postfix_operators(stream, primary)
+
+    @staticmethod
+    def parse_postfix_operators(
+        stream: TokenStream, operand: LolParserExpression
+    ) -> LolParserExpression:
+        """
+        Parse the error propagation operator, e.g. `parse(x)?`.
+
+        If the operand is an error (a negative i32), then the enclosing function
+        returns it; otherwise, the expression's value is the operand's value.
+        """
+        while True:
+            token = stream.get_token()
+            if token is not None and token.is_type(TokenType.QUESTION):
+                eat_token(stream, TokenType.QUESTION)
+                operand = LolParserOperatorExpression(
+                    "?", LolParserOperatorType.UNARY_POSTFIX, [operand]
+                )
+            else:
+                return operand
 
     @staticmethod
     # TODO(dchu): refactor this to make it smarter. Also move the hard-coded
@@ -495,10 +679,14 @@ class Parser:
 
     @staticmethod
     def parse_type_expression(stream: TokenStream) -> LolParserTypeExpression:
-        # We only support single-token type expressions for now
-        return LolParserIdentifier(
-            eat_token(stream, TokenType.IDENTIFIER).as_str()
-        )
+        # We only support single-token type expressions for now, plus a '?'
+        # suffix for optional references (e.g. `cstr?`). The optional type is
+        # a distinct type, so we look it up by its full name.
+        name = eat_token(stream, TokenType.IDENTIFIER).as_str()
+        if stream.get_token().is_type(TokenType.QUESTION):
+            eat_token(stream, TokenType.QUESTION)
+            name = f"{name}?"
+        return LolParserIdentifier(name)
 
     @staticmethod
     def parse_value_expression(stream: TokenStream) -> LolParserValueExpression:
@@ -517,12 +705,14 @@ class Parser:
         return LolParserParameterDefinition(identifier, param_type)
 
     @staticmethod
-    def parse_function_prototype(stream: TokenStream) -> Tuple[
+    def parse_function_prototype(
+        stream: TokenStream, keyword: TokenType = TokenType.FUNCTION
+    ) -> Tuple[
         LolParserIdentifier,
         List[LolParserParameterDefinition],
         LolParserTypeExpression
     ]:
-        _function = eat_token(stream, TokenType.FUNCTION)
+        _function = eat_token(stream, keyword)
         func_identifier = LolParserIdentifier(
             eat_token(stream, TokenType.IDENTIFIER).as_str()
         )
@@ -562,8 +752,22 @@ class Parser:
         # TODO(dchu): if, while, for loops
         elif token.is_type(TokenType.IF):
             return Parser.parse_if(stream)
+        elif token.is_type(TokenType.ASSERT):
+            return Parser.parse_assert(stream)
+        elif token.is_type(TokenType.SYNC):
+            eat_token(stream, TokenType.SYNC)
+            eat_token(stream, TokenType.SEMICOLON)
+            return LolParserSyncStatement()
+        elif token.is_type(TokenType.PROBE):
+            return Parser.parse_probe(stream)
         else:
             result = Parser.parse_value_expression(stream)
+            if isinstance(result, LolParserIdentifier) and stream.get_token().is_type(TokenType.EQUAL):
+                # E.g. `x = x + 1;`
+                eat_token(stream, TokenType.EQUAL)
+                value = Parser.parse_value_expression(stream)
+                eat_token(stream, TokenType.SEMICOLON)
+                return LolParserVariableModification(result, value)
             eat_token(stream, TokenType.SEMICOLON)
             return result
 
@@ -587,6 +791,20 @@ class Parser:
         end_pos = stream.get_pos()
         return LolParserFunctionDefinition(func_identifier, params, ret_type, func_body)
 
+    @staticmethod
+    def parse_bench_definition(stream: TokenStream):
+        func_identifier, params, ret_type = Parser.parse_function_prototype(
+            stream, TokenType.BENCH
+        )
+        if params:
+            raise ValueError(
+                f"bench {func_identifier.name} cannot take parameters"
+            )
+        func_body = Parser.parse_block_body(stream)
+        return LolParserBenchDefinition(
+            func_identifier, params, ret_type, func_body
+        )
+
     ############################################################################
     ### VARIABLE DEFINITION
     ############################################################################
@@ -596,6 +814,10 @@ class Parser:
     ):
         start_pos = stream.get_pos()
         _let = eat_token(stream, TokenType.LET)
+        mutable = False
+        if stream.get_token().is_type(TokenType.MUT):
+            eat_token(stream, TokenType.MUT)
+            mutable = True
         identifier = LolParserIdentifier(eat_token(stream, TokenType.IDENTIFIER).as_str())
         eat_token(stream, TokenType.COLON)
         data_type = Parser.parse_type_expression(stream)
@@ -603,7 +825,7 @@ class Parser:
         value = Parser.parse_value_expression(stream)
         eat_token(stream, TokenType.SEMICOLON)
         end_pos = stream.get_pos()
-        return LolParserVariableDefinition(identifier, data_type, value)
+        return LolParserVariableDefinition(identifier, data_type, value, mutable)
 
     ############################################################################
     ### IMPORT
@@ -640,6 +862,8 @@ class Parser:
         while token is not None:
             if token.is_type(TokenType.FUNCTION):
                 result.append(Parser.parse_function_definition(stream))
+            elif token.is_type(TokenType.BENCH):
+                result.append(Parser.parse_bench_definition(stream))
             elif token.is_type(TokenType.MODULE):
                 result.append(Parser.parse_import_module(stream))
             elif token.is_type(TokenType.LET):  # Global variable
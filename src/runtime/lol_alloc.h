@@ -0,0 +1,675 @@
+/*
+ * Memory Allocator
+ *
+ * The general-purpose allocator of the runtime: every runtime module
+ * allocates through `lol_alloc()`/`lol_free()`, and so should code that
+ * includes them. Do not mix these with malloc()/free().
+ *
+ * The default allocator is built for many threads:
+ *
+ * - Each thread has a heap with a list of pages per size class, so most
+ *   allocations and frees are a pop or a push on a thread-local free list,
+ *   with no locks or atomic operations.
+ * - Sizes are rounded up to one of `LOL_ALLOC_CLASS_COUNT` classes: multiples
+ *   of 16 bytes up to 128, then four classes per power of two up to
+ *   `LOL_ALLOC_MAX_SMALL` (at most 25% wasted). Larger blocks get their own
+ *   mapping.
+ * - A page (`LOL_ALLOC_PAGE_SIZE`, or a span of pages with room for at least
+ *   four blocks) holds blocks of one class, and belongs to a 2 MiB segment,
+ *   which is aligned so that we find a block's page by masking its address.
+ *   Segments are the size of a huge page, and we ask the kernel to back them
+ *   with huge pages, which saves TLB misses.
+ * - A block freed by a thread other than its page's owner is pushed onto the
+ *   page's remote-free queue with one atomic operation. The owner takes the
+ *   whole queue back when it runs out of blocks.
+ * - When a thread exits, its heap (with its pages) goes to the next thread
+ *   that starts allocating.
+ * - Once every block of a segment has been freed, the segment is unmapped,
+ *   unless its heap still takes new pages from it. Until then, its empty pages
+ *   stay with their size class, and are not returned to the kernel.
+ *
+ * Compile with `-DLOL_ALLOC_SYSTEM` to use malloc() instead, e.g. to compare
+ * them or to use a memory checker. The statistics and hooks work with either.
+ *
+ * N.B. the state is `static`, like the rest of the runtime, so each
+ * translation unit that includes this header has its own allocator.
+ */
+#ifndef LOL_ALLOC_H
+#define LOL_ALLOC_H
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef LOL_ALLOC_SYSTEM
+#include <malloc.h>
+#else
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#include "lol_hints.h"
+
+struct lol_alloc_stats {
+    size_t allocations;
+    size_t frees;
+    /* Frees by a thread other than the one that allocated the block. */
+    size_t remote_frees;
+    /* Usable sizes, i.e. after rounding up to the size class. */
+    size_t allocated_bytes;
+    size_t freed_bytes;
+    /* Memory that we got from the kernel. */
+    size_t mapped_bytes;
+};
+
+/* Called after every allocation and before every free, e.g. by the heap
+profiler (lol_heap_profile.h). Allocations made inside a hook do not call the
+hooks again. While an allocation's hook runs, `lol_alloc_hook_caller` is the
+return address in the function that called lol_alloc() (which is always
+inlined), so that the hook can find the call site in a stack trace. */
+struct lol_alloc_hooks {
+    void (*alloc)(void *pointer, size_t size);
+    void (*free)(void *pointer, size_t size);
+};
+
+static const struct lol_alloc_hooks *lol_alloc_hooks_current = NULL;
+static __thread int lol_alloc_in_hook = 0;
+static __thread void *lol_alloc_hook_caller = NULL;
+
+/* Install hooks (or remove them with NULL). The hooks must stay valid until
+they are removed. */
+static inline void lol_alloc_set_hooks(const struct lol_alloc_hooks *hooks) {
+    __atomic_store_n(&lol_alloc_hooks_current, hooks, __ATOMIC_RELEASE);
+}
+
+static LOL_COLD void lol_alloc_call_hook(
+    const struct lol_alloc_hooks *hooks,
+    int is_alloc,
+    void *pointer,
+    size_t size
+) {
+    if (lol_alloc_in_hook) {
+        return;
+    }
+    lol_alloc_in_hook = 1;
+    lol_alloc_hook_caller = __builtin_return_address(0);
+    if (is_alloc && hooks->alloc != NULL) {
+        hooks->alloc(pointer, size);
+    } else if (!is_alloc && hooks->free != NULL) {
+        hooks->free(pointer, size);
+    }
+    lol_alloc_in_hook = 0;
+}
+
+#define LOL_ALLOC_HOOK(is_alloc, pointer, size)                                 \
+    do {                                                                        \
+        const struct lol_alloc_hooks *lol_alloc_hooks_ =                        \
+            __atomic_load_n(&lol_alloc_hooks_current, __ATOMIC_ACQUIRE);        \
+        if (LOL_UNLIKELY(lol_alloc_hooks_ != NULL)) {                           \
+            lol_alloc_call_hook(lol_alloc_hooks_, (is_alloc), (pointer), (size)); \
+        }                                                                       \
+    } while (0)
+
+/* Add to a statistic that only the calling thread writes. */
+static inline void lol_alloc_count(size_t *counter, size_t n) {
+    __atomic_store_n(counter, __atomic_load_n(counter, __ATOMIC_RELAXED) + n, __ATOMIC_RELAXED);
+}
+
+#ifdef LOL_ALLOC_SYSTEM
+
+/******************************************************************************/
+/* SYSTEM ALLOCATOR                                                           */
+/******************************************************************************/
+
+static struct lol_alloc_stats lol_alloc_system_stats;
+
+static LOL_ALWAYS_INLINE void *lol_alloc(size_t size) {
+    void *pointer = malloc(size);
+
+    if (pointer != NULL) {
+        size_t usable = malloc_usable_size(pointer);
+
+        __atomic_add_fetch(&lol_alloc_system_stats.allocations, 1, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&lol_alloc_system_stats.allocated_bytes, usable, __ATOMIC_RELAXED);
+        LOL_ALLOC_HOOK(1, pointer, usable);
+    }
+    return pointer;
+}
+
+static inline void lol_free(void *pointer) {
+    size_t usable = 0;
+
+    if (pointer == NULL) {
+        return;
+    }
+    usable = malloc_usable_size(pointer);
+    LOL_ALLOC_HOOK(0, pointer, usable);
+    __atomic_add_fetch(&lol_alloc_system_stats.frees, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&lol_alloc_system_stats.freed_bytes, usable, __ATOMIC_RELAXED);
+    free(pointer);
+}
+
+static inline size_t lol_alloc_usable_size(void *pointer) {
+    return pointer == NULL ? 0 : malloc_usable_size(pointer);
+}
+
+static inline void lol_alloc_get_stats(struct lol_alloc_stats *stats) {
+    stats->allocations = __atomic_load_n(&lol_alloc_system_stats.allocations, __ATOMIC_RELAXED);
+    stats->frees = __atomic_load_n(&lol_alloc_system_stats.frees, __ATOMIC_RELAXED);
+    stats->remote_frees = 0;
+    stats->allocated_bytes = __atomic_load_n(&lol_alloc_system_stats.allocated_bytes, __ATOMIC_RELAXED);
+    stats->freed_bytes = __atomic_load_n(&lol_alloc_system_stats.freed_bytes, __ATOMIC_RELAXED);
+    stats->mapped_bytes = 0;
+}
+
+#else
+
+/******************************************************************************/
+/* SIZE CLASSES                                                               */
+/******************************************************************************/
+
+#define LOL_ALLOC_SEGMENT_SIZE ((size_t)2 << 20)
+#define LOL_ALLOC_PAGE_SIZE ((size_t)64 << 10)
+#define LOL_ALLOC_PAGES_PER_SEGMENT (LOL_ALLOC_SEGMENT_SIZE / LOL_ALLOC_PAGE_SIZE)
+#define LOL_ALLOC_MAX_SMALL ((size_t)256 << 10)
+#define LOL_ALLOC_CLASS_COUNT 52
+
+/* Get the size class of a block of `size` bytes (0 < size <= LOL_ALLOC_MAX_SMALL). */
+static inline unsigned lol_alloc_class(size_t size) {
+    size_t s = size - 1;
+    unsigned log2 = 0;
+
+    if (size <= 128) {
+        return (unsigned)(s / 16);
+    }
+    log2 = (unsigned)(8 * sizeof(unsigned long) - 1) - (unsigned)__builtin_clzl((unsigned long)s);
+    return 8 + (log2 - 7) * 4 + (unsigned)((s >> (log2 - 2)) & 3);
+}
+
+static inline size_t lol_alloc_class_size(unsigned size_class) {
+    unsigned log2 = 0;
+
+    if (size_class < 8) {
+        return 16 * (size_t)(size_class + 1);
+    }
+    log2 = 7 + (size_class - 8) / 4;
+    return ((size_t)1 << log2) + (size_t)((size_class - 8) % 4 + 1) * ((size_t)1 << (log2 - 2));
+}
+
+/******************************************************************************/
+/* SEGMENTS, PAGES AND HEAPS                                                  */
+/******************************************************************************/
+
+enum lol_alloc_segment_kind {
+    /* Pages of small blocks. Page 0 holds the segment's header. */
+    LOL_ALLOC_SMALL_SEGMENT,
+    /* One large block, right after the header. */
+    LOL_ALLOC_LARGE_SEGMENT
+};
+
+struct lol_alloc_heap;
+
+struct lol_alloc_page {
+    /* Owner only: free blocks, and never-used blocks in [bump, end). */
+    void *free;
+    char *bump;
+    char *end;
+    /* Blocks freed by other threads. */
+    void *remote_free;
+    size_t block_size;
+    /* Owner only: blocks handed out and not yet freed (or taken back). */
+    size_t used;
+    unsigned size_class;
+    /* The index of the first page of the span that this page is part of,
+    which holds the span's fields. */
+    unsigned first;
+    int is_full;
+    /* In the owner's list of available (or full) pages of the class. */
+    struct lol_alloc_page *prev;
+    struct lol_alloc_page *next;
+};
+
+struct lol_alloc_segment {
+    enum lol_alloc_segment_kind kind;
+    /* Large segments: the mapped size and the block's usable size. */
+    size_t mapped_size;
+    size_t block_size;
+    struct lol_alloc_heap *heap;
+    /* Small segments: the pages handed out so far, which must all be empty
+    before the segment can be unmapped. */
+    unsigned used_pages;
+    struct lol_alloc_page pages[LOL_ALLOC_PAGES_PER_SEGMENT];
+};
+
+/* Large blocks start here, which keeps them 64-byte aligned. */
+#define LOL_ALLOC_LARGE_OFFSET ((sizeof(struct lol_alloc_segment) + 63) / 64 * 64)
+
+struct lol_alloc_heap {
+    /* Pages that may have free blocks, and pages that had none left. */
+    struct lol_alloc_page *available[LOL_ALLOC_CLASS_COUNT];
+    struct lol_alloc_page *full[LOL_ALLOC_CLASS_COUNT];
+    /* The segment that new pages come from. */
+    struct lol_alloc_segment *segment;
+    /* Incremented by remote frees; tells the owner to look at full pages. */
+    size_t remote_pending;
+    struct lol_alloc_stats stats;
+    int in_use;
+    struct lol_alloc_heap *next;
+};
+
+static struct lol_alloc_heap *lol_alloc_heaps = NULL;
+static __thread struct lol_alloc_heap *lol_alloc_self = NULL;
+static pthread_key_t lol_alloc_key;
+static pthread_once_t lol_alloc_key_once = PTHREAD_ONCE_INIT;
+static size_t lol_alloc_mapped_bytes = 0;
+
+static inline struct lol_alloc_segment *lol_alloc_get_segment(const void *pointer) {
+    return (struct lol_alloc_segment *)((uintptr_t)pointer & ~(uintptr_t)(LOL_ALLOC_SEGMENT_SIZE - 1));
+}
+
+static inline struct lol_alloc_page *lol_alloc_get_page(
+    struct lol_alloc_segment *segment,
+    const void *pointer
+) {
+    struct lol_alloc_page *page =
+        &segment->pages[((uintptr_t)pointer - (uintptr_t)segment) / LOL_ALLOC_PAGE_SIZE];
+
+    return &segment->pages[page->first];
+}
+
+/* Get the number of pages in a span of blocks of a size class. */
+static inline unsigned lol_alloc_span_pages(unsigned size_class) {
+    return (unsigned)((4 * lol_alloc_class_size(size_class) + LOL_ALLOC_PAGE_SIZE - 1) / LOL_ALLOC_PAGE_SIZE);
+}
+
+/* Map `size` bytes (a multiple of the OS page size) aligned to a segment. */
+static LOL_COLD void *lol_alloc_map_segment(size_t size) {
+    size_t padded = size + LOL_ALLOC_SEGMENT_SIZE;
+    char *memory = mmap(NULL, padded, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    char *aligned = NULL;
+
+    if (memory == MAP_FAILED) {
+        return NULL;
+    }
+    aligned = (char *)(((uintptr_t)memory + LOL_ALLOC_SEGMENT_SIZE - 1)
+        & ~(uintptr_t)(LOL_ALLOC_SEGMENT_SIZE - 1));
+    if (aligned != memory) {
+        munmap(memory, (size_t)(aligned - memory));
+    }
+    munmap(aligned + size, (size_t)(memory + padded - (aligned + size)));
+#ifdef MADV_HUGEPAGE
+    if (size % LOL_ALLOC_SEGMENT_SIZE == 0) {
+        (void)madvise(aligned, size, MADV_HUGEPAGE);
+    }
+#endif
+    __atomic_add_fetch(&lol_alloc_mapped_bytes, size, __ATOMIC_RELAXED);
+    return aligned;
+}
+
+static void lol_alloc_release_heap(void *heap) {
+    lol_alloc_self = NULL;
+    __atomic_store_n(&((struct lol_alloc_heap *)heap)->in_use, 0, __ATOMIC_RELEASE);
+}
+
+static void lol_alloc_create_key(void) {
+    (void)pthread_key_create(&lol_alloc_key, lol_alloc_release_heap);
+}
+
+/* Get a heap for the calling thread, adopting one from an exited thread if
+we can. Return NULL if we are out of memory. */
+static LOL_COLD struct lol_alloc_heap *lol_alloc_register(void) {
+    struct lol_alloc_heap *heap = NULL;
+
+    pthread_once(&lol_alloc_key_once, lol_alloc_create_key);
+    for (heap = __atomic_load_n(&lol_alloc_heaps, __ATOMIC_ACQUIRE); heap != NULL; heap = heap->next) {
+        int expected = 0;
+
+        if (__atomic_compare_exchange_n(
+                &heap->in_use, &expected, 1, 0,
+                __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+            break;
+        }
+    }
+    if (heap == NULL) {
+        /* Heaps are never freed, so they may live in a segment's header
+        page... but that is 64 KiB; a mapping of its own is simpler. */
+        heap = mmap(NULL, sizeof *heap, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (heap == MAP_FAILED) {
+            return NULL;
+        }
+        heap->in_use = 1;
+        heap->next = __atomic_load_n(&lol_alloc_heaps, __ATOMIC_RELAXED);
+        while (!__atomic_compare_exchange_n(
+                &lol_alloc_heaps, &heap->next, heap, 1,
+                __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+        }
+    }
+    (void)pthread_setspecific(lol_alloc_key, heap);
+    lol_alloc_self = heap;
+    return heap;
+}
+
+static inline void lol_alloc_unlink(struct lol_alloc_page **list, struct lol_alloc_page *page) {
+    if (page->prev != NULL) {
+        page->prev->next = page->next;
+    } else {
+        *list = page->next;
+    }
+    if (page->next != NULL) {
+        page->next->prev = page->prev;
+    }
+    page->prev = page->next = NULL;
+}
+
+static inline void lol_alloc_push(struct lol_alloc_page **list, struct lol_alloc_page *page) {
+    page->prev = NULL;
+    page->next = *list;
+    if (*list != NULL) {
+        (*list)->prev = page;
+    }
+    *list = page;
+}
+
+/* Take back the blocks that other threads freed. Return whether there were
+any. */
+static inline int lol_alloc_collect_remote(struct lol_alloc_page *page) {
+    void *remote = NULL;
+    void *last = NULL;
+
+    if (__atomic_load_n(&page->remote_free, __ATOMIC_RELAXED) == NULL) {
+        return 0;
+    }
+    remote = __atomic_exchange_n(&page->remote_free, NULL, __ATOMIC_ACQUIRE);
+    for (last = remote; *(void **)last != NULL; last = *(void **)last) {
+        --page->used;
+    }
+    --page->used;
+    *(void **)last = page->free;
+    page->free = remote;
+    return 1;
+}
+
+/* Unmap a small segment if none of its blocks are in use and its heap does
+not take new pages from it. Return whether we did. */
+static LOL_COLD int lol_alloc_release_segment(
+    struct lol_alloc_heap *heap,
+    struct lol_alloc_segment *segment
+) {
+    struct lol_alloc_page *page = NULL;
+    unsigned i = 0;
+
+    if (segment == heap->segment) {
+        return 0;
+    }
+    /* Page 0 holds the header; the others start spans or belong to one. */
+    for (i = 1; i < segment->used_pages; ++i) {
+        if (segment->pages[i].first == i && segment->pages[i].used != 0) {
+            return 0;
+        }
+    }
+    for (i = 1; i < segment->used_pages; ++i) {
+        page = &segment->pages[i];
+        if (page->first == i) {
+            lol_alloc_unlink(
+                page->is_full ? &heap->full[page->size_class] : &heap->available[page->size_class],
+                page);
+        }
+    }
+    __atomic_sub_fetch(&lol_alloc_mapped_bytes, LOL_ALLOC_SEGMENT_SIZE, __ATOMIC_RELAXED);
+    munmap(segment, LOL_ALLOC_SEGMENT_SIZE);
+    return 1;
+}
+
+/* Get a fresh span for a size class, or NULL if we are out of memory. */
+static LOL_COLD struct lol_alloc_page *lol_alloc_new_page(struct lol_alloc_heap *heap, unsigned size_class) {
+    struct lol_alloc_segment *segment = heap->segment;
+    struct lol_alloc_page *page = NULL;
+    unsigned pages = lol_alloc_span_pages(size_class);
+    unsigned i = 0;
+    char *start = NULL;
+
+    if (segment == NULL || segment->used_pages + pages > LOL_ALLOC_PAGES_PER_SEGMENT) {
+        /* The rest of the old segment (if any) is too small: leave it. */
+        segment = lol_alloc_map_segment(LOL_ALLOC_SEGMENT_SIZE);
+        if (segment == NULL) {
+            return NULL;
+        }
+        segment->kind = LOL_ALLOC_SMALL_SEGMENT;
+        segment->heap = heap;
+        /* Page 0 holds this header. */
+        segment->used_pages = 1;
+        heap->segment = segment;
+    }
+    page = &segment->pages[segment->used_pages];
+    start = (char *)segment + segment->used_pages * LOL_ALLOC_PAGE_SIZE;
+    for (i = 0; i < pages; ++i) {
+        segment->pages[segment->used_pages + i].first = segment->used_pages;
+    }
+    segment->used_pages += pages;
+    page->free = NULL;
+    page->bump = start;
+    page->end = start + pages * LOL_ALLOC_PAGE_SIZE
+        / lol_alloc_class_size(size_class) * lol_alloc_class_size(size_class);
+    page->block_size = lol_alloc_class_size(size_class);
+    page->used = 0;
+    page->size_class = size_class;
+    page->is_full = 0;
+    lol_alloc_push(&heap->available[size_class], page);
+    return page;
+}
+
+/* Find a block of a size class when the first available page has no free
+blocks. */
+static LOL_COLD void *lol_alloc_small_slow(struct lol_alloc_heap *heap, unsigned size_class) {
+    struct lol_alloc_page *page = NULL;
+    unsigned c = 0;
+
+    /* Other threads freed blocks on pages that we had given up on. */
+    if (__atomic_load_n(&heap->remote_pending, __ATOMIC_RELAXED) != 0) {
+        struct lol_alloc_page *next = NULL;
+
+        __atomic_store_n(&heap->remote_pending, 0, __ATOMIC_RELAXED);
+        for (c = 0; c < LOL_ALLOC_CLASS_COUNT; ++c) {
+            for (page = heap->full[c]; page != NULL; page = next) {
+                next = page->next;
+                if (lol_alloc_collect_remote(page)) {
+                    lol_alloc_unlink(&heap->full[c], page);
+                    page->is_full = 0;
+                    lol_alloc_push(&heap->available[c], page);
+                    /* That may unmap `next` too: start over. */
+                    if (page->used == 0 && lol_alloc_release_segment(heap, lol_alloc_get_segment(page))) {
+                        next = heap->full[c];
+                    }
+                }
+            }
+        }
+    }
+    while ((page = heap->available[size_class]) != NULL) {
+        if (page->free == NULL && page->bump < page->end) {
+            page->free = page->bump;
+            *(void **)page->bump = NULL;
+            page->bump += page->block_size;
+        }
+        if (page->free != NULL || lol_alloc_collect_remote(page)) {
+            break;
+        }
+        /* Nothing left: set it aside until blocks are freed. */
+        lol_alloc_unlink(&heap->available[size_class], page);
+        page->is_full = 1;
+        lol_alloc_push(&heap->full[size_class], page);
+    }
+    if (page == NULL && (page = lol_alloc_new_page(heap, size_class)) == NULL) {
+        return NULL;
+    }
+    if (page->free == NULL) {
+        page->free = page->bump;
+        *(void **)page->bump = NULL;
+        page->bump += page->block_size;
+    }
+    return page->free;
+}
+
+static LOL_COLD void *lol_alloc_large(struct lol_alloc_heap *heap, size_t size) {
+    size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+    size_t mapped = (LOL_ALLOC_LARGE_OFFSET + size + page_size - 1) / page_size * page_size;
+    struct lol_alloc_segment *segment = NULL;
+
+    if (size > SIZE_MAX - LOL_ALLOC_LARGE_OFFSET - LOL_ALLOC_SEGMENT_SIZE
+            || (segment = lol_alloc_map_segment(mapped)) == NULL) {
+        return NULL;
+    }
+    segment->kind = LOL_ALLOC_LARGE_SEGMENT;
+    segment->mapped_size = mapped;
+    segment->block_size = mapped - LOL_ALLOC_LARGE_OFFSET;
+    segment->heap = heap;
+    return (char *)segment + LOL_ALLOC_LARGE_OFFSET;
+}
+
+/******************************************************************************/
+/* ALLOCATE AND FREE                                                          */
+/******************************************************************************/
+
+/* Return a block of at least `size` bytes, aligned to 16 bytes, or NULL if we
+are out of memory. */
+static LOL_ALWAYS_INLINE void *lol_alloc(size_t size) {
+    struct lol_alloc_heap *heap = lol_alloc_self;
+    struct lol_alloc_page *page = NULL;
+    void *block = NULL;
+    size_t usable = 0;
+
+    if (LOL_UNLIKELY(heap == NULL) && (heap = lol_alloc_register()) == NULL) {
+        return NULL;
+    }
+    if (LOL_UNLIKELY(size > LOL_ALLOC_MAX_SMALL)) {
+        block = lol_alloc_large(heap, size);
+        if (block == NULL) {
+            return NULL;
+        }
+        usable = lol_alloc_get_segment(block)->block_size;
+    } else {
+        unsigned size_class = lol_alloc_class(size == 0 ? 1 : size);
+
+        page = heap->available[size_class];
+        block = page != NULL ? page->free : NULL;
+        if (LOL_UNLIKELY(block == NULL)) {
+            block = lol_alloc_small_slow(heap, size_class);
+            if (block == NULL) {
+                return NULL;
+            }
+            page = heap->available[size_class];
+        }
+        page->free = *(void **)block;
+        ++page->used;
+        usable = page->block_size;
+    }
+    lol_alloc_count(&heap->stats.allocations, 1);
+    lol_alloc_count(&heap->stats.allocated_bytes, usable);
+    LOL_ALLOC_HOOK(1, block, usable);
+    return block;
+}
+
+static inline size_t lol_alloc_usable_size(void *pointer) {
+    struct lol_alloc_segment *segment = lol_alloc_get_segment(pointer);
+
+    if (pointer == NULL) {
+        return 0;
+    }
+    if (segment->kind == LOL_ALLOC_LARGE_SEGMENT) {
+        return segment->block_size;
+    }
+    return lol_alloc_get_page(segment, pointer)->block_size;
+}
+
+static inline void lol_free(void *pointer) {
+    struct lol_alloc_heap *heap = lol_alloc_self;
+    struct lol_alloc_segment *segment = lol_alloc_get_segment(pointer);
+    struct lol_alloc_page *page = NULL;
+    struct lol_alloc_heap *owner = NULL;
+    size_t usable = 0;
+
+    if (pointer == NULL) {
+        return;
+    }
+    if (LOL_UNLIKELY(heap == NULL)) {
+        heap = lol_alloc_register();
+    }
+    usable = lol_alloc_usable_size(pointer);
+    LOL_ALLOC_HOOK(0, pointer, usable);
+    if (heap != NULL) {
+        lol_alloc_count(&heap->stats.frees, 1);
+        lol_alloc_count(&heap->stats.freed_bytes, usable);
+    }
+    if (LOL_UNLIKELY(segment->kind == LOL_ALLOC_LARGE_SEGMENT)) {
+        __atomic_sub_fetch(&lol_alloc_mapped_bytes, segment->mapped_size, __ATOMIC_RELAXED);
+        munmap(segment, segment->mapped_size);
+        return;
+    }
+    page = lol_alloc_get_page(segment, pointer);
+    if (LOL_LIKELY(segment->heap == heap)) {
+        *(void **)pointer = page->free;
+        page->free = pointer;
+        if (LOL_UNLIKELY(page->is_full)) {
+            lol_alloc_unlink(&heap->full[page->size_class], page);
+            page->is_full = 0;
+            lol_alloc_push(&heap->available[page->size_class], page);
+        }
+        if (LOL_UNLIKELY(--page->used == 0)) {
+            (void)lol_alloc_release_segment(heap, segment);
+        }
+        return;
+    }
+    /* Another thread's page: hand the block back to its owner. Once it is
+    pushed, the owner may take it back and unmap the segment. */
+    owner = segment->heap;
+    *(void **)pointer = __atomic_load_n(&page->remote_free, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(
+            &page->remote_free, (void **)pointer, pointer, 1,
+            __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+    }
+    __atomic_add_fetch(&owner->remote_pending, 1, __ATOMIC_RELAXED);
+    if (heap != NULL) {
+        lol_alloc_count(&heap->stats.remote_frees, 1);
+    }
+}
+
+/* Sum the statistics of every thread. Each one is exact only while no other
+thread allocates. */
+static inline void lol_alloc_get_stats(struct lol_alloc_stats *stats) {
+    struct lol_alloc_heap *heap = NULL;
+    struct lol_alloc_stats total = { 0 };
+
+    for (heap = __atomic_load_n(&lol_alloc_heaps, __ATOMIC_ACQUIRE); heap != NULL; heap = heap->next) {
+        total.allocations += __atomic_load_n(&heap->stats.allocations, __ATOMIC_RELAXED);
+        total.frees += __atomic_load_n(&heap->stats.frees, __ATOMIC_RELAXED);
+        total.remote_frees += __atomic_load_n(&heap->stats.remote_frees, __ATOMIC_RELAXED);
+        total.allocated_bytes += __atomic_load_n(&heap->stats.allocated_bytes, __ATOMIC_RELAXED);
+        total.freed_bytes += __atomic_load_n(&heap->stats.freed_bytes, __ATOMIC_RELAXED);
+    }
+    total.mapped_bytes = __atomic_load_n(&lol_alloc_mapped_bytes, __ATOMIC_RELAXED);
+    *stats = total;
+}
+
+#endif /* LOL_ALLOC_SYSTEM */
+
+/* Like calloc(): return `count * size` zeroed bytes, or NULL if we are out of
+memory or the size overflows. */
+static LOL_ALWAYS_INLINE void *lol_calloc(size_t count, size_t size) {
+    void *pointer = NULL;
+
+    if (size != 0 && count > SIZE_MAX / size) {
+        return NULL;
+    }
+    pointer = lol_alloc(count * size);
+    if (pointer != NULL) {
+        memset(pointer, 0, count * size);
+    }
+    return pointer;
+}
+
+#endif /* LOL_ALLOC_H */
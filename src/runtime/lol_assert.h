@@ -0,0 +1,47 @@
+/*
+ * Assertions
+ *
+ * The emitted code for Do's `assert[level] condition;` statement. There are
+ * three levels:
+ *
+ * Level            | Checked                               | Hint
+ * :----------------|:--------------------------------------|:-----------------
+ * `debug` (default)| unless compiled with `NDEBUG`         | none
+ * `release`        | always                                | none
+ * `assume`         | only with `LOL_CHECK_ASSUMPTIONS`     | the compiler may assume the condition
+ *
+ * Checks branch to `lol_assert_fail()`, which is marked cold and never
+ * inlined, so the failure path is kept out of the hot code. Assumptions cost
+ * nothing at runtime; instead, they tell the C compiler (and Do's analyzer)
+ * facts that it may optimize on. If an assumption is false, the behaviour is
+ * undefined, so test with `-DLOL_CHECK_ASSUMPTIONS` first.
+ */
+#ifndef LOL_ASSERT_H
+#define LOL_ASSERT_H
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "lol_hints.h"
+
+static LOL_COLD LOL_NORETURN LOL_UNUSED void lol_assert_fail(
+    const char *message
+) {
+    fprintf(stderr, "Assertion failed: %s\n", message);
+    abort();
+}
+
+#define LOL_ASSERT(x, message)                                                  \
+    do {                                                                        \
+        if (LOL_UNLIKELY(!(x))) {                                               \
+            lol_assert_fail(message);                                           \
+        }                                                                       \
+    } while (0)
+
+#ifdef LOL_CHECK_ASSUMPTIONS
+#define LOL_ASSUME(x, message) LOL_ASSERT(x, message)
+#else
+#define LOL_ASSUME(x, message) LOL_ASSUME_HINT(x)
+#endif
+
+#endif /* LOL_ASSERT_H */
@@ -0,0 +1,404 @@
+/*
+ * Micro-Benchmark Runner
+ *
+ * The emitter collects every `bench` declaration in a Do module into a table
+ * of `struct lol_bench` and, when the emitted C is compiled with `-DLOL_BENCH`,
+ * replaces the program's `main()` with `lol_bench_main()`. For example:
+ *
+ * ```bash
+ * python src/compiler/lol.py -i examples/bench_fibonacci.lol -o results
+ * gcc -O2 -DLOL_BENCH -I src/runtime results/bench_fibonacci-*.c -o bench
+ * ./bench [name ...]
+ * ```
+ *
+ * For each benchmark (or only those named on the command line), the runner:
+ *
+ * 1. Warms up (caches, branch predictors, CPU frequency) for
+ *    `LOL_BENCH_WARMUP_NS`.
+ * 2. Calibrates the number of iterations per sample so that each sample takes
+ *    about `LOL_BENCH_SAMPLE_NS`, which keeps the clock's overhead and
+ *    resolution out of the measurement.
+ * 3. Times `LOL_BENCH_SAMPLES` samples with `clock_gettime(CLOCK_MONOTONIC)`.
+ * 4. Reports the median and the median absolute deviation (MAD) of the time
+ *    per iteration as JSON on `stdout`. Unlike the mean and the standard
+ *    deviation, these are robust to the occasional preempted sample.
+ *
+ * On Linux, the runner also reads hardware performance counters (cycles,
+ * instructions, cache misses, and branch misses) with `perf_event_open()`
+ * around each sample, and reports them per iteration next to the timings,
+ * along with the instructions per cycle (IPC). Counters that cannot be opened
+ * (e.g. in a container, in a VM without a virtual PMU, or when
+ * `/proc/sys/kernel/perf_event_paranoid` forbids it) are reported as `null`.
+ * Define `LOL_BENCH_NO_COUNTERS` to skip them altogether.
+ *
+ * Every result is passed through `LOL_BENCH_DO_NOT_OPTIMIZE()`, so the C
+ * compiler cannot delete the computation as dead code.
+ */
+#ifndef LOL_BENCH_H
+#define LOL_BENCH_H
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#if defined(__linux__) && !defined(LOL_BENCH_NO_COUNTERS)
+#define LOL_BENCH_HAVE_COUNTERS 1
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#else
+#define LOL_BENCH_HAVE_COUNTERS 0
+#endif
+
+#include "lol_sort.h"
+
+#ifndef LOL_BENCH_WARMUP_NS
+#define LOL_BENCH_WARMUP_NS 100000000ULL /* 100 ms */
+#endif
+#ifndef LOL_BENCH_SAMPLE_NS
+#define LOL_BENCH_SAMPLE_NS 10000000ULL /* 10 ms */
+#endif
+#ifndef LOL_BENCH_SAMPLES
+#define LOL_BENCH_SAMPLES 31
+#endif
+
+/* Force `x` to be computed (into a register or memory) and assume that the
+barrier reads and writes all memory. This is the optimization barrier that
+keeps benchmark results from being eliminated as dead code. */
+#define LOL_BENCH_DO_NOT_OPTIMIZE(x) __asm__ __volatile__("" : : "r,m"(x) : "memory")
+
+/* The benchmark bodies must not be inlined into (or have their results
+hoisted out of) the timing loop. GCC's `noipa` also stops it from inferring
+that the body is a pure function of no arguments. */
+#if defined(__has_attribute)
+#if __has_attribute(noipa)
+#define LOL_BENCH_NOINLINE __attribute__((noipa))
+#endif
+#endif
+#ifndef LOL_BENCH_NOINLINE
+#define LOL_BENCH_NOINLINE __attribute__((noinline))
+#endif
+
+struct lol_bench {
+    const char *name;
+    /* Run the benchmark body `iterations` times. */
+    void (*run)(uint64_t iterations);
+};
+
+enum lol_bench_counter {
+    LOL_BENCH_CYCLES,
+    LOL_BENCH_INSTRUCTIONS,
+    LOL_BENCH_CACHE_MISSES,
+    LOL_BENCH_BRANCH_MISSES,
+    LOL_BENCH_NUM_COUNTERS,
+};
+
+static const char *const lol_bench_counter_names[LOL_BENCH_NUM_COUNTERS] = {
+    "cycles",
+    "instructions",
+    "cache_misses",
+    "branch_misses",
+};
+
+struct lol_bench_counters {
+    /* File descriptor of each counter, or -1 if it is unavailable. The first
+    available counter leads the group, so all are scheduled together. */
+    int fds[LOL_BENCH_NUM_COUNTERS];
+    int leader;
+    /* Sum over all samples, scaled up if the kernel multiplexed the PMU. */
+    double totals[LOL_BENCH_NUM_COUNTERS];
+};
+
+struct lol_bench_result {
+    uint64_t iterations;
+    double median_ns;
+    double mad_ns;
+    double min_ns;
+    double max_ns;
+    /* Per iteration; only meaningful where `has_counter` is set. */
+    double counters[LOL_BENCH_NUM_COUNTERS];
+    int has_counter[LOL_BENCH_NUM_COUNTERS];
+};
+
+#define lol_bench_less_double(a, b) (*(a) < *(b))
+LOL_SORT_DEFINE(lol_bench_double, double, lol_bench_less_double)
+
+static inline uint64_t lol_bench_now_ns(void) {
+    struct timespec ts = { 0 };
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static inline uint64_t lol_bench_time_ns(
+    const struct lol_bench *bench,
+    uint64_t iterations
+) {
+    uint64_t start = lol_bench_now_ns();
+    bench->run(iterations);
+    return lol_bench_now_ns() - start;
+}
+
+/******************************************************************************/
+/* HARDWARE PERFORMANCE COUNTERS                                              */
+/******************************************************************************/
+
+static inline void lol_bench_counters_open(struct lol_bench_counters *c) {
+    int i = 0;
+
+    memset(c, 0, sizeof *c);
+    c->leader = -1;
+    for (i = 0; i < LOL_BENCH_NUM_COUNTERS; ++i) {
+        c->fds[i] = -1;
+    }
+#if LOL_BENCH_HAVE_COUNTERS
+    {
+        static const uint64_t configs[LOL_BENCH_NUM_COUNTERS] = {
+            PERF_COUNT_HW_CPU_CYCLES,
+            PERF_COUNT_HW_INSTRUCTIONS,
+            PERF_COUNT_HW_CACHE_MISSES,
+            PERF_COUNT_HW_BRANCH_MISSES,
+        };
+        for (i = 0; i < LOL_BENCH_NUM_COUNTERS; ++i) {
+            struct perf_event_attr attr;
+            memset(&attr, 0, sizeof attr);
+            attr.size = sizeof attr;
+            attr.type = PERF_TYPE_HARDWARE;
+            attr.config = configs[i];
+            /* The members follow the leader, which starts disabled. */
+            attr.disabled = c->leader == -1;
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            attr.read_format =
+                PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+            c->fds[i] = (int)syscall(
+                __NR_perf_event_open, &attr, 0, -1, c->leader, 0
+            );
+            if (c->fds[i] < 0) {
+                /* Unavailable: carry on without this counter. */
+                c->fds[i] = -1;
+            } else if (c->leader == -1) {
+                c->leader = c->fds[i];
+            }
+        }
+    }
+#endif
+}
+
+static inline void lol_bench_counters_close(struct lol_bench_counters *c) {
+#if LOL_BENCH_HAVE_COUNTERS
+    int i = 0;
+    for (i = 0; i < LOL_BENCH_NUM_COUNTERS; ++i) {
+        if (c->fds[i] != -1) {
+            close(c->fds[i]);
+            c->fds[i] = -1;
+        }
+    }
+    c->leader = -1;
+#else
+    (void)c;
+#endif
+}
+
+static inline void lol_bench_counters_start(struct lol_bench_counters *c) {
+#if LOL_BENCH_HAVE_COUNTERS
+    if (c->leader != -1) {
+        ioctl(c->leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+        ioctl(c->leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    }
+#else
+    (void)c;
+#endif
+}
+
+static inline void lol_bench_counters_stop(struct lol_bench_counters *c) {
+#if LOL_BENCH_HAVE_COUNTERS
+    int i = 0;
+
+    if (c->leader == -1) {
+        return;
+    }
+    ioctl(c->leader, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+    for (i = 0; i < LOL_BENCH_NUM_COUNTERS; ++i) {
+        /* value, time enabled, time running */
+        uint64_t data[3] = { 0 };
+        if (c->fds[i] == -1) {
+            continue;
+        }
+        if (read(c->fds[i], data, sizeof data) != (ssize_t)sizeof data) {
+            continue;
+        }
+        if (data[2] != 0) {
+            c->totals[i] += (double)data[0] * (double)data[1] / (double)data[2];
+        }
+    }
+#else
+    (void)c;
+#endif
+}
+
+/* Find the number of iterations that takes about LOL_BENCH_SAMPLE_NS. */
+static inline uint64_t lol_bench_calibrate(const struct lol_bench *bench) {
+    uint64_t iterations = 1;
+
+    while (1) {
+        uint64_t elapsed = lol_bench_time_ns(bench, iterations);
+        if (elapsed >= LOL_BENCH_SAMPLE_NS / 10) {
+            /* Long enough to extrapolate from. */
+            double per_iteration = (double)elapsed / (double)iterations;
+            double target = (double)LOL_BENCH_SAMPLE_NS / per_iteration;
+            return target < 1.0 ? 1 : (uint64_t)target;
+        }
+        if (iterations > UINT64_MAX / 10) {
+            return iterations;
+        }
+        iterations *= 10;
+    }
+}
+
+static inline double lol_bench_median(double *sorted, size_t n) {
+    if (n % 2 == 1) {
+        return sorted[n / 2];
+    }
+    return (sorted[n / 2 - 1] + sorted[n / 2]) / 2.0;
+}
+
+static inline struct lol_bench_result lol_bench_measure(
+    const struct lol_bench *bench
+) {
+    struct lol_bench_result result = { 0 };
+    struct lol_bench_counters counters = { 0 };
+    double samples[LOL_BENCH_SAMPLES] = { 0 };
+    double deviations[LOL_BENCH_SAMPLES] = { 0 };
+    uint64_t warmup_start = lol_bench_now_ns();
+    size_t i = 0;
+
+    while (lol_bench_now_ns() - warmup_start < LOL_BENCH_WARMUP_NS) {
+        bench->run(1);
+    }
+    result.iterations = lol_bench_calibrate(bench);
+
+    lol_bench_counters_open(&counters);
+    for (i = 0; i < LOL_BENCH_SAMPLES; ++i) {
+        uint64_t elapsed = 0;
+        /* The ioctl() calls stay outside of the timed region. */
+        lol_bench_counters_start(&counters);
+        elapsed = lol_bench_time_ns(bench, result.iterations);
+        lol_bench_counters_stop(&counters);
+        samples[i] = (double)elapsed / (double)result.iterations;
+    }
+    for (i = 0; i < LOL_BENCH_NUM_COUNTERS; ++i) {
+        result.has_counter[i] = counters.fds[i] != -1;
+        result.counters[i] = counters.totals[i]
+            / ((double)result.iterations * LOL_BENCH_SAMPLES);
+    }
+    lol_bench_counters_close(&counters);
+
+    lol_bench_double_sort_unstable(samples, LOL_BENCH_SAMPLES);
+    result.median_ns = lol_bench_median(samples, LOL_BENCH_SAMPLES);
+    result.min_ns = samples[0];
+    result.max_ns = samples[LOL_BENCH_SAMPLES - 1];
+    for (i = 0; i < LOL_BENCH_SAMPLES; ++i) {
+        double d = samples[i] - result.median_ns;
+        deviations[i] = d < 0.0 ? -d : d;
+    }
+    lol_bench_double_sort_unstable(deviations, LOL_BENCH_SAMPLES);
+    result.mad_ns = lol_bench_median(deviations, LOL_BENCH_SAMPLES);
+    return result;
+}
+
+static inline int lol_bench_is_selected(
+    const char *name,
+    int argc,
+    char **argv
+) {
+    int i = 0;
+
+    if (argc <= 1) {
+        return 1;
+    }
+    for (i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], name) == 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static inline void lol_bench_print_result(
+    const struct lol_bench *bench,
+    const struct lol_bench_result *result
+) {
+    int i = 0;
+
+    /* Benchmark names are Do identifiers, so they need no JSON escaping. */
+    printf(
+        "    {\"name\": \"%s\", \"iterations\": %llu, \"samples\": %d, "
+        "\"median_ns\": %.3f, \"mad_ns\": %.3f, "
+        "\"min_ns\": %.3f, \"max_ns\": %.3f",
+        bench->name,
+        (unsigned long long)result->iterations,
+        LOL_BENCH_SAMPLES,
+        result->median_ns,
+        result->mad_ns,
+        result->min_ns,
+        result->max_ns
+    );
+    for (i = 0; i < LOL_BENCH_NUM_COUNTERS; ++i) {
+        if (result->has_counter[i]) {
+            printf(
+                ", \"%s_per_iter\": %.3f",
+                lol_bench_counter_names[i],
+                result->counters[i]
+            );
+        } else {
+            printf(", \"%s_per_iter\": null", lol_bench_counter_names[i]);
+        }
+    }
+    if (result->has_counter[LOL_BENCH_CYCLES]
+        && result->has_counter[LOL_BENCH_INSTRUCTIONS]
+        && result->counters[LOL_BENCH_CYCLES] > 0.0) {
+        printf(
+            ", \"ipc\": %.3f}",
+            result->counters[LOL_BENCH_INSTRUCTIONS]
+                / result->counters[LOL_BENCH_CYCLES]
+        );
+    } else {
+        printf(", \"ipc\": null}");
+    }
+}
+
+static inline int lol_bench_main(
+    const struct lol_bench *benches,
+    size_t n,
+    int argc,
+    char **argv
+) {
+    size_t i = 0;
+    int first = 1;
+
+    printf("{\"benchmarks\": [\n");
+    for (i = 0; i < n; ++i) {
+        struct lol_bench_result result = { 0 };
+        if (!lol_bench_is_selected(benches[i].name, argc, argv)) {
+            continue;
+        }
+        result = lol_bench_measure(&benches[i]);
+        if (!first) {
+            printf(",\n");
+        }
+        lol_bench_print_result(&benches[i], &result);
+        fflush(stdout);
+        first = 0;
+    }
+    printf("\n]}\n");
+    return 0;
+}
+
+#endif /* LOL_BENCH_H */
@@ -0,0 +1,486 @@
+/*
+ * Concurrent Hash Map
+ *
+ * A hash map that many threads may read and write at once, monomorphized per
+ * key and value type like `lol_sort.h`:
+ *
+ * ```c
+ * static inline uint64_t hash_int(const int *key) { return lol_cmap_hash_u64((uint64_t)*key); }
+ * #define equal_int(a, b) (*(a) == *(b))
+ * LOL_CMAP_DEFINE(int_cache, int, double, hash_int, equal_int)
+ *
+ * struct int_cache cache;
+ * int_cache_init(&cache, 1024);
+ * int_cache_put(&cache, &key, &value);          // from any thread
+ * if (int_cache_get(&cache, &key, &value)) ...  // from any thread
+ * ```
+ *
+ * The generated functions are:
+ *
+ * Function                                                       | Description
+ * :--------------------------------------------------------------|:-----------------------------
+ * `int prefix_init(struct prefix *map, size_t capacity)`          | returns 0 or `ENOMEM`.
+ * `void prefix_destroy(struct prefix *map)`                       | only once no other thread uses the map.
+ * `int prefix_get(struct prefix *map, const key_type *key, value_type *value)` | returns non-zero and copies the value out if the key is present.
+ * `int prefix_put(struct prefix *map, const key_type *key, const value_type *value)` | inserts or replaces. Returns 0 or `ENOMEM`.
+ * `int prefix_remove(struct prefix *map, const key_type *key)`    | returns non-zero if the key was present.
+ * `size_t prefix_size(struct prefix *map)`                        | the number of entries, exact only while no one writes.
+ *
+ * Design:
+ *
+ * - Each bucket is a singly-linked list of immutable nodes. Reads take no
+ *   locks and write nothing shared; they only follow pointers inside an epoch
+ *   region (see lol_epoch.h), so a node unlinked by a writer stays valid
+ *   until the readers are done with it.
+ * - Writers lock one bucket (a bit in its head pointer). Replacing a value
+ *   swaps in a new node, so readers never see a half-written value.
+ * - The entry count is split over `LOL_CMAP_COUNTERS` cache lines, so that
+ *   inserts on different buckets do not contend on one counter.
+ * - When the table gets too full, a writer allocates a table twice the size.
+ *   From then on, every write moves `LOL_CMAP_MIGRATE_STEP` buckets into the
+ *   new table. A moved bucket is marked, and anyone who finds the mark looks
+ *   in the new table instead. Nobody waits for the whole table to move.
+ */
+#ifndef LOL_CMAP_H
+#define LOL_CMAP_H
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <errno.h>
+#include <sched.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "lol_alloc.h"
+#include "lol_epoch.h"
+#include "lol_hints.h"
+
+/* Buckets moved per write while resizing. */
+#define LOL_CMAP_MIGRATE_STEP 4
+/* Must be a power of two. */
+#define LOL_CMAP_COUNTERS 16
+/* Resize when there are more than 3/4 as many entries as buckets. */
+#define LOL_CMAP_LOAD_NUMERATOR 3
+#define LOL_CMAP_LOAD_DENOMINATOR 4
+
+/* A bucket's head is a node pointer, possibly with the lock bit set, or
+LOL_CMAP_MOVED once the bucket has been moved to the next table. */
+#define LOL_CMAP_LOCKED ((uintptr_t)1)
+#define LOL_CMAP_MOVED ((uintptr_t)2)
+
+struct lol_cmap_counter {
+    size_t value;
+    char padding[64 - sizeof(size_t)];
+};
+
+/* Mix the bits of an integer key (the finalizer of MurmurHash3). */
+static inline uint64_t lol_cmap_hash_u64(uint64_t x) {
+    x ^= x >> 33;
+    x *= UINT64_C(0xFF51AFD7ED558CCD);
+    x ^= x >> 33;
+    x *= UINT64_C(0xC4CEB9FE1A85EC53);
+    x ^= x >> 33;
+    return x;
+}
+
+/* Lock a bucket and return its head, or return LOL_CMAP_MOVED (without
+locking) if it has been moved. */
+static inline uintptr_t lol_cmap_lock_bucket(uintptr_t *bucket) {
+    unsigned spins = 0;
+
+    for (;;) {
+        uintptr_t head = __atomic_load_n(bucket, __ATOMIC_RELAXED);
+
+        if (head == LOL_CMAP_MOVED) {
+            return LOL_CMAP_MOVED;
+        }
+        if (!(head & LOL_CMAP_LOCKED) && __atomic_compare_exchange_n(
+                bucket, &head, head | LOL_CMAP_LOCKED, 1,
+                __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+            return head;
+        }
+        if (++spins % 64 == 0) {
+            sched_yield();
+        }
+    }
+}
+
+/* Publish a bucket's new head and unlock it. */
+static inline void lol_cmap_unlock_bucket(uintptr_t *bucket, uintptr_t head) {
+    __atomic_store_n(bucket, head, __ATOMIC_RELEASE);
+}
+
+#define LOL_CMAP_DEFINE(prefix, key_type, value_type, hash, equal)              \
+                                                                                \
+struct prefix##_node {                                                          \
+    key_type key;                                                               \
+    value_type value;                                                           \
+    uint64_t hash;                                                              \
+    struct prefix##_node *next;                                                 \
+};                                                                              \
+                                                                                \
+struct prefix##_table {                                                         \
+    size_t mask;                                                                \
+    uintptr_t *buckets;                                                         \
+    /* The table that buckets are being moved to, or NULL. */                   \
+    struct prefix##_table *next;                                                \
+    /* The next bucket to move, and how many have been moved. */                \
+    size_t cursor;                                                              \
+    size_t moved;                                                               \
+    /* Whether moving a bucket failed for lack of memory. */                    \
+    int failed;                                                                 \
+};                                                                              \
+                                                                                \
+struct prefix {                                                                 \
+    struct prefix##_table *table;                                               \
+    struct lol_cmap_counter counts[LOL_CMAP_COUNTERS];                          \
+};                                                                              \
+                                                                                \
+static inline struct prefix##_table *prefix##_new_table(size_t size) {          \
+    struct prefix##_table *table = lol_calloc(1, sizeof *table);                \
+                                                                                \
+    if (table == NULL) {                                                        \
+        return NULL;                                                            \
+    }                                                                           \
+    table->buckets = lol_calloc(size, sizeof *table->buckets);                  \
+    if (table->buckets == NULL) {                                               \
+        lol_free(table);                                                        \
+        return NULL;                                                            \
+    }                                                                           \
+    table->mask = size - 1;                                                     \
+    return table;                                                               \
+}                                                                               \
+                                                                                \
+static void prefix##_free_table(void *pointer) {                                \
+    struct prefix##_table *table = pointer;                                     \
+                                                                                \
+    lol_free(table->buckets);                                                   \
+    lol_free(table);                                                            \
+}                                                                               \
+                                                                                \
+static inline int prefix##_init(struct prefix *map, size_t capacity) {          \
+    size_t size = 16;                                                           \
+    size_t i = 0;                                                               \
+                                                                                \
+    while (size * LOL_CMAP_LOAD_NUMERATOR / LOL_CMAP_LOAD_DENOMINATOR < capacity) { \
+        size *= 2;                                                              \
+    }                                                                           \
+    map->table = prefix##_new_table(size);                                      \
+    for (i = 0; i < LOL_CMAP_COUNTERS; ++i) {                                   \
+        map->counts[i].value = 0;                                               \
+    }                                                                           \
+    return map->table == NULL ? ENOMEM : 0;                                     \
+}                                                                               \
+                                                                                \
+static inline void prefix##_free_chain(uintptr_t head) {                        \
+    struct prefix##_node *node = (struct prefix##_node *)(head & ~LOL_CMAP_LOCKED); \
+                                                                                \
+    if (head == LOL_CMAP_MOVED) {                                               \
+        return;                                                                 \
+    }                                                                           \
+    while (node != NULL) {                                                      \
+        struct prefix##_node *next = node->next;                                \
+                                                                                \
+        lol_free(node);                                                         \
+        node = next;                                                            \
+    }                                                                           \
+}                                                                               \
+                                                                                \
+static inline void prefix##_destroy(struct prefix *map) {                       \
+    struct prefix##_table *table = map->table;                                  \
+                                                                                \
+    while (table != NULL) {                                                     \
+        struct prefix##_table *next = table->next;                              \
+        size_t i = 0;                                                           \
+                                                                                \
+        for (i = 0; i <= table->mask; ++i) {                                    \
+            prefix##_free_chain(table->buckets[i]);                             \
+        }                                                                       \
+        prefix##_free_table(table);                                             \
+        table = next;                                                           \
+    }                                                                           \
+    map->table = NULL;                                                          \
+}                                                                               \
+                                                                                \
+static inline size_t prefix##_size(struct prefix *map) {                        \
+    size_t size = 0;                                                            \
+    size_t i = 0;                                                               \
+                                                                                \
+    for (i = 0; i < LOL_CMAP_COUNTERS; ++i) {                                   \
+        size += __atomic_load_n(&map->counts[i].value, __ATOMIC_RELAXED);       \
+    }                                                                           \
+    return size;                                                                \
+}                                                                               \
+                                                                                \
+static inline int prefix##_get(                                                 \
+    struct prefix *map,                                                         \
+    const key_type *key,                                                        \
+    value_type *value                                                           \
+) {                                                                             \
+    uint64_t h = hash(key);                                                     \
+    struct prefix##_table *table = NULL;                                        \
+    int found = 0;                                                              \
+                                                                                \
+    lol_epoch_enter();                                                          \
+    table = __atomic_load_n(&map->table, __ATOMIC_ACQUIRE);                     \
+    for (;;) {                                                                  \
+        uintptr_t head = __atomic_load_n(&table->buckets[h & table->mask], __ATOMIC_ACQUIRE); \
+        struct prefix##_node *node = NULL;                                      \
+                                                                                \
+        if (head == LOL_CMAP_MOVED) {                                           \
+            table = __atomic_load_n(&table->next, __ATOMIC_ACQUIRE);            \
+            continue;                                                           \
+        }                                                                       \
+        node = (struct prefix##_node *)(head & ~LOL_CMAP_LOCKED);               \
+        for (; node != NULL; node = __atomic_load_n(&node->next, __ATOMIC_ACQUIRE)) { \
+            if (node->hash == h && equal(&node->key, key)) {                    \
+                *value = node->value;                                           \
+                found = 1;                                                      \
+                break;                                                          \
+            }                                                                   \
+        }                                                                       \
+        break;                                                                  \
+    }                                                                           \
+    lol_epoch_exit();                                                           \
+    return found;                                                               \
+}                                                                               \
+                                                                                \
+/* Move bucket `i` of `table` to the next table. Return 1 if we moved it, 0 if \
+it had already been moved, or -1 if we ran out of memory (it stays put). */    \
+static inline int prefix##_move_bucket(struct prefix##_table *table, size_t i) { \
+    struct prefix##_table *next = __atomic_load_n(&table->next, __ATOMIC_ACQUIRE); \
+    uintptr_t head = lol_cmap_lock_bucket(&table->buckets[i]);                  \
+    struct prefix##_node *node = NULL;                                          \
+    struct prefix##_node *copies = NULL;                                        \
+                                                                                \
+    if (head == LOL_CMAP_MOVED) {                                               \
+        return 0;                                                               \
+    }                                                                           \
+    /* Copy first: readers may still be walking the old chain, so its nodes    \
+    must keep their links until they are retired. */                          \
+    for (node = (struct prefix##_node *)head; node != NULL; node = node->next) { \
+        struct prefix##_node *copy = lol_alloc(sizeof *copy);                   \
+                                                                                \
+        if (copy == NULL) {                                                     \
+            prefix##_free_chain((uintptr_t)copies);                             \
+            lol_cmap_unlock_bucket(&table->buckets[i], head);                   \
+            return -1;                                                          \
+        }                                                                       \
+        *copy = *node;                                                          \
+        copy->next = copies;                                                    \
+        copies = copy;                                                          \
+    }                                                                           \
+    while (copies != NULL) {                                                    \
+        struct prefix##_node *copy = copies;                                    \
+        uintptr_t *bucket = &next->buckets[copy->hash & next->mask];            \
+                                                                                \
+        copies = copies->next;                                                  \
+        /* The new bucket is only moved once this table is done. */            \
+        copy->next = (struct prefix##_node *)lol_cmap_lock_bucket(bucket);      \
+        lol_cmap_unlock_bucket(bucket, (uintptr_t)copy);                        \
+    }                                                                           \
+    lol_cmap_unlock_bucket(&table->buckets[i], LOL_CMAP_MOVED);                 \
+    for (node = (struct prefix##_node *)head; node != NULL; node = node->next) { \
+        lol_epoch_retire(node, lol_free);                                       \
+    }                                                                           \
+    return 1;                                                                   \
+}                                                                               \
+                                                                                \
+/* Note that `count` more buckets of `table` were moved, and switch to the     \
+next table once they all have been. */                                         \
+static inline void prefix##_finish_moves(                                      \
+    struct prefix *map,                                                         \
+    struct prefix##_table *table,                                               \
+    size_t count                                                                \
+) {                                                                             \
+    if (__atomic_add_fetch(&table->moved, count, __ATOMIC_ACQ_REL) == table->mask + 1) { \
+        __atomic_store_n(                                                       \
+            &map->table, __atomic_load_n(&table->next, __ATOMIC_ACQUIRE), __ATOMIC_RELEASE \
+        );                                                                      \
+        lol_epoch_retire(table, prefix##_free_table);                           \
+    }                                                                           \
+}                                                                               \
+                                                                                \
+/* Move some buckets of a resizing table. */                                   \
+static inline void prefix##_help_resize(struct prefix *map, struct prefix##_table *table) { \
+    size_t begin = __atomic_fetch_add(&table->cursor, LOL_CMAP_MIGRATE_STEP, __ATOMIC_RELAXED); \
+    size_t i = 0, moved = 0;                                                    \
+    int failed = 0;                                                             \
+                                                                                \
+    if (begin > table->mask) {                                                  \
+        /* Retry the buckets that could not be moved earlier. Clearing the      \
+        flag claims the rescan, so that only one writer does it, and later      \
+        writes skip it unless a bucket fails again. */                          \
+        if (!__atomic_exchange_n(&table->failed, 0, __ATOMIC_RELAXED)) {        \
+            return;                                                             \
+        }                                                                       \
+        for (i = 0; i <= table->mask; ++i) {                                    \
+            int result = prefix##_move_bucket(table, i);                        \
+                                                                                \
+            if (result == 1) {                                                  \
+                ++moved;                                                        \
+            } else if (result < 0) {                                            \
+                failed = 1;                                                     \
+            }                                                                   \
+        }                                                                       \
+        if (failed) {                                                           \
+            __atomic_store_n(&table->failed, 1, __ATOMIC_RELAXED);              \
+        }                                                                       \
+        if (moved != 0) {                                                       \
+            prefix##_finish_moves(map, table, moved);                           \
+        }                                                                       \
+        return;                                                                 \
+    }                                                                           \
+    for (i = begin; i < begin + LOL_CMAP_MIGRATE_STEP && i <= table->mask; ++i) { \
+        int result = prefix##_move_bucket(table, i);                            \
+                                                                                \
+        if (result == 1) {                                                      \
+            ++moved;                                                            \
+        } else if (result < 0) {                                                \
+            __atomic_store_n(&table->failed, 1, __ATOMIC_RELAXED);              \
+        }                                                                       \
+    }                                                                           \
+    if (moved != 0) {                                                           \
+        prefix##_finish_moves(map, table, moved);                               \
+    }                                                                           \
+}                                                                               \
+                                                                                \
+/* Lock the bucket for hash `h`, following moved buckets, and return its       \
+first node. Helps with any resize in progress first. */                       \
+static inline struct prefix##_node *prefix##_lock(                             \
+    struct prefix *map,                                                         \
+    uint64_t h,                                                                 \
+    uintptr_t **bucket                                                          \
+) {                                                                             \
+    struct prefix##_table *table = __atomic_load_n(&map->table, __ATOMIC_ACQUIRE); \
+    struct prefix##_table *next = __atomic_load_n(&table->next, __ATOMIC_ACQUIRE); \
+                                                                                \
+    if (LOL_UNLIKELY(next != NULL)) {                                           \
+        prefix##_help_resize(map, table);                                       \
+    }                                                                           \
+    for (;;) {                                                                  \
+        uintptr_t head = 0;                                                     \
+                                                                                \
+        *bucket = &table->buckets[h & table->mask];                             \
+        head = lol_cmap_lock_bucket(*bucket);                                   \
+        if (head != LOL_CMAP_MOVED) {                                           \
+            return (struct prefix##_node *)head;                                \
+        }                                                                       \
+        table = __atomic_load_n(&table->next, __ATOMIC_ACQUIRE);                \
+    }                                                                           \
+}                                                                               \
+                                                                                \
+/* The number of entries above which a table should grow. */                  \
+static inline size_t prefix##_limit(struct prefix##_table *table) {            \
+    return (table->mask + 1) * LOL_CMAP_LOAD_NUMERATOR / LOL_CMAP_LOAD_DENOMINATOR; \
+}                                                                               \
+                                                                                \
+/* Start a resize if the map is too full and none is in progress. */          \
+static LOL_COLD void prefix##_start_resize(struct prefix *map) {               \
+    struct prefix##_table *table = __atomic_load_n(&map->table, __ATOMIC_ACQUIRE); \
+    struct prefix##_table *expected = NULL;                                     \
+    struct prefix##_table *next = NULL;                                         \
+                                                                                \
+    if (__atomic_load_n(&table->next, __ATOMIC_ACQUIRE) != NULL                 \
+            || prefix##_size(map) <= prefix##_limit(table)) {                   \
+        return;                                                                 \
+    }                                                                           \
+    next = prefix##_new_table(2 * (table->mask + 1));                           \
+    if (next == NULL) {                                                         \
+        /* Stay at this size; the map still works, only slower. */             \
+        return;                                                                 \
+    }                                                                           \
+    if (!__atomic_compare_exchange_n(                                           \
+            &table->next, &expected, next, 0,                                   \
+            __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {                              \
+        prefix##_free_table(next);                                              \
+    }                                                                           \
+}                                                                               \
+                                                                                \
+static inline int prefix##_put(                                                 \
+    struct prefix *map,                                                         \
+    const key_type *key,                                                        \
+    const value_type *value                                                     \
+) {                                                                             \
+    uint64_t h = hash(key);                                                     \
+    struct prefix##_node *fresh = lol_alloc(sizeof *fresh);                     \
+    struct prefix##_node *first = NULL;                                         \
+    struct prefix##_node *node = NULL;                                          \
+    struct prefix##_node **link = NULL;                                         \
+    struct lol_cmap_counter *counter = &map->counts[h & (LOL_CMAP_COUNTERS - 1)]; \
+    uintptr_t *bucket = NULL;                                                   \
+    size_t count = 0;                                                           \
+                                                                                \
+    if (fresh == NULL) {                                                        \
+        return ENOMEM;                                                          \
+    }                                                                           \
+    fresh->key = *key;                                                          \
+    fresh->value = *value;                                                      \
+    fresh->hash = h;                                                            \
+    lol_epoch_enter();                                                          \
+    first = prefix##_lock(map, h, &bucket);                                     \
+    for (link = &first; *link != NULL; link = &(*link)->next) {                 \
+        if ((*link)->hash == h && equal(&(*link)->key, key)) {                  \
+            node = *link;                                                       \
+            break;                                                              \
+        }                                                                       \
+    }                                                                           \
+    if (node != NULL) {                                                         \
+        /* Replace the node, so that readers see the old or the new value. */  \
+        fresh->next = node->next;                                               \
+        if (link == &first) {                                                   \
+            first = fresh;                                                      \
+        } else {                                                                \
+            __atomic_store_n(link, fresh, __ATOMIC_RELEASE);                    \
+        }                                                                       \
+        lol_cmap_unlock_bucket(bucket, (uintptr_t)first);                       \
+        lol_epoch_retire(node, lol_free);                                       \
+        lol_epoch_exit();                                                       \
+        return 0;                                                               \
+    }                                                                           \
+    fresh->next = first;                                                        \
+    lol_cmap_unlock_bucket(bucket, (uintptr_t)fresh);                           \
+    /* Only sum the counters when this one suggests that the map is full. */   \
+    count = __atomic_add_fetch(&counter->value, 1, __ATOMIC_RELAXED);           \
+    if (LOL_UNLIKELY(count * LOL_CMAP_COUNTERS                                  \
+            > prefix##_limit(__atomic_load_n(&map->table, __ATOMIC_ACQUIRE)))) { \
+        prefix##_start_resize(map);                                             \
+    }                                                                           \
+    lol_epoch_exit();                                                           \
+    return 0;                                                                   \
+}                                                                               \
+                                                                                \
+static inline int prefix##_remove(struct prefix *map, const key_type *key) {   \
+    uint64_t h = hash(key);                                                     \
+    struct prefix##_node *first = NULL;                                         \
+    struct prefix##_node *node = NULL;                                          \
+    struct prefix##_node **link = NULL;                                         \
+    uintptr_t *bucket = NULL;                                                   \
+                                                                                \
+    lol_epoch_enter();                                                          \
+    first = prefix##_lock(map, h, &bucket);                                     \
+    for (link = &first; *link != NULL; link = &(*link)->next) {                 \
+        if ((*link)->hash == h && equal(&(*link)->key, key)) {                  \
+            node = *link;                                                       \
+            break;                                                              \
+        }                                                                       \
+    }                                                                           \
+    if (node != NULL) {                                                         \
+        if (link == &first) {                                                   \
+            first = node->next;                                                 \
+        } else {                                                                \
+            __atomic_store_n(link, node->next, __ATOMIC_RELEASE);               \
+        }                                                                       \
+    }                                                                           \
+    lol_cmap_unlock_bucket(bucket, (uintptr_t)first);                           \
+    if (node != NULL) {                                                         \
+        lol_epoch_retire(node, lol_free);                                       \
+        (void)__atomic_sub_fetch(&map->counts[h & (LOL_CMAP_COUNTERS - 1)].value, 1, __ATOMIC_RELAXED); \
+    }                                                                           \
+    lol_epoch_exit();                                                           \
+    return node != NULL;                                                        \
+}
+
+#endif /* LOL_CMAP_H */
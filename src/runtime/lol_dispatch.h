@@ -0,0 +1,84 @@
+/*
+ * Threaded Dispatch
+ *
+ * Macros for the dispatch loop of an interpreter or state machine. A `switch`
+ * in a loop has one indirect branch that every opcode goes through, so the
+ * branch predictor only learns "which opcode usually comes next" overall.
+ * With GCC and Clang, these macros lower the loop to direct threading instead:
+ * a table of label addresses (`&&label`) and a `goto *` at the end of every
+ * handler. Each handler then has its own indirect branch, which learns the
+ * opcode that usually follows it, and we skip the switch's bounds check.
+ *
+ * Other compilers (or `-DLOL_DISPATCH_SWITCH`) get a `switch` in a loop with
+ * the same behaviour.
+ *
+ * E.g.
+ *
+ * ```c
+ * #define OPCODES(X) X(OP_PUSH) X(OP_ADD) X(OP_HALT)
+ * enum opcode { OPCODES(LOL_DISPATCH_ENUM) };
+ *
+ * int run(const unsigned char *pc) {
+ *     LOL_DISPATCH_TABLE(table, OPCODES);
+ *     int acc = 0;
+ *
+ *     LOL_DISPATCH(table, *pc++) {
+ *     LOL_CASE(OP_PUSH):
+ *         acc = *pc++;
+ *         LOL_NEXT(table, *pc++);
+ *     LOL_CASE(OP_ADD):
+ *         acc += *pc++;
+ *         LOL_NEXT(table, *pc++);
+ *     LOL_CASE(OP_HALT):
+ *         return acc;
+ *     }
+ * }
+ * ```
+ *
+ * N.B.
+ *
+ * 1. The opcode expression must be the same in `LOL_DISPATCH()` and in every
+ *    `LOL_NEXT()`, because the `switch` fallback only evaluates the former.
+ * 2. Every opcode must have a handler and must be in range; there is no
+ *    default case. Validate the program before running it.
+ * 3. With the `switch` fallback, `LOL_NEXT()` is a `continue`, so do not use
+ *    it inside another loop in a handler.
+ */
+#ifndef LOL_DISPATCH_H
+#define LOL_DISPATCH_H
+
+#if (defined(__GNUC__) || defined(__clang__)) && !defined(LOL_DISPATCH_SWITCH)
+#define LOL_DISPATCH_COMPUTED_GOTO 1
+#else
+#define LOL_DISPATCH_COMPUTED_GOTO 0
+#endif
+
+/* For an X-macro list of opcodes, e.g. `enum { OPCODES(LOL_DISPATCH_ENUM) };` */
+#define LOL_DISPATCH_ENUM(name) name,
+
+#if LOL_DISPATCH_COMPUTED_GOTO
+
+/* Computed gotos are a GNU extension, so -pedantic would warn about them. */
+#define LOL_DISPATCH_LABEL(name) __extension__ &&lol_dispatch_##name,
+#define LOL_DISPATCH_GOTO(table, opcode)                                        \
+    _Pragma("GCC diagnostic push")                                              \
+    _Pragma("GCC diagnostic ignored \"-Wpedantic\"")                            \
+    goto *(table)[(opcode)];                                                    \
+    _Pragma("GCC diagnostic pop")
+
+#define LOL_DISPATCH_TABLE(table, opcodes)                                      \
+    static const void *const table[] = { opcodes(LOL_DISPATCH_LABEL) }
+#define LOL_DISPATCH(table, opcode) LOL_DISPATCH_GOTO(table, opcode)
+#define LOL_CASE(name) lol_dispatch_##name
+#define LOL_NEXT(table, opcode) LOL_DISPATCH_GOTO(table, opcode)
+
+#else
+
+#define LOL_DISPATCH_TABLE(table, opcodes) enum { table }
+#define LOL_DISPATCH(table, opcode) for (;;) switch (opcode)
+#define LOL_CASE(name) case name
+#define LOL_NEXT(table, opcode) continue
+
+#endif
+
+#endif /* LOL_DISPATCH_H */
@@ -0,0 +1,339 @@
+/*
+ * Epoch-Based Reclamation
+ *
+ * Lock-free readers may still be looking at a node after a writer unlinks it,
+ * so the writer cannot free it right away. Instead, readers mark the regions
+ * in which they hold pointers into a shared structure, and writers retire
+ * what they unlink:
+ *
+ * ```c
+ * lol_epoch_enter();
+ * node = __atomic_load_n(&head, __ATOMIC_ACQUIRE);
+ * ... read node ...
+ * lol_epoch_exit();
+ *
+ * // In a writer, after unlinking `old`:
+ * lol_epoch_retire(old, lol_free);
+ * ```
+ *
+ * There is a global epoch, and each thread publishes the epoch it saw when it
+ * entered. The global epoch only advances once every thread inside a region
+ * has seen it, so once it has advanced twice past the epoch in which a node
+ * was retired, no thread can still hold a pointer to the node.
+ *
+ * Regions may nest. Do not block (e.g. wait for a lock) inside one for long:
+ * nothing retired anywhere can be freed meanwhile.
+ *
+ * Quiescent-state mode: a thread that reads shared structures all the time
+ * can skip the regions altogether. It calls `lol_epoch_online()` once, then
+ * `lol_epoch_quiescent()` whenever it holds no shared pointers (e.g. between
+ * requests, or between tasks in the task pool, which does this for its
+ * workers), and `lol_epoch_offline()` before it blocks. Its reads then cost
+ * nothing but the loads themselves (see `lol_read_mostly.h`).
+ *
+ * Retired pointers are kept in per-thread batches of `LOL_EPOCH_BATCH_SIZE`,
+ * one batch per epoch, and a whole batch is freed at once. A thread only
+ * tries to advance the epoch when a batch fills up (or when it is
+ * quiescent), so that the scan of every thread's epoch is amortized.
+ */
+#ifndef LOL_EPOCH_H
+#define LOL_EPOCH_H
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "lol_alloc.h"
+#include "lol_hints.h"
+
+/* Pointers retired per batch. A thread tries to advance the epoch each time
+it fills a batch. */
+#ifndef LOL_EPOCH_BATCH_SIZE
+#define LOL_EPOCH_BATCH_SIZE 64
+#endif
+
+/* Set in a thread's published state while it is inside a region or online. */
+#define LOL_EPOCH_ACTIVE ((uint64_t)1)
+
+struct lol_epoch_retired {
+    void *pointer;
+    void (*free)(void *pointer);
+};
+
+/* The pointers that one thread retired in one epoch. */
+struct lol_epoch_batch {
+    uint64_t epoch;
+    unsigned count;
+    struct lol_epoch_batch *next;
+    struct lol_epoch_retired retired[LOL_EPOCH_BATCH_SIZE];
+};
+
+struct lol_epoch_thread {
+    /* (epoch << 1) | LOL_EPOCH_ACTIVE while inside a region or online, else
+    0. */
+    uint64_t state;
+    /* Whether a live thread owns this record. Records are never freed;
+    exited threads' records (and their batches) are reused. */
+    int in_use;
+    int depth;
+    int online;
+    /* Newest first, so the epochs never increase along the list. */
+    struct lol_epoch_batch *batches;
+    /* Freed batches, kept to be reused. */
+    struct lol_epoch_batch *spare;
+    struct lol_epoch_thread *next;
+};
+
+static uint64_t lol_epoch_global = 1;
+static struct lol_epoch_thread *lol_epoch_threads = NULL;
+static __thread struct lol_epoch_thread *lol_epoch_self = NULL;
+static pthread_key_t lol_epoch_key;
+static pthread_once_t lol_epoch_key_once = PTHREAD_ONCE_INIT;
+
+static void lol_epoch_release_thread(void *record) {
+    struct lol_epoch_thread *self = record;
+
+    self->depth = 0;
+    self->online = 0;
+    __atomic_store_n(&self->state, 0, __ATOMIC_RELEASE);
+    __atomic_store_n(&self->in_use, 0, __ATOMIC_RELEASE);
+}
+
+static void lol_epoch_create_key(void) {
+    (void)pthread_key_create(&lol_epoch_key, lol_epoch_release_thread);
+}
+
+/* Get a record for the calling thread, reusing one from an exited thread if
+we can. Return NULL if we are out of memory. */
+static LOL_COLD struct lol_epoch_thread *lol_epoch_register(void) {
+    struct lol_epoch_thread *record = NULL;
+
+    pthread_once(&lol_epoch_key_once, lol_epoch_create_key);
+    for (record = __atomic_load_n(&lol_epoch_threads, __ATOMIC_ACQUIRE);
+            record != NULL;
+            record = record->next) {
+        int expected = 0;
+
+        if (__atomic_compare_exchange_n(
+                &record->in_use, &expected, 1, 0,
+                __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+            break;
+        }
+    }
+    if (record == NULL) {
+        record = lol_calloc(1, sizeof *record);
+        if (record == NULL) {
+            return NULL;
+        }
+        record->in_use = 1;
+        record->next = __atomic_load_n(&lol_epoch_threads, __ATOMIC_RELAXED);
+        while (!__atomic_compare_exchange_n(
+                &lol_epoch_threads, &record->next, record, 1,
+                __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+        }
+    }
+    (void)pthread_setspecific(lol_epoch_key, record);
+    lol_epoch_self = record;
+    return record;
+}
+
+static inline struct lol_epoch_thread *lol_epoch_get_self(void) {
+    struct lol_epoch_thread *self = lol_epoch_self;
+
+    if (LOL_UNLIKELY(self == NULL)) {
+        self = lol_epoch_register();
+    }
+    return self;
+}
+
+/* Publish the current epoch as the oldest one whose pointers we may hold. */
+static inline void lol_epoch_announce(struct lol_epoch_thread *self) {
+    uint64_t epoch = __atomic_load_n(&lol_epoch_global, __ATOMIC_RELAXED);
+
+    /* The exchange orders the announcement before our loads of shared
+    pointers; a release store would not. */
+    (void)__atomic_exchange_n(
+        &self->state, (epoch << 1) | LOL_EPOCH_ACTIVE, __ATOMIC_SEQ_CST
+    );
+}
+
+/* Start a region in which pointers to shared nodes may be held. */
+static inline void lol_epoch_enter(void) {
+    struct lol_epoch_thread *self = lol_epoch_get_self();
+
+    if (LOL_UNLIKELY(self == NULL)) {
+        /* Without a record, nothing is ever freed (see lol_epoch_retire). */
+        return;
+    }
+    /* An online thread has already announced an epoch that it may still
+    hold pointers from, so it must keep it. */
+    if (self->depth++ == 0 && !self->online) {
+        lol_epoch_announce(self);
+    }
+}
+
+static inline void lol_epoch_exit(void) {
+    struct lol_epoch_thread *self = lol_epoch_self;
+
+    if (LOL_UNLIKELY(self == NULL)) {
+        return;
+    }
+    if (--self->depth == 0 && !self->online) {
+        __atomic_store_n(&self->state, 0, __ATOMIC_RELEASE);
+    }
+}
+
+/* Advance the global epoch if every thread in a region has seen it. Return
+the (possibly new) global epoch. */
+static inline uint64_t lol_epoch_try_advance(void) {
+    uint64_t epoch = __atomic_load_n(&lol_epoch_global, __ATOMIC_SEQ_CST);
+    struct lol_epoch_thread *record = NULL;
+
+    for (record = __atomic_load_n(&lol_epoch_threads, __ATOMIC_ACQUIRE);
+            record != NULL;
+            record = record->next) {
+        uint64_t state = __atomic_load_n(&record->state, __ATOMIC_SEQ_CST);
+
+        if ((state & LOL_EPOCH_ACTIVE) && (state >> 1) != epoch) {
+            return epoch;
+        }
+    }
+    if (__atomic_compare_exchange_n(
+            &lol_epoch_global, &epoch, epoch + 1, 0,
+            __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)) {
+        return epoch + 1;
+    }
+    /* Someone else advanced it; `epoch` now holds the new value. */
+    return epoch;
+}
+
+/* Free the calling thread's batches that no thread can still see. */
+static inline void lol_epoch_collect(void) {
+    struct lol_epoch_thread *self = lol_epoch_get_self();
+    struct lol_epoch_batch **link = NULL;
+    struct lol_epoch_batch *batch = NULL;
+    uint64_t epoch = 0;
+
+    if (self == NULL || self->batches == NULL) {
+        return;
+    }
+    epoch = lol_epoch_try_advance();
+    for (link = &self->batches; *link != NULL; link = &(*link)->next) {
+        if ((*link)->epoch + 2 <= epoch) {
+            break;
+        }
+    }
+    /* Everything from here on is older. */
+    batch = *link;
+    *link = NULL;
+    while (batch != NULL) {
+        struct lol_epoch_batch *next = batch->next;
+        unsigned i = 0;
+
+        for (i = 0; i < batch->count; ++i) {
+            batch->retired[i].free(batch->retired[i].pointer);
+        }
+        batch->next = self->spare;
+        self->spare = batch;
+        batch = next;
+    }
+}
+
+/* Get a batch for pointers retired in `epoch`, or NULL if we are out of
+memory. */
+static LOL_COLD struct lol_epoch_batch *lol_epoch_new_batch(
+    struct lol_epoch_thread *self,
+    uint64_t epoch
+) {
+    struct lol_epoch_batch *batch = self->spare;
+
+    if (batch == NULL) {
+        /* Free what we can first, which may give us a spare batch. */
+        lol_epoch_collect();
+        batch = self->spare;
+    }
+    if (batch != NULL) {
+        self->spare = batch->next;
+    } else if ((batch = lol_alloc(sizeof *batch)) == NULL) {
+        return NULL;
+    }
+    batch->epoch = epoch;
+    batch->count = 0;
+    batch->next = self->batches;
+    self->batches = batch;
+    return batch;
+}
+
+/* Free `pointer` with `free_fn` once no thread can still be reading it. Call
+this after `pointer` has been unlinked from every shared structure. */
+static inline void lol_epoch_retire(void *pointer, void (*free_fn)(void *pointer)) {
+    struct lol_epoch_thread *self = lol_epoch_get_self();
+    struct lol_epoch_batch *batch = NULL;
+    uint64_t epoch = __atomic_load_n(&lol_epoch_global, __ATOMIC_SEQ_CST);
+
+    if (self == NULL) {
+        /* Leaking is safe; freeing too early is not. */
+        return;
+    }
+    batch = self->batches;
+    if (LOL_UNLIKELY(batch == NULL || batch->epoch != epoch
+            || batch->count == LOL_EPOCH_BATCH_SIZE)) {
+        if (batch != NULL && batch->count == LOL_EPOCH_BATCH_SIZE) {
+            lol_epoch_collect();
+        }
+        batch = lol_epoch_new_batch(self, epoch);
+        if (batch == NULL) {
+            return;
+        }
+    }
+    batch->retired[batch->count].pointer = pointer;
+    batch->retired[batch->count].free = free_fn;
+    ++batch->count;
+}
+
+/* Switch the calling thread to quiescent-state mode: until
+`lol_epoch_offline()`, it may hold shared pointers outside of regions, as
+long as it drops them before each `lol_epoch_quiescent()`. */
+static inline void lol_epoch_online(void) {
+    struct lol_epoch_thread *self = lol_epoch_get_self();
+
+    if (self != NULL && !self->online) {
+        self->online = 1;
+        if (self->depth == 0) {
+            lol_epoch_announce(self);
+        }
+    }
+}
+
+/* Declare that the calling thread holds no shared pointers right now, and
+free its retired pointers that nobody can see any more. */
+static inline void lol_epoch_quiescent(void) {
+    struct lol_epoch_thread *self = lol_epoch_self;
+
+    if (self == NULL) {
+        return;
+    }
+    if (self->online && self->depth == 0) {
+        lol_epoch_announce(self);
+    }
+    lol_epoch_collect();
+}
+
+/* Leave quiescent-state mode, e.g. before blocking, so that the thread does
+not hold back reclamation while it waits. */
+static inline void lol_epoch_offline(void) {
+    struct lol_epoch_thread *self = lol_epoch_self;
+
+    if (self != NULL && self->online) {
+        self->online = 0;
+        if (self->depth == 0) {
+            __atomic_store_n(&self->state, 0, __ATOMIC_RELEASE);
+        }
+    }
+}
+
+#endif /* LOL_EPOCH_H */
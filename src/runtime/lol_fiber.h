@@ -0,0 +1,700 @@
+/*
+ * Fibers
+ *
+ * Threads of execution with their own stacks that a pool of worker threads
+ * multiplexes in user space, so that blocking-style code (e.g. a deep
+ * recursive parser) can wait without holding a thread:
+ *
+ * ```c
+ * static void parse(void *arg) {
+ *     ...
+ *     lol_fiber_yield();
+ *     ...
+ * }
+ * struct lol_fiber *fiber = lol_fiber_spawn(parse, input);
+ * lol_fiber_join(fiber);
+ * ```
+ *
+ * Switching fibers saves the callee-saved registers on one stack and loads
+ * them from another: about 20 instructions, in hand-written assembly for
+ * x86-64 and AArch64. Elsewhere (or with -DLOL_FIBER_UCONTEXT), we use
+ * swapcontext(), which also makes a system call to save the signal mask.
+ * The floating-point control registers (MXCSR, FPCR) are not switched, so
+ * fibers must not change them.
+ *
+ * Each fiber gets `LOL_FIBER_STACK_SIZE` bytes of stack, of which only the
+ * pages that it touches use memory. Below the stack is a guard page, so an
+ * overflow crashes instead of corrupting memory. Every guarded stack is a
+ * separate mapping, so more than about 30,000 fibers at once need a higher
+ * `vm.max_map_count`, or -DLOL_FIBER_NO_GUARD, which takes stacks from
+ * lol_alloc.h instead. Workers keep the stacks of finished fibers for reuse.
+ *
+ * The pool starts with the first spawn. It has one worker per online CPU, or
+ * `LOL_FIBER_WORKERS` if that environment variable is set. Each worker runs
+ * the fibers in its queue in order, and steals from the others when it runs
+ * out. A fiber that is spawned or woken by a worker goes to that worker.
+ *
+ * A fiber that waits must not block its worker (e.g. on a lol_lock.h mutex
+ * or a system call), or it blocks every fiber queued behind it. Instead,
+ * it parks with `lol_fiber_park()` until someone calls `lol_fiber_unpark()`.
+ */
+#ifndef LOL_FIBER_H
+#define LOL_FIBER_H
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <limits.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "lol_alloc.h"
+#include "lol_hints.h"
+#include "lol_lock.h"
+
+#if !defined(LOL_FIBER_UCONTEXT) && !defined(__x86_64__) && !defined(__aarch64__)
+#define LOL_FIBER_UCONTEXT
+#endif
+#ifdef LOL_FIBER_UCONTEXT
+#include <ucontext.h>
+#endif
+
+#ifndef LOL_FIBER_STACK_SIZE
+#define LOL_FIBER_STACK_SIZE (64 * 1024)
+#endif
+#ifndef LOL_FIBER_MAX_WORKERS
+#define LOL_FIBER_MAX_WORKERS 64
+#endif
+/* Finished fibers' stacks that each worker keeps. */
+#ifndef LOL_FIBER_STACK_CACHE
+#define LOL_FIBER_STACK_CACHE 64
+#endif
+/* Rounds of stealing before an idle worker sleeps. */
+#define LOL_FIBER_IDLE_SPINS 64
+
+/* Under ThreadSanitizer, tell it about every switch of stacks, or it takes
+each fiber's calls and returns for the worker's. */
+#ifdef LOL_TSAN
+void *__tsan_get_current_fiber(void);
+void *__tsan_create_fiber(unsigned flags);
+void __tsan_destroy_fiber(void *fiber);
+void __tsan_switch_to_fiber(void *fiber, unsigned flags);
+#endif
+
+/* What a fiber asks its worker to do once it has switched away. */
+enum lol_fiber_action {
+    LOL_FIBER_YIELD,
+    LOL_FIBER_PARK,
+    LOL_FIBER_EXIT
+};
+
+/* The park state: a permit from unpark, or parked (switched away). */
+#define LOL_FIBER_RUNNING 0
+#define LOL_FIBER_NOTIFIED 1
+#define LOL_FIBER_PARKED 2
+
+struct lol_fiber {
+#ifdef LOL_FIBER_UCONTEXT
+    ucontext_t context;
+#else
+    /* The saved stack pointer, under which the registers are saved. */
+    void *sp;
+#endif
+    void (*entry)(void *arg);
+    void *arg;
+    char *stack;
+    enum lol_fiber_action action;
+    uint32_t park_state;
+    /* Set once the fiber has finished, and a futex for joining threads. */
+    uint32_t done;
+    uint32_t thread_joining;
+    struct lol_fiber *joiner;
+    /* The fiber and its handle each hold a reference. */
+    int references;
+    /* The next fiber in a run queue. */
+    struct lol_fiber *next;
+#ifdef LOL_TSAN
+    void *tsan_fiber;
+#endif
+};
+
+struct lol_fiber_worker {
+    struct lol_mutex lock;
+    struct lol_fiber *head;
+    struct lol_fiber *tail;
+#ifdef LOL_FIBER_UCONTEXT
+    ucontext_t context;
+#else
+    void *sp;
+#endif
+    struct lol_fiber *current;
+    /* Stacks for reuse, linked through their lowest word. */
+    char *stacks;
+    int stack_count;
+    int index;
+#ifdef LOL_TSAN
+    void *tsan_fiber;
+#endif
+};
+
+static struct lol_fiber_worker *lol_fiber_workers = NULL;
+static int lol_fiber_worker_count = 0;
+/* 0: not started, 1: starting, 2: running. */
+static int lol_fiber_pool_state = 0;
+static unsigned lol_fiber_next_worker = 0;
+/* Sleeping workers, and a futex that is bumped to wake one. */
+static int lol_fiber_idle = 0;
+static uint32_t lol_fiber_wakeups = 0;
+static __thread struct lol_fiber_worker *lol_fiber_worker_self = NULL;
+
+/******************************************************************************/
+/* CONTEXT SWITCH                                                             */
+/******************************************************************************/
+
+#ifndef LOL_FIBER_UCONTEXT
+/* Save the callee-saved registers on the current stack, store the stack
+pointer in `*from`, and resume the context saved at `to`. Defined weak, so
+that every file that includes this header may define it. */
+__attribute__((visibility("hidden"))) void lol_fiber_switch_context(void **from, void *to);
+/* Where a new fiber's context "returns" to: it calls the function in the
+second saved register with the first as the argument. */
+__attribute__((visibility("hidden"))) void lol_fiber_trampoline(void);
+
+#if defined(__x86_64__)
+__asm__(
+    ".text\n"
+    ".weak lol_fiber_switch_context\n"
+    ".hidden lol_fiber_switch_context\n"
+    ".type lol_fiber_switch_context, @function\n"
+    "lol_fiber_switch_context:\n"
+    "    pushq %rbp\n"
+    "    pushq %rbx\n"
+    "    pushq %r12\n"
+    "    pushq %r13\n"
+    "    pushq %r14\n"
+    "    pushq %r15\n"
+    "    movq %rsp, (%rdi)\n"
+    "    movq %rsi, %rsp\n"
+    "    popq %r15\n"
+    "    popq %r14\n"
+    "    popq %r13\n"
+    "    popq %r12\n"
+    "    popq %rbx\n"
+    "    popq %rbp\n"
+    "    ret\n"
+    ".size lol_fiber_switch_context, .-lol_fiber_switch_context\n"
+    ".weak lol_fiber_trampoline\n"
+    ".hidden lol_fiber_trampoline\n"
+    ".type lol_fiber_trampoline, @function\n"
+    "lol_fiber_trampoline:\n"
+    "    .cfi_startproc\n"
+    /* The outermost frame, for debuggers and backtrace(). */
+    "    .cfi_undefined rip\n"
+    "    movq %r12, %rdi\n"
+    "    callq *%r13\n"
+    "    ud2\n"
+    "    .cfi_endproc\n"
+    ".size lol_fiber_trampoline, .-lol_fiber_trampoline\n"
+);
+/* The registers that lol_fiber_switch_context() pops, and the address that
+it returns to. */
+#define LOL_FIBER_SAVED_WORDS 7
+#define LOL_FIBER_ARG_WORD 3
+#define LOL_FIBER_FUNCTION_WORD 2
+#define LOL_FIBER_RETURN_WORD 6
+#else /* __aarch64__ */
+__asm__(
+    ".text\n"
+    ".weak lol_fiber_switch_context\n"
+    ".hidden lol_fiber_switch_context\n"
+    ".type lol_fiber_switch_context, %function\n"
+    "lol_fiber_switch_context:\n"
+    "    sub sp, sp, #160\n"
+    "    stp x19, x20, [sp, #0]\n"
+    "    stp x21, x22, [sp, #16]\n"
+    "    stp x23, x24, [sp, #32]\n"
+    "    stp x25, x26, [sp, #48]\n"
+    "    stp x27, x28, [sp, #64]\n"
+    "    stp x29, x30, [sp, #80]\n"
+    "    stp d8, d9, [sp, #96]\n"
+    "    stp d10, d11, [sp, #112]\n"
+    "    stp d12, d13, [sp, #128]\n"
+    "    stp d14, d15, [sp, #144]\n"
+    "    mov x2, sp\n"
+    "    str x2, [x0]\n"
+    "    mov sp, x1\n"
+    "    ldp x19, x20, [sp, #0]\n"
+    "    ldp x21, x22, [sp, #16]\n"
+    "    ldp x23, x24, [sp, #32]\n"
+    "    ldp x25, x26, [sp, #48]\n"
+    "    ldp x27, x28, [sp, #64]\n"
+    "    ldp x29, x30, [sp, #80]\n"
+    "    ldp d8, d9, [sp, #96]\n"
+    "    ldp d10, d11, [sp, #112]\n"
+    "    ldp d12, d13, [sp, #128]\n"
+    "    ldp d14, d15, [sp, #144]\n"
+    "    add sp, sp, #160\n"
+    "    ret\n"
+    ".size lol_fiber_switch_context, .-lol_fiber_switch_context\n"
+    ".weak lol_fiber_trampoline\n"
+    ".hidden lol_fiber_trampoline\n"
+    ".type lol_fiber_trampoline, %function\n"
+    "lol_fiber_trampoline:\n"
+    "    .cfi_startproc\n"
+    "    .cfi_undefined x30\n"
+    "    mov x0, x19\n"
+    "    blr x20\n"
+    "    brk #0\n"
+    "    .cfi_endproc\n"
+    ".size lol_fiber_trampoline, .-lol_fiber_trampoline\n"
+);
+/* x19-x30 and d8-d15, in the order in which they are stored. */
+#define LOL_FIBER_SAVED_WORDS 20
+#define LOL_FIBER_ARG_WORD 0
+#define LOL_FIBER_FUNCTION_WORD 1
+#define LOL_FIBER_RETURN_WORD 11
+#endif
+#endif /* LOL_FIBER_UCONTEXT */
+
+/******************************************************************************/
+/* STACKS                                                                     */
+/******************************************************************************/
+
+/* Return the lowest usable address of a new stack, or NULL. */
+static inline char *lol_fiber_map_stack(void) {
+#ifdef LOL_FIBER_NO_GUARD
+    return lol_alloc(LOL_FIBER_STACK_SIZE);
+#else
+    size_t guard = (size_t)sysconf(_SC_PAGESIZE);
+    char *memory = mmap(NULL, guard + LOL_FIBER_STACK_SIZE, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_STACK, -1, 0);
+
+    if (memory == MAP_FAILED) {
+        return NULL;
+    }
+    if (mprotect(memory, guard, PROT_NONE) != 0) {
+        munmap(memory, guard + LOL_FIBER_STACK_SIZE);
+        return NULL;
+    }
+    return memory + guard;
+#endif
+}
+
+static inline void lol_fiber_unmap_stack(char *stack) {
+#ifdef LOL_FIBER_NO_GUARD
+    lol_free(stack);
+#else
+    size_t guard = (size_t)sysconf(_SC_PAGESIZE);
+
+    munmap(stack - guard, guard + LOL_FIBER_STACK_SIZE);
+#endif
+}
+
+static inline char *lol_fiber_get_stack(struct lol_fiber_worker *worker) {
+    char *stack = NULL;
+
+    if (worker != NULL && worker->stacks != NULL) {
+        stack = worker->stacks;
+        worker->stacks = *(char **)stack;
+        --worker->stack_count;
+        return stack;
+    }
+    return lol_fiber_map_stack();
+}
+
+static inline void lol_fiber_put_stack(struct lol_fiber_worker *worker, char *stack) {
+    if (worker->stack_count < LOL_FIBER_STACK_CACHE) {
+        *(char **)stack = worker->stacks;
+        worker->stacks = stack;
+        ++worker->stack_count;
+    } else {
+        lol_fiber_unmap_stack(stack);
+    }
+}
+
+/******************************************************************************/
+/* SCHEDULER                                                                  */
+/******************************************************************************/
+
+/* Not inlined, so that a fiber that moved to another worker does not reuse
+the previous worker's thread-local address. */
+static __attribute__((noinline)) struct lol_fiber_worker *lol_fiber_get_worker(void) {
+    return lol_fiber_worker_self;
+}
+
+static inline void lol_fiber_enqueue(struct lol_fiber_worker *worker, struct lol_fiber *fiber) {
+    fiber->next = NULL;
+    lol_mutex_lock(&worker->lock);
+    /* Idle workers read `head` without the lock. */
+    if (worker->tail == NULL) {
+        __atomic_store_n(&worker->head, fiber, __ATOMIC_RELAXED);
+    } else {
+        worker->tail->next = fiber;
+    }
+    worker->tail = fiber;
+    lol_mutex_unlock(&worker->lock);
+    /* Either a worker going to sleep sees the fiber, or we see it idle. */
+#ifdef LOL_TSAN
+    /* ThreadSanitizer does not model fences; this orders the same way. */
+    if (__atomic_fetch_add(&lol_fiber_idle, 0, __ATOMIC_SEQ_CST) != 0) {
+#else
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&lol_fiber_idle, __ATOMIC_SEQ_CST) != 0) {
+#endif
+        (void)__atomic_fetch_add(&lol_fiber_wakeups, 1, __ATOMIC_SEQ_CST);
+        lol_futex_wake(&lol_fiber_wakeups, 1);
+    }
+}
+
+/* Make a fiber runnable, preferably on the calling worker. */
+static inline void lol_fiber_schedule(struct lol_fiber *fiber) {
+    struct lol_fiber_worker *worker = lol_fiber_get_worker();
+
+    if (worker == NULL) {
+        unsigned i = __atomic_fetch_add(&lol_fiber_next_worker, 1, __ATOMIC_RELAXED);
+
+        worker = &lol_fiber_workers[i % (unsigned)lol_fiber_worker_count];
+    }
+    lol_fiber_enqueue(worker, fiber);
+}
+
+static inline struct lol_fiber *lol_fiber_dequeue(struct lol_fiber_worker *worker, int wait) {
+    struct lol_fiber *fiber = NULL;
+
+    if (__atomic_load_n(&worker->head, __ATOMIC_RELAXED) == NULL) {
+        return NULL;
+    }
+    if (wait) {
+        lol_mutex_lock(&worker->lock);
+    } else if (!lol_mutex_trylock(&worker->lock)) {
+        return NULL;
+    }
+    fiber = worker->head;
+    if (fiber != NULL) {
+        __atomic_store_n(&worker->head, fiber->next, __ATOMIC_RELAXED);
+        if (fiber->next == NULL) {
+            worker->tail = NULL;
+        }
+    }
+    lol_mutex_unlock(&worker->lock);
+    return fiber;
+}
+
+static inline struct lol_fiber *lol_fiber_find_work(struct lol_fiber_worker *self) {
+    struct lol_fiber *fiber = lol_fiber_dequeue(self, 1);
+    int i = 0;
+
+    for (i = 1; fiber == NULL && i < lol_fiber_worker_count; ++i) {
+        fiber = lol_fiber_dequeue(&lol_fiber_workers[(self->index + i) % lol_fiber_worker_count], 0);
+    }
+    return fiber;
+}
+
+static inline void lol_fiber_release(struct lol_fiber *fiber) {
+    if (__atomic_sub_fetch(&fiber->references, 1, __ATOMIC_ACQ_REL) == 0) {
+        lol_free(fiber);
+    }
+}
+
+static inline void lol_fiber_unpark(struct lol_fiber *fiber);
+
+/* Finish what a fiber asked for, now that we are off its stack. */
+static inline void lol_fiber_after_switch(struct lol_fiber_worker *self, struct lol_fiber *fiber) {
+    uint32_t running = LOL_FIBER_RUNNING;
+    struct lol_fiber *joiner = NULL;
+
+    switch (fiber->action) {
+    case LOL_FIBER_YIELD:
+        lol_fiber_enqueue(self, fiber);
+        break;
+    case LOL_FIBER_PARK:
+        if (!__atomic_compare_exchange_n(&fiber->park_state, &running, LOL_FIBER_PARKED, 0,
+                __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            /* Unparked while switching away: use up the permit and go on. */
+            __atomic_store_n(&fiber->park_state, LOL_FIBER_RUNNING, __ATOMIC_RELAXED);
+            lol_fiber_enqueue(self, fiber);
+        }
+        break;
+    case LOL_FIBER_EXIT:
+        lol_fiber_put_stack(self, fiber->stack);
+        __atomic_store_n(&fiber->done, 1, __ATOMIC_SEQ_CST);
+        joiner = __atomic_load_n(&fiber->joiner, __ATOMIC_SEQ_CST);
+        if (joiner != NULL) {
+            lol_fiber_unpark(joiner);
+        }
+        if (__atomic_load_n(&fiber->thread_joining, __ATOMIC_SEQ_CST)) {
+            lol_futex_wake(&fiber->done, INT_MAX);
+        }
+#ifdef LOL_TSAN
+        __tsan_destroy_fiber(fiber->tsan_fiber);
+#endif
+        lol_fiber_release(fiber);
+        break;
+    }
+}
+
+static inline void lol_fiber_run(struct lol_fiber_worker *self, struct lol_fiber *fiber) {
+    self->current = fiber;
+#ifdef LOL_TSAN
+    __tsan_switch_to_fiber(fiber->tsan_fiber, 0);
+#endif
+#ifdef LOL_FIBER_UCONTEXT
+    swapcontext(&self->context, &fiber->context);
+#else
+    lol_fiber_switch_context(&self->sp, fiber->sp);
+#endif
+    self->current = NULL;
+    lol_fiber_after_switch(self, fiber);
+}
+
+/* Switch from the current fiber back to its worker, which does `action`. */
+static inline void lol_fiber_switch_to_worker(enum lol_fiber_action action) {
+    struct lol_fiber_worker *worker = lol_fiber_get_worker();
+    struct lol_fiber *fiber = worker->current;
+
+    fiber->action = action;
+#ifdef LOL_TSAN
+    __tsan_switch_to_fiber(worker->tsan_fiber, 0);
+#endif
+#ifdef LOL_FIBER_UCONTEXT
+    swapcontext(&fiber->context, &worker->context);
+#else
+    lol_fiber_switch_context(&fiber->sp, worker->sp);
+#endif
+    /* We may be on another worker now. */
+}
+
+static void *lol_fiber_worker_main(void *arg) {
+    struct lol_fiber_worker *self = arg;
+    unsigned spins = 0;
+
+    lol_fiber_worker_self = self;
+#ifdef LOL_TSAN
+    self->tsan_fiber = __tsan_get_current_fiber();
+#endif
+    for (;;) {
+        struct lol_fiber *fiber = lol_fiber_find_work(self);
+        uint32_t wakeups = 0;
+        int i = 0, found = 0;
+
+        if (fiber != NULL) {
+            spins = 0;
+            lol_fiber_run(self, fiber);
+            continue;
+        }
+        if (spins < LOL_FIBER_IDLE_SPINS) {
+            ++spins;
+            lol_lock_pause();
+            continue;
+        }
+        /* Sleep, unless a fiber was queued after we looked. */
+        (void)__atomic_fetch_add(&lol_fiber_idle, 1, __ATOMIC_SEQ_CST);
+        wakeups = __atomic_load_n(&lol_fiber_wakeups, __ATOMIC_SEQ_CST);
+        for (i = 0; i < lol_fiber_worker_count; ++i) {
+            found |= __atomic_load_n(&lol_fiber_workers[i].head, __ATOMIC_SEQ_CST) != NULL;
+        }
+        if (!found) {
+            lol_futex_wait(&lol_fiber_wakeups, wakeups);
+        }
+        (void)__atomic_fetch_sub(&lol_fiber_idle, 1, __ATOMIC_SEQ_CST);
+        spins = 0;
+    }
+    return NULL;
+}
+
+static inline int lol_fiber_get_worker_count(void) {
+    const char *env = getenv("LOL_FIBER_WORKERS");
+    long count = env != NULL ? atol(env) : sysconf(_SC_NPROCESSORS_ONLN);
+
+    if (count < 1) {
+        return 1;
+    }
+    return count > LOL_FIBER_MAX_WORKERS ? LOL_FIBER_MAX_WORKERS : (int)count;
+}
+
+/* Start the workers. Return 0 once they run (whoever started them). */
+static LOL_COLD int lol_fiber_start(void) {
+    int expected = 0;
+    int count = 0, i = 0;
+
+    if (!__atomic_compare_exchange_n(&lol_fiber_pool_state, &expected, 1, 0,
+            __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        while (expected == 1) {
+            lol_lock_pause();
+            expected = __atomic_load_n(&lol_fiber_pool_state, __ATOMIC_ACQUIRE);
+        }
+        return lol_fiber_worker_count == 0 ? -1 : 0;
+    }
+    count = lol_fiber_get_worker_count();
+    lol_fiber_workers = lol_calloc((size_t)count, sizeof *lol_fiber_workers);
+    if (lol_fiber_workers == NULL) {
+        __atomic_store_n(&lol_fiber_pool_state, 2, __ATOMIC_RELEASE);
+        return -1;
+    }
+    for (i = 0; i < count; ++i) {
+        lol_fiber_workers[i].index = i;
+    }
+    lol_fiber_worker_count = count;
+    for (i = 0; i < count; ++i) {
+        pthread_t thread;
+        pthread_attr_t attr;
+
+        pthread_attr_init(&attr);
+        pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+        if (pthread_create(&thread, &attr, lol_fiber_worker_main, &lol_fiber_workers[i]) != 0) {
+            /* The other workers steal from the missing workers' queues. */
+            if (i == 0) {
+                lol_fiber_worker_count = 0;
+            }
+            pthread_attr_destroy(&attr);
+            break;
+        }
+        pthread_attr_destroy(&attr);
+    }
+    __atomic_store_n(&lol_fiber_pool_state, 2, __ATOMIC_RELEASE);
+    return lol_fiber_worker_count == 0 ? -1 : 0;
+}
+
+/******************************************************************************/
+/* FIBERS                                                                     */
+/******************************************************************************/
+
+static void lol_fiber_main(struct lol_fiber *fiber) {
+    fiber->entry(fiber->arg);
+    lol_fiber_switch_to_worker(LOL_FIBER_EXIT);
+}
+
+#ifdef LOL_FIBER_UCONTEXT
+static void lol_fiber_ucontext_main(void) {
+    lol_fiber_main(lol_fiber_get_worker()->current);
+}
+
+/* Apart from lol_fiber_spawn(), whose locals getcontext() (which may return
+twice) could otherwise clobber. */
+static void lol_fiber_make_context(struct lol_fiber *fiber) {
+    getcontext(&fiber->context);
+    fiber->context.uc_stack.ss_sp = fiber->stack;
+    fiber->context.uc_stack.ss_size = LOL_FIBER_STACK_SIZE;
+    fiber->context.uc_link = NULL;
+    makecontext(&fiber->context, lol_fiber_ucontext_main, 0);
+}
+#endif
+
+/* Return the running fiber, or NULL if the caller is not a fiber. */
+static inline struct lol_fiber *lol_fiber_self(void) {
+    struct lol_fiber_worker *worker = lol_fiber_get_worker();
+
+    return worker == NULL ? NULL : worker->current;
+}
+
+/* Start running `entry(arg)` in a new fiber. Return its handle, which must be
+joined or detached, or NULL if we ran out of memory. */
+static inline struct lol_fiber *lol_fiber_spawn(void (*entry)(void *arg), void *arg) {
+    struct lol_fiber *fiber = NULL;
+
+    if (LOL_UNLIKELY(__atomic_load_n(&lol_fiber_pool_state, __ATOMIC_ACQUIRE) != 2)
+            && lol_fiber_start() != 0) {
+        return NULL;
+    }
+    fiber = lol_calloc(1, sizeof *fiber);
+    if (fiber == NULL) {
+        return NULL;
+    }
+    fiber->stack = lol_fiber_get_stack(lol_fiber_get_worker());
+    if (fiber->stack == NULL) {
+        lol_free(fiber);
+        return NULL;
+    }
+    fiber->entry = entry;
+    fiber->arg = arg;
+    fiber->references = 2;
+#ifdef LOL_TSAN
+    fiber->tsan_fiber = __tsan_create_fiber(0);
+#endif
+#ifdef LOL_FIBER_UCONTEXT
+    lol_fiber_make_context(fiber);
+#else
+    {
+        /* The stack's top is 16-byte aligned; the trampoline's call keeps it
+        aligned as the ABI requires. */
+        void **sp = (void **)(fiber->stack + LOL_FIBER_STACK_SIZE) - LOL_FIBER_SAVED_WORDS;
+
+        memset(sp, 0, LOL_FIBER_SAVED_WORDS * sizeof *sp);
+        sp[LOL_FIBER_ARG_WORD] = fiber;
+        sp[LOL_FIBER_FUNCTION_WORD] = (void *)(uintptr_t)lol_fiber_main;
+        sp[LOL_FIBER_RETURN_WORD] = (void *)(uintptr_t)lol_fiber_trampoline;
+        fiber->sp = sp;
+    }
+#endif
+    lol_fiber_schedule(fiber);
+    return fiber;
+}
+
+/* Let the other fibers in the queue run first. */
+static inline void lol_fiber_yield(void) {
+    lol_fiber_switch_to_worker(LOL_FIBER_YIELD);
+}
+
+/* Sleep until another fiber or thread calls `lol_fiber_unpark()` on this
+fiber. If it already has, return at once. May also return spuriously, so
+check the condition that you wait for in a loop. Only fibers may park. */
+static inline void lol_fiber_park(void) {
+    struct lol_fiber *self = lol_fiber_get_worker()->current;
+
+    if (__atomic_exchange_n(&self->park_state, LOL_FIBER_RUNNING, __ATOMIC_ACQUIRE) == LOL_FIBER_NOTIFIED) {
+        return;
+    }
+    lol_fiber_switch_to_worker(LOL_FIBER_PARK);
+}
+
+/* Wake a parked fiber, or make its next park return at once. */
+static inline void lol_fiber_unpark(struct lol_fiber *fiber) {
+    uint32_t state = __atomic_load_n(&fiber->park_state, __ATOMIC_ACQUIRE);
+
+    for (;;) {
+        if (state == LOL_FIBER_NOTIFIED) {
+            return;
+        } else if (state == LOL_FIBER_RUNNING) {
+            if (__atomic_compare_exchange_n(&fiber->park_state, &state, LOL_FIBER_NOTIFIED, 1,
+                    __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+                return;
+            }
+        } else if (__atomic_compare_exchange_n(&fiber->park_state, &state, LOL_FIBER_RUNNING, 1,
+                __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            lol_fiber_schedule(fiber);
+            return;
+        }
+    }
+}
+
+/* Wait for a fiber to finish and free its handle. Fibers park while they
+wait, and threads sleep. Only one fiber or thread may join a fiber. */
+static inline void lol_fiber_join(struct lol_fiber *fiber) {
+    struct lol_fiber *self = lol_fiber_self();
+
+    if (self != NULL) {
+        __atomic_store_n(&fiber->joiner, self, __ATOMIC_SEQ_CST);
+        while (!__atomic_load_n(&fiber->done, __ATOMIC_SEQ_CST)) {
+            lol_fiber_park();
+        }
+    } else {
+        __atomic_store_n(&fiber->thread_joining, 1, __ATOMIC_SEQ_CST);
+        while (!__atomic_load_n(&fiber->done, __ATOMIC_SEQ_CST)) {
+            lol_futex_wait(&fiber->done, 0);
+        }
+    }
+    lol_fiber_release(fiber);
+}
+
+/* Free a fiber's handle without waiting; the fiber is freed once it ends. */
+static inline void lol_fiber_detach(struct lol_fiber *fiber) {
+    lol_fiber_release(fiber);
+}
+
+#endif /* LOL_FIBER_H */
@@ -0,0 +1,388 @@
+/*
+ * Heap Profiler
+ *
+ * Samples the allocations made through `lol_alloc()` (see lol_alloc.h) and
+ * records the call stack of each sample, so we can see which call sites
+ * allocate the most bytes and which ones still hold memory. Set the
+ * environment variable `LOL_HEAP_PROFILE` to the file for the report:
+ *
+ * ```sh
+ * lol.py -i prog.lol -o out -fheap-profile
+ * gcc -g -pthread -I src/runtime out/prog-*.c -o prog
+ * LOL_HEAP_PROFILE=prog.heap ./prog
+ * pprof -lines -top prog prog.heap
+ * ```
+ *
+ * The report is written when the program exits, and also (to `<file>.<n>`)
+ * each time the process gets `LOL_HEAP_PROFILE_SIGNAL`, e.g.
+ * `kill -USR2 <pid>`. It is in the text format of gperftools' heap profiler:
+ * for each stack, the estimated live objects and bytes, then (in brackets)
+ * the allocated ones, then the stack's return addresses. The mapping of the
+ * process follows, so pprof can symbolize the addresses from the program's
+ * debug information. With `-fheap-profile`, the compiler emits `#line`
+ * directives, so that debug information points at the Do source rather than
+ * at the emitted C.
+ *
+ * Overhead: without `LOL_HEAP_PROFILE`, none beyond the allocator's check for
+ * hooks. With it, about one allocation per `LOL_HEAP_PROFILE_RATE` bytes is
+ * sampled (taking a stack trace and a lock), and a free costs one extra load
+ * unless its block was sampled. A sampled block of `size` bytes stands for
+ * about `max(size, rate)` allocated bytes, so the counts are estimates.
+ */
+#ifndef LOL_HEAP_PROFILE_H
+#define LOL_HEAP_PROFILE_H
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <execinfo.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lol_alloc.h"
+#include "lol_hints.h"
+#include "lol_random.h"
+
+/* The mean number of bytes allocated between samples (like gperftools). */
+#ifndef LOL_HEAP_PROFILE_RATE
+#define LOL_HEAP_PROFILE_RATE ((size_t)512 << 10)
+#endif
+#ifndef LOL_HEAP_PROFILE_SIGNAL
+#define LOL_HEAP_PROFILE_SIGNAL SIGUSR2
+#endif
+/* Stacks are truncated to this many frames. */
+#define LOL_HEAP_PROFILE_MAX_DEPTH 32
+/* Distinct stacks. Once the table is full, new stacks are not recorded. */
+#define LOL_HEAP_PROFILE_MAX_SITES 4096
+/* Sampled blocks that are live at once. Beyond this, samples are dropped. */
+#define LOL_HEAP_PROFILE_MAX_LIVE ((size_t)1 << 16)
+/* The most frames that the profiler and the allocator put above the call
+site: the sampler, the hook, and lol_alloc_call_hook(), unless inlined. */
+#define LOL_HEAP_PROFILE_MAX_SKIP 8
+
+struct lol_heap_profile_site {
+    uint64_t hash;
+    int depth;
+    void *frames[LOL_HEAP_PROFILE_MAX_DEPTH];
+    /* Estimates, i.e. weighted by each sample's odds of being sampled. */
+    size_t alloc_count;
+    size_t alloc_bytes;
+    size_t live_count;
+    size_t live_bytes;
+};
+
+/* A sampled block that has not been freed yet. */
+struct lol_heap_profile_live {
+    void *pointer;
+    struct lol_heap_profile_site *site;
+    size_t count;
+    size_t bytes;
+};
+
+struct lol_heap_profile {
+    pthread_mutex_t lock;
+    const char *path;
+    size_t rate;
+    int dumps;
+    size_t site_count;
+    /* Samples dropped because a table was full. */
+    size_t dropped;
+    struct lol_heap_profile_site sites[LOL_HEAP_PROFILE_MAX_SITES];
+    /* Open addressing with linear probing, keyed by pointer. */
+    struct lol_heap_profile_live live[LOL_HEAP_PROFILE_MAX_LIVE];
+    /* How many sampled live blocks hash to each slot of `live`, saturating
+    at UCHAR_MAX. Read without the lock to skip unsampled frees. */
+    unsigned char live_filter[LOL_HEAP_PROFILE_MAX_LIVE];
+};
+
+static struct lol_heap_profile lol_heap_profile_state = { PTHREAD_MUTEX_INITIALIZER, NULL, 0, 0, 0, 0, { { 0 } }, { { 0 } }, { 0 } };
+static uint64_t lol_heap_profile_threads = 0;
+/* Bytes left to allocate before the calling thread's next sample. */
+static __thread int64_t lol_heap_profile_countdown = 0;
+static __thread uint64_t lol_heap_profile_random = 0;
+
+static inline size_t lol_heap_profile_slot(const void *pointer) {
+    uint64_t x = (uint64_t)(uintptr_t)pointer;
+
+    return (size_t)((x * UINT64_C(0x9E3779B97F4A7C15)) >> 48) & (LOL_HEAP_PROFILE_MAX_LIVE - 1);
+}
+
+/* Draw the gap to the next sample, uniformly from [1, 2 * rate], so that
+samples are not in step with a loop's allocations. */
+static inline int64_t lol_heap_profile_next_gap(void) {
+    if (lol_heap_profile_random == 0) {
+        /* Give each thread its own sequence. */
+        lol_heap_profile_random = __atomic_add_fetch(&lol_heap_profile_threads, 1, __ATOMIC_RELAXED);
+    }
+    return 1 + (int64_t)(lol_splitmix64_next(&lol_heap_profile_random) % (2 * lol_heap_profile_state.rate));
+}
+
+static struct lol_heap_profile_site *lol_heap_profile_find_site(void **frames, int depth) {
+    struct lol_heap_profile *profile = &lol_heap_profile_state;
+    uint64_t hash = (uint64_t)depth;
+    size_t i = 0;
+    int j = 0;
+
+    for (j = 0; j < depth; ++j) {
+        hash = (hash ^ (uint64_t)(uintptr_t)frames[j]) * UINT64_C(0x100000001B3);
+    }
+    for (i = (size_t)hash % LOL_HEAP_PROFILE_MAX_SITES; ; i = (i + 1) % LOL_HEAP_PROFILE_MAX_SITES) {
+        struct lol_heap_profile_site *site = &profile->sites[i];
+
+        if (site->depth == 0) {
+            if (profile->site_count == LOL_HEAP_PROFILE_MAX_SITES - 1) {
+                /* Keep one slot empty, so that lookups stop. */
+                return NULL;
+            }
+            ++profile->site_count;
+            site->hash = hash;
+            site->depth = depth;
+            memcpy(site->frames, frames, (size_t)depth * sizeof *frames);
+            return site;
+        }
+        if (site->hash == hash && site->depth == depth
+                && memcmp(site->frames, frames, (size_t)depth * sizeof *frames) == 0) {
+            return site;
+        }
+    }
+}
+
+static LOL_COLD void lol_heap_profile_sample(void *pointer, size_t size) {
+    struct lol_heap_profile *profile = &lol_heap_profile_state;
+    void *frames[LOL_HEAP_PROFILE_MAX_DEPTH + LOL_HEAP_PROFILE_MAX_SKIP];
+    int depth = backtrace(frames, LOL_HEAP_PROFILE_MAX_DEPTH + LOL_HEAP_PROFILE_MAX_SKIP);
+    int skip = 0;
+    struct lol_heap_profile_site *site = NULL;
+    /* A block smaller than the rate is sampled with odds of about
+    size / rate, so it stands for rate / size blocks. */
+    size_t count = size >= profile->rate || size == 0 ? 1 : profile->rate / size;
+    size_t bytes = size >= profile->rate ? size : profile->rate;
+    size_t slot = lol_heap_profile_slot(pointer);
+    size_t i = slot;
+
+    /* Start at the call site, however many frames (depending on inlining
+    and tail calls) are above it. */
+    while (skip < depth && frames[skip] != lol_alloc_hook_caller) {
+        ++skip;
+    }
+    if (skip == depth) {
+        /* Not found: keep the whole stack rather than guess. */
+        skip = 0;
+    }
+    if (depth - skip > LOL_HEAP_PROFILE_MAX_DEPTH) {
+        depth = skip + LOL_HEAP_PROFILE_MAX_DEPTH;
+    }
+    if (depth <= skip) {
+        return;
+    }
+    pthread_mutex_lock(&profile->lock);
+    site = lol_heap_profile_find_site(frames + skip, depth - skip);
+    while (site != NULL && profile->live[i].pointer != NULL) {
+        i = (i + 1) & (LOL_HEAP_PROFILE_MAX_LIVE - 1);
+        if (i == slot) {
+            site = NULL;
+        }
+    }
+    if (site == NULL) {
+        ++profile->dropped;
+        pthread_mutex_unlock(&profile->lock);
+        return;
+    }
+    site->alloc_count += count;
+    site->alloc_bytes += bytes;
+    site->live_count += count;
+    site->live_bytes += bytes;
+    profile->live[i].pointer = pointer;
+    profile->live[i].site = site;
+    profile->live[i].count = count;
+    profile->live[i].bytes = bytes;
+    if (profile->live_filter[slot] != (unsigned char)-1) {
+        __atomic_store_n(&profile->live_filter[slot], profile->live_filter[slot] + 1, __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&profile->lock);
+}
+
+static LOL_COLD void lol_heap_profile_unsample(void *pointer) {
+    struct lol_heap_profile *profile = &lol_heap_profile_state;
+    size_t slot = lol_heap_profile_slot(pointer);
+    size_t i = slot;
+    size_t j = 0;
+
+    pthread_mutex_lock(&profile->lock);
+    while (profile->live[i].pointer != pointer) {
+        if (profile->live[i].pointer == NULL) {
+            /* Another block in the same slot was sampled, not this one. */
+            pthread_mutex_unlock(&profile->lock);
+            return;
+        }
+        i = (i + 1) & (LOL_HEAP_PROFILE_MAX_LIVE - 1);
+    }
+    profile->live[i].site->live_count -= profile->live[i].count;
+    profile->live[i].site->live_bytes -= profile->live[i].bytes;
+    if (profile->live_filter[slot] != (unsigned char)-1) {
+        __atomic_store_n(&profile->live_filter[slot], profile->live_filter[slot] - 1, __ATOMIC_RELAXED);
+    }
+    /* Shift later entries back into the hole, so that no probe sequence
+    is cut short. */
+    for (j = (i + 1) & (LOL_HEAP_PROFILE_MAX_LIVE - 1);
+            profile->live[j].pointer != NULL;
+            j = (j + 1) & (LOL_HEAP_PROFILE_MAX_LIVE - 1)) {
+        size_t home = lol_heap_profile_slot(profile->live[j].pointer);
+
+        /* Move it unless its home slot lies cyclically in (i, j]. */
+        if (((j - home) & (LOL_HEAP_PROFILE_MAX_LIVE - 1)) >= ((j - i) & (LOL_HEAP_PROFILE_MAX_LIVE - 1))) {
+            profile->live[i] = profile->live[j];
+            i = j;
+        }
+    }
+    profile->live[i].pointer = NULL;
+    pthread_mutex_unlock(&profile->lock);
+}
+
+static void lol_heap_profile_on_alloc(void *pointer, size_t size) {
+    if ((lol_heap_profile_countdown -= (int64_t)size) > 0) {
+        return;
+    }
+    if (lol_heap_profile_random == 0) {
+        /* The thread's first allocation: start counting down from a random
+        point rather than sampling it. */
+        lol_heap_profile_countdown = lol_heap_profile_next_gap() - (int64_t)size;
+        if (lol_heap_profile_countdown > 0) {
+            return;
+        }
+    }
+    lol_heap_profile_countdown = lol_heap_profile_next_gap();
+    lol_heap_profile_sample(pointer, size);
+}
+
+static void lol_heap_profile_on_free(void *pointer, size_t size) {
+    (void)size;
+    if (LOL_UNLIKELY(__atomic_load_n(
+            &lol_heap_profile_state.live_filter[lol_heap_profile_slot(pointer)],
+            __ATOMIC_RELAXED) != 0)) {
+        lol_heap_profile_unsample(pointer);
+    }
+}
+
+static const struct lol_alloc_hooks lol_heap_profile_hooks = {
+    lol_heap_profile_on_alloc,
+    lol_heap_profile_on_free
+};
+
+/* Write the report to `path`. Return 0 on success. */
+static inline int lol_heap_profile_dump(const char *path) {
+    struct lol_heap_profile *profile = &lol_heap_profile_state;
+    struct lol_heap_profile_site total = { 0 };
+    FILE *file = fopen(path, "w");
+    FILE *maps = NULL;
+    char line[4096];
+    size_t i = 0;
+    int j = 0;
+
+    if (file == NULL) {
+        return -1;
+    }
+    pthread_mutex_lock(&profile->lock);
+    for (i = 0; i < LOL_HEAP_PROFILE_MAX_SITES; ++i) {
+        total.alloc_count += profile->sites[i].alloc_count;
+        total.alloc_bytes += profile->sites[i].alloc_bytes;
+        total.live_count += profile->sites[i].live_count;
+        total.live_bytes += profile->sites[i].live_bytes;
+    }
+    fprintf(file, "heap profile: %6zu: %8zu [%6zu: %8zu] @ heapprofile\n",
+        total.live_count, total.live_bytes, total.alloc_count, total.alloc_bytes);
+    for (i = 0; i < LOL_HEAP_PROFILE_MAX_SITES; ++i) {
+        const struct lol_heap_profile_site *site = &profile->sites[i];
+
+        if (site->depth == 0) {
+            continue;
+        }
+        fprintf(file, "%6zu: %8zu [%6zu: %8zu] @",
+            site->live_count, site->live_bytes, site->alloc_count, site->alloc_bytes);
+        for (j = 0; j < site->depth; ++j) {
+            fprintf(file, " %p", site->frames[j]);
+        }
+        fputc('\n', file);
+    }
+    if (profile->dropped != 0) {
+        fprintf(stderr, "lol_heap_profile: dropped %zu samples (tables full)\n", profile->dropped);
+    }
+    pthread_mutex_unlock(&profile->lock);
+    /* So that pprof can map the addresses back to the program. */
+    fputs("\nMAPPED_LIBRARIES:\n", file);
+    if ((maps = fopen("/proc/self/maps", "r")) != NULL) {
+        while (fgets(line, sizeof line, maps) != NULL) {
+            fputs(line, file);
+        }
+        fclose(maps);
+    }
+    return fclose(file) == 0 ? 0 : -1;
+}
+
+static void lol_heap_profile_dump_at_exit(void) {
+    if (lol_heap_profile_dump(lol_heap_profile_state.path) != 0) {
+        perror(lol_heap_profile_state.path);
+    }
+}
+
+/* Wait for the dump signal, which every other thread blocks. */
+static void *lol_heap_profile_signal_thread(void *arg) {
+    sigset_t *signals = arg;
+    char path[4096];
+    int number = 0;
+
+    while (sigwait(signals, &number) == 0) {
+        snprintf(path, sizeof path, "%s.%d", lol_heap_profile_state.path, ++lol_heap_profile_state.dumps);
+        if (lol_heap_profile_dump(path) != 0) {
+            perror(path);
+        }
+    }
+    return NULL;
+}
+
+/* Start profiling, with a report written to `path` at exit and on
+`LOL_HEAP_PROFILE_SIGNAL`. Call it before starting any threads, so that they
+inherit the blocked signal. Return 0 on success. */
+static inline int lol_heap_profile_start(const char *path, size_t rate) {
+    static sigset_t signals;
+    pthread_t thread;
+    void *frames[1];
+
+    lol_heap_profile_state.path = path;
+    lol_heap_profile_state.rate = rate == 0 ? 1 : rate;
+    /* backtrace() loads libgcc on first use; do it now, not in a hook. */
+    (void)backtrace(frames, 1);
+    sigemptyset(&signals);
+    sigaddset(&signals, LOL_HEAP_PROFILE_SIGNAL);
+    if (pthread_sigmask(SIG_BLOCK, &signals, NULL) == 0
+            && pthread_create(&thread, NULL, lol_heap_profile_signal_thread, &signals) == 0) {
+        (void)pthread_detach(thread);
+    }
+    if (atexit(lol_heap_profile_dump_at_exit) != 0) {
+        return -1;
+    }
+    lol_alloc_set_hooks(&lol_heap_profile_hooks);
+    return 0;
+}
+
+/* Start profiling before main() if `LOL_HEAP_PROFILE` is set. The rate may
+be overridden with `LOL_HEAP_PROFILE_RATE` (in bytes). */
+static LOL_COLD __attribute__((constructor)) void lol_heap_profile_init(void) {
+    const char *path = getenv("LOL_HEAP_PROFILE");
+    const char *rate = getenv("LOL_HEAP_PROFILE_RATE");
+
+    if (path == NULL || *path == '\0') {
+        return;
+    }
+    if (lol_heap_profile_start(path, rate != NULL ? (size_t)strtoull(rate, NULL, 10) : LOL_HEAP_PROFILE_RATE) != 0) {
+        perror("lol_heap_profile_start");
+    }
+}
+
+#endif /* LOL_HEAP_PROFILE_H */
@@ -0,0 +1,70 @@
+/*
+ * Compiler Hints
+ *
+ * Portable wrappers around the GCC/Clang builtins that the emitted code uses
+ * to tell the C compiler what it knows (or what the programmer promised).
+ * Other compilers get the same semantics without the hint.
+ */
+#ifndef LOL_HINTS_H
+#define LOL_HINTS_H
+
+#if defined(__GNUC__) || defined(__clang__)
+#define LOL_LIKELY(x) __builtin_expect(!!(x), 1)
+#define LOL_UNLIKELY(x) __builtin_expect(!!(x), 0)
+/* Rarely executed: optimize for size and place it away from the hot code. */
+#define LOL_COLD __attribute__((cold, noinline))
+#define LOL_NORETURN __attribute__((noreturn))
+#define LOL_UNUSED __attribute__((unused))
+/* Inlined even at -O0, e.g. so that it never shows up in stack traces. */
+#define LOL_ALWAYS_INLINE inline __attribute__((always_inline))
+#else
+#define LOL_LIKELY(x) (x)
+#define LOL_UNLIKELY(x) (x)
+#define LOL_COLD
+#define LOL_NORETURN
+#define LOL_UNUSED
+#define LOL_ALWAYS_INLINE inline
+#endif
+
+/* The pointer parameters at the given (1-based) positions are never null. E.g.
+`LOL_NONNULL(1, 3) int f(char *a, int b, char *c);` */
+#if defined(__GNUC__) || defined(__clang__)
+#define LOL_NONNULL(...) __attribute__((nonnull(__VA_ARGS__)))
+#else
+#define LOL_NONNULL(...)
+#endif
+
+/* Put the code after a label in the cold section. E.g. `error: LOL_COLD_LABEL;`
+Clang only accepts the cold attribute on functions. */
+#if defined(__GNUC__) && !defined(__clang__)
+#define LOL_COLD_LABEL __attribute__((cold))
+#else
+#define LOL_COLD_LABEL
+#endif
+
+/* Let the compiler assume that `x` is true without evaluating it at runtime.
+Undefined behaviour if `x` is false! */
+#if defined(__clang__)
+#define LOL_ASSUME_HINT(x) __builtin_assume(x)
+#elif defined(__GNUC__)
+#define LOL_ASSUME_HINT(x)                                                      \
+    do {                                                                        \
+        if (!(x)) {                                                             \
+            __builtin_unreachable();                                            \
+        }                                                                       \
+    } while (0)
+#else
+#define LOL_ASSUME_HINT(x) ((void)0)
+#endif
+
+/* Defined when building with ThreadSanitizer, which needs some code to be
+written differently (e.g. it does not model fences). */
+#if defined(__SANITIZE_THREAD__)
+#define LOL_TSAN
+#elif defined(__has_feature)
+#if __has_feature(thread_sanitizer)
+#define LOL_TSAN
+#endif
+#endif
+
+#endif /* LOL_HINTS_H */
@@ -0,0 +1,512 @@
+/*
+ * Locks
+ *
+ * A mutex, a readers-writer lock and a condition variable, built directly on
+ * Linux futexes. Taking a free lock is one atomic compare-and-swap, and
+ * releasing a lock that nobody waits for is one atomic exchange; only waiting
+ * and waking make system calls.
+ *
+ * ```c
+ * static struct lol_mutex lock = LOL_MUTEX_INITIALIZER;
+ * lol_mutex_lock(&lock);
+ * ...
+ * lol_mutex_unlock(&lock);
+ * ```
+ *
+ * A thread that finds a mutex taken spins for a while before it sleeps,
+ * since the owner will usually release it sooner than a sleep and wake-up
+ * take. How long it spins adapts to how long it took to get each lock
+ * recently (as with glibc's PTHREAD_MUTEX_ADAPTIVE_NP), up to
+ * `LOL_LOCK_MAX_SPINS` pauses.
+ *
+ * Readers-writer locks prefer writers: once a writer waits, new readers wait
+ * too, so that writers are not starved.
+ *
+ * With -DLOL_LOCK_PROFILE, every place that takes a lock records how often it
+ * did, how often it had to wait, and how long it waited for and held the lock
+ * (held only for mutexes and write locks). Places are `__FILE__:__LINE__`, so
+ * with a source map (see -fheap-profile) they are lines of Do source. The
+ * report, sorted by total wait, is written at exit to the file named by the
+ * environment variable `LOL_LOCK_PROFILE` ("-" for stderr).
+ */
+#ifndef LOL_LOCK_H
+#define LOL_LOCK_H
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <limits.h>
+#include <linux/futex.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#ifdef LOL_LOCK_PROFILE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#endif
+
+#include "lol_hints.h"
+
+#ifndef LOL_LOCK_MAX_SPINS
+#define LOL_LOCK_MAX_SPINS 100
+#endif
+
+/* Where a lock is taken, for the contention profile. */
+struct lol_lock_site {
+    const char *file;
+    int line;
+    const char *kind;
+    uint64_t acquisitions;
+    uint64_t contentions;
+    uint64_t wait_ns;
+    uint64_t max_wait_ns;
+    uint64_t hold_ns;
+    int registered;
+    struct lol_lock_site *next;
+};
+
+struct lol_mutex {
+    /* 0 if free, 1 if held, and 2 if held and someone may be asleep. */
+    uint32_t state;
+    /* The average number of spins that it took to get the lock. */
+    uint32_t spins;
+#ifdef LOL_LOCK_PROFILE
+    struct lol_lock_site *site;
+    uint64_t acquired_ns;
+#endif
+};
+
+/* The readers-writer lock's state: a count of readers and these flags. */
+#define LOL_RWLOCK_WRITER 0x80000000u
+#define LOL_RWLOCK_WRITER_WAITING 0x40000000u
+#define LOL_RWLOCK_SLEEPING 0x20000000u
+#define LOL_RWLOCK_READERS 0x1fffffffu
+
+struct lol_rwlock {
+    uint32_t state;
+#ifdef LOL_LOCK_PROFILE
+    struct lol_lock_site *site;
+    uint64_t acquired_ns;
+#endif
+};
+
+struct lol_condvar {
+    /* Bumped by every signal, so that a waiter sees whether it missed one. */
+    uint32_t sequence;
+    uint32_t waiters;
+};
+
+#define LOL_MUTEX_INITIALIZER { 0 }
+#define LOL_RWLOCK_INITIALIZER { 0 }
+#define LOL_CONDVAR_INITIALIZER { 0, 0 }
+
+/******************************************************************************/
+/* FUTEXES                                                                    */
+/******************************************************************************/
+
+/* Sleep while `*address == expected` (or until a spurious wake-up). */
+static inline void lol_futex_wait(uint32_t *address, uint32_t expected) {
+    (void)syscall(SYS_futex, address, FUTEX_WAIT_PRIVATE, expected, NULL, NULL, 0);
+}
+
+static inline void lol_futex_wake(uint32_t *address, int count) {
+    (void)syscall(SYS_futex, address, FUTEX_WAKE_PRIVATE, count, NULL, NULL, 0);
+}
+
+/* Tell the CPU that we are spinning, which saves power and lets the other
+hyper-thread run. */
+static inline void lol_lock_pause(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    __asm__ __volatile__("yield");
+#endif
+}
+
+/******************************************************************************/
+/* PROFILE                                                                    */
+/******************************************************************************/
+
+#ifdef LOL_LOCK_PROFILE
+static struct lol_lock_site *lol_lock_sites = NULL;
+
+static inline uint64_t lol_lock_now_ns(void) {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000 + (uint64_t)now.tv_nsec;
+}
+
+static LOL_COLD void lol_lock_register_site(struct lol_lock_site *site) {
+    int expected = 0;
+
+    if (!__atomic_compare_exchange_n(&site->registered, &expected, 1, 0,
+            __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        return;
+    }
+    site->next = __atomic_load_n(&lol_lock_sites, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&lol_lock_sites, &site->next, site, 1,
+            __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+    }
+}
+
+/* Record an acquisition at `site` that waited from `start_ns` (or 0 if it
+did not wait), and return the time at which the lock was taken. */
+static inline uint64_t lol_lock_record_acquisition(struct lol_lock_site *site, uint64_t start_ns) {
+    uint64_t now = lol_lock_now_ns();
+    uint64_t wait = start_ns == 0 ? 0 : now - start_ns;
+    uint64_t max_wait = 0;
+
+    if (LOL_UNLIKELY(!__atomic_load_n(&site->registered, __ATOMIC_RELAXED))) {
+        lol_lock_register_site(site);
+    }
+    (void)__atomic_fetch_add(&site->acquisitions, 1, __ATOMIC_RELAXED);
+    if (start_ns != 0) {
+        (void)__atomic_fetch_add(&site->contentions, 1, __ATOMIC_RELAXED);
+        (void)__atomic_fetch_add(&site->wait_ns, wait, __ATOMIC_RELAXED);
+        max_wait = __atomic_load_n(&site->max_wait_ns, __ATOMIC_RELAXED);
+        while (wait > max_wait && !__atomic_compare_exchange_n(&site->max_wait_ns, &max_wait, wait, 1,
+                __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        }
+    }
+    return now;
+}
+
+static inline void lol_lock_record_release(struct lol_lock_site *site, uint64_t acquired_ns) {
+    if (site != NULL) {
+        (void)__atomic_fetch_add(&site->hold_ns, lol_lock_now_ns() - acquired_ns, __ATOMIC_RELAXED);
+    }
+}
+
+static int lol_lock_compare_sites(const void *a, const void *b) {
+    uint64_t x = (*(struct lol_lock_site *const *)a)->wait_ns;
+    uint64_t y = (*(struct lol_lock_site *const *)b)->wait_ns;
+
+    return x < y ? 1 : x > y ? -1 : 0;
+}
+
+/* Write one line per site, the one with the most total wait first. */
+static inline void lol_lock_profile_write(FILE *file) {
+    /* Sites are added at the head, so the list after it does not change. */
+    struct lol_lock_site *head = __atomic_load_n(&lol_lock_sites, __ATOMIC_ACQUIRE);
+    struct lol_lock_site *site = NULL;
+    struct lol_lock_site **sites = NULL;
+    size_t count = 0;
+    size_t i = 0;
+
+    for (site = head; site != NULL; site = site->next) {
+        ++count;
+    }
+    sites = malloc((count == 0 ? 1 : count) * sizeof *sites);
+    if (sites == NULL) {
+        return;
+    }
+    for (site = head; site != NULL; site = site->next) {
+        sites[i++] = site;
+    }
+    qsort(sites, count, sizeof *sites, lol_lock_compare_sites);
+    fprintf(file, "%14s %14s %12s %12s %14s %-6s %s\n",
+        "wait_ns", "hold_ns", "acquisitions", "contentions", "max_wait_ns", "kind", "site");
+    for (i = 0; i < count; ++i) {
+        fprintf(file, "%14llu %14llu %12llu %12llu %14llu %-6s %s:%d\n",
+            (unsigned long long)__atomic_load_n(&sites[i]->wait_ns, __ATOMIC_RELAXED),
+            (unsigned long long)__atomic_load_n(&sites[i]->hold_ns, __ATOMIC_RELAXED),
+            (unsigned long long)__atomic_load_n(&sites[i]->acquisitions, __ATOMIC_RELAXED),
+            (unsigned long long)__atomic_load_n(&sites[i]->contentions, __ATOMIC_RELAXED),
+            (unsigned long long)__atomic_load_n(&sites[i]->max_wait_ns, __ATOMIC_RELAXED),
+            sites[i]->kind, sites[i]->file, sites[i]->line);
+    }
+    free(sites);
+}
+
+static void lol_lock_profile_at_exit(void) {
+    const char *path = getenv("LOL_LOCK_PROFILE");
+    FILE *file = NULL;
+
+    if (strcmp(path, "-") == 0) {
+        lol_lock_profile_write(stderr);
+    } else if ((file = fopen(path, "w")) != NULL) {
+        lol_lock_profile_write(file);
+        fclose(file);
+    } else {
+        perror("lol_lock_profile");
+    }
+}
+
+static LOL_COLD __attribute__((constructor)) void lol_lock_profile_init(void) {
+    const char *path = getenv("LOL_LOCK_PROFILE");
+
+    if (path != NULL && *path != '\0') {
+        (void)atexit(lol_lock_profile_at_exit);
+    }
+}
+#endif /* LOL_LOCK_PROFILE */
+
+/******************************************************************************/
+/* MUTEX                                                                      */
+/******************************************************************************/
+
+static inline int lol_mutex_trylock(struct lol_mutex *mutex) {
+    uint32_t expected = 0;
+
+    return __atomic_compare_exchange_n(&mutex->state, &expected, 1, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+}
+
+static LOL_COLD void lol_mutex_lock_slow(struct lol_mutex *mutex) {
+    uint32_t spins = __atomic_load_n(&mutex->spins, __ATOMIC_RELAXED);
+    uint32_t limit = 2 * spins + 10;
+    uint32_t i = 0;
+
+    if (limit > LOL_LOCK_MAX_SPINS) {
+        limit = LOL_LOCK_MAX_SPINS;
+    }
+    for (i = 0; i < limit; ++i) {
+        if (__atomic_load_n(&mutex->state, __ATOMIC_RELAXED) == 0 && lol_mutex_trylock(mutex)) {
+            /* Move the average an eighth of the way to this lock's spins. */
+            __atomic_store_n(&mutex->spins, spins + ((int32_t)(i - spins)) / 8, __ATOMIC_RELAXED);
+            return;
+        }
+        lol_lock_pause();
+    }
+    __atomic_store_n(&mutex->spins, spins + ((int32_t)(limit - spins)) / 8, __ATOMIC_RELAXED);
+    /* Mark the mutex as having sleepers (which we may be), so that the owner
+    wakes one when it unlocks. */
+    while (__atomic_exchange_n(&mutex->state, 2, __ATOMIC_ACQUIRE) != 0) {
+        lol_futex_wait(&mutex->state, 2);
+    }
+}
+
+static inline void lol_mutex_lock_unprofiled(struct lol_mutex *mutex) {
+    if (LOL_UNLIKELY(!lol_mutex_trylock(mutex))) {
+        lol_mutex_lock_slow(mutex);
+    }
+}
+
+static inline void lol_mutex_unlock_unprofiled(struct lol_mutex *mutex) {
+    if (LOL_UNLIKELY(__atomic_exchange_n(&mutex->state, 0, __ATOMIC_RELEASE) == 2)) {
+        lol_futex_wake(&mutex->state, 1);
+    }
+}
+
+#ifdef LOL_LOCK_PROFILE
+static inline void lol_mutex_lock_at(struct lol_mutex *mutex, struct lol_lock_site *site) {
+    uint64_t start = 0;
+
+    if (LOL_UNLIKELY(!lol_mutex_trylock(mutex))) {
+        start = lol_lock_now_ns();
+        lol_mutex_lock_slow(mutex);
+    }
+    mutex->acquired_ns = lol_lock_record_acquisition(site, start);
+    mutex->site = site;
+}
+
+static inline void lol_mutex_unlock(struct lol_mutex *mutex) {
+    struct lol_lock_site *site = mutex->site;
+
+    /* A lock taken by lol_mutex_trylock() has no site. */
+    mutex->site = NULL;
+    lol_lock_record_release(site, mutex->acquired_ns);
+    lol_mutex_unlock_unprofiled(mutex);
+}
+#else
+static inline void lol_mutex_lock(struct lol_mutex *mutex) {
+    lol_mutex_lock_unprofiled(mutex);
+}
+
+static inline void lol_mutex_unlock(struct lol_mutex *mutex) {
+    lol_mutex_unlock_unprofiled(mutex);
+}
+#endif /* LOL_LOCK_PROFILE */
+
+/******************************************************************************/
+/* READERS-WRITER LOCK                                                        */
+/******************************************************************************/
+
+/* Sleep until `state` changes from `seen`, after marking that someone sleeps. */
+static LOL_COLD void lol_rwlock_sleep(struct lol_rwlock *lock, uint32_t seen, uint32_t flags) {
+    uint32_t marked = seen | flags | LOL_RWLOCK_SLEEPING;
+
+    if (marked == seen || __atomic_compare_exchange_n(&lock->state, &seen, marked, 0,
+            __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        lol_futex_wait(&lock->state, marked);
+    }
+}
+
+/* Wake everyone if anyone sleeps, now that the lock is free. They race for
+it again, and the waiting writers mark themselves again. */
+static inline void lol_rwlock_wake(struct lol_rwlock *lock, uint32_t released) {
+    if (LOL_UNLIKELY(released & LOL_RWLOCK_SLEEPING)) {
+        (void)__atomic_fetch_and(&lock->state, ~(LOL_RWLOCK_SLEEPING | LOL_RWLOCK_WRITER_WAITING),
+            __ATOMIC_RELAXED);
+        lol_futex_wake(&lock->state, INT_MAX);
+    }
+}
+
+static inline void lol_rwlock_read_lock_unprofiled(struct lol_rwlock *lock, int *waited) {
+    uint32_t state = __atomic_load_n(&lock->state, __ATOMIC_RELAXED);
+    uint32_t spins = 0;
+
+    for (;;) {
+        if (LOL_LIKELY(!(state & (LOL_RWLOCK_WRITER | LOL_RWLOCK_WRITER_WAITING)))) {
+            if (__atomic_compare_exchange_n(&lock->state, &state, state + 1, 1,
+                    __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+                return;
+            }
+            continue;
+        }
+        *waited = 1;
+        if (spins < LOL_LOCK_MAX_SPINS) {
+            ++spins;
+            lol_lock_pause();
+        } else {
+            lol_rwlock_sleep(lock, state, 0);
+        }
+        state = __atomic_load_n(&lock->state, __ATOMIC_RELAXED);
+    }
+}
+
+static inline void lol_rwlock_write_lock_unprofiled(struct lol_rwlock *lock, int *waited) {
+    uint32_t state = 0;
+    uint32_t spins = 0;
+
+    if (LOL_LIKELY(__atomic_compare_exchange_n(&lock->state, &state, LOL_RWLOCK_WRITER, 0,
+            __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))) {
+        return;
+    }
+    *waited = 1;
+    for (;;) {
+        if (!(state & (LOL_RWLOCK_WRITER | LOL_RWLOCK_READERS))) {
+            /* Keep the flags, since others may still wait. */
+            if (__atomic_compare_exchange_n(&lock->state, &state, state | LOL_RWLOCK_WRITER, 1,
+                    __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+                return;
+            }
+            continue;
+        }
+        if (spins < LOL_LOCK_MAX_SPINS) {
+            ++spins;
+            lol_lock_pause();
+        } else {
+            lol_rwlock_sleep(lock, state, LOL_RWLOCK_WRITER_WAITING);
+        }
+        state = __atomic_load_n(&lock->state, __ATOMIC_RELAXED);
+    }
+}
+
+static inline void lol_rwlock_read_unlock(struct lol_rwlock *lock) {
+    uint32_t released = __atomic_fetch_sub(&lock->state, 1, __ATOMIC_RELEASE);
+
+    if ((released & LOL_RWLOCK_READERS) == 1) {
+        lol_rwlock_wake(lock, released);
+    }
+}
+
+static inline void lol_rwlock_write_unlock_unprofiled(struct lol_rwlock *lock) {
+    lol_rwlock_wake(lock, __atomic_fetch_and(&lock->state, ~LOL_RWLOCK_WRITER, __ATOMIC_RELEASE));
+}
+
+#ifdef LOL_LOCK_PROFILE
+static inline void lol_rwlock_read_lock_at(struct lol_rwlock *lock, struct lol_lock_site *site) {
+    uint64_t start = lol_lock_now_ns();
+    int waited = 0;
+
+    lol_rwlock_read_lock_unprofiled(lock, &waited);
+    (void)lol_lock_record_acquisition(site, waited ? start : 0);
+}
+
+static inline void lol_rwlock_write_lock_at(struct lol_rwlock *lock, struct lol_lock_site *site) {
+    uint64_t start = lol_lock_now_ns();
+    int waited = 0;
+
+    lol_rwlock_write_lock_unprofiled(lock, &waited);
+    lock->acquired_ns = lol_lock_record_acquisition(site, waited ? start : 0);
+    lock->site = site;
+}
+
+static inline void lol_rwlock_write_unlock(struct lol_rwlock *lock) {
+    struct lol_lock_site *site = lock->site;
+
+    lock->site = NULL;
+    lol_lock_record_release(site, lock->acquired_ns);
+    lol_rwlock_write_unlock_unprofiled(lock);
+}
+#else
+static inline void lol_rwlock_read_lock(struct lol_rwlock *lock) {
+    int waited = 0;
+
+    lol_rwlock_read_lock_unprofiled(lock, &waited);
+}
+
+static inline void lol_rwlock_write_lock(struct lol_rwlock *lock) {
+    int waited = 0;
+
+    lol_rwlock_write_lock_unprofiled(lock, &waited);
+}
+
+static inline void lol_rwlock_write_unlock(struct lol_rwlock *lock) {
+    lol_rwlock_write_unlock_unprofiled(lock);
+}
+#endif /* LOL_LOCK_PROFILE */
+
+/******************************************************************************/
+/* CONDITION VARIABLE                                                         */
+/******************************************************************************/
+
+/* Unlock the mutex, sleep until signalled (or a spurious wake-up, so check
+the condition in a loop), and lock the mutex again. */
+static inline void lol_condvar_wait(struct lol_condvar *condvar, struct lol_mutex *mutex) {
+    uint32_t sequence = 0;
+#ifdef LOL_LOCK_PROFILE
+    struct lol_lock_site *site = mutex->site;
+#endif
+
+    /* Sequentially consistent, so that a signaller either sees us waiting or
+    bumps the sequence before we read it. */
+    (void)__atomic_fetch_add(&condvar->waiters, 1, __ATOMIC_SEQ_CST);
+    sequence = __atomic_load_n(&condvar->sequence, __ATOMIC_SEQ_CST);
+    lol_mutex_unlock(mutex);
+    lol_futex_wait(&condvar->sequence, sequence);
+    (void)__atomic_fetch_sub(&condvar->waiters, 1, __ATOMIC_RELAXED);
+#ifdef LOL_LOCK_PROFILE
+    if (site != NULL) {
+        lol_mutex_lock_at(mutex, site);
+        return;
+    }
+#endif
+    lol_mutex_lock_unprofiled(mutex);
+}
+
+static inline void lol_condvar_signal(struct lol_condvar *condvar) {
+    (void)__atomic_fetch_add(&condvar->sequence, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&condvar->waiters, __ATOMIC_SEQ_CST) != 0) {
+        lol_futex_wake(&condvar->sequence, 1);
+    }
+}
+
+/* Wake every waiter. They then take turns at the mutex. */
+static inline void lol_condvar_broadcast(struct lol_condvar *condvar) {
+    (void)__atomic_fetch_add(&condvar->sequence, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&condvar->waiters, __ATOMIC_SEQ_CST) != 0) {
+        lol_futex_wake(&condvar->sequence, INT_MAX);
+    }
+}
+
+#ifdef LOL_LOCK_PROFILE
+/* Each place that takes a lock gets its own site. */
+#define LOL_LOCK_AT(function, lock, kind)                                       \
+    do {                                                                        \
+        static struct lol_lock_site LOLlock_site = {                            \
+            __FILE__, __LINE__, kind, 0, 0, 0, 0, 0, 0, NULL                    \
+        };                                                                      \
+        function((lock), &LOLlock_site);                                        \
+    } while (0)
+#define lol_mutex_lock(mutex) LOL_LOCK_AT(lol_mutex_lock_at, mutex, "mutex")
+#define lol_rwlock_read_lock(lock) LOL_LOCK_AT(lol_rwlock_read_lock_at, lock, "read")
+#define lol_rwlock_write_lock(lock) LOL_LOCK_AT(lol_rwlock_write_lock_at, lock, "write")
+#endif /* LOL_LOCK_PROFILE */
+
+#endif /* LOL_LOCK_H */
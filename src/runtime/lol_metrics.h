@@ -0,0 +1,421 @@
+/*
+ * Metrics
+ *
+ * Counters, gauges and latency histograms for operational metrics, written in
+ * the Prometheus text format:
+ *
+ * ```c
+ * struct lol_metric *requests = lol_metrics_counter("requests_total", "Requests handled.");
+ * struct lol_metric *latency = lol_metrics_histogram("request_ns", "Request latency (ns).");
+ *
+ * uint64_t start = lol_metrics_now_ns();
+ * ... handle the request ...
+ * lol_counter_inc(requests);
+ * lol_histogram_record(latency, lol_metrics_now_ns() - start);
+ * ```
+ *
+ * Updates are cheap enough for hot paths (a few nanoseconds): threads are
+ * spread over `LOL_METRICS_SHARDS` shards, each with its own copy of every
+ * counter and histogram bucket, so an update is one uncontended atomic add.
+ * Reads sum the shards. Gauges are single values, since setting one only
+ * makes sense globally.
+ *
+ * Histograms are log-linear: exact below 16, then four buckets per power of
+ * two, so a bucket's bounds are within 25% of any value in it, from
+ * nanoseconds to centuries. Only the buckets that are not empty are written.
+ *
+ * Registration is idempotent (the same name gives the same metric), never
+ * fails (once the registry is full, updates to the metric are discarded), and
+ * keeps the name and help pointers, so pass string literals.
+ *
+ * `lol_metrics_start_dump()` writes every metric periodically to a file
+ * (replaced atomically, e.g. for node_exporter's textfile collector) or to a
+ * Unix socket ("unix:/path"), and once more at exit. Setting the environment
+ * variable `LOL_METRICS_DUMP` (and optionally `LOL_METRICS_PERIOD_MS`) starts
+ * it before main().
+ */
+#ifndef LOL_METRICS_H
+#define LOL_METRICS_H
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "lol_hints.h"
+
+#ifndef LOL_METRICS_SHARDS
+#define LOL_METRICS_SHARDS 16
+#endif
+/* Counter and histogram values per shard. A counter takes 1, a histogram
+`LOL_METRICS_HISTOGRAM_SLOTS`. */
+#ifndef LOL_METRICS_SLOTS
+#define LOL_METRICS_SLOTS 4096
+#endif
+#ifndef LOL_METRICS_MAX_METRICS
+#define LOL_METRICS_MAX_METRICS 256
+#endif
+#define LOL_METRICS_DEFAULT_PERIOD_MS 10000
+
+/* Buckets 0-15 hold the values 0-15; then each power of two has 4. */
+#define LOL_METRICS_HISTOGRAM_BUCKETS (16 + (64 - 4) * 4)
+/* The buckets, then the sum of the values. */
+#define LOL_METRICS_HISTOGRAM_SLOTS (LOL_METRICS_HISTOGRAM_BUCKETS + 1)
+
+enum lol_metric_kind {
+    LOL_METRIC_COUNTER,
+    LOL_METRIC_GAUGE,
+    LOL_METRIC_HISTOGRAM
+};
+
+struct lol_metric {
+    enum lol_metric_kind kind;
+    const char *name;
+    const char *help;
+    /* The first slot (counters and histograms) or the gauge's index. Index 0
+    is where the updates of discarded metrics go. */
+    unsigned index;
+};
+
+struct lol_metrics_shard {
+    uint64_t values[LOL_METRICS_SLOTS];
+};
+
+/* Aligned so that shards never share a cache line. */
+static struct lol_metrics_shard lol_metrics_shards[LOL_METRICS_SHARDS] __attribute__((aligned(64)));
+static int64_t lol_metrics_gauges[LOL_METRICS_MAX_METRICS];
+static struct lol_metric lol_metrics_registry[LOL_METRICS_MAX_METRICS];
+static struct lol_metric lol_metrics_discarded = { LOL_METRIC_COUNTER, "", NULL, 0 };
+/* Published with a release store once the metric is filled in. */
+static unsigned lol_metrics_count = 0;
+/* Slot 0 and gauge 0 discard updates. */
+static unsigned lol_metrics_used_slots = 1;
+static unsigned lol_metrics_used_gauges = 1;
+static pthread_mutex_t lol_metrics_lock = PTHREAD_MUTEX_INITIALIZER;
+static unsigned lol_metrics_thread_count = 0;
+static __thread struct lol_metrics_shard *lol_metrics_self = NULL;
+
+/******************************************************************************/
+/* REGISTRATION                                                               */
+/******************************************************************************/
+
+/* Return the metric called `name`, registering it if needed, or the
+discarded metric if the registry is full or the name has another kind. */
+static LOL_COLD struct lol_metric *lol_metrics_register(
+    enum lol_metric_kind kind,
+    const char *name,
+    const char *help,
+    unsigned slots
+) {
+    struct lol_metric *metric = NULL;
+    struct lol_metric *result = &lol_metrics_discarded;
+    unsigned i = 0;
+
+    pthread_mutex_lock(&lol_metrics_lock);
+    for (i = 0; i < lol_metrics_count; ++i) {
+        if (strcmp(lol_metrics_registry[i].name, name) == 0) {
+            if (lol_metrics_registry[i].kind == kind) {
+                result = &lol_metrics_registry[i];
+            }
+            pthread_mutex_unlock(&lol_metrics_lock);
+            return result;
+        }
+    }
+    if (lol_metrics_count < LOL_METRICS_MAX_METRICS) {
+        metric = &lol_metrics_registry[lol_metrics_count];
+        if (kind == LOL_METRIC_GAUGE && lol_metrics_used_gauges < LOL_METRICS_MAX_METRICS) {
+            metric->index = lol_metrics_used_gauges++;
+            result = metric;
+        } else if (kind != LOL_METRIC_GAUGE && lol_metrics_used_slots + slots <= LOL_METRICS_SLOTS) {
+            metric->index = lol_metrics_used_slots;
+            lol_metrics_used_slots += slots;
+            result = metric;
+        }
+    }
+    if (result != &lol_metrics_discarded) {
+        metric->kind = kind;
+        metric->name = name;
+        metric->help = help;
+        __atomic_store_n(&lol_metrics_count, lol_metrics_count + 1, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&lol_metrics_lock);
+    return result;
+}
+
+static inline struct lol_metric *lol_metrics_counter(const char *name, const char *help) {
+    return lol_metrics_register(LOL_METRIC_COUNTER, name, help, 1);
+}
+
+static inline struct lol_metric *lol_metrics_gauge(const char *name, const char *help) {
+    return lol_metrics_register(LOL_METRIC_GAUGE, name, help, 0);
+}
+
+static inline struct lol_metric *lol_metrics_histogram(const char *name, const char *help) {
+    return lol_metrics_register(LOL_METRIC_HISTOGRAM, name, help, LOL_METRICS_HISTOGRAM_SLOTS);
+}
+
+/******************************************************************************/
+/* UPDATES                                                                    */
+/******************************************************************************/
+
+static LOL_COLD struct lol_metrics_shard *lol_metrics_assign_shard(void) {
+    unsigned thread = __atomic_fetch_add(&lol_metrics_thread_count, 1, __ATOMIC_RELAXED);
+
+    lol_metrics_self = &lol_metrics_shards[thread % LOL_METRICS_SHARDS];
+    return lol_metrics_self;
+}
+
+static inline struct lol_metrics_shard *lol_metrics_get_shard(void) {
+    struct lol_metrics_shard *shard = lol_metrics_self;
+
+    if (LOL_UNLIKELY(shard == NULL)) {
+        shard = lol_metrics_assign_shard();
+    }
+    return shard;
+}
+
+static inline void lol_counter_add(const struct lol_metric *counter, uint64_t n) {
+    /* Atomic only because threads may share a shard; it is uncontended
+    otherwise. */
+    (void)__atomic_fetch_add(&lol_metrics_get_shard()->values[counter->index], n, __ATOMIC_RELAXED);
+}
+
+static inline void lol_counter_inc(const struct lol_metric *counter) {
+    lol_counter_add(counter, 1);
+}
+
+static inline void lol_gauge_set(const struct lol_metric *gauge, int64_t value) {
+    __atomic_store_n(&lol_metrics_gauges[gauge->index], value, __ATOMIC_RELAXED);
+}
+
+static inline void lol_gauge_add(const struct lol_metric *gauge, int64_t delta) {
+    (void)__atomic_fetch_add(&lol_metrics_gauges[gauge->index], delta, __ATOMIC_RELAXED);
+}
+
+/* Get the histogram bucket of a value. */
+static inline unsigned lol_metrics_bucket(uint64_t value) {
+    unsigned log2 = 0;
+
+    if (value < 16) {
+        return (unsigned)value;
+    }
+    log2 = 63 - (unsigned)__builtin_clzll((unsigned long long)value);
+    return 16 + (log2 - 4) * 4 + (unsigned)((value >> (log2 - 2)) & 3);
+}
+
+/* Get the largest value in a histogram bucket. */
+static inline uint64_t lol_metrics_bucket_bound(unsigned bucket) {
+    unsigned log2 = 0;
+
+    if (bucket < 16) {
+        return bucket;
+    }
+    log2 = 4 + (bucket - 16) / 4;
+    /* Written so that the last bucket does not overflow. */
+    return ((uint64_t)1 << log2) - 1 + (uint64_t)((bucket - 16) % 4 + 1) * ((uint64_t)1 << (log2 - 2));
+}
+
+static inline void lol_histogram_record(const struct lol_metric *histogram, uint64_t value) {
+    uint64_t *values = &lol_metrics_get_shard()->values[histogram->index];
+
+    if (LOL_UNLIKELY(histogram->index == 0)) {
+        return;
+    }
+    (void)__atomic_fetch_add(&values[lol_metrics_bucket(value)], 1, __ATOMIC_RELAXED);
+    (void)__atomic_fetch_add(&values[LOL_METRICS_HISTOGRAM_BUCKETS], value, __ATOMIC_RELAXED);
+}
+
+/* A monotonic clock for latencies, in nanoseconds. */
+static inline uint64_t lol_metrics_now_ns(void) {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000 + (uint64_t)now.tv_nsec;
+}
+
+/******************************************************************************/
+/* READS AND DUMPS                                                            */
+/******************************************************************************/
+
+/* Sum a slot over every shard. */
+static inline uint64_t lol_metrics_read_slot(unsigned slot) {
+    uint64_t total = 0;
+    unsigned i = 0;
+
+    for (i = 0; i < LOL_METRICS_SHARDS; ++i) {
+        total += __atomic_load_n(&lol_metrics_shards[i].values[slot], __ATOMIC_RELAXED);
+    }
+    return total;
+}
+
+static inline uint64_t lol_counter_read(const struct lol_metric *counter) {
+    return counter->index == 0 ? 0 : lol_metrics_read_slot(counter->index);
+}
+
+static inline int64_t lol_gauge_read(const struct lol_metric *gauge) {
+    return gauge->index == 0 ? 0 : __atomic_load_n(&lol_metrics_gauges[gauge->index], __ATOMIC_RELAXED);
+}
+
+static inline void lol_metrics_write_histogram(FILE *file, const struct lol_metric *metric) {
+    uint64_t count = 0;
+    unsigned bucket = 0;
+
+    for (bucket = 0; bucket < LOL_METRICS_HISTOGRAM_BUCKETS; ++bucket) {
+        uint64_t n = lol_metrics_read_slot(metric->index + bucket);
+
+        if (n != 0) {
+            count += n;
+            fprintf(file, "%s_bucket{le=\"%llu\"} %llu\n", metric->name,
+                (unsigned long long)lol_metrics_bucket_bound(bucket), (unsigned long long)count);
+        }
+    }
+    fprintf(file, "%s_bucket{le=\"+Inf\"} %llu\n", metric->name, (unsigned long long)count);
+    fprintf(file, "%s_sum %llu\n", metric->name,
+        (unsigned long long)lol_metrics_read_slot(metric->index + LOL_METRICS_HISTOGRAM_BUCKETS));
+    fprintf(file, "%s_count %llu\n", metric->name, (unsigned long long)count);
+}
+
+/* Write every metric in the Prometheus text format. The values are read one
+by one while other threads may update them, so they are not a snapshot. */
+static inline void lol_metrics_write(FILE *file) {
+    static const char *const types[] = { "counter", "gauge", "histogram" };
+    unsigned count = __atomic_load_n(&lol_metrics_count, __ATOMIC_ACQUIRE);
+    unsigned i = 0;
+
+    for (i = 0; i < count; ++i) {
+        const struct lol_metric *metric = &lol_metrics_registry[i];
+
+        if (metric->help != NULL) {
+            fprintf(file, "# HELP %s %s\n", metric->name, metric->help);
+        }
+        fprintf(file, "# TYPE %s %s\n", metric->name, types[metric->kind]);
+        switch (metric->kind) {
+        case LOL_METRIC_COUNTER:
+            fprintf(file, "%s %llu\n", metric->name, (unsigned long long)lol_metrics_read_slot(metric->index));
+            break;
+        case LOL_METRIC_GAUGE:
+            fprintf(file, "%s %lld\n", metric->name,
+                (long long)__atomic_load_n(&lol_metrics_gauges[metric->index], __ATOMIC_RELAXED));
+            break;
+        case LOL_METRIC_HISTOGRAM:
+            lol_metrics_write_histogram(file, metric);
+            break;
+        }
+    }
+}
+
+/* Serializes dumps, e.g. the dump thread's with the one at exit, which would
+otherwise write the same temporary file at once. */
+static pthread_mutex_t lol_metrics_dump_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static inline int lol_metrics_dump_unlocked(const char *target) {
+    char temporary[4096];
+    FILE *file = NULL;
+
+    if (strncmp(target, "unix:", 5) == 0) {
+        struct sockaddr_un address = { 0 };
+        int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+        address.sun_family = AF_UNIX;
+        if (fd < 0 || strlen(target + 5) >= sizeof address.sun_path) {
+            if (fd >= 0) {
+                close(fd);
+            }
+            return -1;
+        }
+        strcpy(address.sun_path, target + 5);
+        if (connect(fd, (struct sockaddr *)&address, sizeof address) != 0
+                || (file = fdopen(fd, "w")) == NULL) {
+            close(fd);
+            return -1;
+        }
+        lol_metrics_write(file);
+        return fclose(file) == 0 ? 0 : -1;
+    }
+    if (snprintf(temporary, sizeof temporary, "%s.tmp", target) >= (int)sizeof temporary
+            || (file = fopen(temporary, "w")) == NULL) {
+        return -1;
+    }
+    lol_metrics_write(file);
+    if (fclose(file) != 0) {
+        remove(temporary);
+        return -1;
+    }
+    return rename(temporary, target) == 0 ? 0 : -1;
+}
+
+/* Write every metric to `target`: a file, which is replaced atomically, or
+"unix:<path>" for a Unix stream socket. Return 0 on success. */
+static inline int lol_metrics_dump(const char *target) {
+    int result = 0;
+
+    pthread_mutex_lock(&lol_metrics_dump_lock);
+    result = lol_metrics_dump_unlocked(target);
+    pthread_mutex_unlock(&lol_metrics_dump_lock);
+    return result;
+}
+
+struct lol_metrics_dumper {
+    const char *target;
+    unsigned period_ms;
+};
+
+static struct lol_metrics_dumper lol_metrics_dumper_config;
+
+static void *lol_metrics_dump_thread(void *arg) {
+    const struct lol_metrics_dumper *dumper = arg;
+    struct timespec period;
+
+    period.tv_sec = dumper->period_ms / 1000;
+    period.tv_nsec = (long)(dumper->period_ms % 1000) * 1000000;
+    for (;;) {
+        nanosleep(&period, NULL);
+        /* A collector that is not listening yet is not an error. */
+        (void)lol_metrics_dump(dumper->target);
+    }
+    return NULL;
+}
+
+static void lol_metrics_dump_at_exit(void) {
+    (void)lol_metrics_dump(lol_metrics_dumper_config.target);
+}
+
+/* Dump every `period_ms` milliseconds from a background thread, and at exit.
+Call it once. Return 0 on success. */
+static inline int lol_metrics_start_dump(const char *target, unsigned period_ms) {
+    pthread_t thread;
+
+    lol_metrics_dumper_config.target = target;
+    lol_metrics_dumper_config.period_ms = period_ms == 0 ? 1 : period_ms;
+    if (pthread_create(&thread, NULL, lol_metrics_dump_thread, &lol_metrics_dumper_config) != 0) {
+        return -1;
+    }
+    (void)pthread_detach(thread);
+    return atexit(lol_metrics_dump_at_exit) == 0 ? 0 : -1;
+}
+
+static LOL_COLD __attribute__((constructor)) void lol_metrics_init(void) {
+    const char *target = getenv("LOL_METRICS_DUMP");
+    const char *period = getenv("LOL_METRICS_PERIOD_MS");
+
+    if (target == NULL || *target == '\0') {
+        return;
+    }
+    if (lol_metrics_start_dump(
+            target,
+            period != NULL ? (unsigned)strtoul(period, NULL, 10) : LOL_METRICS_DEFAULT_PERIOD_MS) != 0) {
+        perror("lol_metrics_start_dump");
+    }
+}
+
+#endif /* LOL_METRICS_H */
@@ -0,0 +1,298 @@
+/*
+ * NUMA Topology and Placement
+ *
+ * On a multi-socket machine, each socket (NUMA node) has its own memory, and
+ * reading another node's memory costs more latency and shares the link
+ * between the sockets. Linux places a page on the node of the thread that
+ * first touches it, so memory-bound parallel code should:
+ *
+ * 1. keep each thread on one node (`lol_numa_pin_thread()`);
+ * 2. allocate the data that a thread works on from that thread
+ *    (`lol_numa_alloc(size, LOL_NUMA_LOCAL)`), or interleave data that every
+ *    thread reads (`LOL_NUMA_INTERLEAVE`);
+ * 3. split loops the same way when initializing and processing the data
+ *    (`lol_numa_split()`), so that each thread touches the pages that it
+ *    placed.
+ *
+ * ```c
+ * // In worker `i` of `n`, for both the loop that fills `data` and the loops
+ * // that read it:
+ * size_t begin, end;
+ * lol_numa_split(length, i, n, &begin, &end);
+ * for (j = begin; j < end; ++j) { ... data[j] ... }
+ * ```
+ *
+ * The topology comes from /sys/devices/system/node, whose node numbers may
+ * have gaps (e.g. "0-1,4" online). Without it (e.g. on a
+ * single-node machine or a system other than Linux), there is one node with
+ * every CPU, and the placement policies do nothing beyond first touch.
+ */
+#ifndef LOL_NUMA_H
+#define LOL_NUMA_H
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <pthread.h>
+#include <sched.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "lol_hints.h"
+
+#ifndef LOL_NUMA_MAX_NODES
+#define LOL_NUMA_MAX_NODES 64
+#endif
+#ifndef LOL_NUMA_MAX_CPUS
+#define LOL_NUMA_MAX_CPUS 1024
+#endif
+
+/* From <numaif.h>, which is part of libnuma rather than libc. */
+#define LOL_NUMA_MPOL_PREFERRED 1
+#define LOL_NUMA_MPOL_INTERLEAVE 3
+
+enum lol_numa_placement {
+    /* On the calling thread's node, or on another one once it is full. */
+    LOL_NUMA_LOCAL,
+    /* Spread page by page over every node, for data all threads share. */
+    LOL_NUMA_INTERLEAVE
+};
+
+struct lol_numa_topology {
+    /* The online nodes' numbers, in increasing order. */
+    short nodes[LOL_NUMA_MAX_NODES];
+    int node_count;
+    int cpu_count;
+    /* The node of each CPU, or -1 if it is offline. */
+    short cpu_node[LOL_NUMA_MAX_CPUS];
+    /* The online CPUs grouped by node, so that consecutive workers share a
+    node (and their steals stay local). */
+    short cpus_by_node[LOL_NUMA_MAX_CPUS];
+};
+
+static struct lol_numa_topology lol_numa_topology_cache;
+/* 0: not read, 1: reading, 2: read. */
+static int lol_numa_topology_state = 0;
+
+/* Set `members[i]` for each number `i < size` in a list like "0-3,8-11". */
+static inline void lol_numa_parse_list(const char *list, char *members, int size) {
+    while (*list != '\0' && *list != '\n') {
+        int lo = 0, hi = 0, length = 0, i = 0;
+
+        if (sscanf(list, "%d-%d%n", &lo, &hi, &length) != 2) {
+            if (sscanf(list, "%d%n", &lo, &length) != 1) {
+                return;
+            }
+            hi = lo;
+        }
+        for (i = lo < 0 ? 0 : lo; i <= hi && i < size; ++i) {
+            members[i] = 1;
+        }
+        list += length;
+        if (*list == ',') {
+            ++list;
+        }
+    }
+}
+
+/* Read a file that holds one list (e.g. a sysfs cpulist) into `members`.
+Return 0 on success. */
+static inline int lol_numa_read_list(const char *path, char *members, int size) {
+    char list[4096];
+    FILE *file = fopen(path, "r");
+    int result = -1;
+
+    if (file == NULL) {
+        return -1;
+    }
+    if (fgets(list, sizeof list, file) != NULL) {
+        lol_numa_parse_list(list, members, size);
+        result = 0;
+    }
+    fclose(file);
+    return result;
+}
+
+static LOL_COLD void lol_numa_read_topology(struct lol_numa_topology *topology) {
+    char path[64];
+    char online_nodes[LOL_NUMA_MAX_NODES] = { 0 };
+    char cpus[LOL_NUMA_MAX_CPUS];
+    int node = 0, cpu = 0, count = 0, i = 0;
+    long online = sysconf(_SC_NPROCESSORS_ONLN);
+
+    for (cpu = 0; cpu < LOL_NUMA_MAX_CPUS; ++cpu) {
+        topology->cpu_node[cpu] = -1;
+    }
+    topology->node_count = 0;
+    if (lol_numa_read_list("/sys/devices/system/node/online", online_nodes, LOL_NUMA_MAX_NODES) == 0) {
+        for (node = 0; node < LOL_NUMA_MAX_NODES; ++node) {
+            if (!online_nodes[node]) {
+                continue;
+            }
+            sprintf(path, "/sys/devices/system/node/node%d/cpulist", node);
+            memset(cpus, 0, sizeof cpus);
+            /* A node may have memory but no CPUs. */
+            (void)lol_numa_read_list(path, cpus, LOL_NUMA_MAX_CPUS);
+            for (cpu = 0; cpu < LOL_NUMA_MAX_CPUS; ++cpu) {
+                if (cpus[cpu]) {
+                    topology->cpu_node[cpu] = (short)node;
+                }
+            }
+            topology->nodes[topology->node_count++] = (short)node;
+        }
+    }
+    if (topology->node_count == 0) {
+        /* No NUMA information: one node with every online CPU. */
+        topology->nodes[0] = 0;
+        topology->node_count = 1;
+        for (cpu = 0; cpu < online && cpu < LOL_NUMA_MAX_CPUS; ++cpu) {
+            topology->cpu_node[cpu] = 0;
+        }
+    }
+    for (i = 0; i < topology->node_count; ++i) {
+        for (cpu = 0; cpu < LOL_NUMA_MAX_CPUS; ++cpu) {
+            if (topology->cpu_node[cpu] == topology->nodes[i]) {
+                topology->cpus_by_node[count++] = (short)cpu;
+            }
+        }
+    }
+    topology->cpu_count = count;
+}
+
+/* Get the machine's topology. It is read once, by the first caller. */
+static inline const struct lol_numa_topology *lol_numa_get_topology(void) {
+    int expected = 0;
+
+    if (LOL_LIKELY(__atomic_load_n(&lol_numa_topology_state, __ATOMIC_ACQUIRE) == 2)) {
+        return &lol_numa_topology_cache;
+    }
+    if (__atomic_compare_exchange_n(
+            &lol_numa_topology_state, &expected, 1, 0,
+            __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        lol_numa_read_topology(&lol_numa_topology_cache);
+        __atomic_store_n(&lol_numa_topology_state, 2, __ATOMIC_RELEASE);
+    }
+    while (__atomic_load_n(&lol_numa_topology_state, __ATOMIC_ACQUIRE) != 2) {
+        sched_yield();
+    }
+    return &lol_numa_topology_cache;
+}
+
+/* Get the node of the CPU that the calling thread is running on. */
+static inline int lol_numa_current_node(void) {
+    const struct lol_numa_topology *topology = lol_numa_get_topology();
+    int cpu = sched_getcpu();
+
+    if (cpu < 0 || cpu >= LOL_NUMA_MAX_CPUS || topology->cpu_node[cpu] < 0) {
+        return topology->nodes[0];
+    }
+    return topology->cpu_node[cpu];
+}
+
+/* Get the CPU for the `index`th worker of a pool. Workers fill one node before
+the next, and wrap around if there are more workers than CPUs. */
+static inline int lol_numa_worker_cpu(int index) {
+    const struct lol_numa_topology *topology = lol_numa_get_topology();
+
+    if (topology->cpu_count == 0) {
+        return index;
+    }
+    return topology->cpus_by_node[index % topology->cpu_count];
+}
+
+/* Run the calling thread only on `cpu`. Return 0 on success. */
+static inline int lol_numa_pin_thread(int cpu) {
+    cpu_set_t set;
+
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return pthread_setaffinity_np(pthread_self(), sizeof set, &set);
+}
+
+/* Set the memory policy of a range of pages. Return 0 on success. */
+static inline int lol_numa_mbind(
+    void *memory,
+    size_t size,
+    int mode,
+    const unsigned long *nodes
+) {
+#ifdef SYS_mbind
+    return (int)syscall(SYS_mbind, memory, size, mode, nodes, (unsigned long)LOL_NUMA_MAX_NODES + 1, 0);
+#else
+    (void)memory;
+    (void)size;
+    (void)mode;
+    (void)nodes;
+    return -1;
+#endif
+}
+
+/* Allocate `size` bytes of zeroed, page-aligned memory, placed as asked.
+Return NULL if we are out of memory. Free it with `lol_numa_free()`. */
+static inline void *lol_numa_alloc(size_t size, enum lol_numa_placement placement) {
+    const struct lol_numa_topology *topology = lol_numa_get_topology();
+    unsigned long nodes[LOL_NUMA_MAX_NODES / (8 * sizeof(unsigned long)) + 1] = { 0 };
+    void *memory = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    int node = 0, i = 0;
+
+    if (memory == MAP_FAILED) {
+        return NULL;
+    }
+    if (topology->node_count == 1) {
+        return memory;
+    }
+    if (placement == LOL_NUMA_INTERLEAVE) {
+        for (i = 0; i < topology->node_count; ++i) {
+            node = topology->nodes[i];
+            nodes[node / (8 * sizeof *nodes)] |= 1UL << (node % (8 * sizeof *nodes));
+        }
+        (void)lol_numa_mbind(memory, size, LOL_NUMA_MPOL_INTERLEAVE, nodes);
+    } else {
+        long page_size = sysconf(_SC_PAGESIZE);
+        size_t offset = 0;
+
+        node = lol_numa_current_node();
+        nodes[node / (8 * sizeof *nodes)] = 1UL << (node % (8 * sizeof *nodes));
+        /* Preferred rather than bound, so that a full node spills over to
+        the others instead of failing the page fault. */
+        if (lol_numa_mbind(memory, size, LOL_NUMA_MPOL_PREFERRED, nodes) != 0) {
+            /* E.g. a seccomp filter forbids mbind: place the pages by
+            touching them from this thread instead. */
+            for (offset = 0; offset < size; offset += (size_t)page_size) {
+                ((volatile char *)memory)[offset] = 0;
+            }
+        }
+    }
+    return memory;
+}
+
+static inline void lol_numa_free(void *memory, size_t size) {
+    if (memory != NULL) {
+        munmap(memory, size);
+    }
+}
+
+/* Get worker `index`'s share [*begin, *end) of `count` iterations split over
+`workers` workers. Use the same split for every loop over the same data, so
+that each worker touches the pages that it placed. */
+static inline void lol_numa_split(
+    size_t count,
+    int index,
+    int workers,
+    size_t *begin,
+    size_t *end
+) {
+    size_t share = count / (size_t)workers;
+    size_t extra = count % (size_t)workers;
+    size_t i = (size_t)index;
+
+    *begin = i * share + (i < extra ? i : extra);
+    *end = *begin + share + (i < extra ? 1 : 0);
+}
+
+#endif /* LOL_NUMA_H */
@@ -0,0 +1,321 @@
+/*
+ * Pseudo-Random Number Generators
+ *
+ * The C standard library's `rand()` is slow, has poor statistical quality,
+ * and keeps its state in a global that every thread contends on. This module
+ * provides small-state generators instead:
+ *
+ * Generator                | State     | Use
+ * :------------------------|:----------|:------------------------------------
+ * `lol_splitmix64_next()`  | 8 bytes   | seeding the other generators.
+ * `struct lol_xoshiro256ss`| 32 bytes  | the default generator. Fast, 64-bit output.
+ * `struct lol_pcg32`       | 16 bytes  | 32-bit output with selectable streams.
+ *
+ * The `lol_random_*()` functions use a per-thread xoshiro256** instance, so
+ * threads never share state. Each thread's generator is derived from the
+ * global seed (see `lol_random_seed()`) by jumping ahead 2^128 steps per
+ * thread, so the streams of different threads never overlap. Threads are
+ * numbered in the order they first draw a number, so runs are reproducible if
+ * that order is.
+ *
+ * Bounded sampling uses Lemire's multiply-and-reject method, which is
+ * unbiased and usually costs a single multiplication (no division).
+ */
+#ifndef LOL_RANDOM_H
+#define LOL_RANDOM_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#define LOL_RANDOM_DEFAULT_SEED UINT64_C(0x853C49E6748FEA9B)
+
+static inline uint64_t lol_random_rotl(uint64_t x, int k) {
+    return (x << k) | (x >> (64 - k));
+}
+
+/******************************************************************************/
+/* SPLITMIX64                                                                 */
+/******************************************************************************/
+
+static inline uint64_t lol_splitmix64_next(uint64_t *state) {
+    uint64_t z = (*state += UINT64_C(0x9E3779B97F4A7C15));
+    z = (z ^ (z >> 30)) * UINT64_C(0xBF58476D1CE4E5B9);
+    z = (z ^ (z >> 27)) * UINT64_C(0x94D049BB133111EB);
+    return z ^ (z >> 31);
+}
+
+/******************************************************************************/
+/* XOSHIRO256**                                                               */
+/******************************************************************************/
+
+struct lol_xoshiro256ss {
+    uint64_t s[4];
+};
+
+static inline void lol_xoshiro256ss_seed(
+    struct lol_xoshiro256ss *rng,
+    uint64_t seed
+) {
+    /* SplitMix64 never yields an all-zero state, which xoshiro cannot leave. */
+    rng->s[0] = lol_splitmix64_next(&seed);
+    rng->s[1] = lol_splitmix64_next(&seed);
+    rng->s[2] = lol_splitmix64_next(&seed);
+    rng->s[3] = lol_splitmix64_next(&seed);
+}
+
+static inline uint64_t lol_xoshiro256ss_next(struct lol_xoshiro256ss *rng) {
+    uint64_t *s = rng->s;
+    uint64_t result = lol_random_rotl(s[1] * 5, 7) * 9;
+    uint64_t t = s[1] << 17;
+
+    s[2] ^= s[0];
+    s[3] ^= s[1];
+    s[1] ^= s[2];
+    s[0] ^= s[3];
+    s[2] ^= t;
+    s[3] = lol_random_rotl(s[3], 45);
+    return result;
+}
+
+/* Advance the generator by 2^128 steps. Calling this once per thread gives
+each thread a non-overlapping subsequence. */
+static inline void lol_xoshiro256ss_jump(struct lol_xoshiro256ss *rng) {
+    static const uint64_t jump[4] = {
+        UINT64_C(0x180EC6D33CFD0ABA), UINT64_C(0xD5A61266F0C9392C),
+        UINT64_C(0xA9582618E03FC9AA), UINT64_C(0x39ABDC4529B1661C),
+    };
+    uint64_t s[4] = { 0 };
+    int i = 0, b = 0;
+
+    for (i = 0; i < 4; ++i) {
+        for (b = 0; b < 64; ++b) {
+            if (jump[i] & (UINT64_C(1) << b)) {
+                s[0] ^= rng->s[0];
+                s[1] ^= rng->s[1];
+                s[2] ^= rng->s[2];
+                s[3] ^= rng->s[3];
+            }
+            (void)lol_xoshiro256ss_next(rng);
+        }
+    }
+    memcpy(rng->s, s, sizeof s);
+}
+
+/* Return a uniformly distributed integer in [0, bound). The bound must be
+non-zero. */
+static inline uint32_t lol_xoshiro256ss_bounded_u32(
+    struct lol_xoshiro256ss *rng,
+    uint32_t bound
+) {
+    uint64_t m = (lol_xoshiro256ss_next(rng) >> 32) * (uint64_t)bound;
+    uint32_t low = (uint32_t)m;
+
+    if (low < bound) {
+        /* Only reached with probability bound / 2^32. */
+        uint32_t threshold = (uint32_t)-bound % bound;
+        while (low < threshold) {
+            m = (lol_xoshiro256ss_next(rng) >> 32) * (uint64_t)bound;
+            low = (uint32_t)m;
+        }
+    }
+    return (uint32_t)(m >> 32);
+}
+
+/* Return a uniformly distributed integer in [0, bound). The bound must be
+non-zero. */
+static inline uint64_t lol_xoshiro256ss_bounded_u64(
+    struct lol_xoshiro256ss *rng,
+    uint64_t bound
+) {
+    /* Reject samples above the largest multiple of the bound. */
+    uint64_t threshold = -bound % bound;
+    uint64_t x = lol_xoshiro256ss_next(rng);
+
+    while (x < threshold) {
+        x = lol_xoshiro256ss_next(rng);
+    }
+    return x % bound;
+}
+
+/* Return a uniformly distributed double in [0, 1). */
+static inline double lol_xoshiro256ss_double(struct lol_xoshiro256ss *rng) {
+    return (double)(lol_xoshiro256ss_next(rng) >> 11) * 0x1.0p-53;
+}
+
+static inline void lol_xoshiro256ss_fill_u64(
+    struct lol_xoshiro256ss *rng,
+    uint64_t *out,
+    size_t n
+) {
+    /* Work on a local copy so that the state stays in registers. */
+    struct lol_xoshiro256ss local = *rng;
+    size_t i = 0;
+
+    for (i = 0; i < n; ++i) {
+        out[i] = lol_xoshiro256ss_next(&local);
+    }
+    *rng = local;
+}
+
+static inline void lol_xoshiro256ss_fill_bounded_u32(
+    struct lol_xoshiro256ss *rng,
+    uint32_t *out,
+    size_t n,
+    uint32_t bound
+) {
+    struct lol_xoshiro256ss local = *rng;
+    size_t i = 0;
+
+    for (i = 0; i < n; ++i) {
+        out[i] = lol_xoshiro256ss_bounded_u32(&local, bound);
+    }
+    *rng = local;
+}
+
+static inline void lol_xoshiro256ss_fill_bytes(
+    struct lol_xoshiro256ss *rng,
+    void *buf,
+    size_t n
+) {
+    unsigned char *out = buf;
+    uint64_t x = 0;
+
+    while (n >= sizeof x) {
+        x = lol_xoshiro256ss_next(rng);
+        memcpy(out, &x, sizeof x);
+        out += sizeof x;
+        n -= sizeof x;
+    }
+    if (n != 0) {
+        x = lol_xoshiro256ss_next(rng);
+        memcpy(out, &x, n);
+    }
+}
+
+/******************************************************************************/
+/* PCG32                                                                      */
+/******************************************************************************/
+
+struct lol_pcg32 {
+    uint64_t state;
+    /* Must be odd. Different values select independent streams. */
+    uint64_t inc;
+};
+
+static inline uint32_t lol_pcg32_next(struct lol_pcg32 *rng) {
+    uint64_t old = rng->state;
+    uint32_t xorshifted = (uint32_t)(((old >> 18) ^ old) >> 27);
+    uint32_t rot = (uint32_t)(old >> 59);
+
+    rng->state = old * UINT64_C(6364136223846793005) + rng->inc;
+    return (xorshifted >> rot) | (xorshifted << ((-rot) & 31));
+}
+
+static inline void lol_pcg32_seed(
+    struct lol_pcg32 *rng,
+    uint64_t seed,
+    uint64_t stream
+) {
+    rng->state = 0;
+    rng->inc = (stream << 1) | 1;
+    (void)lol_pcg32_next(rng);
+    rng->state += seed;
+    (void)lol_pcg32_next(rng);
+}
+
+/* Return a uniformly distributed integer in [0, bound). The bound must be
+non-zero. */
+static inline uint32_t lol_pcg32_bounded_u32(
+    struct lol_pcg32 *rng,
+    uint32_t bound
+) {
+    uint64_t m = (uint64_t)lol_pcg32_next(rng) * bound;
+    uint32_t low = (uint32_t)m;
+
+    if (low < bound) {
+        uint32_t threshold = (uint32_t)-bound % bound;
+        while (low < threshold) {
+            m = (uint64_t)lol_pcg32_next(rng) * bound;
+            low = (uint32_t)m;
+        }
+    }
+    return (uint32_t)(m >> 32);
+}
+
+/******************************************************************************/
+/* PER-THREAD GENERATOR                                                       */
+/******************************************************************************/
+
+static uint64_t lol_random_global_seed = LOL_RANDOM_DEFAULT_SEED;
+/* Number of threads that have seeded their generator from the global seed. */
+static uint64_t lol_random_thread_count = 0;
+static __thread struct lol_xoshiro256ss lol_random_thread_rng;
+static __thread int lol_random_thread_seeded = 0;
+
+static inline void lol_random_thread_init(uint64_t thread_index) {
+    uint64_t i = 0;
+
+    lol_xoshiro256ss_seed(&lol_random_thread_rng, lol_random_global_seed);
+    for (i = 0; i < thread_index; ++i) {
+        lol_xoshiro256ss_jump(&lol_random_thread_rng);
+    }
+    lol_random_thread_seeded = 1;
+}
+
+/* Get the calling thread's generator. */
+static inline struct lol_xoshiro256ss *lol_random_thread(void) {
+    if (!lol_random_thread_seeded) {
+        uint64_t index = __atomic_fetch_add(
+            &lol_random_thread_count, 1, __ATOMIC_RELAXED
+        );
+        lol_random_thread_init(index);
+    }
+    return &lol_random_thread_rng;
+}
+
+/* Set the global seed and reseed the calling thread as the first thread. Call
+this before starting other threads; threads that have already drawn a number
+keep their current state. */
+static inline void lol_random_seed(int seed) {
+    lol_random_global_seed = (uint64_t)(unsigned)seed;
+    __atomic_store_n(&lol_random_thread_count, 1, __ATOMIC_RELAXED);
+    lol_random_thread_init(0);
+}
+
+static inline uint64_t lol_random_u64(void) {
+    return lol_xoshiro256ss_next(lol_random_thread());
+}
+
+static inline uint32_t lol_random_bounded_u32(uint32_t bound) {
+    return lol_xoshiro256ss_bounded_u32(lol_random_thread(), bound);
+}
+
+static inline double lol_random_double(void) {
+    return lol_xoshiro256ss_double(lol_random_thread());
+}
+
+/* Return a uniformly distributed integer in [lo, hi]. */
+static inline int lol_random_range_i32(int lo, int hi) {
+    uint32_t span = 0;
+
+    if (hi < lo) {
+        return lo;
+    }
+    /* Unsigned arithmetic so that the span cannot overflow. */
+    span = (uint32_t)hi - (uint32_t)lo + 1;
+    if (span == 0) {
+        return (int)(int32_t)(lol_random_u64() >> 32);
+    }
+    return (int)(int32_t)((uint32_t)lo + lol_random_bounded_u32(span));
+}
+
+static inline void lol_random_fill_u64(uint64_t *out, size_t n) {
+    lol_xoshiro256ss_fill_u64(lol_random_thread(), out, n);
+}
+
+static inline void lol_random_fill_bytes(void *buf, size_t n) {
+    lol_xoshiro256ss_fill_bytes(lol_random_thread(), buf, n);
+}
+
+#endif /* LOL_RANDOM_H */
@@ -0,0 +1,190 @@
+/*
+ * Reference Counting
+ *
+ * Shared ownership of heap values. A value is allocated with a header that
+ * holds its reference count, and the user gets a pointer to the value itself:
+ *
+ * ```c
+ * struct node *n = lol_rc_new(sizeof *n, node_drop, node_share);
+ * lol_rc_retain(n);   // another reference
+ * lol_rc_release(n);  // ... gone again
+ * lol_rc_release(n);  // calls node_drop(n), then frees it
+ * ```
+ *
+ * The count is not atomic while the value is only reachable from one thread,
+ * which is by far the common case. Call `lol_rc_share()` before handing a
+ * value to another thread; from then on, its count is atomic. The count
+ * encodes the mode in its sign, so checking the mode costs nothing extra:
+ *
+ * Count | Meaning
+ * :-----|:----------------------------------------------------------------
+ * n > 0 | n references, all on one thread. Plain increments and decrements.
+ * n < 0 | -n references, possibly on many threads. Atomic operations.
+ *
+ * Sharing a value shares everything that it references, since the last
+ * release may happen on another thread and release the children there. The
+ * share callback mirrors the drop callback: it calls `lol_rc_share()` on each
+ * reference that the value holds (and drop calls `lol_rc_release()` on each).
+ *
+ * To avoid inc/dec traffic altogether, the caller (usually the compiler)
+ * should:
+ *
+ * 1. borrow instead of retaining: a callee that does not keep a reference
+ *    needs no retain/release pair around the call;
+ * 2. move on the last use: passing the caller's last reference transfers it
+ *    rather than retaining a new one and releasing the old one;
+ * 3. reuse in place: `lol_rc_release_for_reuse()` hands back the memory of a
+ *    uniquely-referenced value, so that `lol_rc_reuse()` can build the new
+ *    value there instead of calling lol_free() and then lol_alloc().
+ */
+#ifndef LOL_RC_H
+#define LOL_RC_H
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "lol_alloc.h"
+#include "lol_hints.h"
+
+struct lol_rc_header {
+    /* See the table above. Only changes sign in `lol_rc_share()`. */
+    intptr_t count;
+    /* The allocated size of the value, for reuse. */
+    size_t size;
+    /* Release the value's own references (may be NULL). Called before the
+    value's memory is freed or reused. */
+    void (*drop)(void *value);
+    /* Share the value's own references (may be NULL if it holds none). */
+    void (*share)(void *value);
+};
+
+/* Keep the value aligned for any type we allocate. */
+#define LOL_RC_ALIGN 16
+#define LOL_RC_HEADER_SIZE                                                      \
+    ((sizeof(struct lol_rc_header) + LOL_RC_ALIGN - 1) / LOL_RC_ALIGN * LOL_RC_ALIGN)
+
+static inline struct lol_rc_header *lol_rc_header(const void *value) {
+    return (struct lol_rc_header *)((char *)value - LOL_RC_HEADER_SIZE);
+}
+
+/* Return a value with one reference, or NULL if we are out of memory. */
+static inline void *lol_rc_new(
+    size_t size,
+    void (*drop)(void *value),
+    void (*share)(void *value)
+) {
+    struct lol_rc_header *header = lol_alloc(LOL_RC_HEADER_SIZE + size);
+
+    if (header == NULL) {
+        return NULL;
+    }
+    header->count = 1;
+    header->size = size;
+    header->drop = drop;
+    header->share = share;
+    return (char *)header + LOL_RC_HEADER_SIZE;
+}
+
+/* Make the counts of the value and of everything that it references atomic,
+so that the value may be passed to other threads. Only call this while the
+calling thread is the only one with references. */
+static inline void lol_rc_share(void *value) {
+    struct lol_rc_header *header = lol_rc_header(value);
+
+    if (header->count > 0) {
+        __atomic_store_n(&header->count, -header->count, __ATOMIC_RELEASE);
+        /* A child that is already shared stops the walk, so each value is
+        visited once even if it is referenced many times. */
+        if (header->share != NULL) {
+            header->share(value);
+        }
+    }
+}
+
+static inline void lol_rc_retain(void *value) {
+    struct lol_rc_header *header = lol_rc_header(value);
+
+    /* The sign only changes while one thread owns the value, so a relaxed
+    load is enough to pick the path. */
+    if (LOL_LIKELY(__atomic_load_n(&header->count, __ATOMIC_RELAXED) > 0)) {
+        ++header->count;
+    } else {
+        (void)__atomic_fetch_sub(&header->count, 1, __ATOMIC_RELAXED);
+    }
+}
+
+static LOL_COLD void lol_rc_free(struct lol_rc_header *header) {
+    void *value = (char *)header + LOL_RC_HEADER_SIZE;
+
+    if (header->drop != NULL) {
+        header->drop(value);
+    }
+    lol_free(header);
+}
+
+/* Drop a reference, and free the value if it was the last one. */
+static inline void lol_rc_release(void *value) {
+    struct lol_rc_header *header = lol_rc_header(value);
+    intptr_t count = __atomic_load_n(&header->count, __ATOMIC_RELAXED);
+
+    if (LOL_LIKELY(count > 1)) {
+        header->count = count - 1;
+    } else if (count == 1) {
+        lol_rc_free(header);
+    } else if (__atomic_add_fetch(&header->count, 1, __ATOMIC_ACQ_REL) == 0) {
+        /* The acquire makes the other threads' writes to the value visible
+        to the drop. */
+        lol_rc_free(header);
+    }
+}
+
+/* Whether this is the only reference, i.e. the value may be changed in place. */
+static inline int lol_rc_is_unique(const void *value) {
+    intptr_t count = __atomic_load_n(&lol_rc_header(value)->count, __ATOMIC_ACQUIRE);
+
+    return count == 1 || count == -1;
+}
+
+/* Drop a reference. If it was the last one, drop the value's own references
+and return its memory (with one reference) to pass to `lol_rc_reuse()`;
+otherwise, return NULL. */
+static inline void *lol_rc_release_for_reuse(void *value) {
+    struct lol_rc_header *header = lol_rc_header(value);
+
+    if (lol_rc_is_unique(value)) {
+        if (header->drop != NULL) {
+            header->drop(value);
+        }
+        header->count = 1;
+        return value;
+    }
+    lol_rc_release(value);
+    return NULL;
+}
+
+/* Get memory for a new value, reusing the memory from
+`lol_rc_release_for_reuse()` if there is any and it is big enough. */
+static inline void *lol_rc_reuse(
+    void *reuse,
+    size_t size,
+    void (*drop)(void *value),
+    void (*share)(void *value)
+) {
+    if (reuse != NULL) {
+        struct lol_rc_header *header = lol_rc_header(reuse);
+
+        if (LOL_LIKELY(header->size >= size)) {
+            header->drop = drop;
+            header->share = share;
+            return reuse;
+        }
+        lol_free(header);
+    }
+    return lol_rc_new(size, drop, share);
+}
+
+#endif /* LOL_RC_H */
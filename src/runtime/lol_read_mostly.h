@@ -0,0 +1,88 @@
+/*
+ * Read-Mostly Values
+ *
+ * RCU-style shared state, e.g. configuration that is reloaded now and then
+ * but read on every request. Readers get a pointer to the current value with
+ * a single atomic load, and never write to shared memory, so reads scale with
+ * the number of readers. A writer publishes a new copy; the old copy is freed
+ * once no reader can still be using it (see lol_epoch.h).
+ *
+ * ```c
+ * LOL_READ_MOSTLY_DEFINE(config_cell, struct config)
+ *
+ * static struct config_cell config;
+ * config_cell_init(&config, &defaults);
+ *
+ * // Reader, e.g. in a task or in a thread that called lol_epoch_online():
+ * const struct config *c = config_cell_read(&config);
+ * ... use c until the next lol_epoch_quiescent() ...
+ *
+ * // Writer, on any thread:
+ * config_cell_update(&config, &reloaded);
+ * ```
+ *
+ * A pointer from `prefix_read()` stays valid until the reading thread's next
+ * quiescent state if it is online (task pool workers are), or until the end
+ * of the enclosing `lol_epoch_enter()`/`lol_epoch_exit()` region otherwise.
+ *
+ * The generated functions are:
+ *
+ * Function                                                      | Description
+ * :-------------------------------------------------------------|:-----------------------------
+ * `int prefix_init(struct prefix *cell, const type *value)`      | returns 0 or `ENOMEM`.
+ * `const type *prefix_read(struct prefix *cell)`                 | the current value.
+ * `int prefix_update(struct prefix *cell, const type *value)`    | publishes a copy of `*value`. Returns 0 or `ENOMEM`.
+ * `void prefix_destroy(struct prefix *cell)`                     | only once no other thread uses the cell.
+ *
+ * Concurrent updates do not wait for each other; the last one wins.
+ */
+#ifndef LOL_READ_MOSTLY_H
+#define LOL_READ_MOSTLY_H
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <errno.h>
+
+#include "lol_alloc.h"
+#include "lol_epoch.h"
+
+#define LOL_READ_MOSTLY_DEFINE(prefix, type)                                    \
+                                                                                \
+struct prefix {                                                                 \
+    type *current;                                                              \
+};                                                                              \
+                                                                                \
+static inline int prefix##_init(struct prefix *cell, const type *value) {       \
+    cell->current = lol_alloc(sizeof *cell->current);                           \
+    if (cell->current == NULL) {                                                \
+        return ENOMEM;                                                          \
+    }                                                                           \
+    *cell->current = *value;                                                    \
+    return 0;                                                                   \
+}                                                                               \
+                                                                                \
+static inline const type *prefix##_read(struct prefix *cell) {                  \
+    return __atomic_load_n(&cell->current, __ATOMIC_ACQUIRE);                   \
+}                                                                               \
+                                                                                \
+static inline int prefix##_update(struct prefix *cell, const type *value) {     \
+    type *fresh = lol_alloc(sizeof *fresh);                                     \
+    type *old = NULL;                                                           \
+                                                                                \
+    if (fresh == NULL) {                                                        \
+        return ENOMEM;                                                          \
+    }                                                                           \
+    *fresh = *value;                                                            \
+    old = __atomic_exchange_n(&cell->current, fresh, __ATOMIC_ACQ_REL);         \
+    lol_epoch_retire(old, lol_free);                                            \
+    return 0;                                                                   \
+}                                                                               \
+                                                                                \
+static inline void prefix##_destroy(struct prefix *cell) {                      \
+    lol_free(cell->current);                                                    \
+    cell->current = NULL;                                                       \
+}
+
+#endif /* LOL_READ_MOSTLY_H */
@@ -0,0 +1,265 @@
+/*
+ * Slot Map
+ *
+ * A container of records that are referenced by handles instead of pointers,
+ * monomorphized per record type like `lol_sort.h`:
+ *
+ * ```c
+ * struct particle { float x, y, dx, dy; };
+ * LOL_SLOTMAP_DEFINE(particles, struct particle)
+ *
+ * struct particles map;
+ * uint32_t handle = LOL_SLOTMAP_NULL;
+ * particles_init(&map, 1024);
+ * particles_insert(&map, &p, &handle);
+ * struct particle *q = particles_get(&map, handle);  // NULL once removed
+ * for (i = 0; i < particles_size(&map); ++i) {
+ *     particles_values(&map)[i].x += ...;
+ * }
+ * ```
+ *
+ * The generated functions are:
+ *
+ * Function                                                     | Description
+ * :------------------------------------------------------------|:-----------------------------
+ * `int prefix_init(struct prefix *map, size_t capacity)`        | returns 0 or `ENOMEM`.
+ * `void prefix_destroy(struct prefix *map)`                     | frees the storage.
+ * `int prefix_reserve(struct prefix *map, size_t capacity)`     | makes room for `capacity` records. Returns 0 or `ENOMEM`.
+ * `int prefix_insert(struct prefix *map, const type *value, uint32_t *handle)` | copies the value in. Returns 0 or `ENOMEM` (also when full).
+ * `type *prefix_get(struct prefix *map, uint32_t handle)`       | the record, or NULL if the handle is stale or invalid.
+ * `int prefix_remove(struct prefix *map, uint32_t handle)`      | returns non-zero if the record was present.
+ * `size_t prefix_size(const struct prefix *map)`                | the number of records.
+ * `type *prefix_values(struct prefix *map)`                     | the records, densely packed in no particular order.
+ * `uint32_t prefix_handle_at(const struct prefix *map, size_t i)` | the handle of `prefix_values(map)[i]`.
+ *
+ * Design:
+ *
+ * - The records are packed at the front of one array, so iterating over them
+ *   reads contiguous memory. Removing a record moves the last record into its
+ *   place, so pointers into the array are only valid until the next insert or
+ *   remove; handles stay valid until their record is removed.
+ * - A handle is 32 bits, half the size of a pointer: a slot index in the low
+ *   `LOL_SLOTMAP_INDEX_BITS` (20) bits and a generation in the rest. The slot
+ *   holds the record's position in the packed array and the slot's own
+ *   generation, so a lookup is two array reads. A slot's generation is odd
+ *   while it is in use and is bumped when its record is removed, so stale
+ *   handles do not match until the same slot has been reused 2^11 times. More
+ *   index bits allow more records (at most 2^LOL_SLOTMAP_INDEX_BITS) but fewer
+ *   reuses before a stale handle can match again.
+ * - Free slots form a list through their position field and are reused first.
+ *   `LOL_SLOTMAP_NULL` (0) is never a valid handle.
+ * - The packed array also records each record's slot, which remove needs to
+ *   redirect the slot of the record that it moves.
+ */
+#ifndef LOL_SLOTMAP_H
+#define LOL_SLOTMAP_H
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "lol_alloc.h"
+#include "lol_hints.h"
+
+#ifndef LOL_SLOTMAP_INDEX_BITS
+#define LOL_SLOTMAP_INDEX_BITS 20
+#endif
+#if LOL_SLOTMAP_INDEX_BITS < 1 || LOL_SLOTMAP_INDEX_BITS > 30
+#error "LOL_SLOTMAP_INDEX_BITS must leave room for a generation"
+#endif
+#define LOL_SLOTMAP_NULL 0u
+#define LOL_SLOTMAP_MAX_SIZE ((size_t)1 << LOL_SLOTMAP_INDEX_BITS)
+#define LOL_SLOTMAP_INDEX_MASK ((1u << LOL_SLOTMAP_INDEX_BITS) - 1)
+#define LOL_SLOTMAP_GENERATION_MASK (UINT32_MAX >> LOL_SLOTMAP_INDEX_BITS)
+/* Ends the list of free slots. */
+#define LOL_SLOTMAP_END UINT32_MAX
+
+struct lol_slotmap_slot {
+    /* The record's position in the packed array, or the next free slot. */
+    uint32_t index;
+    /* Wraps around within LOL_SLOTMAP_GENERATION_MASK. */
+    uint32_t generation;
+};
+
+static inline uint32_t lol_slotmap_handle(uint32_t index, uint32_t generation) {
+    return generation << LOL_SLOTMAP_INDEX_BITS | index;
+}
+
+static inline uint32_t lol_slotmap_handle_index(uint32_t handle) {
+    return handle & LOL_SLOTMAP_INDEX_MASK;
+}
+
+static inline uint32_t lol_slotmap_handle_generation(uint32_t handle) {
+    return handle >> LOL_SLOTMAP_INDEX_BITS;
+}
+
+/* Return a copy of an array of `count` elements of `size` bytes with room for
+`capacity`, and free the old one, or return NULL (keeping the old one). */
+static inline void *lol_slotmap_grow(void *array, size_t size, size_t count, size_t capacity) {
+    void *grown = NULL;
+
+    if (capacity > SIZE_MAX / size) {
+        return NULL;
+    }
+    grown = lol_alloc(capacity * size);
+    if (grown == NULL) {
+        return NULL;
+    }
+    if (count != 0) {
+        memcpy(grown, array, count * size);
+    }
+    lol_free(array);
+    return grown;
+}
+
+#define LOL_SLOTMAP_DEFINE(prefix, type)                                        \
+                                                                                \
+struct prefix {                                                                 \
+    /* The records, and the slot of each. */                                    \
+    type *values;                                                               \
+    uint32_t *value_slots;                                                      \
+    size_t size;                                                                \
+    /* Slots are reused before new ones are used, so there are never more       \
+    slots than the most records there have been, nor more than `capacity`. */   \
+    struct lol_slotmap_slot *slots;                                             \
+    size_t slot_count;                                                          \
+    size_t capacity;                                                            \
+    uint32_t free_slot;                                                         \
+};                                                                              \
+                                                                                \
+/* Grow the arrays to hold `capacity` records. Return 0 or ENOMEM. */           \
+static LOL_COLD int prefix##_reserve(struct prefix *map, size_t capacity) {     \
+    void *grown = NULL;                                                         \
+                                                                                \
+    if (capacity > LOL_SLOTMAP_MAX_SIZE) {                                      \
+        capacity = LOL_SLOTMAP_MAX_SIZE;                                        \
+    }                                                                           \
+    if (capacity <= map->capacity) {                                            \
+        return 0;                                                               \
+    }                                                                           \
+    grown = lol_slotmap_grow(map->values, sizeof(type), map->size, capacity);   \
+    if (grown == NULL) {                                                        \
+        return ENOMEM;                                                          \
+    }                                                                           \
+    map->values = grown;                                                        \
+    grown = lol_slotmap_grow(map->value_slots, sizeof(uint32_t), map->size,     \
+        capacity);                                                              \
+    if (grown == NULL) {                                                        \
+        return ENOMEM;                                                          \
+    }                                                                           \
+    map->value_slots = grown;                                                   \
+    grown = lol_slotmap_grow(map->slots, sizeof(struct lol_slotmap_slot),       \
+        map->slot_count, capacity);                                             \
+    if (grown == NULL) {                                                        \
+        return ENOMEM;                                                          \
+    }                                                                           \
+    map->slots = grown;                                                         \
+    map->capacity = capacity;                                                   \
+    return 0;                                                                   \
+}                                                                               \
+                                                                                \
+static inline int prefix##_init(struct prefix *map, size_t capacity) {          \
+    map->values = NULL;                                                         \
+    map->value_slots = NULL;                                                    \
+    map->size = 0;                                                              \
+    map->slots = NULL;                                                          \
+    map->slot_count = 0;                                                        \
+    map->capacity = 0;                                                          \
+    map->free_slot = LOL_SLOTMAP_END;                                           \
+    return capacity == 0 ? 0 : prefix##_reserve(map, capacity);                 \
+}                                                                               \
+                                                                                \
+static inline void prefix##_destroy(struct prefix *map) {                       \
+    lol_free(map->values);                                                      \
+    lol_free(map->value_slots);                                                 \
+    lol_free(map->slots);                                                       \
+    prefix##_init(map, 0);                                                      \
+}                                                                               \
+                                                                                \
+static inline size_t prefix##_size(const struct prefix *map) {                  \
+    return map->size;                                                           \
+}                                                                               \
+                                                                                \
+static inline type *prefix##_values(struct prefix *map) {                       \
+    return map->values;                                                         \
+}                                                                               \
+                                                                                \
+static inline uint32_t prefix##_handle_at(const struct prefix *map, size_t i) { \
+    uint32_t slot = map->value_slots[i];                                        \
+                                                                                \
+    return lol_slotmap_handle(slot, map->slots[slot].generation);               \
+}                                                                               \
+                                                                                \
+static inline int prefix##_insert(                                              \
+    struct prefix *map,                                                         \
+    const type *value,                                                          \
+    uint32_t *handle                                                            \
+) {                                                                             \
+    /* `value` may point into the map, whose storage growing frees. */          \
+    type copy = *value;                                                         \
+    uint32_t slot = map->free_slot;                                             \
+                                                                                \
+    if (LOL_UNLIKELY(map->size == map->capacity)                                \
+            && (map->size == LOL_SLOTMAP_MAX_SIZE                               \
+                || prefix##_reserve(map, 2 * map->capacity + 16) != 0)) {       \
+        return ENOMEM;                                                          \
+    }                                                                           \
+    if (slot != LOL_SLOTMAP_END) {                                              \
+        map->free_slot = map->slots[slot].index;                                \
+    } else {                                                                    \
+        slot = (uint32_t)map->slot_count++;                                     \
+        map->slots[slot].generation = 0;                                        \
+    }                                                                           \
+    /* Odd while in use. */                                                     \
+    map->slots[slot].generation = (map->slots[slot].generation + 1)             \
+        & LOL_SLOTMAP_GENERATION_MASK;                                          \
+    map->slots[slot].index = (uint32_t)map->size;                               \
+    map->values[map->size] = copy;                                              \
+    map->value_slots[map->size] = slot;                                         \
+    ++map->size;                                                                \
+    *handle = lol_slotmap_handle(slot, map->slots[slot].generation);            \
+    return 0;                                                                   \
+}                                                                               \
+                                                                                \
+static inline type *prefix##_get(struct prefix *map, uint32_t handle) {         \
+    uint32_t slot = lol_slotmap_handle_index(handle);                           \
+    uint32_t generation = lol_slotmap_handle_generation(handle);                \
+                                                                                \
+    /* An even generation (e.g. of LOL_SLOTMAP_NULL) is never in use. */        \
+    if (slot >= map->slot_count || map->slots[slot].generation != generation    \
+            || !(generation & 1)) {                                             \
+        return NULL;                                                            \
+    }                                                                           \
+    return &map->values[map->slots[slot].index];                                \
+}                                                                               \
+                                                                                \
+static inline int prefix##_remove(struct prefix *map, uint32_t handle) {        \
+    uint32_t slot = lol_slotmap_handle_index(handle);                           \
+    uint32_t index = 0;                                                         \
+    size_t last = 0;                                                            \
+                                                                                \
+    if (prefix##_get(map, handle) == NULL) {                                    \
+        return 0;                                                               \
+    }                                                                           \
+    /* Move the last record into the hole. */                                   \
+    index = map->slots[slot].index;                                             \
+    last = map->size - 1;                                                       \
+    if (index != last) {                                                        \
+        map->values[index] = map->values[last];                                 \
+        map->value_slots[index] = map->value_slots[last];                       \
+        map->slots[map->value_slots[index]].index = index;                      \
+    }                                                                           \
+    --map->size;                                                                \
+    map->slots[slot].generation = (map->slots[slot].generation + 1)             \
+        & LOL_SLOTMAP_GENERATION_MASK;                                          \
+    map->slots[slot].index = map->free_slot;                                    \
+    map->free_slot = slot;                                                      \
+    return 1;                                                                   \
+}                                                                               \
+
+#endif /* LOL_SLOTMAP_H */
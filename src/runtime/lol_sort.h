@@ -0,0 +1,464 @@
+/*
+ * Monomorphized Sorting and Searching
+ *
+ * The standard library's `qsort()` and `bsearch()` call the comparator through
+ * a function pointer on every comparison, which the C compiler cannot inline.
+ * Instead, `LOL_SORT_DEFINE(prefix, type, less)` stamps out a family of
+ * functions for one element type and one comparison, so that the comparison is
+ * inlined straight into the loops.
+ *
+ * The `less` argument is the name of a function (or function-like macro) that
+ * takes two `const type *` and returns non-zero if the first sorts strictly
+ * before the second. For example:
+ *
+ * ```c
+ * #define lol_less_int(a, b) (*(a) < *(b))
+ * LOL_SORT_DEFINE(int_array, int, lol_less_int)
+ *
+ * int_array_sort_unstable(values, n);
+ * ```
+ *
+ * The generated functions are:
+ *
+ * Function                                        | Description
+ * :-----------------------------------------------|:-----------------------------
+ * `int prefix_sort(type *a, size_t n)`            | stable merge sort. Returns 0 or `ENOMEM`.
+ * `void prefix_sort_unstable(type *a, size_t n)`  | pattern-defeating quicksort (pdqsort).
+ * `size_t prefix_partition(type *a, size_t n, const type *pivot)` | move elements less than `*pivot` to the front. Returns how many there are.
+ * `size_t prefix_lower_bound(const type *a, size_t n, const type *key)` | branchless index of the first element not less than `*key`.
+ * `size_t prefix_upper_bound(const type *a, size_t n, const type *key)` | branchless index of the first element greater than `*key`.
+ * `int prefix_binary_search(const type *a, size_t n, const type *key, size_t *index)` | returns non-zero if `*key` is in `a`. The lower bound is stored in `*index`.
+ *
+ * For records with integer keys, `LOL_RADIX_SORT_DEFINE(prefix, type, key_type,
+ * key)` generates `int prefix_radix_sort(type *a, size_t n)`, which is a stable
+ * least-significant-digit radix sort. The `key` function maps a `const type *`
+ * to an unsigned `key_type` (e.g. `uint32_t`); use `lol_radix_key_i32()` and
+ * `lol_radix_key_i64()` to order signed keys correctly.
+ */
+#ifndef LOL_SORT_H
+#define LOL_SORT_H
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lol_alloc.h"
+
+/* Below this size, insertion sort beats the partitioning overhead. */
+#define LOL_SORT_INSERTION_THRESHOLD 24
+/* Above this size, pdqsort picks its pivot as the pseudo-median of nine. */
+#define LOL_SORT_NINTHER_THRESHOLD 128
+/* Maximum number of moves a partial insertion sort makes before giving up. */
+#define LOL_SORT_PARTIAL_INSERTION_LIMIT 8
+/* Length of the runs that the stable merge sort insertion-sorts first. */
+#define LOL_SORT_MERGE_RUN 32
+
+static inline uint32_t lol_radix_key_i32(int32_t x) {
+    /* Flip the sign bit so that negative numbers sort before positive ones. */
+    return (uint32_t)x ^ UINT32_C(0x80000000);
+}
+
+static inline uint64_t lol_radix_key_i64(int64_t x) {
+    return (uint64_t)x ^ UINT64_C(0x8000000000000000);
+}
+
+static inline int lol_sort_log2(size_t n) {
+    int log = 0;
+    while (n >>= 1) {
+        ++log;
+    }
+    return log;
+}
+
+#define LOL_SORT_DEFINE(prefix, type, less)                                     \
+                                                                                \
+static inline void prefix##_swap(type *a, type *b) {                            \
+    type tmp = *a;                                                              \
+    *a = *b;                                                                    \
+    *b = tmp;                                                                   \
+}                                                                               \
+                                                                                \
+static inline void prefix##_sort2(type *a, type *b) {                           \
+    if (less(b, a)) {                                                           \
+        prefix##_swap(a, b);                                                    \
+    }                                                                           \
+}                                                                               \
+                                                                                \
+static inline void prefix##_sort3(type *a, type *b, type *c) {                  \
+    prefix##_sort2(a, b);                                                       \
+    prefix##_sort2(b, c);                                                       \
+    prefix##_sort2(a, b);                                                       \
+}                                                                               \
+                                                                                \
+static inline void prefix##_insertion_sort(type *begin, type *end) {            \
+    type *cur = NULL;                                                           \
+    if (begin == end) {                                                         \
+        return;                                                                 \
+    }                                                                           \
+    for (cur = begin + 1; cur != end; ++cur) {                                  \
+        type *sift = cur;                                                       \
+        type tmp = *cur;                                                        \
+        while (sift != begin && less(&tmp, sift - 1)) {                         \
+            *sift = *(sift - 1);                                                \
+            --sift;                                                             \
+        }                                                                       \
+        *sift = tmp;                                                            \
+    }                                                                           \
+}                                                                               \
+                                                                                \
+/* Insertion sort that gives up (returning 0) after a few moves. This makes   \
+already-sorted partitions cost O(n) instead of recursing into them. */          \
+static inline int prefix##_partial_insertion_sort(type *begin, type *end) {     \
+    size_t moves = 0;                                                           \
+    type *cur = NULL;                                                           \
+    if (begin == end) {                                                         \
+        return 1;                                                               \
+    }                                                                           \
+    for (cur = begin + 1; cur != end; ++cur) {                                  \
+        type *sift = cur;                                                       \
+        type tmp = *cur;                                                        \
+        if (!less(&tmp, sift - 1)) {                                            \
+            continue;                                                           \
+        }                                                                       \
+        do {                                                                    \
+            *sift = *(sift - 1);                                                \
+            --sift;                                                             \
+        } while (sift != begin && less(&tmp, sift - 1));                        \
+        *sift = tmp;                                                            \
+        moves += (size_t)(cur - sift);                                          \
+        if (moves > LOL_SORT_PARTIAL_INSERTION_LIMIT) {                         \
+            return 0;                                                           \
+        }                                                                       \
+    }                                                                           \
+    return 1;                                                                   \
+}                                                                               \
+                                                                                \
+static inline void prefix##_sift_down(type *a, size_t root, size_t n) {         \
+    type tmp = a[root];                                                         \
+    while (2 * root + 1 < n) {                                                  \
+        size_t child = 2 * root + 1;                                            \
+        if (child + 1 < n && less(&a[child], &a[child + 1])) {                  \
+            ++child;                                                            \
+        }                                                                       \
+        if (!less(&tmp, &a[child])) {                                           \
+            break;                                                              \
+        }                                                                       \
+        a[root] = a[child];                                                     \
+        root = child;                                                           \
+    }                                                                           \
+    a[root] = tmp;                                                              \
+}                                                                               \
+                                                                                \
+static inline void prefix##_heap_sort(type *begin, type *end) {                 \
+    size_t n = (size_t)(end - begin);                                           \
+    size_t i = 0;                                                               \
+    for (i = n / 2; i-- > 0;) {                                                 \
+        prefix##_sift_down(begin, i, n);                                        \
+    }                                                                           \
+    for (i = n; i-- > 1;) {                                                     \
+        prefix##_swap(&begin[0], &begin[i]);                                    \
+        prefix##_sift_down(begin, 0, i);                                        \
+    }                                                                           \
+}                                                                               \
+                                                                                \
+/* Partition [begin, end) around the pivot *begin. Elements equal to the      \
+pivot go to the right. Sets *already_partitioned if no swaps were needed. The \
+median-of-three selection guarantees that the unguarded scans terminate. */    \
+static inline type *prefix##_partition_right(                                   \
+    type *begin, type *end, int *already_partitioned                            \
+) {                                                                             \
+    type pivot = *begin;                                                        \
+    type *first = begin;                                                        \
+    type *last = end;                                                           \
+    type *pivot_pos = NULL;                                                     \
+    while (less(++first, &pivot)) {                                             \
+        /* no op */                                                             \
+    }                                                                           \
+    if (first - 1 == begin) {                                                   \
+        while (first < last && !less(--last, &pivot)) {                         \
+            /* no op */                                                         \
+        }                                                                       \
+    } else {                                                                    \
+        while (!less(--last, &pivot)) {                                         \
+            /* no op */                                                         \
+        }                                                                       \
+    }                                                                           \
+    *already_partitioned = first >= last;                                       \
+    while (first < last) {                                                      \
+        prefix##_swap(first, last);                                             \
+        while (less(++first, &pivot)) {                                         \
+            /* no op */                                                         \
+        }                                                                       \
+        while (!less(--last, &pivot)) {                                         \
+            /* no op */                                                         \
+        }                                                                       \
+    }                                                                           \
+    pivot_pos = first - 1;                                                      \
+    *begin = *pivot_pos;                                                        \
+    *pivot_pos = pivot;                                                         \
+    return pivot_pos;                                                           \
+}                                                                               \
+                                                                                \
+/* Partition [begin, end) around the pivot *begin, with elements equal to the \
+pivot on the left. This is used when the pivot equals the element before     \
+begin, so that runs of equal elements are finished in linear time. */         \
+static inline type *prefix##_partition_left(type *begin, type *end) {          \
+    type pivot = *begin;                                                        \
+    type *first = begin;                                                        \
+    type *last = end;                                                           \
+    while (less(&pivot, --last)) {                                              \
+        /* no op */                                                             \
+    }                                                                           \
+    if (last + 1 == end) {                                                      \
+        while (first < last && !less(&pivot, ++first)) {                        \
+            /* no op */                                                         \
+        }                                                                       \
+    } else {                                                                    \
+        while (!less(&pivot, ++first)) {                                        \
+            /* no op */                                                         \
+        }                                                                       \
+    }                                                                           \
+    while (first < last) {                                                      \
+        prefix##_swap(first, last);                                             \
+        while (less(&pivot, --last)) {                                          \
+            /* no op */                                                         \
+        }                                                                       \
+        while (!less(&pivot, ++first)) {                                        \
+            /* no op */                                                         \
+        }                                                                       \
+    }                                                                           \
+    *begin = *last;                                                             \
+    *last = pivot;                                                              \
+    return last;                                                                \
+}                                                                               \
+                                                                                \
+static inline void prefix##_pdqsort_loop(                                       \
+    type *begin, type *end, int bad_allowed, int leftmost                       \
+) {                                                                             \
+    while (1) {                                                                 \
+        size_t size = (size_t)(end - begin);                                    \
+        size_t half = size / 2;                                                 \
+        size_t l_size = 0, r_size = 0;                                          \
+        int already_partitioned = 0;                                            \
+        type *pivot_pos = NULL;                                                 \
+                                                                                \
+        if (size < LOL_SORT_INSERTION_THRESHOLD) {                              \
+            prefix##_insertion_sort(begin, end);                                \
+            return;                                                             \
+        }                                                                       \
+        /* Move the (pseudo-)median to *begin. */                               \
+        if (size > LOL_SORT_NINTHER_THRESHOLD) {                                \
+            prefix##_sort3(begin, begin + half, end - 1);                       \
+            prefix##_sort3(begin + 1, begin + (half - 1), end - 2);             \
+            prefix##_sort3(begin + 2, begin + (half + 1), end - 3);             \
+            prefix##_sort3(begin + (half - 1), begin + half, begin + (half + 1));\
+            prefix##_swap(begin, begin + half);                                 \
+        } else {                                                                \
+            prefix##_sort3(begin + half, begin, end - 1);                       \
+        }                                                                       \
+        /* If the pivot equals the element before this partition, then every   \
+        element here is at least the pivot; strip the equal ones. */            \
+        if (!leftmost && !less(begin - 1, begin)) {                             \
+            begin = prefix##_partition_left(begin, end) + 1;                    \
+            continue;                                                           \
+        }                                                                       \
+                                                                                \
+        pivot_pos = prefix##_partition_right(begin, end, &already_partitioned); \
+        l_size = (size_t)(pivot_pos - begin);                                   \
+        r_size = (size_t)(end - (pivot_pos + 1));                               \
+                                                                                \
+        if (l_size < size / 8 || r_size < size / 8) {                           \
+            /* Too many bad pivots: fall back to guaranteed O(n log n). */      \
+            if (--bad_allowed == 0) {                                           \
+                prefix##_heap_sort(begin, end);                                 \
+                return;                                                         \
+            }                                                                   \
+            /* Break up the pattern that produced the bad pivot. */             \
+            if (l_size >= LOL_SORT_INSERTION_THRESHOLD) {                       \
+                prefix##_swap(begin, begin + l_size / 4);                       \
+                prefix##_swap(pivot_pos - 1, pivot_pos - l_size / 4);           \
+            }                                                                   \
+            if (r_size >= LOL_SORT_INSERTION_THRESHOLD) {                       \
+                prefix##_swap(pivot_pos + 1, pivot_pos + 1 + r_size / 4);       \
+                prefix##_swap(end - 1, end - r_size / 4);                       \
+            }                                                                   \
+        } else if (already_partitioned                                          \
+            && prefix##_partial_insertion_sort(begin, pivot_pos)                \
+            && prefix##_partial_insertion_sort(pivot_pos + 1, end)) {           \
+            return;                                                             \
+        }                                                                       \
+                                                                                \
+        /* Recurse into the left side and loop on the right side. */            \
+        prefix##_pdqsort_loop(begin, pivot_pos, bad_allowed, leftmost);         \
+        begin = pivot_pos + 1;                                                  \
+        leftmost = 0;                                                           \
+    }                                                                           \
+}                                                                               \
+                                                                                \
+static inline void prefix##_sort_unstable(type *a, size_t n) {                  \
+    if (n < 2) {                                                                \
+        return;                                                                 \
+    }                                                                           \
+    prefix##_pdqsort_loop(a, a + n, lol_sort_log2(n), 1);                       \
+}                                                                               \
+                                                                                \
+static inline void prefix##_merge(                                              \
+    const type *src, type *dst, size_t lo, size_t mid, size_t hi                \
+) {                                                                             \
+    size_t i = lo, j = mid, k = lo;                                             \
+    while (i < mid && j < hi) {                                                 \
+        /* Take from the right only if strictly less, to stay stable. */        \
+        if (less(&src[j], &src[i])) {                                           \
+            dst[k++] = src[j++];                                                \
+        } else {                                                                \
+            dst[k++] = src[i++];                                                \
+        }                                                                       \
+    }                                                                           \
+    while (i < mid) {                                                           \
+        dst[k++] = src[i++];                                                    \
+    }                                                                           \
+    while (j < hi) {                                                            \
+        dst[k++] = src[j++];                                                    \
+    }                                                                           \
+}                                                                               \
+                                                                                \
+static inline int prefix##_sort(type *a, size_t n) {                            \
+    type *buf = NULL;                                                           \
+    type *src = a, *dst = NULL, *tmp = NULL;                                    \
+    size_t width = 0, lo = 0;                                                   \
+                                                                                \
+    for (lo = 0; lo < n; lo += LOL_SORT_MERGE_RUN) {                            \
+        size_t hi = n - lo < LOL_SORT_MERGE_RUN ? n : lo + LOL_SORT_MERGE_RUN;  \
+        prefix##_insertion_sort(a + lo, a + hi);                                \
+    }                                                                           \
+    if (n <= LOL_SORT_MERGE_RUN) {                                              \
+        return 0;                                                               \
+    }                                                                           \
+    if ((buf = lol_alloc(n * sizeof *buf)) == NULL) {                           \
+        return ENOMEM;                                                          \
+    }                                                                           \
+    dst = buf;                                                                  \
+    for (width = LOL_SORT_MERGE_RUN; width < n; width *= 2) {                   \
+        for (lo = 0; lo < n; lo += 2 * width) {                                 \
+            size_t mid = n - lo < width ? n : lo + width;                       \
+            size_t hi = n - mid < width ? n : mid + width;                      \
+            prefix##_merge(src, dst, lo, mid, hi);                              \
+        }                                                                       \
+        tmp = src;                                                              \
+        src = dst;                                                              \
+        dst = tmp;                                                              \
+    }                                                                           \
+    if (src != a) {                                                             \
+        memcpy(a, src, n * sizeof *a);                                          \
+    }                                                                           \
+    lol_free(buf);                                                              \
+    return 0;                                                                   \
+}                                                                               \
+                                                                                \
+static inline size_t prefix##_partition(                                        \
+    type *a, size_t n, const type *pivot                                        \
+) {                                                                             \
+    size_t lo = 0, i = 0;                                                       \
+    for (i = 0; i < n; ++i) {                                                   \
+        if (less(&a[i], pivot)) {                                               \
+            prefix##_swap(&a[lo], &a[i]);                                       \
+            ++lo;                                                               \
+        }                                                                       \
+    }                                                                           \
+    return lo;                                                                  \
+}                                                                               \
+                                                                                \
+/* The loop body has no data-dependent branch; the ternary compiles to a      \
+conditional move, so the search does not pay for branch mispredictions. */    \
+static inline size_t prefix##_lower_bound(                                      \
+    const type *a, size_t n, const type *key                                    \
+) {                                                                             \
+    const type *base = a;                                                       \
+    if (n == 0) {                                                               \
+        return 0;                                                               \
+    }                                                                           \
+    while (n > 1) {                                                             \
+        size_t half = n / 2;                                                    \
+        base = less(&base[half - 1], key) ? base + half : base;                 \
+        n -= half;                                                              \
+    }                                                                           \
+    return (size_t)(base - a) + (less(base, key) ? 1 : 0);                      \
+}                                                                               \
+                                                                                \
+/* The elements equal to `*key` are [lower bound, upper bound). */              \
+static inline size_t prefix##_upper_bound(                                      \
+    const type *a, size_t n, const type *key                                    \
+) {                                                                             \
+    const type *base = a;                                                       \
+    if (n == 0) {                                                               \
+        return 0;                                                               \
+    }                                                                           \
+    while (n > 1) {                                                             \
+        size_t half = n / 2;                                                    \
+        base = !less(key, &base[half - 1]) ? base + half : base;                \
+        n -= half;                                                              \
+    }                                                                           \
+    return (size_t)(base - a) + (!less(key, base) ? 1 : 0);                     \
+}                                                                               \
+                                                                                \
+static inline int prefix##_binary_search(                                       \
+    const type *a, size_t n, const type *key, size_t *index                     \
+) {                                                                             \
+    size_t i = prefix##_lower_bound(a, n, key);                                 \
+    if (index != NULL) {                                                        \
+        *index = i;                                                             \
+    }                                                                           \
+    return i < n && !less(key, &a[i]);                                          \
+}
+
+#define LOL_RADIX_SORT_DEFINE(prefix, type, key_type, key)                      \
+                                                                                \
+static inline int prefix##_radix_sort(type *a, size_t n) {                      \
+    type *buf = NULL;                                                           \
+    type *src = a, *dst = NULL, *tmp = NULL;                                    \
+    size_t counts[256] = { 0 };                                                 \
+    size_t shift = 0, i = 0;                                                    \
+                                                                                \
+    if (n < 2) {                                                                \
+        return 0;                                                               \
+    }                                                                           \
+    if ((buf = lol_alloc(n * sizeof *buf)) == NULL) {                           \
+        return ENOMEM;                                                          \
+    }                                                                           \
+    dst = buf;                                                                  \
+    for (shift = 0; shift < 8 * sizeof(key_type); shift += 8) {                 \
+        size_t total = 0;                                                       \
+        memset(counts, 0, sizeof counts);                                       \
+        for (i = 0; i < n; ++i) {                                               \
+            ++counts[(key(&src[i]) >> shift) & 0xFF];                           \
+        }                                                                       \
+        /* Skip the pass if every key shares this digit. */                     \
+        if (counts[(key(&src[0]) >> shift) & 0xFF] == n) {                      \
+            continue;                                                           \
+        }                                                                       \
+        for (i = 0; i < 256; ++i) {                                             \
+            size_t c = counts[i];                                               \
+            counts[i] = total;                                                  \
+            total += c;                                                         \
+        }                                                                       \
+        for (i = 0; i < n; ++i) {                                               \
+            dst[counts[(key(&src[i]) >> shift) & 0xFF]++] = src[i];             \
+        }                                                                       \
+        tmp = src;                                                              \
+        src = dst;                                                              \
+        dst = tmp;                                                              \
+    }                                                                           \
+    if (src != a) {                                                             \
+        memcpy(a, src, n * sizeof *a);                                          \
+    }                                                                           \
+    lol_free(buf);                                                              \
+    return 0;                                                                   \
+}
+
+#endif /* LOL_SORT_H */
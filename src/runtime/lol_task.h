@@ -0,0 +1,453 @@
+/*
+ * Fork-Join Tasks
+ *
+ * The runtime for Do's `spawn` and `sync`. Each worker thread has a
+ * Chase-Lev work-stealing deque: it pushes and pops its own tasks at one end
+ * without contention, and idle workers steal the oldest (i.e. biggest) tasks
+ * from the other end.
+ *
+ * A task is a `struct lol_task` at the start of a frame that also holds the
+ * call's arguments and result. The frame lives on the spawning function's
+ * stack, which is safe because the function syncs every task before it
+ * returns.
+ *
+ * ```c
+ * struct fib_task { struct lol_task task; int n; int result; };
+ * static void fib_task_run(struct lol_task *task) {
+ *     struct fib_task *frame = (struct fib_task *)task;
+ *     frame->result = fib(frame->n);
+ * }
+ * ...
+ * struct fib_task a;
+ * if (lol_task_should_spawn()) {
+ *     a.n = n - 1;
+ *     lol_task_spawn(&a.task, fib_task_run);
+ * } else {
+ *     a.result = fib(n - 1);
+ *     lol_task_skip(&a.task);
+ * }
+ * b = fib(n - 2);
+ * lol_task_sync(&a.task);
+ * return a.result + b;
+ * ```
+ *
+ * Spawning is only worth it while other workers may run the task. Once a
+ * worker has `LOL_TASK_SPAWN_CUTOFF` tasks waiting in its deque,
+ * `lol_task_should_spawn()` says no, and the caller makes a plain call. This
+ * cuts recursion over to serial code below a grain size that adapts to how
+ * busy the other workers are. A thread that is not a worker (or a pool of
+ * one) never spawns.
+ *
+ * The pool is started by the first thread that spawns a task. That thread
+ * becomes worker 0. There is one worker per online CPU, or `LOL_TASK_WORKERS`
+ * if that environment variable is set. If `LOL_TASK_PIN` is set, each worker is
+ * pinned to its own CPU, filling one NUMA node before the next (see
+ * lol_numa.h), so that a worker's memory stays on its node.
+ *
+ * A worker that finds nothing to steal for a while parks on a futex, so a
+ * program that has finished its parallel work does not keep the CPUs busy.
+ * Spawning a task wakes a parked worker to steal it.
+ */
+#ifndef LOL_TASK_H
+#define LOL_TASK_H
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <pthread.h>
+#include <sched.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "lol_alloc.h"
+#include "lol_epoch.h"
+#include "lol_hints.h"
+#include "lol_lock.h"
+#include "lol_numa.h"
+
+#ifndef LOL_TASK_MAX_WORKERS
+#define LOL_TASK_MAX_WORKERS 64
+#endif
+/* Must be a power of two. */
+#ifndef LOL_TASK_DEQUE_SIZE
+#define LOL_TASK_DEQUE_SIZE 256
+#endif
+#ifndef LOL_TASK_SPAWN_CUTOFF
+#define LOL_TASK_SPAWN_CUTOFF 16
+#endif
+/* Failed attempts to steal before an idle worker parks. */
+#define LOL_TASK_IDLE_ROUNDS 128
+
+struct lol_task {
+    void (*run)(struct lol_task *task);
+    /* Set (with release semantics) once `run` has returned. */
+    int done;
+};
+
+/* A Chase-Lev deque with a fixed capacity. When it is full, we run tasks
+immediately instead of growing it. See "Correct and Efficient Work-Stealing
+for Weak Memory Models" (Le et al., 2013) for the memory orderings. */
+struct lol_task_deque {
+    int64_t top;
+    /* Keep the owner's end on a different cache line from the thieves' end. */
+    char padding[64 - sizeof(int64_t)];
+    int64_t bottom;
+    struct lol_task *tasks[LOL_TASK_DEQUE_SIZE];
+};
+
+struct lol_task_worker {
+    struct lol_task_deque deque;
+    uint64_t rng;
+    int index;
+    /* The CPU to pin the worker to, or -1 to let it move. */
+    int cpu;
+};
+
+static struct lol_task_worker *lol_task_workers = NULL;
+static int lol_task_worker_count = 0;
+/* 0: not started, 1: starting, 2: running. */
+static int lol_task_pool_state = 0;
+/* Parked workers, and a futex that is bumped to wake one. */
+static int lol_task_idle = 0;
+static uint32_t lol_task_wakeups = 0;
+static __thread struct lol_task_worker *lol_task_self = NULL;
+
+/******************************************************************************/
+/* DEQUE                                                                      */
+/******************************************************************************/
+
+static inline int64_t lol_task_deque_size(struct lol_task_deque *deque) {
+    int64_t bottom = __atomic_load_n(&deque->bottom, __ATOMIC_RELAXED);
+    int64_t top = __atomic_load_n(&deque->top, __ATOMIC_RELAXED);
+
+    return bottom - top;
+}
+
+/* Only called by the owner. Return 0 if the deque is full. */
+static inline int lol_task_deque_push(
+    struct lol_task_deque *deque,
+    struct lol_task *task
+) {
+    int64_t bottom = __atomic_load_n(&deque->bottom, __ATOMIC_RELAXED);
+    int64_t top = __atomic_load_n(&deque->top, __ATOMIC_ACQUIRE);
+
+    if (bottom - top >= LOL_TASK_DEQUE_SIZE) {
+        return 0;
+    }
+    __atomic_store_n(
+        &deque->tasks[bottom & (LOL_TASK_DEQUE_SIZE - 1)], task, __ATOMIC_RELAXED
+    );
+    /* Publish the task (and its frame) to the thieves. */
+    __atomic_store_n(&deque->bottom, bottom + 1, __ATOMIC_RELEASE);
+    return 1;
+}
+
+/* Only called by the owner. Return the newest task, or NULL. */
+static inline struct lol_task *lol_task_deque_pop(struct lol_task_deque *deque) {
+    int64_t bottom = __atomic_load_n(&deque->bottom, __ATOMIC_RELAXED) - 1;
+    int64_t top = 0;
+    struct lol_task *task = NULL;
+
+#ifdef LOL_TSAN
+    /* ThreadSanitizer does not model fences; these order the same way. */
+    __atomic_store_n(&deque->bottom, bottom, __ATOMIC_SEQ_CST);
+    top = __atomic_load_n(&deque->top, __ATOMIC_SEQ_CST);
+#else
+    __atomic_store_n(&deque->bottom, bottom, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    top = __atomic_load_n(&deque->top, __ATOMIC_RELAXED);
+#endif
+    if (top > bottom) {
+        /* Empty */
+        __atomic_store_n(&deque->bottom, bottom + 1, __ATOMIC_RELAXED);
+        return NULL;
+    }
+    task = __atomic_load_n(
+        &deque->tasks[bottom & (LOL_TASK_DEQUE_SIZE - 1)], __ATOMIC_RELAXED
+    );
+    if (top == bottom) {
+        /* The last task: race the thieves for it. */
+        if (!__atomic_compare_exchange_n(
+                &deque->top, &top, top + 1, 0,
+                __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+            task = NULL;
+        }
+        __atomic_store_n(&deque->bottom, bottom + 1, __ATOMIC_RELAXED);
+    }
+    return task;
+}
+
+/* Called by any thread. Return the oldest task, or NULL. */
+static inline struct lol_task *lol_task_deque_steal(
+    struct lol_task_deque *deque
+) {
+    int64_t top = 0, bottom = 0;
+    struct lol_task *task = NULL;
+
+#ifdef LOL_TSAN
+    /* ThreadSanitizer does not model fences; these order the same way. */
+    top = __atomic_load_n(&deque->top, __ATOMIC_SEQ_CST);
+    bottom = __atomic_load_n(&deque->bottom, __ATOMIC_SEQ_CST);
+#else
+    top = __atomic_load_n(&deque->top, __ATOMIC_ACQUIRE);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    bottom = __atomic_load_n(&deque->bottom, __ATOMIC_ACQUIRE);
+#endif
+    if (top >= bottom) {
+        return NULL;
+    }
+    task = __atomic_load_n(
+        &deque->tasks[top & (LOL_TASK_DEQUE_SIZE - 1)], __ATOMIC_RELAXED
+    );
+    if (!__atomic_compare_exchange_n(
+            &deque->top, &top, top + 1, 0,
+            __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+        /* Another thread took it first. */
+        return NULL;
+    }
+    return task;
+}
+
+/******************************************************************************/
+/* WORKERS                                                                    */
+/******************************************************************************/
+
+static inline void lol_task_run(struct lol_task *task) {
+    task->run(task);
+    __atomic_store_n(&task->done, 1, __ATOMIC_RELEASE);
+}
+
+/* Try to run one task from another worker. Return whether we did. */
+static inline int lol_task_steal_and_run(struct lol_task_worker *self) {
+    struct lol_task *task = NULL;
+    uint64_t x = self->rng;
+    int victim = 0;
+
+    /* xorshift64 */
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    self->rng = x;
+    victim = (int)(x % (uint64_t)lol_task_worker_count);
+    if (victim == self->index) {
+        return 0;
+    }
+    task = lol_task_deque_steal(&lol_task_workers[victim].deque);
+    if (task == NULL) {
+        return 0;
+    }
+    lol_task_run(task);
+    return 1;
+}
+
+/* Wait a little longer each time that we fail to find work. After
+LOL_TASK_IDLE_ROUNDS failures, this sleeps; an idle worker parks instead. */
+static inline void lol_task_backoff(unsigned *failures) {
+    if (*failures < 64) {
+        ++*failures;
+    } else if (*failures < 128) {
+        ++*failures;
+        sched_yield();
+    } else {
+        struct timespec delay = { 0, 100 * 1000 };
+        nanosleep(&delay, NULL);
+    }
+}
+
+/* Sleep until a task is spawned, unless one was spawned after we looked. */
+static LOL_COLD void lol_task_park(void) {
+    uint32_t wakeups = 0;
+    int i = 0, found = 0;
+
+    /* Do not hold back reclamation while we sleep. */
+    lol_epoch_offline();
+    (void)__atomic_fetch_add(&lol_task_idle, 1, __ATOMIC_SEQ_CST);
+    wakeups = __atomic_load_n(&lol_task_wakeups, __ATOMIC_SEQ_CST);
+    for (i = 0; i < lol_task_worker_count; ++i) {
+        struct lol_task_deque *deque = &lol_task_workers[i].deque;
+
+        found |= __atomic_load_n(&deque->bottom, __ATOMIC_SEQ_CST)
+            > __atomic_load_n(&deque->top, __ATOMIC_SEQ_CST);
+    }
+    if (!found) {
+        lol_futex_wait(&lol_task_wakeups, wakeups);
+    }
+    (void)__atomic_fetch_sub(&lol_task_idle, 1, __ATOMIC_SEQ_CST);
+    lol_epoch_online();
+}
+
+static LOL_COLD void lol_task_wake_one(void) {
+    (void)__atomic_fetch_add(&lol_task_wakeups, 1, __ATOMIC_SEQ_CST);
+    lol_futex_wake(&lol_task_wakeups, 1);
+}
+
+/* Wake a parked worker, if there is one, to steal a task that we pushed. */
+static inline void lol_task_notify(void) {
+    /* Either a worker going to sleep sees the task, or we see it idle. */
+#ifdef LOL_TSAN
+    /* ThreadSanitizer does not model fences; this orders the same way. */
+    if (__atomic_fetch_add(&lol_task_idle, 0, __ATOMIC_SEQ_CST) != 0) {
+#else
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (LOL_UNLIKELY(__atomic_load_n(&lol_task_idle, __ATOMIC_SEQ_CST) != 0)) {
+#endif
+        lol_task_wake_one();
+    }
+}
+
+static void *lol_task_worker_main(void *arg) {
+    struct lol_task_worker *self = arg;
+    unsigned failures = 0;
+
+    lol_task_self = self;
+    if (self->cpu >= 0) {
+        (void)lol_numa_pin_thread(self->cpu);
+    }
+    /* Between tasks, a worker holds no pointers into shared structures, so
+    it reports quiescent states instead of entering epoch regions (see
+    lol_epoch.h). Idle workers report one on every attempt to steal, and go
+    offline while they are parked, so they never hold back reclamation. */
+    lol_epoch_online();
+    for (;;) {
+        int ran = lol_task_steal_and_run(self);
+
+        lol_epoch_quiescent();
+        if (ran) {
+            failures = 0;
+        } else if (failures < LOL_TASK_IDLE_ROUNDS) {
+            lol_task_backoff(&failures);
+        } else {
+            lol_task_park();
+            failures = 0;
+        }
+    }
+    return NULL;
+}
+
+static inline int lol_task_get_worker_count(void) {
+    const char *env = getenv("LOL_TASK_WORKERS");
+    long count = env != NULL ? atol(env) : sysconf(_SC_NPROCESSORS_ONLN);
+
+    if (count < 1) {
+        return 1;
+    }
+    return count > LOL_TASK_MAX_WORKERS ? LOL_TASK_MAX_WORKERS : (int)count;
+}
+
+/* Start the pool with the calling thread as worker 0. Return the calling
+thread's worker, or NULL if another thread started the pool. */
+static LOL_COLD struct lol_task_worker *lol_task_start(void) {
+    int expected = 0;
+    int count = 0, i = 0;
+    int pin = getenv("LOL_TASK_PIN") != NULL;
+
+    if (!__atomic_compare_exchange_n(
+            &lol_task_pool_state, &expected, 1, 0,
+            __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        return NULL;
+    }
+    count = lol_task_get_worker_count();
+    lol_task_workers = lol_calloc((size_t)count, sizeof *lol_task_workers);
+    if (lol_task_workers == NULL) {
+        /* Everything runs serially. */
+        return NULL;
+    }
+    for (i = 0; i < count; ++i) {
+        lol_task_workers[i].index = i;
+        lol_task_workers[i].rng = UINT64_C(0x9E3779B97F4A7C15) * (uint64_t)(i + 1);
+        lol_task_workers[i].cpu = pin ? lol_numa_worker_cpu(i) : -1;
+    }
+    lol_task_worker_count = count;
+    lol_task_self = &lol_task_workers[0];
+    if (pin) {
+        (void)lol_numa_pin_thread(lol_task_workers[0].cpu);
+    }
+    for (i = 1; i < count; ++i) {
+        pthread_t thread;
+        pthread_attr_t attr;
+
+        pthread_attr_init(&attr);
+        pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+        if (pthread_create(&thread, &attr, lol_task_worker_main, &lol_task_workers[i]) != 0) {
+            /* Nobody will steal from the missing workers' empty deques. */
+            pthread_attr_destroy(&attr);
+            break;
+        }
+        pthread_attr_destroy(&attr);
+    }
+    __atomic_store_n(&lol_task_pool_state, 2, __ATOMIC_RELEASE);
+    return lol_task_self;
+}
+
+/******************************************************************************/
+/* SPAWN AND SYNC                                                             */
+/******************************************************************************/
+
+/* Whether a new task may run in parallel. If not, make the call directly and
+mark the task as done with `lol_task_skip()`; this is the serial cutoff. */
+static inline int lol_task_should_spawn(void) {
+    struct lol_task_worker *self = lol_task_self;
+
+    if (LOL_UNLIKELY(self == NULL)) {
+        if (__atomic_load_n(&lol_task_pool_state, __ATOMIC_RELAXED) != 0) {
+            return 0;
+        }
+        self = lol_task_start();
+        if (self == NULL) {
+            return 0;
+        }
+    }
+    return lol_task_worker_count > 1
+        && lol_task_deque_size(&self->deque) < LOL_TASK_SPAWN_CUTOFF;
+}
+
+/* Start a task, after `lol_task_should_spawn()` said yes. It may run later,
+on any worker. */
+static inline void lol_task_spawn(
+    struct lol_task *task,
+    void (*run)(struct lol_task *task)
+) {
+    task->run = run;
+    task->done = 0;
+    if (!lol_task_deque_push(&lol_task_self->deque, task)) {
+        lol_task_run(task);
+        return;
+    }
+    lol_task_notify();
+}
+
+/* Mark a task whose call was made directly as done. */
+static inline void lol_task_skip(struct lol_task *task) {
+    task->done = 1;
+}
+
+/* Wait for a task to finish. Sync tasks in the reverse of the order in which
+they were spawned. */
+static inline void lol_task_sync(struct lol_task *task) {
+    struct lol_task_worker *self = lol_task_self;
+    unsigned failures = 0;
+
+    if (__atomic_load_n(&task->done, __ATOMIC_ACQUIRE)) {
+        return;
+    }
+    /* Newer tasks have been synced, so it is the newest task in our deque,
+    unless it was stolen. */
+    if (lol_task_deque_pop(&self->deque) == task) {
+        lol_task_run(task);
+        return;
+    }
+    /* Stolen: help the other workers until the thief is done with it. */
+    while (!__atomic_load_n(&task->done, __ATOMIC_ACQUIRE)) {
+        if (lol_task_steal_and_run(self)) {
+            failures = 0;
+        } else {
+            lol_task_backoff(&failures);
+        }
+    }
+}
+
+#endif /* LOL_TASK_H */
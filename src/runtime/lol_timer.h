@@ -0,0 +1,620 @@
+/*
+ * Timers
+ *
+ * A hierarchical timing wheel (Varghese and Lauck), which adds and cancels a
+ * timer in O(1) however many are pending, where a heap would take O(log n).
+ * Time is counted in ticks of `LOL_TIMER_TICK_NS` (1 ms). The wheel has 4
+ * levels of 64 slots each: level 0 holds the timers of the next 64 ticks, one
+ * slot per tick, and level L the timers of the next 64^(L+1) ticks, 64^L ticks
+ * per slot. When level 0 wraps around, the next slot of level 1 is spread out
+ * over level 0, and so on up the levels. Timers more than 64^4 ticks (about
+ * 4.7 hours) away wait in the last slot of level 3 and are placed again when
+ * it comes round.
+ *
+ * The wheel only does work at ticks when a slot expires or cascades, which a
+ * bitmap of occupied slots per level finds in a few instructions. So an event
+ * loop sleeps in `epoll_wait()` until the next of these ticks, and then runs
+ * every timer due in a batch:
+ *
+ * ```c
+ * struct lol_timer_loop loop;
+ * struct lol_timer timer;
+ * struct epoll_event events[16];
+ *
+ * lol_timer_loop_init(&loop);
+ * lol_timer_init(&timer, on_timeout, connection);
+ * lol_timer_loop_add_ms(&loop, &timer, 5000);
+ * for (;;) {
+ *     int n = lol_timer_loop_wait(&loop, events, 16);
+ *     ...
+ * }
+ * ```
+ *
+ * Do code uses a shared loop on a background thread through `lol_sleep_ms()`
+ * (which parks a fiber, see lol_fiber.h, and only sleeps a thread otherwise)
+ * and the `lol_timeout_*()` handles.
+ */
+#ifndef LOL_TIMER_H
+#define LOL_TIMER_H
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <errno.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "lol_fiber.h"
+#include "lol_hints.h"
+#include "lol_lock.h"
+
+#ifndef LOL_TIMER_TICK_NS
+#define LOL_TIMER_TICK_NS 1000000
+#endif
+#define LOL_TIMER_LEVELS 4
+#define LOL_TIMER_SLOT_BITS 6
+#define LOL_TIMER_SLOTS (1 << LOL_TIMER_SLOT_BITS)
+#define LOL_TIMER_SLOT_MASK (LOL_TIMER_SLOTS - 1)
+/* How far ahead the wheel reaches. */
+#define LOL_TIMER_MAX_TICKS (UINT64_C(1) << (LOL_TIMER_LEVELS * LOL_TIMER_SLOT_BITS))
+#define LOL_TIMER_NEVER UINT64_MAX
+
+/* A timer, usually embedded in whatever it times out. */
+struct lol_timer {
+    /* A doubly-linked list per slot; `prev` is NULL unless pending. */
+    struct lol_timer *next;
+    struct lol_timer *prev;
+    uint64_t expires;
+    void (*callback)(struct lol_timer *timer);
+    void *arg;
+};
+
+struct lol_timer_wheel {
+    /* The last tick that was processed. */
+    uint64_t now;
+    size_t count;
+    /* Each slot's list head, and a bit per slot that may be non-empty. */
+    struct lol_timer slots[LOL_TIMER_LEVELS][LOL_TIMER_SLOTS];
+    uint64_t occupied[LOL_TIMER_LEVELS];
+};
+
+/******************************************************************************/
+/* TIMING WHEEL                                                               */
+/******************************************************************************/
+
+static inline void lol_timer_init(struct lol_timer *timer, void (*callback)(struct lol_timer *timer), void *arg) {
+    timer->next = NULL;
+    timer->prev = NULL;
+    timer->expires = 0;
+    timer->callback = callback;
+    timer->arg = arg;
+}
+
+static inline int lol_timer_pending(const struct lol_timer *timer) {
+    return timer->prev != NULL;
+}
+
+static inline void lol_timer_wheel_init(struct lol_timer_wheel *wheel, uint64_t now) {
+    int level = 0, slot = 0;
+
+    wheel->now = now;
+    wheel->count = 0;
+    for (level = 0; level < LOL_TIMER_LEVELS; ++level) {
+        for (slot = 0; slot < LOL_TIMER_SLOTS; ++slot) {
+            wheel->slots[level][slot].next = &wheel->slots[level][slot];
+            wheel->slots[level][slot].prev = &wheel->slots[level][slot];
+        }
+        wheel->occupied[level] = 0;
+    }
+}
+
+/* Put a timer in the slot for tick `at` (which may be its expiry, or the
+latest tick that the wheel reaches). */
+static inline void lol_timer_wheel_place(struct lol_timer_wheel *wheel, struct lol_timer *timer, uint64_t at) {
+    uint64_t delta = at - wheel->now;
+    int level = 0;
+    unsigned slot = 0;
+    struct lol_timer *head = NULL;
+
+    if (delta >= LOL_TIMER_MAX_TICKS) {
+        at = wheel->now + LOL_TIMER_MAX_TICKS - 1;
+        delta = LOL_TIMER_MAX_TICKS - 1;
+    }
+    while (delta >= (UINT64_C(1) << ((level + 1) * LOL_TIMER_SLOT_BITS))) {
+        ++level;
+    }
+    slot = (unsigned)(at >> (level * LOL_TIMER_SLOT_BITS)) & LOL_TIMER_SLOT_MASK;
+    head = &wheel->slots[level][slot];
+    timer->next = head;
+    timer->prev = head->prev;
+    head->prev->next = timer;
+    head->prev = timer;
+    wheel->occupied[level] |= UINT64_C(1) << slot;
+}
+
+/* Start a timer that expires at tick `expires`. A tick that has passed
+expires at the next tick. The timer must not be pending. */
+static inline void lol_timer_wheel_add(struct lol_timer_wheel *wheel, struct lol_timer *timer, uint64_t expires) {
+    timer->expires = expires;
+    lol_timer_wheel_place(wheel, timer, expires > wheel->now ? expires : wheel->now + 1);
+    ++wheel->count;
+}
+
+/* Stop a timer. Return whether it was pending (i.e. it had not expired). */
+static inline int lol_timer_wheel_cancel(struct lol_timer_wheel *wheel, struct lol_timer *timer) {
+    if (!lol_timer_pending(timer)) {
+        return 0;
+    }
+    /* The slot's bit is cleared lazily, by lol_timer_wheel_next(). */
+    timer->prev->next = timer->next;
+    timer->next->prev = timer->prev;
+    timer->next = NULL;
+    timer->prev = NULL;
+    --wheel->count;
+    return 1;
+}
+
+static inline uint64_t lol_timer_rotate_right(uint64_t bits, unsigned count) {
+    return (bits >> count) | (bits << ((64 - count) & 63));
+}
+
+/* Return the next tick at which a slot expires or cascades, or
+`LOL_TIMER_NEVER`. No timer expires before it. */
+static inline uint64_t lol_timer_wheel_next(struct lol_timer_wheel *wheel) {
+    uint64_t next = LOL_TIMER_NEVER;
+    int level = 0;
+
+    if (wheel->count == 0) {
+        return LOL_TIMER_NEVER;
+    }
+    for (level = 0; level < LOL_TIMER_LEVELS; ++level) {
+        int shift = level * LOL_TIMER_SLOT_BITS;
+        /* The first unit of 64^level ticks that is yet to be processed. */
+        uint64_t unit = (wheel->now >> shift) + 1;
+        unsigned start = (unsigned)unit & LOL_TIMER_SLOT_MASK;
+
+        while (wheel->occupied[level] != 0) {
+            unsigned offset = (unsigned)__builtin_ctzll(lol_timer_rotate_right(wheel->occupied[level], start));
+            unsigned slot = (start + offset) & LOL_TIMER_SLOT_MASK;
+            uint64_t tick = (unit + offset) << shift;
+
+            if (wheel->slots[level][slot].next == &wheel->slots[level][slot]) {
+                wheel->occupied[level] &= ~(UINT64_C(1) << slot);
+                continue;
+            }
+            if (tick < next) {
+                next = tick;
+            }
+            break;
+        }
+    }
+    return next;
+}
+
+/* Empty a slot, and return its timers (still linked through `next`). */
+static inline struct lol_timer *lol_timer_wheel_take(struct lol_timer_wheel *wheel, int level, unsigned slot) {
+    struct lol_timer *head = &wheel->slots[level][slot];
+    struct lol_timer *first = head->next;
+
+    wheel->occupied[level] &= ~(UINT64_C(1) << slot);
+    if (first == head) {
+        return NULL;
+    }
+    head->prev->next = NULL;
+    head->next = head;
+    head->prev = head;
+    return first;
+}
+
+/* Process the ticks up to `now`, and return the timers that expired, linked
+through `next`. They are no longer pending, so their callbacks may add them
+again. */
+static inline struct lol_timer *lol_timer_wheel_collect(struct lol_timer_wheel *wheel, uint64_t now) {
+    struct lol_timer *expired = NULL;
+    struct lol_timer **tail = &expired;
+
+    while (wheel->now < now) {
+        uint64_t next = lol_timer_wheel_next(wheel);
+        struct lol_timer *timer = NULL;
+        int level = 0;
+
+        if (next > now) {
+            wheel->now = now;
+            break;
+        }
+        /* Nothing happens in between. */
+        wheel->now = next;
+        for (level = 1; level < LOL_TIMER_LEVELS; ++level) {
+            int shift = level * LOL_TIMER_SLOT_BITS;
+
+            if ((next & ((UINT64_C(1) << shift) - 1)) != 0) {
+                break;
+            }
+            timer = lol_timer_wheel_take(wheel, level, (unsigned)(next >> shift) & LOL_TIMER_SLOT_MASK);
+            while (timer != NULL) {
+                struct lol_timer *following = timer->next;
+
+                /* Lands in this tick's slot if it is due now. */
+                lol_timer_wheel_place(wheel, timer, timer->expires > next ? timer->expires : next);
+                timer = following;
+            }
+        }
+        timer = lol_timer_wheel_take(wheel, 0, (unsigned)next & LOL_TIMER_SLOT_MASK);
+        *tail = timer;
+        for (; timer != NULL; timer = timer->next) {
+            timer->prev = NULL;
+            --wheel->count;
+            tail = &timer->next;
+        }
+    }
+    return expired;
+}
+
+/* Run the callbacks of timers from lol_timer_wheel_collect(), and return how
+many there were. */
+static inline size_t lol_timer_run(struct lol_timer *expired) {
+    size_t count = 0;
+
+    while (expired != NULL) {
+        struct lol_timer *timer = expired;
+
+        expired = timer->next;
+        timer->next = NULL;
+        timer->callback(timer);
+        ++count;
+    }
+    return count;
+}
+
+/* Process the ticks up to `now` and run the timers that expired. */
+static inline size_t lol_timer_wheel_advance(struct lol_timer_wheel *wheel, uint64_t now) {
+    return lol_timer_run(lol_timer_wheel_collect(wheel, now));
+}
+
+/******************************************************************************/
+/* EVENT LOOP                                                                 */
+/******************************************************************************/
+
+/* A timing wheel that any thread may add timers to, run by a thread that
+waits for them (and for file descriptors) in `lol_timer_loop_wait()`. */
+struct lol_timer_loop {
+    struct lol_mutex lock;
+    struct lol_timer_wheel wheel;
+    uint64_t origin_ns;
+    /* Add other file descriptors to `epoll_fd`, except with `data.ptr`
+    pointing to `event_fd`, which is how adding an earlier timer wakes us. */
+    int epoll_fd;
+    int event_fd;
+    /* The tick that the waiting thread sleeps until, or 0 if it is awake. */
+    uint64_t sleeping_until;
+};
+
+static inline uint64_t lol_timer_now_ns(void) {
+    struct timespec now = { 0 };
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000 + (uint64_t)now.tv_nsec;
+}
+
+/* Return 0, or -1 (and set errno) if we could not create the descriptors. */
+static inline int lol_timer_loop_init(struct lol_timer_loop *loop) {
+    struct epoll_event event = { 0 };
+
+    loop->lock = (struct lol_mutex)LOL_MUTEX_INITIALIZER;
+    loop->origin_ns = lol_timer_now_ns();
+    lol_timer_wheel_init(&loop->wheel, 0);
+    loop->sleeping_until = 0;
+    loop->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (loop->epoll_fd < 0) {
+        return -1;
+    }
+    loop->event_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    event.events = EPOLLIN;
+    event.data.ptr = &loop->event_fd;
+    if (loop->event_fd < 0 || epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, loop->event_fd, &event) != 0) {
+        int error = errno;
+
+        if (loop->event_fd >= 0) {
+            close(loop->event_fd);
+        }
+        close(loop->epoll_fd);
+        errno = error;
+        return -1;
+    }
+    return 0;
+}
+
+static inline void lol_timer_loop_destroy(struct lol_timer_loop *loop) {
+    close(loop->event_fd);
+    close(loop->epoll_fd);
+}
+
+/* The current tick, rounded down. */
+static inline uint64_t lol_timer_loop_ticks(struct lol_timer_loop *loop) {
+    return (lol_timer_now_ns() - loop->origin_ns) / LOL_TIMER_TICK_NS;
+}
+
+/* Start a timer that expires after `ms` milliseconds (and never earlier,
+so it is rounded up to the next tick). */
+static inline void lol_timer_loop_add_ms(struct lol_timer_loop *loop, struct lol_timer *timer, uint64_t ms) {
+    uint64_t expires = (lol_timer_now_ns() - loop->origin_ns + ms * 1000000 + LOL_TIMER_TICK_NS - 1)
+        / LOL_TIMER_TICK_NS;
+    int wake = 0;
+
+    lol_mutex_lock(&loop->lock);
+    lol_timer_wheel_add(&loop->wheel, timer, expires);
+    wake = expires < loop->sleeping_until;
+    if (wake) {
+        loop->sleeping_until = 0;
+    }
+    lol_mutex_unlock(&loop->lock);
+    if (wake) {
+        uint64_t one = 1;
+
+        (void)!write(loop->event_fd, &one, sizeof one);
+    }
+}
+
+/* Stop a timer. Return whether it was pending; if not, its callback has run
+or is running. */
+static inline int lol_timer_loop_cancel(struct lol_timer_loop *loop, struct lol_timer *timer) {
+    int pending = 0;
+
+    lol_mutex_lock(&loop->lock);
+    pending = lol_timer_wheel_cancel(&loop->wheel, timer);
+    lol_mutex_unlock(&loop->lock);
+    return pending;
+}
+
+/* Wait until a file descriptor is ready or a timer is due, run the timers
+that are due, and return the number of events (as epoll_wait() does). Only
+one thread may wait at a time. */
+static inline int lol_timer_loop_wait(struct lol_timer_loop *loop, struct epoll_event *events, int max_events) {
+    struct lol_timer *expired = NULL;
+    uint64_t now = 0, next = 0;
+    int timeout = -1;
+    int count = 0, i = 0, j = 0;
+
+    lol_mutex_lock(&loop->lock);
+    now = lol_timer_loop_ticks(loop);
+    expired = lol_timer_wheel_collect(&loop->wheel, now);
+    next = lol_timer_wheel_next(&loop->wheel);
+    if (expired == NULL && next != LOL_TIMER_NEVER) {
+        uint64_t ms = ((next - now) * LOL_TIMER_TICK_NS + 999999) / 1000000;
+
+        timeout = ms > INT32_MAX ? INT32_MAX : (int)ms;
+    }
+    /* Do not sleep while there are callbacks to run. */
+    loop->sleeping_until = expired != NULL ? 0 : next;
+    lol_mutex_unlock(&loop->lock);
+    if (expired != NULL) {
+        lol_timer_run(expired);
+        timeout = 0;
+    }
+    count = epoll_wait(loop->epoll_fd, events, max_events, timeout);
+    lol_mutex_lock(&loop->lock);
+    loop->sleeping_until = 0;
+    expired = lol_timer_wheel_collect(&loop->wheel, lol_timer_loop_ticks(loop));
+    lol_mutex_unlock(&loop->lock);
+    lol_timer_run(expired);
+    for (i = 0; i < count; ++i) {
+        if (events[i].data.ptr == &loop->event_fd) {
+            uint64_t value = 0;
+
+            (void)!read(loop->event_fd, &value, sizeof value);
+        } else {
+            events[j++] = events[i];
+        }
+    }
+    return count < 0 ? count : j;
+}
+
+/******************************************************************************/
+/* SLEEP AND TIMEOUTS                                                         */
+/******************************************************************************/
+
+/* The most timeouts that Do code may have at once. */
+#ifndef LOL_TIMEOUT_MAX
+#define LOL_TIMEOUT_MAX 4096
+#endif
+#define LOL_TIMEOUT_INDEX_BITS 12
+#if LOL_TIMEOUT_MAX > (1 << LOL_TIMEOUT_INDEX_BITS)
+#error "LOL_TIMEOUT_MAX does not fit in a handle's index"
+#endif
+
+struct lol_timeout {
+    struct lol_timer timer;
+    uint32_t expired;
+    /* Bumped when the handle is freed, so stale handles do not match. */
+    uint32_t generation;
+    /* Freed while its callback ran, so the callback frees the timeout. */
+    int orphaned;
+    int next_free;
+};
+
+static struct lol_timer_loop lol_timer_service;
+static pthread_once_t lol_timer_service_once = PTHREAD_ONCE_INIT;
+static int lol_timer_service_ok = 0;
+static struct lol_timeout lol_timeouts[LOL_TIMEOUT_MAX];
+static struct lol_mutex lol_timeouts_lock = LOL_MUTEX_INITIALIZER;
+static int lol_timeouts_free = -1;
+static int lol_timeouts_used = 0;
+
+static inline void *lol_timer_service_main(void *arg) {
+    struct epoll_event events[8];
+
+    (void)arg;
+    for (;;) {
+        lol_timer_loop_wait(&lol_timer_service, events, 8);
+    }
+    return NULL;
+}
+
+static inline void lol_timer_service_start(void) {
+    pthread_t thread;
+    pthread_attr_t attr;
+
+    if (lol_timer_loop_init(&lol_timer_service) != 0) {
+        return;
+    }
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    lol_timer_service_ok = pthread_create(&thread, &attr, lol_timer_service_main, NULL) == 0;
+    pthread_attr_destroy(&attr);
+}
+
+/* Return the shared loop (started on first use), or NULL if it failed. */
+static inline struct lol_timer_loop *lol_timer_get_service(void) {
+    pthread_once(&lol_timer_service_once, lol_timer_service_start);
+    return lol_timer_service_ok ? &lol_timer_service : NULL;
+}
+
+struct lol_timer_sleeper {
+    struct lol_timer timer;
+    struct lol_fiber *fiber;
+    uint32_t done;
+};
+
+static inline void lol_timer_wake_sleeper(struct lol_timer *timer) {
+    struct lol_timer_sleeper *sleeper = (struct lol_timer_sleeper *)timer;
+    /* Once `done` is set, the sleeper's stack may be gone. */
+    struct lol_fiber *fiber = sleeper->fiber;
+
+    __atomic_store_n(&sleeper->done, 1, __ATOMIC_RELEASE);
+    lol_fiber_unpark(fiber);
+    lol_fiber_release(fiber);
+}
+
+/* Sleep for `ms` milliseconds. A fiber parks on the shared loop's timer, so
+its worker runs other fibers meanwhile; a thread just sleeps. */
+static inline void lol_sleep_ms(int ms) {
+    struct lol_fiber *fiber = lol_fiber_self();
+    struct lol_timer_loop *loop = NULL;
+
+    if (ms <= 0) {
+        if (fiber != NULL) {
+            lol_fiber_yield();
+        }
+        return;
+    }
+    loop = fiber != NULL ? lol_timer_get_service() : NULL;
+    if (loop != NULL) {
+        struct lol_timer_sleeper sleeper = { 0 };
+
+        lol_timer_init(&sleeper.timer, lol_timer_wake_sleeper, NULL);
+        sleeper.fiber = fiber;
+        /* The callback may run after we return and the fiber ends. */
+        (void)__atomic_fetch_add(&fiber->references, 1, __ATOMIC_RELAXED);
+        lol_timer_loop_add_ms(loop, &sleeper.timer, (uint64_t)ms);
+        while (!__atomic_load_n(&sleeper.done, __ATOMIC_ACQUIRE)) {
+            lol_fiber_park();
+        }
+    } else {
+        struct timespec duration = { 0 };
+
+        duration.tv_sec = ms / 1000;
+        duration.tv_nsec = (long)(ms % 1000) * 1000000;
+        while (nanosleep(&duration, &duration) != 0 && errno == EINTR) {
+        }
+    }
+}
+
+static inline void lol_timeout_free(struct lol_timeout *timeout) {
+    timeout->next_free = lol_timeouts_free;
+    lol_timeouts_free = (int)(timeout - lol_timeouts);
+}
+
+static inline void lol_timeout_expire(struct lol_timer *timer) {
+    struct lol_timeout *timeout = (struct lol_timeout *)timer;
+
+    lol_mutex_lock(&lol_timeouts_lock);
+    if (timeout->orphaned) {
+        timeout->orphaned = 0;
+        lol_timeout_free(timeout);
+    } else {
+        __atomic_store_n(&timeout->expired, 1, __ATOMIC_RELEASE);
+    }
+    lol_mutex_unlock(&lol_timeouts_lock);
+}
+
+/* Return the timeout of a handle, or NULL if it is stale or invalid. */
+static inline struct lol_timeout *lol_timeout_get(int handle) {
+    unsigned index = (unsigned)handle & ((1u << LOL_TIMEOUT_INDEX_BITS) - 1);
+
+    if (handle < 0 || index >= LOL_TIMEOUT_MAX
+            || __atomic_load_n(&lol_timeouts[index].generation, __ATOMIC_ACQUIRE)
+                != (unsigned)handle >> LOL_TIMEOUT_INDEX_BITS) {
+        return NULL;
+    }
+    return &lol_timeouts[index];
+}
+
+/* Start a timeout of `ms` milliseconds, and return its handle, which must be
+freed with `lol_timeout_cancel()`. Return -1 if there are too many. */
+static inline int lol_timeout_start(int ms) {
+    struct lol_timer_loop *loop = lol_timer_get_service();
+    struct lol_timeout *timeout = NULL;
+    int index = -1;
+    uint32_t generation = 0;
+
+    if (LOL_UNLIKELY(loop == NULL)) {
+        return -1;
+    }
+    lol_mutex_lock(&lol_timeouts_lock);
+    /* The timer of a free timeout is not in the wheel or running. */
+    if (lol_timeouts_free >= 0) {
+        index = lol_timeouts_free;
+        lol_timeouts_free = lol_timeouts[index].next_free;
+    } else if (lol_timeouts_used < LOL_TIMEOUT_MAX) {
+        index = lol_timeouts_used++;
+    }
+    if (index >= 0) {
+        timeout = &lol_timeouts[index];
+        timeout->expired = 0;
+        generation = timeout->generation;
+    }
+    lol_mutex_unlock(&lol_timeouts_lock);
+    if (index < 0) {
+        return -1;
+    }
+    lol_timer_init(&timeout->timer, lol_timeout_expire, NULL);
+    lol_timer_loop_add_ms(loop, &timeout->timer, ms > 0 ? (uint64_t)ms : 0);
+    return (int)(generation << LOL_TIMEOUT_INDEX_BITS) | index;
+}
+
+/* Return 1 if a timeout has expired (or its handle is invalid), else 0. */
+static inline int lol_timeout_expired(int handle) {
+    struct lol_timeout *timeout = lol_timeout_get(handle);
+
+    return timeout == NULL || __atomic_load_n(&timeout->expired, __ATOMIC_ACQUIRE);
+}
+
+/* Stop a timeout, if it has not expired, and free its handle. */
+static inline void lol_timeout_cancel(int handle) {
+    struct lol_timeout *timeout = lol_timeout_get(handle);
+    int pending = 0;
+
+    if (timeout == NULL) {
+        return;
+    }
+    pending = lol_timer_loop_cancel(&lol_timer_service, &timeout->timer);
+    lol_mutex_lock(&lol_timeouts_lock);
+    if (lol_timeout_get(handle) == timeout) {
+        __atomic_store_n(&timeout->generation,
+            (timeout->generation + 1) & ((1u << (31 - LOL_TIMEOUT_INDEX_BITS)) - 1), __ATOMIC_RELEASE);
+        if (pending || timeout->expired) {
+            lol_timeout_free(timeout);
+        } else {
+            timeout->orphaned = 1;
+        }
+    }
+    lol_mutex_unlock(&lol_timeouts_lock);
+}
+
+#endif /* LOL_TIMER_H */
@@ -0,0 +1,121 @@
+/*
+ * USDT (User Statically-Defined Tracing) probes
+ *
+ * Probes that bpftrace, perf and SystemTap can attach to while the program
+ * runs, e.g. `bpftrace -e 'usdt:./a.out:lol:request_done { @[arg0] = count(); }'`.
+ * Each probe is a single `nop`, so an unattached probe costs (almost) nothing;
+ * attaching replaces it with a breakpoint. The arguments only need to be
+ * somewhere that the tracer can read (a register, memory or a constant), so
+ * computing them is usually free too.
+ *
+ * This emits the same ELF notes (section `.note.stapsdt`) as <sys/sdt.h>,
+ * without needing it installed. The caller gives each argument's size in bytes,
+ * negated if the argument is signed, e.g. for an `int x` and a `const char *s`:
+ *
+ * ```c
+ * LOL_USDT_PROBE2(request_done, -4, x, 8, s);
+ * ```
+ *
+ * The probes are under the provider `LOL_USDT_PROVIDER` ("lol"). On compilers
+ * and architectures that we do not support, or with -DLOL_USDT_DISABLE, the
+ * probes are removed (and their arguments are not evaluated).
+ */
+#ifndef LOL_USDT_H
+#define LOL_USDT_H
+
+#ifndef LOL_USDT_PROVIDER
+#define LOL_USDT_PROVIDER lol
+#endif
+
+#define LOL_USDT_STRINGIFY_(x) #x
+#define LOL_USDT_STRINGIFY(x) LOL_USDT_STRINGIFY_(x)
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__aarch64__)) && !defined(LOL_USDT_DISABLE)
+#define LOL_USDT_ENABLED 1
+
+/* Where an argument may be: an immediate, offsettable memory or a register. */
+#if defined(__x86_64__)
+#define LOL_USDT_ARG(x) "nor"(x)
+#else
+#define LOL_USDT_ARG(x) "r"(x)
+#endif
+
+/* The note that describes the probe at label 990 (see the SystemTap wiki's
+"UserSpaceProbeImplementation"). The tracer relocates the probe's address by
+comparing `_.stapsdt.base`'s recorded and actual addresses. The semaphore
+address is 0, since the probes are always enabled. */
+#define LOL_USDT_NOTE(name, arguments)                                          \
+    "990: nop\n"                                                                \
+    ".pushsection .note.stapsdt,\"?\",\"note\"\n"                               \
+    ".balign 4\n"                                                               \
+    ".4byte 992f-991f, 994f-993f, 3\n"                                          \
+    "991: .asciz \"stapsdt\"\n"                                                 \
+    "992: .balign 4\n"                                                          \
+    "993: .8byte 990b\n"                                                        \
+    ".8byte _.stapsdt.base\n"                                                   \
+    ".8byte 0\n"                                                                \
+    ".asciz \"" LOL_USDT_STRINGIFY(LOL_USDT_PROVIDER) "\"\n"                    \
+    ".asciz \"" #name "\"\n"                                                    \
+    ".asciz \"" arguments "\"\n"                                                \
+    "994: .balign 4\n"                                                          \
+    ".popsection\n"                                                             \
+    ".ifndef _.stapsdt.base\n"                                                  \
+    ".pushsection .stapsdt.base,\"aG\",\"progbits\",.stapsdt.base,comdat\n"     \
+    ".weak _.stapsdt.base\n"                                                    \
+    ".hidden _.stapsdt.base\n"                                                  \
+    "_.stapsdt.base: .space 1\n"                                                \
+    ".size _.stapsdt.base, 1\n"                                                 \
+    ".popsection\n"                                                             \
+    ".endif\n"
+
+#define LOL_USDT_PROBE0(name)                                                   \
+    __asm__ __volatile__(LOL_USDT_NOTE(name, ""))
+#define LOL_USDT_PROBE1(name, s1, a1)                                           \
+    __asm__ __volatile__(LOL_USDT_NOTE(name, #s1 "@%0")                         \
+        :: LOL_USDT_ARG(a1))
+#define LOL_USDT_PROBE2(name, s1, a1, s2, a2)                                   \
+    __asm__ __volatile__(LOL_USDT_NOTE(name, #s1 "@%0 " #s2 "@%1")              \
+        :: LOL_USDT_ARG(a1), LOL_USDT_ARG(a2))
+#define LOL_USDT_PROBE3(name, s1, a1, s2, a2, s3, a3)                           \
+    __asm__ __volatile__(LOL_USDT_NOTE(name, #s1 "@%0 " #s2 "@%1 " #s3 "@%2")   \
+        :: LOL_USDT_ARG(a1), LOL_USDT_ARG(a2), LOL_USDT_ARG(a3))
+#define LOL_USDT_PROBE4(name, s1, a1, s2, a2, s3, a3, s4, a4)                   \
+    __asm__ __volatile__(LOL_USDT_NOTE(name,                                    \
+            #s1 "@%0 " #s2 "@%1 " #s3 "@%2 " #s4 "@%3")                         \
+        :: LOL_USDT_ARG(a1), LOL_USDT_ARG(a2), LOL_USDT_ARG(a3),                \
+            LOL_USDT_ARG(a4))
+#define LOL_USDT_PROBE5(name, s1, a1, s2, a2, s3, a3, s4, a4, s5, a5)           \
+    __asm__ __volatile__(LOL_USDT_NOTE(name,                                    \
+            #s1 "@%0 " #s2 "@%1 " #s3 "@%2 " #s4 "@%3 " #s5 "@%4")              \
+        :: LOL_USDT_ARG(a1), LOL_USDT_ARG(a2), LOL_USDT_ARG(a3),                \
+            LOL_USDT_ARG(a4), LOL_USDT_ARG(a5))
+#define LOL_USDT_PROBE6(name, s1, a1, s2, a2, s3, a3, s4, a4, s5, a5, s6, a6)   \
+    __asm__ __volatile__(LOL_USDT_NOTE(name,                                    \
+            #s1 "@%0 " #s2 "@%1 " #s3 "@%2 " #s4 "@%3 " #s5 "@%4 " #s6 "@%5")   \
+        :: LOL_USDT_ARG(a1), LOL_USDT_ARG(a2), LOL_USDT_ARG(a3),                \
+            LOL_USDT_ARG(a4), LOL_USDT_ARG(a5), LOL_USDT_ARG(a6))
+
+#else
+#define LOL_USDT_ENABLED 0
+
+/* sizeof does not evaluate the arguments, but it does use them. */
+#define LOL_USDT_PROBE0(name) ((void)0)
+#define LOL_USDT_PROBE1(name, s1, a1) ((void)sizeof(a1))
+#define LOL_USDT_PROBE2(name, s1, a1, s2, a2)                                   \
+    ((void)sizeof(a1), (void)sizeof(a2))
+#define LOL_USDT_PROBE3(name, s1, a1, s2, a2, s3, a3)                           \
+    ((void)sizeof(a1), (void)sizeof(a2), (void)sizeof(a3))
+#define LOL_USDT_PROBE4(name, s1, a1, s2, a2, s3, a3, s4, a4)                   \
+    ((void)sizeof(a1), (void)sizeof(a2), (void)sizeof(a3), (void)sizeof(a4))
+#define LOL_USDT_PROBE5(name, s1, a1, s2, a2, s3, a3, s4, a4, s5, a5)           \
+    ((void)sizeof(a1), (void)sizeof(a2), (void)sizeof(a3), (void)sizeof(a4),    \
+        (void)sizeof(a5))
+#define LOL_USDT_PROBE6(name, s1, a1, s2, a2, s3, a3, s4, a4, s5, a5, s6, a6)   \
+    ((void)sizeof(a1), (void)sizeof(a2), (void)sizeof(a3), (void)sizeof(a4),    \
+        (void)sizeof(a5), (void)sizeof(a6))
+#endif
+
+/* The most arguments that a probe may have. */
+#define LOL_USDT_MAX_ARGUMENTS 6
+
+#endif /* LOL_USDT_H */
@@ -0,0 +1,116 @@
+"""
+Test the parameters of outlined cold blocks.
+
+A cold block takes the variables that it uses as parameters. When a later
+`let` shadows one of them, the block must still take the variable that is in
+scope where the block is, with its type and the way that it is passed.
+"""
+import os
+import subprocess
+import tempfile
+
+import compiler.analyzer.lol_analyzer as analyzer
+from compiler.lol import LolModule
+
+RUNTIME_DIR = os.path.join(os.path.dirname(__file__), "..", "..", "src", "runtime")
+
+PROGRAM = """
+module io = import("stdio.h");
+
+function describe(x: i32, y: i32) -> i32 {
+    if[unlikely] x < 0 {
+        io::printf("describe: %d is negative\\n", x);
+        return 0 - 22;
+    }
+    if x > 100 {
+        let y: i32 = x - 100;
+        if[unlikely] y > 50 {
+            io::printf("describe: %d is over 50\\n", y);
+            return 0 - 34;
+        }
+        return y;
+    }
+    if x > 0 {
+        let x: cstr = "positive";
+        io::printf("describe: %s\\n", x);
+        return 1;
+    }
+    return 0;
+}
+
+function main() -> i32 {
+    io::printf(
+        "%d %d %d %d %d\\n",
+        describe(0 - 1, 0), describe(200, 0), describe(120, 0), describe(5, 0), describe(0, 0)
+    );
+    return 0;
+}
+"""
+EXPECTED_OUTPUT = (
+    "describe: -1 is negative\n"
+    "describe: 100 is over 50\n"
+    "describe: positive\n"
+    "-22 -34 20 1 0\n"
+)
+
+
+def compile_and_run(text: str) -> (str, str):
+    """Return the emitted C and what the program prints."""
+    with tempfile.TemporaryDirectory() as tmp:
+        input_file = os.path.join(tmp, "outliner.lol")
+        with open(input_file, "w") as f:
+            f.write(text)
+        module = LolModule(input_file=input_file, output_dir=tmp)
+        module.read_input_file()
+        module.run_lexer()
+        module.run_parser()
+        module.run_analyzer()
+        module.run_optimizer()
+        module.run_emitter()
+        module.save_emitter_output_only()
+        binary = os.path.join(tmp, "outliner")
+        # -Werror, so that passing a variable of the wrong type fails
+        subprocess.run(
+            ["gcc", "-std=c99", "-Wall", "-Werror", "-Wno-unused-variable", "-pthread",
+             "-I", RUNTIME_DIR, module.output_file, "-o", binary],
+            check=True,
+        )
+        output = subprocess.run([binary], check=True, capture_output=True, text=True).stdout
+        return module.code, output
+
+
+def test_shadowed_by_value():
+    code, output = compile_and_run(PROGRAM)
+    # The parameter x, not the cstr that shadows it later
+    assert "LOLcold_0(const int x)" in code
+    assert "LOLcold_0(x)" in code
+    # The local y, which shadows the parameter y
+    assert "LOLcold_1(const int y)" in code
+    assert "LOLcold_1(y)" in code
+    assert output == EXPECTED_OUTPUT, output
+
+
+def test_shadowed_by_reference():
+    limit = analyzer.ABI_MAX_REGISTER_AGGREGATE_SIZE
+    analyzer.ABI_MAX_REGISTER_AGGREGATE_SIZE = 0
+    try:
+        code, output = compile_and_run(PROGRAM)
+    finally:
+        analyzer.ABI_MAX_REGISTER_AGGREGATE_SIZE = limit
+    # The parameter is held by reference, so it is passed on as one...
+    assert "LOLcold_0(const int *restrict x)" in code
+    assert "LOLcold_0(x)" in code
+    # ...while the local that shadows a parameter is held by value.
+    assert "LOLcold_1(const int y)" in code
+    assert "LOLcold_1(y)" in code
+    assert output == EXPECTED_OUTPUT, output
+
+
+def main():
+    test_shadowed_by_value()
+    test_shadowed_by_reference()
+    print("test_outliner: ok")
+
+
+if __name__ == "__main__":
+    main()
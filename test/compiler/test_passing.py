@@ -0,0 +1,126 @@
+"""
+Test how parameters are passed.
+
+Every Do type fits in registers, so to test passing by reference, we lower the
+size limit until even an i32 goes as a `const int *restrict`. Then we check
+the emitted C and that the program still computes the same values.
+"""
+import os
+import subprocess
+import tempfile
+
+import compiler.analyzer.lol_analyzer as analyzer
+from compiler.analyzer.lol_analyzer import (
+    LolAnalysisBuiltinType, LolAnalysisPassingStrategy, get_passing_strategy,
+)
+from compiler.lol import LolModule
+
+RUNTIME_DIR = os.path.join(os.path.dirname(__file__), "..", "..", "src", "runtime")
+
+PROGRAM = """
+module io = import("stdio.h");
+
+function add(x: i32, y: i32) -> i32 {
+    return x + y;
+}
+
+/* Forwards its parameters, and its cold block is outlined */
+function checked_add(x: i32, y: i32) -> i32 {
+    if[unlikely] x < 0 {
+        io::printf("checked_add: %d is negative\\n", x);
+        return 0 - y;
+    }
+    return add(x, y);
+}
+
+function fibonacci(n: i32) -> i32 {
+    if n < 2 {
+        return n;
+    }
+    let a: i32 = spawn fibonacci(n - 1);
+    let b: i32 = fibonacci(n - 2);
+    sync;
+    return a + b;
+}
+
+function main() -> i32 {
+    let three: i32 = 3;
+    io::printf("%d %d %d\\n", checked_add(three, 4), checked_add(0 - 1, 5), fibonacci(15));
+    return 0;
+}
+"""
+EXPECTED_OUTPUT = "checked_add: -1 is negative\n7 -5 610\n"
+
+
+def compile_and_run(text: str) -> (str, str):
+    """Return the emitted C and what the program prints."""
+    with tempfile.TemporaryDirectory() as tmp:
+        input_file = os.path.join(tmp, "passing.lol")
+        with open(input_file, "w") as f:
+            f.write(text)
+        module = LolModule(input_file=input_file, output_dir=tmp)
+        module.read_input_file()
+        module.run_lexer()
+        module.run_parser()
+        module.run_analyzer()
+        module.run_optimizer()
+        module.run_emitter()
+        module.save_emitter_output_only()
+        binary = os.path.join(tmp, "passing")
+        subprocess.run(
+            ["gcc", "-std=c99", "-Wall", "-Werror", "-Wno-unused-variable", "-pthread",
+             "-I", RUNTIME_DIR, module.output_file, "-o", binary],
+            check=True,
+        )
+        output = subprocess.run([binary], check=True, capture_output=True, text=True).stdout
+        return module.code, output
+
+
+def test_strategy():
+    register_sized = LolAnalysisBuiltinType("pair", {}, size=16, align=8)
+    too_big = LolAnalysisBuiltinType("triple", {}, size=24, align=8)
+    assert get_passing_strategy(register_sized) == LolAnalysisPassingStrategy.BY_VALUE
+    assert get_passing_strategy(too_big) == LolAnalysisPassingStrategy.BY_REFERENCE
+
+
+def test_by_value():
+    code, output = compile_and_run(PROGRAM)
+    assert "add(const int x, const int y)" in code
+    assert "*restrict" not in code
+    assert output == EXPECTED_OUTPUT, output
+
+
+def test_by_reference():
+    limit = analyzer.ABI_MAX_REGISTER_AGGREGATE_SIZE
+    analyzer.ABI_MAX_REGISTER_AGGREGATE_SIZE = 0
+    try:
+        code, output = compile_and_run(PROGRAM)
+    finally:
+        analyzer.ABI_MAX_REGISTER_AGGREGATE_SIZE = limit
+    assert "add(const int *restrict x, const int *restrict y)" in code
+    # References are never null
+    assert "LOL_NONNULL(1, 2) int\nadd(" in code
+    # Parameters are dereferenced where they are used...
+    assert "(*x) + (*y)" in code
+    # ...and forwarded as they are, while locals have their address taken
+    assert "add(x, y)" in code
+    assert "checked_add(&three" in code
+    # Outlined cold blocks take the references that their parent holds
+    assert "LOLcold_0(const int *restrict x, const int *restrict y)" in code
+    assert "LOLcold_0(x, y)" in code
+    # A spawned call takes references to the copies in its frame
+    assert "fibonacci(&frame->arg0)" in code
+    # Library functions keep their C prototypes
+    assert "printf(LOLvar_2, (*x))" in code
+    assert output == EXPECTED_OUTPUT, output
+
+
+def main():
+    test_strategy()
+    test_by_value()
+    test_by_reference()
+    print("test_passing: ok")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,100 @@
+"""
+Test that a variable is itself again after the block that shadows it.
+
+A `let` in a block may shadow a variable of the same name until the end of the
+block. After it, the name must refer to the outer variable again, with its
+type and the way that it is held, in every construct that reads it.
+"""
+import os
+import subprocess
+import tempfile
+
+import compiler.analyzer.lol_analyzer as analyzer
+from compiler.lol import LolModule
+
+RUNTIME_DIR = os.path.join(os.path.dirname(__file__), "..", "..", "src", "runtime")
+
+PROGRAM = """
+module io = import("stdio.h");
+
+function after_shadow(x: i32) -> i32 {
+    if x > 100 {
+        let x: cstr = "large";
+        io::printf("after_shadow: %s\\n", x);
+    } else {
+        let x: cstr = "small";
+        io::printf("after_shadow: %s\\n", x);
+    }
+    let y: i32 = x + 1;
+    return y;
+}
+
+function main() -> i32 {
+    let a: i32 = after_shadow(5);
+    let b: i32 = after_shadow(500);
+    io::printf("%d %d\\n", a, b);
+    return 0;
+}
+"""
+EXPECTED_OUTPUT = "after_shadow: small\nafter_shadow: large\n6 501\n"
+
+
+def compile_and_run(text: str, usdt: bool = False) -> (str, str):
+    """Return the emitted C and what the program prints."""
+    with tempfile.TemporaryDirectory() as tmp:
+        input_file = os.path.join(tmp, "shadowing.lol")
+        with open(input_file, "w") as f:
+            f.write(text)
+        module = LolModule(input_file=input_file, output_dir=tmp, usdt=usdt)
+        module.read_input_file()
+        module.run_lexer()
+        module.run_parser()
+        module.run_analyzer()
+        module.run_optimizer()
+        module.run_emitter()
+        module.save_emitter_output_only()
+        binary = os.path.join(tmp, "shadowing")
+        # -Werror, so that using a variable as the wrong type fails
+        subprocess.run(
+            ["gcc", "-std=c99", "-Wall", "-Werror", "-Wno-unused-variable", "-pthread",
+             "-I", RUNTIME_DIR, module.output_file, "-o", binary],
+            check=True,
+        )
+        output = subprocess.run([binary], check=True, capture_output=True, text=True).stdout
+        return module.code, output
+
+
+def test_by_value():
+    code, output = compile_and_run(PROGRAM)
+    assert output == EXPECTED_OUTPUT, output
+
+
+def test_by_reference():
+    limit = analyzer.ABI_MAX_REGISTER_AGGREGATE_SIZE
+    analyzer.ABI_MAX_REGISTER_AGGREGATE_SIZE = 0
+    try:
+        code, output = compile_and_run(PROGRAM)
+    finally:
+        analyzer.ABI_MAX_REGISTER_AGGREGATE_SIZE = limit
+    # The parameter is dereferenced after the blocks as well as before
+    assert "after_shadow(const int *restrict x)" in code
+    assert "(*x) + " in code
+    assert output == EXPECTED_OUTPUT, output
+
+
+def test_entry_probe():
+    code, output = compile_and_run(PROGRAM, usdt=True)
+    # The parameter, not the cstr that was defined last
+    assert "LOL_USDT_PROBE1(after_shadow__entry, -4, x);" in code
+    assert output == EXPECTED_OUTPUT, output
+
+
+def main():
+    test_by_value()
+    test_by_reference()
+    test_entry_probe()
+    print("test_shadowing: ok")
+
+
+if __name__ == "__main__":
+    main()
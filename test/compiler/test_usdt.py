@@ -0,0 +1,132 @@
+"""
+Test the USDT probes that the compiler emits.
+
+We compile `probe` statements (and, with -fusdt, the entry and return probes of
+every function), then read the probe descriptors back from the binary's ELF
+notes, as a tracer would, and check each probe's argument spec: one
+`<size>@<location>` per argument, with the size negative if the argument is
+signed.
+"""
+import os
+import re
+import subprocess
+import tempfile
+from typing import Dict, List
+
+from compiler.lol import LolModule
+
+RUNTIME_DIR = os.path.join(os.path.dirname(__file__), "..", "..", "src", "runtime")
+
+PROGRAM = """
+module io = import("stdio.h");
+
+function trace(a: i32, b: i32, c: i32, d: i32, e: i32, f: i32, g: i32) -> i32 {
+    probe started();
+    probe six(a, b, c, d, e, f);
+    return a + g;
+}
+
+function main() -> i32 {
+    let name: cstr = "probes";
+    let n: i32 = trace(1, 2, 3, 4, 5, 6, 7);
+    probe named(name, n);
+    io::printf("%s: %d\\n", name, n);
+    return 0;
+}
+"""
+EXPECTED_OUTPUT = "probes: 8\n"
+
+TOO_MANY_ARGUMENTS = """
+function main() -> i32 {
+    let n: i32 = 0;
+    probe seven(n, n, n, n, n, n, n);
+    return 0;
+}
+"""
+
+
+def compile_and_run(text: str, usdt: bool = False) -> (str, str, Dict[str, List[str]]):
+    """
+    Return the emitted C, what the program prints, and each probe's argument
+    specs by name (a list, since a probe may be at several places).
+    """
+    with tempfile.TemporaryDirectory() as tmp:
+        input_file = os.path.join(tmp, "usdt.lol")
+        with open(input_file, "w") as f:
+            f.write(text)
+        module = LolModule(input_file=input_file, output_dir=tmp, usdt=usdt)
+        module.read_input_file()
+        module.run_lexer()
+        module.run_parser()
+        module.run_analyzer()
+        module.run_optimizer()
+        module.run_emitter()
+        module.save_emitter_output_only()
+        binary = os.path.join(tmp, "usdt")
+        subprocess.run(
+            ["gcc", "-std=c99", "-O2", "-Wall", "-Werror", "-Wno-unused-variable",
+             "-I", RUNTIME_DIR, module.output_file, "-o", binary],
+            check=True,
+        )
+        output = subprocess.run([binary], check=True, capture_output=True, text=True).stdout
+        notes = subprocess.run(["readelf", "-n", binary], check=True, capture_output=True, text=True).stdout
+    probes: Dict[str, List[str]] = {}
+    for provider, name, arguments in re.findall(
+        r"Provider: (\S+)\n\s+Name: (\S+)\n.*\n(?:\s+Arguments: (.*)\n)?", notes
+    ):
+        assert provider == "lol", provider
+        probes.setdefault(name, []).append(arguments.strip())
+    return module.code, output, probes
+
+
+def signed_32_bit(count: int) -> str:
+    """A pattern for the argument spec of `count` i32 arguments."""
+    return r"\s".join([r"-4@\S+"] * count)
+
+
+def test_probe_statements():
+    code, output, probes = compile_and_run(PROGRAM)
+    assert "#include <lol_usdt.h>" in code
+    assert "LOL_USDT_PROBE0(started);" in code
+    assert "LOL_USDT_PROBE6(six, -4, a, -4, b, -4, c, -4, d, -4, e, -4, f);" in code
+    # A cstr is an unsigned 8-byte pointer
+    assert re.search(r"LOL_USDT_PROBE2\(named, 8, \w+, -4, \w+\);", code)
+    assert output == EXPECTED_OUTPUT, output
+    assert sorted(probes) == ["named", "six", "started"], probes
+    assert probes["started"] == [""]
+    assert re.fullmatch(signed_32_bit(6), probes["six"][0]), probes["six"]
+    assert re.fullmatch(r"8@\S+ -4@\S+", probes["named"][0]), probes["named"]
+
+
+def test_function_probes():
+    code, output, probes = compile_and_run(PROGRAM, usdt=True)
+    assert output == EXPECTED_OUTPUT, output
+    # Entry probes take the first PROBE_MAX_ARGUMENTS parameters
+    assert "LOL_USDT_PROBE6(trace__entry, -4, a, -4, b, -4, c, -4, d, -4, e, -4, f);" in code
+    assert re.fullmatch(signed_32_bit(6), probes["trace__entry"][0]), probes["trace__entry"]
+    assert probes["main__entry"] == [""]
+    # Return probes take the returned value, wherever the function returns
+    for name in ["trace__return", "main__return"]:
+        assert probes[name], probes
+        assert all(re.fullmatch(signed_32_bit(1), spec) for spec in probes[name]), probes[name]
+    assert probes["six"] and probes["named"], probes
+
+
+def test_too_many_arguments():
+    try:
+        compile_and_run(TOO_MANY_ARGUMENTS)
+    except ValueError as e:
+        assert "probe seven has 7 arguments" in str(e), e
+    else:
+        assert False, "a probe with 7 arguments compiled"
+
+
+def main():
+    test_probe_statements()
+    test_function_probes()
+    test_too_many_arguments()
+    print("test_usdt: ok")
+
+
+if __name__ == "__main__":
+    main()
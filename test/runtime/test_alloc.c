@@ -0,0 +1,118 @@
+/* Tests lol_alloc.h: size classes, remote frees and returning segments. */
+#include "lol_alloc.h"
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+
+#define BLOCK_COUNT 100000
+
+static void *blocks[BLOCK_COUNT];
+
+static void test_sizes(void) {
+    size_t sizes[] = { 0, 1, 16, 17, 128, 129, 1000, 4096, 100000, 256 << 10, (256 << 10) + 1, 5 << 20 };
+    size_t i = 0;
+
+    for (i = 0; i < sizeof sizes / sizeof sizes[0]; ++i) {
+        char *block = lol_alloc(sizes[i]);
+
+        assert(block != NULL);
+        assert((uintptr_t)block % 16 == 0);
+        assert(lol_alloc_usable_size(block) >= sizes[i]);
+        memset(block, 0xab, sizes[i]);
+        lol_free(block);
+    }
+    lol_free(NULL);
+    assert(lol_alloc_usable_size(NULL) == 0);
+#ifndef LOL_ALLOC_SYSTEM
+    for (i = 1; i <= LOL_ALLOC_MAX_SMALL; ++i) {
+        assert(lol_alloc_class_size(lol_alloc_class(i)) >= i);
+        assert(lol_alloc_class(i) < LOL_ALLOC_CLASS_COUNT);
+    }
+#endif
+}
+
+static void test_calloc(void) {
+    unsigned char *block = lol_calloc(1000, 3);
+    size_t i = 0;
+
+    assert(block != NULL);
+    for (i = 0; i < 3000; ++i) {
+        assert(block[i] == 0);
+    }
+    lol_free(block);
+    assert(lol_calloc(SIZE_MAX / 2, 3) == NULL);
+}
+
+static void *free_blocks(void *arg) {
+    size_t i = 0;
+
+    (void)arg;
+    for (i = 0; i < BLOCK_COUNT; ++i) {
+        assert(*(size_t *)blocks[i] == i);
+        lol_free(blocks[i]);
+    }
+    return NULL;
+}
+
+/* Allocate many blocks on this thread and free them on another, which pushes
+them onto the remote-free queues. */
+static void test_remote_frees(void) {
+    struct lol_alloc_stats stats = { 0 };
+    pthread_t thread;
+    size_t i = 0;
+
+    for (i = 0; i < BLOCK_COUNT; ++i) {
+        blocks[i] = lol_alloc(48);
+        assert(blocks[i] != NULL);
+        *(size_t *)blocks[i] = i;
+    }
+    assert(pthread_create(&thread, NULL, free_blocks, NULL) == 0);
+    assert(pthread_join(thread, NULL) == 0);
+#ifndef LOL_ALLOC_SYSTEM
+    lol_alloc_get_stats(&stats);
+    assert(stats.remote_frees >= BLOCK_COUNT);
+#endif
+    /* The owner takes them back. */
+    for (i = 0; i < BLOCK_COUNT; ++i) {
+        blocks[i] = lol_alloc(48);
+        assert(blocks[i] != NULL);
+    }
+    for (i = 0; i < BLOCK_COUNT; ++i) {
+        lol_free(blocks[i]);
+    }
+    lol_alloc_get_stats(&stats);
+    assert(stats.allocated_bytes == stats.freed_bytes);
+}
+
+/* Segments whose blocks are all freed go back to the kernel. */
+static void test_release(void) {
+    struct lol_alloc_stats before = { 0 };
+    struct lol_alloc_stats after = { 0 };
+    size_t i = 0;
+
+    lol_alloc_get_stats(&before);
+    for (i = 0; i < BLOCK_COUNT; ++i) {
+        blocks[i] = lol_alloc(1000);
+        assert(blocks[i] != NULL);
+    }
+    for (i = 0; i < BLOCK_COUNT; ++i) {
+        lol_free(blocks[i]);
+    }
+    lol_alloc_get_stats(&after);
+#ifndef LOL_ALLOC_SYSTEM
+    /* All but the segment that new pages come from. */
+    assert(after.mapped_bytes <= before.mapped_bytes + LOL_ALLOC_SEGMENT_SIZE);
+#endif
+    assert(after.allocations - before.allocations == BLOCK_COUNT);
+    assert(after.frees - before.frees == BLOCK_COUNT);
+}
+
+int main(void) {
+    test_sizes();
+    test_calloc();
+    test_remote_frees();
+    test_release();
+    return 0;
+}
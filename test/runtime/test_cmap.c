@@ -0,0 +1,161 @@
+/* Tests lol_cmap.h: the map operations, resizing, and concurrent writers and
+readers. */
+#include "lol_cmap.h"
+
+#include <assert.h>
+#include <pthread.h>
+
+static inline uint64_t hash_int(const int *key) {
+    return lol_cmap_hash_u64((uint64_t)*key);
+}
+
+#define equal_int(a, b) (*(a) == *(b))
+
+LOL_CMAP_DEFINE(int_map, int, int, hash_int, equal_int)
+
+#define THREAD_COUNT 4
+#define KEYS_PER_THREAD 20000
+
+static struct int_map shared;
+
+static void test_single_thread(void) {
+    struct int_map map;
+    int key = 0;
+    int value = 0;
+
+    /* A small table, so that it is resized many times. */
+    assert(int_map_init(&map, 4) == 0);
+    key = 7;
+    assert(!int_map_get(&map, &key, &value));
+    assert(!int_map_remove(&map, &key));
+    for (key = 0; key < 10000; ++key) {
+        value = key * 2;
+        assert(int_map_put(&map, &key, &value) == 0);
+    }
+    assert(int_map_size(&map) == 10000);
+    key = 123;
+    value = -1;
+    assert(int_map_put(&map, &key, &value) == 0);
+    assert(int_map_size(&map) == 10000);
+    for (key = 0; key < 10000; ++key) {
+        assert(int_map_get(&map, &key, &value));
+        assert(value == (key == 123 ? -1 : key * 2));
+    }
+    for (key = 0; key < 10000; key += 2) {
+        assert(int_map_remove(&map, &key));
+    }
+    assert(int_map_size(&map) == 5000);
+    for (key = 0; key < 10000; ++key) {
+        assert(int_map_get(&map, &key, &value) == (key % 2 == 1));
+    }
+    int_map_destroy(&map);
+}
+
+/* Put keys from `*key` on until a resize starts, and return the old table. */
+static struct int_map_table *fill_until_resize(struct int_map *map, int *key) {
+    for (; __atomic_load_n(&map->table->next, __ATOMIC_ACQUIRE) == NULL; ++*key) {
+        assert(int_map_put(map, key, key) == 0);
+    }
+    return map->table;
+}
+
+/* A bucket that could not be moved for lack of memory is retried once every
+bucket has been handed out, and the retry is not repeated once it succeeds. */
+static void test_failed_moves(void) {
+    struct int_map map;
+    struct int_map_table *table = NULL;
+    struct int_map_table *next = NULL;
+    int key = 0, last = 0, value = 0;
+    size_t i = 0;
+
+    assert(int_map_init(&map, 0) == 0);
+    table = fill_until_resize(&map, &key);
+    next = table->next;
+    /* Every bucket has been moved since a move failed, but another writer
+    has not counted its moves yet. */
+    table->cursor = table->mask + 1;
+    for (i = 0; i <= table->mask; ++i) {
+        assert(int_map_move_bucket(table, i) == 1);
+    }
+    table->failed = 1;
+    last = key++;
+    assert(int_map_put(&map, &last, &last) == 0);
+    assert(!table->failed);
+    assert(map.table == table);
+    int_map_finish_moves(&map, table, table->mask + 1);
+    assert(map.table == next);
+
+    /* The retry moves whatever is left, and switches tables. */
+    table = fill_until_resize(&map, &key);
+    next = table->next;
+    table->cursor = table->mask + 1;
+    table->failed = 1;
+    last = key++;
+    assert(int_map_put(&map, &last, &last) == 0);
+    assert(map.table == next);
+    for (last = 0; last < key; ++last) {
+        assert(int_map_get(&map, &last, &value) && value == last);
+    }
+    int_map_destroy(&map);
+}
+
+/* Each writer owns a range of keys, puts them, replaces them and removes
+every other one, while reading the other writers' keys. */
+static void *write_keys(void *arg) {
+    int first = *(int *)arg * KEYS_PER_THREAD;
+    int key = 0;
+    int value = 0;
+
+    for (key = first; key < first + KEYS_PER_THREAD; ++key) {
+        value = key;
+        assert(int_map_put(&shared, &key, &value) == 0);
+    }
+    for (key = first; key < first + KEYS_PER_THREAD; ++key) {
+        int other = (key + KEYS_PER_THREAD) % (THREAD_COUNT * KEYS_PER_THREAD);
+
+        value = -key;
+        assert(int_map_put(&shared, &key, &value) == 0);
+        /* Whatever state another writer has reached, the value matches. */
+        if (int_map_get(&shared, &other, &value)) {
+            assert(value == other || value == -other);
+        }
+    }
+    for (key = first; key < first + KEYS_PER_THREAD; key += 2) {
+        assert(int_map_remove(&shared, &key));
+    }
+    return NULL;
+}
+
+static void test_threads(void) {
+    pthread_t threads[THREAD_COUNT];
+    int ids[THREAD_COUNT];
+    int key = 0;
+    int value = 0;
+    int i = 0;
+
+    assert(int_map_init(&shared, 16) == 0);
+    for (i = 0; i < THREAD_COUNT; ++i) {
+        ids[i] = i;
+        assert(pthread_create(&threads[i], NULL, write_keys, &ids[i]) == 0);
+    }
+    for (i = 0; i < THREAD_COUNT; ++i) {
+        assert(pthread_join(threads[i], NULL) == 0);
+    }
+    assert(int_map_size(&shared) == THREAD_COUNT * KEYS_PER_THREAD / 2);
+    for (key = 0; key < THREAD_COUNT * KEYS_PER_THREAD; ++key) {
+        if (key % 2 == 0) {
+            assert(!int_map_get(&shared, &key, &value));
+        } else {
+            assert(int_map_get(&shared, &key, &value));
+            assert(value == -key);
+        }
+    }
+    int_map_destroy(&shared);
+}
+
+int main(void) {
+    test_single_thread();
+    test_failed_moves();
+    test_threads();
+    return 0;
+}
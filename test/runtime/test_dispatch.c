@@ -0,0 +1,95 @@
+/* Tests lol_dispatch.h: a small bytecode interpreter gives the same results
+with computed gotos and with the switch fallback (-DLOL_DISPATCH_SWITCH). */
+#include "lol_dispatch.h"
+
+#include <assert.h>
+
+#define OPCODES(X)                                                              \
+    X(OP_LOAD_A)                                                                \
+    X(OP_LOAD_B)                                                                \
+    X(OP_ADD)                                                                   \
+    X(OP_MUL)                                                                   \
+    X(OP_DEC_B)                                                                 \
+    X(OP_JUMP_IF_B)                                                             \
+    X(OP_HALT)
+
+enum opcode { OPCODES(LOL_DISPATCH_ENUM) OPCODE_COUNT };
+
+/* How many times each handler ran. */
+static long counts[OPCODE_COUNT];
+
+/* A machine with two registers: a is the result and b is a loop counter. */
+static long run(const unsigned char *code) {
+    LOL_DISPATCH_TABLE(table, OPCODES);
+    const unsigned char *pc = code;
+    long a = 0, b = 0;
+
+    LOL_DISPATCH(table, *pc++) {
+    LOL_CASE(OP_LOAD_A):
+        ++counts[OP_LOAD_A];
+        a = *pc++;
+        LOL_NEXT(table, *pc++);
+    LOL_CASE(OP_LOAD_B):
+        ++counts[OP_LOAD_B];
+        b = *pc++;
+        LOL_NEXT(table, *pc++);
+    LOL_CASE(OP_ADD):
+        ++counts[OP_ADD];
+        a += b;
+        LOL_NEXT(table, *pc++);
+    LOL_CASE(OP_MUL):
+        ++counts[OP_MUL];
+        a *= b;
+        LOL_NEXT(table, *pc++);
+    LOL_CASE(OP_DEC_B):
+        ++counts[OP_DEC_B];
+        --b;
+        LOL_NEXT(table, *pc++);
+    LOL_CASE(OP_JUMP_IF_B):
+        ++counts[OP_JUMP_IF_B];
+        if (b != 0) {
+            pc = code + *pc;
+        } else {
+            ++pc;
+        }
+        LOL_NEXT(table, *pc++);
+    LOL_CASE(OP_HALT):
+        ++counts[OP_HALT];
+        return a;
+    }
+    /* Not reached */
+    return -1;
+}
+
+static void test_programs(void) {
+    /* a = n! */
+    unsigned char factorial[] = {
+        OP_LOAD_A, 1, OP_LOAD_B, 10,
+        /* 4: */ OP_MUL, OP_DEC_B, OP_JUMP_IF_B, 4,
+        OP_HALT,
+    };
+    /* a = 1 + 2 + ... + n */
+    unsigned char sum[] = {
+        OP_LOAD_A, 0, OP_LOAD_B, 100,
+        /* 4: */ OP_ADD, OP_DEC_B, OP_JUMP_IF_B, 4,
+        OP_HALT,
+    };
+    unsigned char halt[] = { OP_HALT };
+
+    assert(run(factorial) == 3628800);
+    assert(counts[OP_MUL] == 10 && counts[OP_JUMP_IF_B] == 10);
+    assert(run(sum) == 5050);
+    assert(counts[OP_ADD] == 100 && counts[OP_DEC_B] == 110);
+    assert(run(halt) == 0);
+    assert(counts[OP_HALT] == 3 && counts[OP_LOAD_A] == 2 && counts[OP_LOAD_B] == 2);
+}
+
+int main(void) {
+#ifdef LOL_DISPATCH_SWITCH
+    assert(!LOL_DISPATCH_COMPUTED_GOTO);
+#else
+    assert(LOL_DISPATCH_COMPUTED_GOTO);
+#endif
+    test_programs();
+    return 0;
+}
@@ -0,0 +1,94 @@
+/* Tests lol_epoch.h: nothing retired is freed while a thread may still read
+it, and everything is freed eventually. */
+#include "lol_epoch.h"
+
+#include <assert.h>
+#include <pthread.h>
+#include <sched.h>
+
+static int freed = 0;
+/* 1: the reader is in its region; 2: the reader may leave it. */
+static int reader_state = 0;
+
+static void count_free(void *pointer) {
+    (void)pointer;
+    __atomic_add_fetch(&freed, 1, __ATOMIC_RELAXED);
+}
+
+/* Retire dummies and collect until `count` pointers have been freed, or give
+up after many rounds. */
+static int wait_for_frees(int count) {
+    static int dummy = 0;
+    int round = 0;
+
+    for (round = 0; round < 100000; ++round) {
+        if (__atomic_load_n(&freed, __ATOMIC_RELAXED) >= count) {
+            return 1;
+        }
+        lol_epoch_retire(&dummy, count_free);
+        lol_epoch_collect();
+    }
+    return 0;
+}
+
+static void *read_in_region(void *arg) {
+    (void)arg;
+    lol_epoch_enter();
+    __atomic_store_n(&reader_state, 1, __ATOMIC_RELEASE);
+    while (__atomic_load_n(&reader_state, __ATOMIC_ACQUIRE) != 2) {
+        sched_yield();
+    }
+    lol_epoch_exit();
+    return NULL;
+}
+
+static void test_region_holds_back_frees(void) {
+    pthread_t reader;
+    int i = 0;
+
+    assert(pthread_create(&reader, NULL, read_in_region, NULL) == 0);
+    while (__atomic_load_n(&reader_state, __ATOMIC_ACQUIRE) != 1) {
+        sched_yield();
+    }
+    /* The epoch can advance once, to the one the reader has not seen, but
+    not twice. */
+    for (i = 0; i < 10 * LOL_EPOCH_BATCH_SIZE; ++i) {
+        lol_epoch_retire(&i, count_free);
+        lol_epoch_collect();
+    }
+    assert(__atomic_load_n(&freed, __ATOMIC_RELAXED) == 0);
+    __atomic_store_n(&reader_state, 2, __ATOMIC_RELEASE);
+    assert(pthread_join(reader, NULL) == 0);
+    assert(wait_for_frees(10 * LOL_EPOCH_BATCH_SIZE));
+}
+
+static void test_nested_regions(void) {
+    lol_epoch_enter();
+    lol_epoch_enter();
+    lol_epoch_exit();
+    /* Still inside the outer region. */
+    assert(__atomic_load_n(&lol_epoch_self->state, __ATOMIC_RELAXED) & LOL_EPOCH_ACTIVE);
+    lol_epoch_exit();
+    assert(__atomic_load_n(&lol_epoch_self->state, __ATOMIC_RELAXED) == 0);
+}
+
+static void test_quiescent_state(void) {
+    int before = __atomic_load_n(&freed, __ATOMIC_RELAXED);
+    int i = 0;
+
+    lol_epoch_online();
+    for (i = 0; i < 4 * LOL_EPOCH_BATCH_SIZE; ++i) {
+        lol_epoch_retire(&i, count_free);
+        lol_epoch_quiescent();
+    }
+    lol_epoch_offline();
+    assert(__atomic_load_n(&lol_epoch_self->state, __ATOMIC_RELAXED) == 0);
+    assert(wait_for_frees(before + 4 * LOL_EPOCH_BATCH_SIZE));
+}
+
+int main(void) {
+    test_region_holds_back_frees();
+    test_nested_regions();
+    test_quiescent_state();
+    return 0;
+}
@@ -0,0 +1,131 @@
+/* Tests lol_fiber.h: spawning, joining, yielding, parking and deep stacks. */
+#include "lol_fiber.h"
+
+#include <assert.h>
+
+#define FIBER_COUNT 1000
+#define PING_PONGS 10000
+
+static int finished = 0;
+
+static void count_finished(void *arg) {
+    (void)arg;
+    lol_fiber_yield();
+    __atomic_add_fetch(&finished, 1, __ATOMIC_RELAXED);
+}
+
+static void test_spawn_and_join(void) {
+    static struct lol_fiber *fibers[FIBER_COUNT];
+    int i = 0;
+
+    for (i = 0; i < FIBER_COUNT; ++i) {
+        fibers[i] = lol_fiber_spawn(count_finished, NULL);
+        assert(fibers[i] != NULL);
+    }
+    for (i = 0; i < FIBER_COUNT; ++i) {
+        lol_fiber_join(fibers[i]);
+    }
+    assert(__atomic_load_n(&finished, __ATOMIC_RELAXED) == FIBER_COUNT);
+    assert(lol_fiber_self() == NULL);
+}
+
+/* Two fibers take turns through park and unpark. */
+struct ping_pong {
+    struct lol_fiber *other;
+    int *turn;
+    int me;
+};
+
+static void play(void *arg) {
+    struct ping_pong *player = arg;
+    int i = 0;
+
+    for (i = 0; i < PING_PONGS; ++i) {
+        while (__atomic_load_n(player->turn, __ATOMIC_ACQUIRE) != player->me) {
+            lol_fiber_park();
+        }
+        __atomic_store_n(player->turn, 1 - player->me, __ATOMIC_RELEASE);
+        while (__atomic_load_n(&player->other, __ATOMIC_ACQUIRE) == NULL) {
+            lol_fiber_yield();
+        }
+        lol_fiber_unpark(__atomic_load_n(&player->other, __ATOMIC_ACQUIRE));
+    }
+}
+
+static void test_park_and_unpark(void) {
+    struct ping_pong players[2];
+    struct lol_fiber *fibers[2];
+    int turn = 0;
+    int i = 0;
+
+    for (i = 0; i < 2; ++i) {
+        players[i].other = NULL;
+        players[i].turn = &turn;
+        players[i].me = i;
+    }
+    for (i = 0; i < 2; ++i) {
+        fibers[i] = lol_fiber_spawn(play, &players[i]);
+        assert(fibers[i] != NULL);
+    }
+    __atomic_store_n(&players[0].other, fibers[1], __ATOMIC_RELEASE);
+    __atomic_store_n(&players[1].other, fibers[0], __ATOMIC_RELEASE);
+    lol_fiber_join(fibers[0]);
+    lol_fiber_join(fibers[1]);
+    assert(turn == 0);
+}
+
+/* A fiber that spawns and joins fibers parks while it waits. */
+static int sum_to(int n) {
+    char frame[256];
+
+    /* Use some stack per call, well below LOL_FIBER_STACK_SIZE in total. */
+    frame[n % sizeof frame] = (char)n;
+    return n == 0 ? frame[0] : n + sum_to(n - 1) - frame[n % sizeof frame] + (char)n;
+}
+
+static void spawn_children(void *arg) {
+    struct lol_fiber *children[8];
+    int i = 0;
+
+    for (i = 0; i < 8; ++i) {
+        children[i] = lol_fiber_spawn(count_finished, NULL);
+        assert(children[i] != NULL);
+    }
+    for (i = 0; i < 8; ++i) {
+        lol_fiber_join(children[i]);
+    }
+    assert(lol_fiber_self() != NULL);
+    *(int *)arg = sum_to(100);
+}
+
+static void test_nested(void) {
+    int result = 0;
+    struct lol_fiber *parent = lol_fiber_spawn(spawn_children, &result);
+
+    assert(parent != NULL);
+    lol_fiber_join(parent);
+    assert(result == 100 * 101 / 2);
+}
+
+static void test_detach(void) {
+    int before = __atomic_load_n(&finished, __ATOMIC_RELAXED);
+    int i = 0;
+
+    for (i = 0; i < 100; ++i) {
+        struct lol_fiber *fiber = lol_fiber_spawn(count_finished, NULL);
+
+        assert(fiber != NULL);
+        lol_fiber_detach(fiber);
+    }
+    while (__atomic_load_n(&finished, __ATOMIC_RELAXED) != before + 100) {
+        sched_yield();
+    }
+}
+
+int main(void) {
+    test_spawn_and_join();
+    test_park_and_unpark();
+    test_nested();
+    test_detach();
+    return 0;
+}
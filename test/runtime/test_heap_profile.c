@@ -0,0 +1,144 @@
+/* Tests lol_heap_profile.h: every allocation is sampled at a rate of one
+byte, and the report attributes each one's bytes to the stack of the function
+that called lol_alloc(). Build it with -O0 too, where nothing is inlined into
+or tail-called from the allocator. */
+#include "lol_heap_profile.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#define SMALL_COUNT 100
+#define LARGE_COUNT 10
+
+/* The return address of each allocating function, i.e. the second frame of
+the stacks that should be reported for it. */
+static void *small_caller = NULL;
+static void *large_caller = NULL;
+
+static __attribute__((noinline)) void *allocate_small(void) {
+    void *pointer = lol_alloc(256);
+
+    small_caller = __builtin_return_address(0);
+    return pointer;
+}
+
+static __attribute__((noinline)) void *allocate_large(void) {
+    void *pointer = lol_alloc(4096);
+
+    large_caller = __builtin_return_address(0);
+    return pointer;
+}
+
+struct report_site {
+    size_t live_count;
+    size_t live_bytes;
+    size_t alloc_count;
+    size_t alloc_bytes;
+    int depth;
+    void *frames[LOL_HEAP_PROFILE_MAX_DEPTH];
+};
+
+/* Read the sites of a report, and return how many there are. */
+static int read_report(const char *path, struct report_site *sites, int max_sites) {
+    FILE *file = fopen(path, "r");
+    char line[4096];
+    int count = 0;
+
+    assert(file != NULL);
+    assert(fgets(line, sizeof line, file) != NULL);
+    assert(strncmp(line, "heap profile:", 13) == 0);
+    while (fgets(line, sizeof line, file) != NULL && line[0] != '\n') {
+        struct report_site *site = &sites[count];
+        char *at = strchr(line, '@');
+        int used = 0;
+
+        assert(count < max_sites && at != NULL);
+        assert(sscanf(line, "%zu: %zu [%zu: %zu]",
+            &site->live_count, &site->live_bytes, &site->alloc_count, &site->alloc_bytes) == 4);
+        site->depth = 0;
+        for (++at; sscanf(at, " %p%n", &site->frames[site->depth], &used) == 1; at += used) {
+            assert(++site->depth <= LOL_HEAP_PROFILE_MAX_DEPTH);
+        }
+        assert(site->depth > 0);
+        ++count;
+    }
+    fclose(file);
+    return count;
+}
+
+/* Find the one site whose stack continues in `caller`. */
+static const struct report_site *find_site(const struct report_site *sites, int count, void *caller) {
+    const struct report_site *found = NULL;
+    int i = 0;
+
+    for (i = 0; i < count; ++i) {
+        if (sites[i].depth >= 2 && sites[i].frames[1] == caller) {
+            assert(found == NULL);
+            found = &sites[i];
+        }
+    }
+    assert(found != NULL);
+    return found;
+}
+
+static void test_attribution(void) {
+    static struct report_site sites[16];
+    char path[] = "/tmp/lol_heap_profile_testXXXXXX";
+    void *small[SMALL_COUNT];
+    void *large[LARGE_COUNT];
+    size_t small_size = 0, large_size = 0;
+    const struct report_site *small_site = NULL, *large_site = NULL;
+    int i = 0, count = 0;
+
+    assert(mkstemp(path) >= 0);
+    assert(lol_heap_profile_start(path, 1) == 0);
+    for (i = 0; i < SMALL_COUNT; ++i) {
+        small[i] = allocate_small();
+    }
+    for (i = 0; i < LARGE_COUNT; ++i) {
+        large[i] = allocate_large();
+    }
+    small_size = lol_alloc_usable_size(small[0]);
+    large_size = lol_alloc_usable_size(large[0]);
+    /* Free half of the small blocks, so that only the rest are live. */
+    for (i = 0; i < SMALL_COUNT / 2; ++i) {
+        lol_free(small[i]);
+    }
+    assert(lol_heap_profile_dump(path) == 0);
+    count = read_report(path, sites, 16);
+
+    /* Each function's blocks are on a stack of their own, which starts at
+    the call site rather than inside the allocator or the profiler. */
+    small_site = find_site(sites, count, small_caller);
+    large_site = find_site(sites, count, large_caller);
+    assert(small_site->frames[0] != large_site->frames[0]);
+    assert(small_site->alloc_count == SMALL_COUNT);
+    assert(small_site->alloc_bytes == SMALL_COUNT * small_size);
+    assert(small_site->live_count == SMALL_COUNT / 2);
+    assert(small_site->live_bytes == SMALL_COUNT / 2 * small_size);
+    assert(large_site->alloc_count == LARGE_COUNT);
+    assert(large_site->alloc_bytes == LARGE_COUNT * large_size);
+    assert(large_site->live_count == LARGE_COUNT);
+
+    for (i = SMALL_COUNT / 2; i < SMALL_COUNT; ++i) {
+        lol_free(small[i]);
+    }
+    for (i = 0; i < LARGE_COUNT; ++i) {
+        lol_free(large[i]);
+    }
+    assert(lol_heap_profile_dump(path) == 0);
+    count = read_report(path, sites, 16);
+    assert(find_site(sites, count, small_caller)->live_bytes == 0);
+    assert(find_site(sites, count, large_caller)->live_bytes == 0);
+    /* Not reported again at exit */
+    lol_alloc_set_hooks(NULL);
+    lol_heap_profile_state.path = "/dev/null";
+    unlink(path);
+}
+
+int main(void) {
+    test_attribution();
+    return 0;
+}
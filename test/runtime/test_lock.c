@@ -0,0 +1,132 @@
+/* Tests lol_lock.h: mutual exclusion, readers-writer exclusion and condition
+variables under contention. */
+#include "lol_lock.h"
+
+#include <assert.h>
+#include <pthread.h>
+
+#define THREAD_COUNT 4
+#define ROUNDS 50000
+
+static struct lol_mutex mutex = LOL_MUTEX_INITIALIZER;
+static long counter = 0;
+
+static struct lol_rwlock rwlock = LOL_RWLOCK_INITIALIZER;
+/* Written only under the write lock, and always equal. */
+static long left = 0;
+static long right = 0;
+
+static struct lol_condvar condvar = LOL_CONDVAR_INITIALIZER;
+static int queued = 0;
+static int consumed = 0;
+
+static void *increment(void *arg) {
+    int i = 0;
+
+    (void)arg;
+    for (i = 0; i < ROUNDS; ++i) {
+        lol_mutex_lock(&mutex);
+        /* Not atomic: a lost update means that two threads held the lock. */
+        counter = counter + 1;
+        lol_mutex_unlock(&mutex);
+    }
+    return NULL;
+}
+
+static void test_mutex(void) {
+    pthread_t threads[THREAD_COUNT];
+    int i = 0;
+
+    for (i = 0; i < THREAD_COUNT; ++i) {
+        assert(pthread_create(&threads[i], NULL, increment, NULL) == 0);
+    }
+    for (i = 0; i < THREAD_COUNT; ++i) {
+        assert(pthread_join(threads[i], NULL) == 0);
+    }
+    assert(counter == (long)THREAD_COUNT * ROUNDS);
+    assert(lol_mutex_trylock(&mutex));
+    assert(!lol_mutex_trylock(&mutex));
+    lol_mutex_unlock(&mutex);
+}
+
+static void *read_or_write(void *arg) {
+    int writer = *(int *)arg;
+    int i = 0;
+
+    for (i = 0; i < ROUNDS; ++i) {
+        if (writer && i % 8 == 0) {
+            lol_rwlock_write_lock(&rwlock);
+            left = left + 1;
+            right = right + 1;
+            lol_rwlock_write_unlock(&rwlock);
+        } else {
+            lol_rwlock_read_lock(&rwlock);
+            assert(left == right);
+            lol_rwlock_read_unlock(&rwlock);
+        }
+    }
+    return NULL;
+}
+
+static void test_rwlock(void) {
+    pthread_t threads[THREAD_COUNT];
+    int writer[THREAD_COUNT];
+    int i = 0;
+
+    for (i = 0; i < THREAD_COUNT; ++i) {
+        writer[i] = i % 2;
+        assert(pthread_create(&threads[i], NULL, read_or_write, &writer[i]) == 0);
+    }
+    for (i = 0; i < THREAD_COUNT; ++i) {
+        assert(pthread_join(threads[i], NULL) == 0);
+    }
+    assert(left == (long)(THREAD_COUNT / 2) * (ROUNDS / 8));
+    assert(right == left);
+}
+
+static void *consume(void *arg) {
+    int i = 0;
+
+    (void)arg;
+    for (i = 0; i < ROUNDS / THREAD_COUNT; ++i) {
+        lol_mutex_lock(&mutex);
+        while (queued == 0) {
+            lol_condvar_wait(&condvar, &mutex);
+        }
+        --queued;
+        ++consumed;
+        lol_mutex_unlock(&mutex);
+    }
+    return NULL;
+}
+
+static void test_condvar(void) {
+    pthread_t threads[THREAD_COUNT];
+    int i = 0;
+
+    for (i = 0; i < THREAD_COUNT; ++i) {
+        assert(pthread_create(&threads[i], NULL, consume, NULL) == 0);
+    }
+    for (i = 0; i < ROUNDS / THREAD_COUNT * THREAD_COUNT; ++i) {
+        lol_mutex_lock(&mutex);
+        ++queued;
+        lol_mutex_unlock(&mutex);
+        if (i % 2 == 0) {
+            lol_condvar_signal(&condvar);
+        } else {
+            lol_condvar_broadcast(&condvar);
+        }
+    }
+    for (i = 0; i < THREAD_COUNT; ++i) {
+        assert(pthread_join(threads[i], NULL) == 0);
+    }
+    assert(queued == 0);
+    assert(consumed == ROUNDS / THREAD_COUNT * THREAD_COUNT);
+}
+
+int main(void) {
+    test_mutex();
+    test_rwlock();
+    test_condvar();
+    return 0;
+}
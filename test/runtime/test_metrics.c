@@ -0,0 +1,200 @@
+/* Tests lol_metrics.h: histogram buckets, registration, the Prometheus text
+format, and dumps from several threads at once. */
+#include "lol_metrics.h"
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define THREAD_COUNT 4
+#define DUMPS_PER_THREAD 200
+#define UPDATES_PER_THREAD 100000
+
+/* Every value is in the bucket whose bound is the first one at or above it. */
+static void test_buckets(void) {
+    uint64_t previous = 0;
+    unsigned bucket = 0;
+    int shift = 0;
+
+    for (bucket = 0; bucket < LOL_METRICS_HISTOGRAM_BUCKETS; ++bucket) {
+        uint64_t bound = lol_metrics_bucket_bound(bucket);
+
+        assert(lol_metrics_bucket(bound) == bucket);
+        if (bucket > 0) {
+            assert(bound > previous);
+            assert(lol_metrics_bucket(previous + 1) == bucket);
+        }
+        /* Within 25% of every value in the bucket */
+        assert(bucket < 16 || bound - previous <= (previous + 1) / 4);
+        previous = bound;
+    }
+    /* The top bucket ends at the largest value. */
+    assert(previous == UINT64_MAX);
+    assert(lol_metrics_bucket(UINT64_MAX) == LOL_METRICS_HISTOGRAM_BUCKETS - 1);
+    for (shift = 4; shift < 64; ++shift) {
+        uint64_t power = (uint64_t)1 << shift;
+
+        assert(lol_metrics_bucket_bound(lol_metrics_bucket(power - 1)) == power - 1);
+        assert(lol_metrics_bucket(power) == 16 + (unsigned)(shift - 4) * 4);
+    }
+}
+
+/* Return everything that lol_metrics_write() writes. The caller frees it. */
+static char *write_metrics(void) {
+    char *text = NULL;
+    size_t size = 0;
+    FILE *file = open_memstream(&text, &size);
+
+    assert(file != NULL);
+    lol_metrics_write(file);
+    assert(fclose(file) == 0);
+    return text;
+}
+
+static void test_registration_and_output(void) {
+    struct lol_metric *requests = lol_metrics_counter("test_requests_total", "Requests handled.");
+    struct lol_metric *depth = lol_metrics_gauge("test_queue_depth", "Requests waiting.");
+    struct lol_metric *latency = lol_metrics_histogram("test_latency_ns", NULL);
+    const char *expected =
+        "# HELP test_requests_total Requests handled.\n"
+        "# TYPE test_requests_total counter\n"
+        "test_requests_total 3\n"
+        "# HELP test_queue_depth Requests waiting.\n"
+        "# TYPE test_queue_depth gauge\n"
+        "test_queue_depth -2\n"
+        "# TYPE test_latency_ns histogram\n"
+        "test_latency_ns_bucket{le=\"5\"} 2\n"
+        "test_latency_ns_bucket{le=\"23\"} 3\n"
+        "test_latency_ns_bucket{le=\"1023\"} 4\n"
+        "test_latency_ns_bucket{le=\"+Inf\"} 4\n"
+        "test_latency_ns_sum 1030\n"
+        "test_latency_ns_count 4\n";
+    char *text = NULL;
+
+    assert(requests != &lol_metrics_discarded);
+    assert(depth != &lol_metrics_discarded);
+    assert(latency != &lol_metrics_discarded);
+    /* Idempotent */
+    assert(lol_metrics_counter("test_requests_total", "Requests handled.") == requests);
+    assert(lol_metrics_histogram("test_latency_ns", NULL) == latency);
+    /* The same name with another kind */
+    assert(lol_metrics_gauge("test_requests_total", NULL) == &lol_metrics_discarded);
+    assert(lol_metrics_histogram("test_queue_depth", NULL) == &lol_metrics_discarded);
+    assert(lol_metrics_counter("test_latency_ns", NULL) == &lol_metrics_discarded);
+
+    lol_counter_inc(requests);
+    lol_counter_add(requests, 2);
+    lol_gauge_set(depth, 3);
+    lol_gauge_add(depth, -5);
+    lol_histogram_record(latency, 5);
+    lol_histogram_record(latency, 5);
+    lol_histogram_record(latency, 20);
+    lol_histogram_record(latency, 1000);
+    /* Updates to the discarded metric go nowhere. */
+    lol_counter_add(&lol_metrics_discarded, 7);
+    lol_gauge_set(&lol_metrics_discarded, 7);
+    lol_histogram_record(&lol_metrics_discarded, 7);
+    assert(lol_counter_read(requests) == 3);
+    assert(lol_gauge_read(depth) == -2);
+    assert(lol_counter_read(&lol_metrics_discarded) == 0);
+    assert(lol_gauge_read(&lol_metrics_discarded) == 0);
+
+    text = write_metrics();
+    assert(strcmp(text, expected) == 0);
+    free(text);
+}
+
+struct worker {
+    pthread_t thread;
+    const char *path;
+    struct lol_metric *counter;
+    int failures;
+};
+
+/* Dump while other threads dump and update. */
+static void *dump_and_update(void *arg) {
+    struct worker *worker = arg;
+    int i = 0;
+
+    for (i = 0; i < UPDATES_PER_THREAD; ++i) {
+        lol_counter_inc(worker->counter);
+        if (i % (UPDATES_PER_THREAD / DUMPS_PER_THREAD) == 0) {
+            worker->failures += lol_metrics_dump(worker->path) != 0;
+        }
+    }
+    return NULL;
+}
+
+static void test_concurrent_dumps(void) {
+    static struct worker workers[THREAD_COUNT];
+    char path[] = "/tmp/lol_metrics_testXXXXXX";
+    char expected[64];
+    char line[256];
+    struct lol_metric *counter = lol_metrics_counter("test_updates_total", NULL);
+    FILE *file = NULL;
+    int i = 0, found = 0;
+
+    assert(mkstemp(path) >= 0);
+    for (i = 0; i < THREAD_COUNT; ++i) {
+        workers[i].path = path;
+        workers[i].counter = counter;
+        assert(pthread_create(&workers[i].thread, NULL, dump_and_update, &workers[i]) == 0);
+    }
+    for (i = 0; i < THREAD_COUNT; ++i) {
+        assert(pthread_join(workers[i].thread, NULL) == 0);
+        /* Each dump finds its own temporary file. */
+        assert(workers[i].failures == 0);
+    }
+    assert(lol_counter_read(counter) == (uint64_t)THREAD_COUNT * UPDATES_PER_THREAD);
+    assert(lol_metrics_dump(path) == 0);
+    snprintf(expected, sizeof expected, "test_updates_total %d\n", THREAD_COUNT * UPDATES_PER_THREAD);
+    file = fopen(path, "r");
+    assert(file != NULL);
+    while (fgets(line, sizeof line, file) != NULL) {
+        found += strcmp(line, expected) == 0;
+    }
+    fclose(file);
+    assert(found == 1);
+    remove(path);
+}
+
+/* Once the registry is full, new metrics are discarded and old ones work. */
+static void test_overflow(void) {
+    static char names[LOL_METRICS_MAX_METRICS][32];
+    struct lol_metric *requests = lol_metrics_counter("test_requests_total", NULL);
+    unsigned i = 0, histograms = 0;
+
+    /* Histograms run out of slots before the registry runs out of entries. */
+    for (i = 0; i < LOL_METRICS_MAX_METRICS; ++i) {
+        snprintf(names[i], sizeof names[i], "test_histogram_%u", i);
+        if (lol_metrics_histogram(names[i], NULL) == &lol_metrics_discarded) {
+            break;
+        }
+        ++histograms;
+    }
+    assert(histograms > 0 && histograms < LOL_METRICS_MAX_METRICS);
+    assert(lol_metrics_used_slots + LOL_METRICS_HISTOGRAM_SLOTS > LOL_METRICS_SLOTS);
+    /* Gauges do not take slots. (The registry keeps the names.) */
+    for (i = histograms; lol_metrics_count < LOL_METRICS_MAX_METRICS; ++i) {
+        snprintf(names[i], sizeof names[i], "test_gauge_%u", i);
+        assert(lol_metrics_gauge(names[i], NULL) != &lol_metrics_discarded);
+    }
+    assert(lol_metrics_gauge("test_one_too_many", NULL) == &lol_metrics_discarded);
+    assert(lol_metrics_counter("test_one_too_many", NULL) == &lol_metrics_discarded);
+    assert(lol_metrics_count == LOL_METRICS_MAX_METRICS);
+    /* Still registered */
+    assert(lol_metrics_counter("test_requests_total", NULL) == requests);
+    lol_counter_inc(requests);
+    assert(lol_counter_read(requests) == 4);
+    free(write_metrics());
+}
+
+int main(void) {
+    test_buckets();
+    test_registration_and_output();
+    test_concurrent_dumps();
+    test_overflow();
+    return 0;
+}
@@ -0,0 +1,119 @@
+/* Tests lol_numa.h: parsing sysfs lists, splitting loops over workers, and
+reading this machine's topology. */
+#include "lol_numa.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Parse a list into `size` members, with guards after them, and return the
+members as a bit mask. */
+static unsigned parse(const char *list, int size) {
+    char members[32 + 4];
+    unsigned mask = 0;
+    int i = 0;
+
+    assert(size <= 32);
+    memset(members, 0, sizeof members);
+    lol_numa_parse_list(list, members, size);
+    for (i = 0; i < size; ++i) {
+        mask |= members[i] ? 1u << i : 0;
+    }
+    for (i = size; i < size + 4; ++i) {
+        assert(!members[i]);
+    }
+    return mask;
+}
+
+static void test_parse_list(void) {
+    assert(parse("0", 8) == 0x1);
+    assert(parse("0-3", 8) == 0xF);
+    /* Node numbers may have gaps */
+    assert(parse("0-1,4", 8) == 0x13);
+    assert(parse("0-1,4\n", 8) == 0x13);
+    assert(parse("1,3,5-6\n", 8) == 0x6A);
+    assert(parse("", 8) == 0);
+    assert(parse("\n", 8) == 0);
+    /* Members at and past `size` are dropped */
+    assert(parse("2-6", 4) == 0xC);
+    assert(parse("4", 4) == 0);
+    assert(parse("3-4", 4) == 0x8);
+    assert(parse("8-11,0", 10) == 0x301);
+    /* Stops at anything that is not a number */
+    assert(parse("1,x,3", 8) == 0x2);
+}
+
+static void test_read_list(void) {
+    char path[] = "/tmp/lol_numa_testXXXXXX";
+    char members[8] = { 0 };
+    int fd = mkstemp(path);
+    FILE *file = NULL;
+
+    assert(fd >= 0);
+    file = fdopen(fd, "w");
+    assert(file != NULL);
+    fputs("0-1,4\n", file);
+    fclose(file);
+    assert(lol_numa_read_list(path, members, 8) == 0);
+    assert(members[0] && members[1] && !members[2] && !members[3] && members[4]);
+    remove(path);
+    assert(lol_numa_read_list(path, members, 8) == -1);
+}
+
+/* The shares cover [0, count) exactly once, in order, and differ in size by at
+most one. */
+static void test_split(void) {
+    size_t counts[] = { 0, 1, 3, 7, 8, 9, 100, 1001 };
+    int workers[] = { 1, 2, 3, 8, 16 };
+    size_t c = 0, w = 0;
+
+    for (c = 0; c < sizeof counts / sizeof counts[0]; ++c) {
+        for (w = 0; w < sizeof workers / sizeof workers[0]; ++w) {
+            size_t count = counts[c], next = 0;
+            size_t smallest = (size_t)-1, largest = 0;
+            int i = 0;
+
+            for (i = 0; i < workers[w]; ++i) {
+                size_t begin = 0, end = 0;
+
+                lol_numa_split(count, i, workers[w], &begin, &end);
+                assert(begin == next && end >= begin);
+                next = end;
+                smallest = end - begin < smallest ? end - begin : smallest;
+                largest = end - begin > largest ? end - begin : largest;
+            }
+            assert(next == count);
+            assert(largest - smallest <= 1);
+        }
+    }
+}
+
+static void test_topology(void) {
+    const struct lol_numa_topology *topology = lol_numa_get_topology();
+    int i = 0, j = 0;
+
+    assert(topology->node_count >= 1 && topology->node_count <= LOL_NUMA_MAX_NODES);
+    assert(topology->cpu_count >= 1);
+    for (i = 1; i < topology->node_count; ++i) {
+        assert(topology->nodes[i] > topology->nodes[i - 1]);
+    }
+    /* Every CPU is on one of the nodes */
+    for (i = 0; i < topology->cpu_count; ++i) {
+        int cpu = topology->cpus_by_node[i], found = 0;
+
+        for (j = 0; j < topology->node_count; ++j) {
+            found |= topology->cpu_node[cpu] == topology->nodes[j];
+        }
+        assert(found);
+    }
+    assert(lol_numa_get_topology() == topology);
+}
+
+int main(void) {
+    test_parse_list();
+    test_read_list();
+    test_split();
+    test_topology();
+    return 0;
+}
@@ -0,0 +1,167 @@
+/* Tests lol_random.h: bounded sampling without modulo bias, the edges of
+lol_random_range_i32(), and independent per-thread streams. */
+#include "lol_random.h"
+
+#include <assert.h>
+#include <limits.h>
+#include <pthread.h>
+
+#define SAMPLE_COUNT 300000
+#define THREAD_COUNT 4
+#define STREAM_LENGTH 1000
+
+/*
+ * With a bound of 3 * 2^30, reducing a 32-bit sample modulo the bound maps
+ * twice as many samples to [0, 2^30) as to the rest, so half of the results
+ * would land there instead of a third. (Likewise for 64 bits.)
+ */
+static void test_no_modulo_bias(void) {
+    struct lol_xoshiro256ss xoshiro;
+    struct lol_pcg32 pcg;
+    uint32_t bound32 = UINT32_C(3) << 30;
+    uint64_t bound64 = UINT64_C(3) << 62;
+    long low_xoshiro32 = 0, low_pcg32 = 0, low_xoshiro64 = 0;
+    int i = 0;
+
+    lol_xoshiro256ss_seed(&xoshiro, 1);
+    lol_pcg32_seed(&pcg, 1, 1);
+    for (i = 0; i < SAMPLE_COUNT; ++i) {
+        uint32_t x = lol_xoshiro256ss_bounded_u32(&xoshiro, bound32);
+        uint32_t y = lol_pcg32_bounded_u32(&pcg, bound32);
+        uint64_t z = lol_xoshiro256ss_bounded_u64(&xoshiro, bound64);
+
+        assert(x < bound32 && y < bound32 && z < bound64);
+        low_xoshiro32 += x < (UINT32_C(1) << 30);
+        low_pcg32 += y < (UINT32_C(1) << 30);
+        low_xoshiro64 += z < (UINT64_C(1) << 62);
+    }
+    /* A third, give or take ~10 standard deviations */
+    assert(low_xoshiro32 > 97000 && low_xoshiro32 < 103000);
+    assert(low_pcg32 > 97000 && low_pcg32 < 103000);
+    assert(low_xoshiro64 > 97000 && low_xoshiro64 < 103000);
+}
+
+/* Small bounds hit every value about equally often. */
+static void test_small_bounds(void) {
+    struct lol_xoshiro256ss rng;
+    long counts[6] = { 0 };
+    uint32_t filled[64];
+    int i = 0;
+
+    lol_xoshiro256ss_seed(&rng, 2);
+    for (i = 0; i < SAMPLE_COUNT; ++i) {
+        ++counts[lol_xoshiro256ss_bounded_u32(&rng, 6)];
+        assert(lol_xoshiro256ss_bounded_u32(&rng, 1) == 0);
+        assert(lol_xoshiro256ss_bounded_u64(&rng, 1) == 0);
+    }
+    for (i = 0; i < 6; ++i) {
+        assert(counts[i] > 48000 && counts[i] < 52000);
+    }
+    lol_xoshiro256ss_fill_bounded_u32(&rng, filled, 64, 3);
+    for (i = 0; i < 64; ++i) {
+        assert(filled[i] < 3);
+    }
+    for (i = 0; i < 1000; ++i) {
+        double x = lol_xoshiro256ss_double(&rng);
+
+        assert(x >= 0.0 && x < 1.0);
+    }
+}
+
+static void test_range(void) {
+    int negative = 0, positive = 0, i = 0;
+
+    assert(lol_random_range_i32(5, 5) == 5);
+    assert(lol_random_range_i32(INT_MIN, INT_MIN) == INT_MIN);
+    assert(lol_random_range_i32(INT_MAX, INT_MAX) == INT_MAX);
+    /* An empty range gives lo */
+    assert(lol_random_range_i32(3, 2) == 3);
+    for (i = 0; i < 1000; ++i) {
+        /* The full range has 2^32 values, which does not fit in the span */
+        int x = lol_random_range_i32(INT_MIN, INT_MAX);
+        int y = lol_random_range_i32(INT_MAX - 1, INT_MAX);
+        int z = lol_random_range_i32(INT_MIN, INT_MIN + 1);
+        int w = lol_random_range_i32(-3, 3);
+
+        negative += x < 0;
+        positive += x > 0;
+        assert(y == INT_MAX - 1 || y == INT_MAX);
+        assert(z == INT_MIN || z == INT_MIN + 1);
+        assert(w >= -3 && w <= 3);
+    }
+    assert(negative > 400 && positive > 400);
+}
+
+struct stream {
+    uint64_t values[STREAM_LENGTH];
+};
+
+static struct stream streams[THREAD_COUNT];
+
+static void *draw_stream(void *arg) {
+    struct stream *stream = arg;
+
+    lol_random_fill_u64(stream->values, STREAM_LENGTH);
+    return NULL;
+}
+
+/* Thread i's stream is the global seed's jumped ahead i times, so the threads'
+streams neither overlap nor depend on how the threads interleave. */
+static void test_thread_streams(void) {
+    struct lol_xoshiro256ss reference;
+    int i = 0, j = 0, k = 0;
+
+    lol_random_seed(42);
+    draw_stream(&streams[0]);
+    /* One thread at a time, so that they are numbered in this order */
+    for (i = 1; i < THREAD_COUNT; ++i) {
+        pthread_t thread;
+
+        assert(pthread_create(&thread, NULL, draw_stream, &streams[i]) == 0);
+        assert(pthread_join(thread, NULL) == 0);
+    }
+    lol_xoshiro256ss_seed(&reference, 42);
+    for (i = 0; i < THREAD_COUNT; ++i) {
+        struct lol_xoshiro256ss rng = reference;
+
+        for (j = 0; j < STREAM_LENGTH; ++j) {
+            assert(streams[i].values[j] == lol_xoshiro256ss_next(&rng));
+        }
+        lol_xoshiro256ss_jump(&reference);
+    }
+    for (i = 0; i < THREAD_COUNT; ++i) {
+        for (j = i + 1; j < THREAD_COUNT; ++j) {
+            for (k = 0; k < STREAM_LENGTH; ++k) {
+                assert(streams[i].values[k] != streams[j].values[k]);
+            }
+        }
+    }
+    /* Reseeding starts the calling thread's stream over */
+    lol_random_seed(42);
+    assert(lol_random_u64() == streams[0].values[0]);
+}
+
+static void test_pcg_streams(void) {
+    struct lol_pcg32 a, b, c;
+    int i = 0, same = 0;
+
+    lol_pcg32_seed(&a, 7, 1);
+    lol_pcg32_seed(&b, 7, 2);
+    lol_pcg32_seed(&c, 7, 1);
+    for (i = 0; i < 1000; ++i) {
+        uint32_t x = lol_pcg32_next(&a);
+
+        same += x == lol_pcg32_next(&b);
+        assert(x == lol_pcg32_next(&c));
+    }
+    assert(same < 5);
+}
+
+int main(void) {
+    test_no_modulo_bias();
+    test_small_bounds();
+    test_range();
+    test_thread_streams();
+    test_pcg_streams();
+    return 0;
+}
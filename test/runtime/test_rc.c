@@ -0,0 +1,152 @@
+/* Tests lol_rc.h: counting, reuse, and sharing a value and its children with
+other threads. */
+#include "lol_rc.h"
+
+#include <assert.h>
+#include <pthread.h>
+
+#define THREAD_COUNT 4
+#define ITERATION_COUNT 100000
+
+struct node {
+    struct node *left;
+    struct node *right;
+    long value;
+};
+
+static int drops = 0;
+
+static void node_drop(void *value) {
+    struct node *node = value;
+
+    if (node->left != NULL) {
+        lol_rc_release(node->left);
+    }
+    if (node->right != NULL) {
+        lol_rc_release(node->right);
+    }
+    __atomic_add_fetch(&drops, 1, __ATOMIC_RELAXED);
+}
+
+static void node_share(void *value) {
+    struct node *node = value;
+
+    if (node->left != NULL) {
+        lol_rc_share(node->left);
+    }
+    if (node->right != NULL) {
+        lol_rc_share(node->right);
+    }
+}
+
+/* Takes over the references to the children. */
+static struct node *make_node(struct node *left, struct node *right, long value) {
+    struct node *node = lol_rc_new(sizeof *node, node_drop, node_share);
+
+    assert(node != NULL);
+    node->left = left;
+    node->right = right;
+    node->value = value;
+    return node;
+}
+
+static int is_shared(const void *value) {
+    return lol_rc_header(value)->count < 0;
+}
+
+static void test_counts(void) {
+    struct node *node = make_node(NULL, NULL, 1);
+
+    assert(lol_rc_is_unique(node));
+    lol_rc_retain(node);
+    assert(!lol_rc_is_unique(node));
+    lol_rc_release(node);
+    assert(lol_rc_is_unique(node));
+    lol_rc_release(node);
+    assert(drops == 1);
+    drops = 0;
+}
+
+static void test_reuse(void) {
+    struct node *child = make_node(NULL, NULL, 1);
+    struct node *node = make_node(child, NULL, 2);
+    void *memory = NULL;
+
+    /* Not the last reference: nothing to reuse */
+    lol_rc_retain(node);
+    assert(lol_rc_release_for_reuse(node) == NULL);
+    assert(drops == 0);
+    /* The last reference: the children are dropped, the memory is kept */
+    memory = lol_rc_release_for_reuse(node);
+    assert(memory == node);
+    assert(drops == 2);
+    assert(lol_rc_reuse(memory, sizeof *node, node_drop, node_share) == memory);
+    node = memory;
+    node->left = NULL;
+    node->right = NULL;
+    /* A shared value that is uniquely referenced may be reused too, and is
+    no longer shared */
+    lol_rc_share(node);
+    assert(is_shared(node));
+    memory = lol_rc_release_for_reuse(node);
+    assert(memory == node && !is_shared(memory));
+    /* Too small: freed and allocated again */
+    node = lol_rc_reuse(memory, 4096, NULL, NULL);
+    assert(node != NULL && lol_rc_is_unique(node));
+    lol_rc_release(node);
+    assert(drops == 3);
+    drops = 0;
+}
+
+static struct node *root = NULL;
+
+static void *use_tree(void *arg) {
+    int i = 0;
+
+    (void)arg;
+    for (i = 0; i < ITERATION_COUNT; ++i) {
+        struct node *left = root->left;
+        struct node *leaf = left->left;
+
+        lol_rc_retain(left);
+        lol_rc_retain(leaf);
+        assert(leaf->value == 1 && root->right->left == leaf);
+        lol_rc_release(leaf);
+        lol_rc_release(left);
+    }
+    /* Whichever thread finishes last drops the whole tree */
+    lol_rc_release(root);
+    return NULL;
+}
+
+/* Sharing the root shares all of the nodes below it, so threads may retain
+and release them, and drop them, concurrently. */
+static void test_shared_tree(void) {
+    pthread_t threads[THREAD_COUNT];
+    struct node *leaf = make_node(NULL, NULL, 1);
+    int i = 0;
+
+    /* The leaf is reachable through both children */
+    lol_rc_retain(leaf);
+    root = make_node(make_node(leaf, NULL, 2), make_node(leaf, NULL, 3), 4);
+    lol_rc_share(root);
+    assert(is_shared(root) && is_shared(root->left) && is_shared(root->right));
+    assert(is_shared(leaf));
+    for (i = 0; i < THREAD_COUNT; ++i) {
+        lol_rc_retain(root);
+        assert(pthread_create(&threads[i], NULL, use_tree, NULL) == 0);
+    }
+    lol_rc_release(root);
+    for (i = 0; i < THREAD_COUNT; ++i) {
+        assert(pthread_join(threads[i], NULL) == 0);
+    }
+    assert(__atomic_load_n(&drops, __ATOMIC_RELAXED) == 4);
+    drops = 0;
+}
+
+int main(void) {
+    test_counts();
+    test_reuse();
+    test_shared_tree();
+    return 0;
+}
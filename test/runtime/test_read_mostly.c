@@ -0,0 +1,74 @@
+/* Tests lol_read_mostly.h: readers always see a whole value while a writer
+publishes new ones. */
+#include "lol_read_mostly.h"
+
+#include <assert.h>
+#include <pthread.h>
+
+struct pair {
+    long a;
+    long b;
+};
+
+LOL_READ_MOSTLY_DEFINE(pair_cell, struct pair)
+
+#define READER_COUNT 3
+#define UPDATE_COUNT 20000
+
+static struct pair_cell cell;
+static int done = 0;
+
+static void *read_pairs(void *arg) {
+    long last = 0;
+    int online = *(int *)arg;
+
+    if (online) {
+        lol_epoch_online();
+    }
+    while (!__atomic_load_n(&done, __ATOMIC_ACQUIRE)) {
+        const struct pair *pair = NULL;
+
+        if (!online) {
+            lol_epoch_enter();
+        }
+        pair = pair_cell_read(&cell);
+        assert(pair->b == 2 * pair->a);
+        /* Values are published in order. */
+        assert(pair->a >= last);
+        last = pair->a;
+        if (online) {
+            lol_epoch_quiescent();
+        } else {
+            lol_epoch_exit();
+        }
+    }
+    if (online) {
+        lol_epoch_offline();
+    }
+    return NULL;
+}
+
+int main(void) {
+    pthread_t readers[READER_COUNT];
+    int online[READER_COUNT];
+    struct pair pair = { 0, 0 };
+    int i = 0;
+
+    assert(pair_cell_init(&cell, &pair) == 0);
+    for (i = 0; i < READER_COUNT; ++i) {
+        online[i] = i % 2;
+        assert(pthread_create(&readers[i], NULL, read_pairs, &online[i]) == 0);
+    }
+    for (i = 1; i <= UPDATE_COUNT; ++i) {
+        pair.a = i;
+        pair.b = 2 * i;
+        assert(pair_cell_update(&cell, &pair) == 0);
+    }
+    __atomic_store_n(&done, 1, __ATOMIC_RELEASE);
+    for (i = 0; i < READER_COUNT; ++i) {
+        assert(pthread_join(readers[i], NULL) == 0);
+    }
+    assert(pair_cell_read(&cell)->a == UPDATE_COUNT);
+    pair_cell_destroy(&cell);
+    return 0;
+}
@@ -0,0 +1,108 @@
+/* Tests lol_slotmap.h: handles against a model under random inserts and
+removes, stale handles, and inserting a value from the map itself. */
+#include "lol_slotmap.h"
+
+#include <assert.h>
+
+struct record {
+    int id;
+    double x;
+};
+
+LOL_SLOTMAP_DEFINE(records, struct record)
+
+#define RECORD_COUNT 20000
+#define STEPS 500000
+
+static uint32_t handles[RECORD_COUNT];
+static int live[RECORD_COUNT];
+
+static void test_random(void) {
+    struct records map;
+    uint64_t random = 7;
+    long sum = 0, expected = 0;
+    size_t k = 0;
+    int step = 0, i = 0;
+
+    assert(records_init(&map, 0) == 0);
+    assert(records_get(&map, LOL_SLOTMAP_NULL) == NULL);
+    for (step = 0; step < STEPS; ++step) {
+        random = random * UINT64_C(6364136223846793005) + UINT64_C(1442695040888963407);
+        i = (int)((random >> 33) % RECORD_COUNT);
+        if (!live[i] && (random & 1)) {
+            struct record value = { 0 };
+
+            value.id = i;
+            value.x = i * 0.5;
+            assert(records_insert(&map, &value, &handles[i]) == 0);
+            assert(handles[i] != LOL_SLOTMAP_NULL);
+            live[i] = 1;
+        } else if (live[i] && (random & 2)) {
+            assert(records_remove(&map, handles[i]));
+            assert(!records_remove(&map, handles[i]));
+            live[i] = 0;
+        } else if (live[i]) {
+            struct record *record = records_get(&map, handles[i]);
+
+            assert(record != NULL && record->id == i && record->x == i * 0.5);
+        } else if (handles[i] != LOL_SLOTMAP_NULL) {
+            /* Stale, though its slot has probably been reused. */
+            assert(records_get(&map, handles[i]) == NULL);
+        }
+    }
+    for (i = 0; i < RECORD_COUNT; ++i) {
+        if (live[i]) {
+            expected += i;
+        }
+    }
+    for (k = 0; k < records_size(&map); ++k) {
+        struct record *record = &records_values(&map)[k];
+
+        sum += record->id;
+        assert(records_get(&map, records_handle_at(&map, k)) == record);
+    }
+    assert(sum == expected);
+    records_destroy(&map);
+}
+
+static void test_reserve_and_aliasing(void) {
+    struct records map;
+    struct record value = { 1, 1.0 };
+    uint32_t handle = LOL_SLOTMAP_NULL;
+    uint32_t first = LOL_SLOTMAP_NULL;
+    int i = 0;
+
+    assert(records_init(&map, 5) == 0);
+    assert(records_reserve(&map, 0) == 0);
+    assert(records_reserve(&map, 5) == 0);
+    assert(records_insert(&map, &value, &first) == 0);
+    /* Each insert may grow the storage that `value` points into. */
+    for (i = 0; i < 1000; ++i) {
+        assert(records_insert(&map, records_get(&map, first), &handle) == 0);
+        assert(records_get(&map, handle)->id == 1);
+    }
+    records_destroy(&map);
+}
+
+static void test_full(void) {
+    struct records map;
+    struct record value = { 0, 0.0 };
+    uint32_t handle = LOL_SLOTMAP_NULL;
+    size_t i = 0;
+
+    assert(records_init(&map, 0) == 0);
+    for (i = 0; i < LOL_SLOTMAP_MAX_SIZE; ++i) {
+        assert(records_insert(&map, &value, &handle) == 0);
+    }
+    assert(records_insert(&map, &value, &handle) == ENOMEM);
+    assert(records_remove(&map, handle));
+    assert(records_insert(&map, &value, &handle) == 0);
+    records_destroy(&map);
+}
+
+int main(void) {
+    test_random();
+    test_reserve_and_aliasing();
+    test_full();
+    return 0;
+}
@@ -0,0 +1,156 @@
+/* Tests lol_sort.h: the sorts against qsort() on random and patterned inputs,
+stability, partitioning, and the binary searches against a linear scan. */
+#include "lol_sort.h"
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_SIZE 5000
+
+/* `seq` is the original position, to check stability. */
+struct record {
+    int key;
+    int seq;
+};
+
+#define record_less(a, b) ((a)->key < (b)->key)
+LOL_SORT_DEFINE(records, struct record, record_less)
+
+static uint32_t record_key(const struct record *r) {
+    return lol_radix_key_i32(r->key);
+}
+LOL_RADIX_SORT_DEFINE(records, struct record, uint32_t, record_key)
+
+#define int_less(a, b) (*(a) < *(b))
+LOL_SORT_DEFINE(ints, int, int_less)
+
+static uint64_t rng = 0x9E3779B97F4A7C15u;
+
+static uint32_t next_random(void) {
+    rng ^= rng << 13;
+    rng ^= rng >> 7;
+    rng ^= rng << 17;
+    return (uint32_t)(rng >> 32);
+}
+
+/* The order that a stable sort must produce. */
+static int compare_stable(const void *a, const void *b) {
+    const struct record *x = a, *y = b;
+
+    if (x->key != y->key) {
+        return x->key < y->key ? -1 : 1;
+    }
+    return x->seq < y->seq ? -1 : x->seq > y->seq;
+}
+
+enum pattern { RANDOM, FEW_KEYS, ALL_EQUAL, SORTED, REVERSED, ORGAN_PIPE, NEGATIVE, PATTERN_COUNT };
+
+static void fill(struct record *a, size_t n, enum pattern pattern) {
+    size_t i = 0;
+
+    for (i = 0; i < n; ++i) {
+        switch (pattern) {
+        case RANDOM: a[i].key = (int)(next_random() % 1000000); break;
+        case FEW_KEYS: a[i].key = (int)(next_random() % 4); break;
+        case ALL_EQUAL: a[i].key = 7; break;
+        case SORTED: a[i].key = (int)i; break;
+        case REVERSED: a[i].key = (int)(n - i); break;
+        case ORGAN_PIPE: a[i].key = (int)(i < n / 2 ? i : n - i); break;
+        default: a[i].key = (int)next_random(); break;
+        }
+        a[i].seq = (int)i;
+    }
+}
+
+static void test_sorts(void) {
+    static struct record input[MAX_SIZE], expected[MAX_SIZE], actual[MAX_SIZE];
+    size_t sizes[] = { 0, 1, 2, 3, 23, 24, 25, 32, 33, 64, 127, 128, 129, 1000, MAX_SIZE };
+    size_t s = 0, i = 0;
+    int pattern = 0;
+
+    for (s = 0; s < sizeof sizes / sizeof sizes[0]; ++s) {
+        size_t n = sizes[s];
+
+        for (pattern = 0; pattern < PATTERN_COUNT; ++pattern) {
+            fill(input, n, (enum pattern)pattern);
+            memcpy(expected, input, n * sizeof *input);
+            qsort(expected, n, sizeof *expected, compare_stable);
+
+            /* Stable: equal keys keep their order */
+            memcpy(actual, input, n * sizeof *input);
+            assert(records_sort(actual, n) == 0);
+            assert(memcmp(actual, expected, n * sizeof *actual) == 0);
+
+            memcpy(actual, input, n * sizeof *input);
+            assert(records_radix_sort(actual, n) == 0);
+            assert(memcmp(actual, expected, n * sizeof *actual) == 0);
+
+            /* Unstable: the same keys, and the same records */
+            memcpy(actual, input, n * sizeof *input);
+            records_sort_unstable(actual, n);
+            for (i = 0; i < n; ++i) {
+                assert(actual[i].key == expected[i].key);
+            }
+            qsort(actual, n, sizeof *actual, compare_stable);
+            assert(memcmp(actual, expected, n * sizeof *actual) == 0);
+        }
+    }
+}
+
+static void test_partition(void) {
+    int a[1000];
+    int pivot = 500;
+    size_t i = 0, lo = 0;
+
+    for (i = 0; i < 1000; ++i) {
+        a[i] = (int)(next_random() % 1000);
+    }
+    lo = ints_partition(a, 1000, &pivot);
+    for (i = 0; i < 1000; ++i) {
+        assert((a[i] < pivot) == (i < lo));
+    }
+    assert(ints_partition(a, 0, &pivot) == 0);
+}
+
+static void test_search(void) {
+    int a[200];
+    size_t n = 0, i = 0, index = 0;
+    int key = 0;
+
+    /* Empty */
+    assert(ints_lower_bound(a, 0, &key) == 0);
+    assert(ints_upper_bound(a, 0, &key) == 0);
+    assert(!ints_binary_search(a, 0, &key, &index) && index == 0);
+    for (n = 1; n <= 200; n += 13) {
+        /* Sorted, with runs of equal values and gaps */
+        for (i = 0; i < n; ++i) {
+            a[i] = (int)(next_random() % 40) * 2;
+        }
+        ints_sort_unstable(a, n);
+        for (key = -1; key <= 81; ++key) {
+            size_t lower = 0, upper = 0;
+
+            while (lower < n && a[lower] < key) {
+                ++lower;
+            }
+            upper = lower;
+            while (upper < n && a[upper] == key) {
+                ++upper;
+            }
+            assert(ints_lower_bound(a, n, &key) == lower);
+            assert(ints_upper_bound(a, n, &key) == upper);
+            assert(ints_binary_search(a, n, &key, &index) == (upper > lower));
+            assert(index == lower);
+        }
+    }
+    assert(ints_binary_search(a, 1, &a[0], NULL));
+}
+
+int main(void) {
+    test_sorts();
+    test_partition();
+    test_search();
+    return 0;
+}
@@ -0,0 +1,155 @@
+/* Tests lol_task.h: the deque, spawning and syncing across workers, and idle
+workers parking instead of spinning. */
+#include "lol_task.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define WORKER_COUNT 4
+#define MANY_TASKS (LOL_TASK_DEQUE_SIZE + 44)
+#define SLOW_TASKS 16
+
+static void nothing(struct lol_task *task) {
+    (void)task;
+}
+
+/* The owner takes the newest task and thieves take the oldest. */
+static void test_deque(void) {
+    static struct lol_task_deque deque;
+    struct lol_task tasks[LOL_TASK_DEQUE_SIZE + 1];
+    int i = 0;
+
+    assert(lol_task_deque_pop(&deque) == NULL);
+    assert(lol_task_deque_steal(&deque) == NULL);
+    for (i = 0; i < 3; ++i) {
+        assert(lol_task_deque_push(&deque, &tasks[i]));
+    }
+    assert(lol_task_deque_size(&deque) == 3);
+    assert(lol_task_deque_steal(&deque) == &tasks[0]);
+    assert(lol_task_deque_pop(&deque) == &tasks[2]);
+    assert(lol_task_deque_pop(&deque) == &tasks[1]);
+    assert(lol_task_deque_pop(&deque) == NULL);
+    /* Full */
+    for (i = 0; i < LOL_TASK_DEQUE_SIZE; ++i) {
+        tasks[i].run = nothing;
+        assert(lol_task_deque_push(&deque, &tasks[i]));
+    }
+    assert(!lol_task_deque_push(&deque, &tasks[LOL_TASK_DEQUE_SIZE]));
+    for (i = LOL_TASK_DEQUE_SIZE - 1; i >= 0; --i) {
+        assert(lol_task_deque_pop(&deque) == &tasks[i]);
+    }
+}
+
+struct fib_task {
+    struct lol_task task;
+    int n;
+    int result;
+};
+
+static int fib(int n);
+
+static void fib_task_run(struct lol_task *task) {
+    struct fib_task *frame = (struct fib_task *)task;
+
+    frame->result = fib(frame->n);
+}
+
+/* The code that the compiler emits for spawn and sync. */
+static int fib(int n) {
+    struct fib_task a;
+    int b = 0;
+
+    if (n < 2) {
+        return n;
+    }
+    if (lol_task_should_spawn()) {
+        a.n = n - 1;
+        lol_task_spawn(&a.task, fib_task_run);
+    } else {
+        a.result = fib(n - 1);
+        lol_task_skip(&a.task);
+    }
+    b = fib(n - 2);
+    lol_task_sync(&a.task);
+    return a.result + b;
+}
+
+struct slow_task {
+    struct lol_task task;
+    int worker;
+};
+
+static void slow_task_run(struct lol_task *task) {
+    struct slow_task *frame = (struct slow_task *)task;
+    struct timespec delay = { 0, 2 * 1000 * 1000 };
+
+    frame->worker = lol_task_self->index;
+    nanosleep(&delay, NULL);
+}
+
+/* Return how many of the tasks ran on other workers than the calling one. */
+static int run_slow_tasks(void) {
+    struct slow_task tasks[SLOW_TASKS];
+    int i = 0, stolen = 0;
+
+    for (i = 0; i < SLOW_TASKS; ++i) {
+        tasks[i].worker = -1;
+        lol_task_spawn(&tasks[i].task, slow_task_run);
+    }
+    for (i = SLOW_TASKS - 1; i >= 0; --i) {
+        lol_task_sync(&tasks[i].task);
+        assert(tasks[i].task.done && tasks[i].worker >= 0);
+        stolen += tasks[i].worker != 0;
+    }
+    return stolen;
+}
+
+static double cpu_seconds(void) {
+    struct timespec now;
+
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &now);
+    return (double)now.tv_sec + (double)now.tv_nsec / 1e9;
+}
+
+static void test_spawn_and_sync(void) {
+    static struct fib_task many[MANY_TASKS];
+    int i = 0;
+
+    assert(fib(25) == 75025);
+    assert(lol_task_worker_count == WORKER_COUNT);
+    /* Past the deque's capacity, tasks run as they are spawned. */
+    for (i = 0; i < MANY_TASKS; ++i) {
+        many[i].n = i % 20;
+        lol_task_spawn(&many[i].task, fib_task_run);
+    }
+    for (i = MANY_TASKS - 1; i >= 0; --i) {
+        lol_task_sync(&many[i].task);
+        assert(many[i].result == fib(i % 20));
+    }
+    assert(run_slow_tasks() > 0);
+}
+
+/* Idle workers park rather than spin, and spawning wakes them. */
+static void test_parking(void) {
+    struct timespec idle = { 0, 300 * 1000 * 1000 };
+    double start = 0;
+
+    /* Give the workers time to park. */
+    nanosleep(&idle, NULL);
+    start = cpu_seconds();
+    nanosleep(&idle, NULL);
+    /* Three spinning workers would use about 0.9 s. */
+    assert(cpu_seconds() - start < 0.05);
+    assert(__atomic_load_n(&lol_task_idle, __ATOMIC_SEQ_CST) == WORKER_COUNT - 1);
+    assert(run_slow_tasks() > 0);
+    assert(fib(20) == 6765);
+}
+
+int main(void) {
+    test_deque();
+    setenv("LOL_TASK_WORKERS", "4", 1);
+    test_spawn_and_sync();
+    test_parking();
+    return 0;
+}
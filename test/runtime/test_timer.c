@@ -0,0 +1,197 @@
+/* Tests lol_timer.h: the timing wheel tick by tick, the event loop, sleeping
+and timeouts. */
+#include "lol_timer.h"
+
+#include <assert.h>
+
+#define TIMER_COUNT 5000
+
+struct counted {
+    struct lol_timer timer;
+    uint64_t fired_at;
+    int fired;
+};
+
+static uint64_t wheel_now = 0;
+
+static void record(struct lol_timer *timer) {
+    struct counted *counted = (struct counted *)timer;
+
+    counted->fired_at = wheel_now;
+    ++counted->fired;
+}
+
+static uint64_t next_random(uint64_t *state) {
+    *state = *state * UINT64_C(6364136223846793005) + UINT64_C(1442695040888963407);
+    return *state >> 33;
+}
+
+/* Every timer fires once, at exactly its tick, wherever the wheel puts it,
+and cancelled timers never fire. */
+static void test_wheel(void) {
+    static struct lol_timer_wheel wheel;
+    static struct counted timers[TIMER_COUNT];
+    uint64_t random = 1;
+    uint64_t expires[TIMER_COUNT];
+    size_t fired = 0;
+    int i = 0;
+
+    lol_timer_wheel_init(&wheel, 0);
+    assert(lol_timer_wheel_next(&wheel) == LOL_TIMER_NEVER);
+    for (i = 0; i < TIMER_COUNT; ++i) {
+        /* Spread over every level, and past the end of the wheel. */
+        int level = (int)(next_random(&random) % (LOL_TIMER_LEVELS + 1));
+
+        expires[i] = 1 + next_random(&random) % (UINT64_C(1) << (level * LOL_TIMER_SLOT_BITS + 2));
+        lol_timer_init(&timers[i].timer, record, NULL);
+        lol_timer_wheel_add(&wheel, &timers[i].timer, expires[i]);
+        assert(lol_timer_pending(&timers[i].timer));
+    }
+    for (i = 0; i < TIMER_COUNT; i += 7) {
+        assert(lol_timer_wheel_cancel(&wheel, &timers[i].timer));
+        assert(!lol_timer_wheel_cancel(&wheel, &timers[i].timer));
+    }
+    while (wheel.count != 0) {
+        uint64_t next = lol_timer_wheel_next(&wheel);
+
+        /* Jump from event to event, as an event loop does. */
+        assert(next != LOL_TIMER_NEVER && next > wheel_now);
+        wheel_now = next;
+        fired += lol_timer_wheel_advance(&wheel, next);
+    }
+    for (i = 0; i < TIMER_COUNT; ++i) {
+        assert(timers[i].fired == (i % 7 != 0));
+        assert(i % 7 == 0 || timers[i].fired_at == expires[i]);
+        assert(!lol_timer_pending(&timers[i].timer));
+    }
+    assert(fired == TIMER_COUNT - (TIMER_COUNT + 6) / 7);
+}
+
+/* A timer in the past fires at the next tick. */
+static void test_wheel_past(void) {
+    static struct lol_timer_wheel wheel;
+    struct counted late = { 0 };
+
+    lol_timer_wheel_init(&wheel, 1000);
+    wheel_now = 1000;
+    lol_timer_init(&late.timer, record, NULL);
+    lol_timer_wheel_add(&wheel, &late.timer, 10);
+    assert(lol_timer_wheel_next(&wheel) == 1001);
+    wheel_now = 1001;
+    assert(lol_timer_wheel_advance(&wheel, 1001) == 1);
+    assert(late.fired == 1);
+}
+
+static struct lol_timer_loop loop;
+static int loop_fired = 0;
+
+static void count_loop_timer(struct lol_timer *timer) {
+    (void)timer;
+    ++loop_fired;
+}
+
+static void *add_from_thread(void *arg) {
+    static struct lol_timer timer;
+
+    (void)arg;
+    lol_timer_init(&timer, count_loop_timer, NULL);
+    lol_timer_loop_add_ms(&loop, &timer, 10);
+    return NULL;
+}
+
+/* Timers on a loop fire no earlier than asked, and an earlier timer added
+from another thread wakes the loop. */
+static void test_loop(void) {
+    struct lol_timer first;
+    struct lol_timer cancelled;
+    struct lol_timer hour;
+    struct epoll_event events[4];
+    pthread_t thread;
+    uint64_t start = 0;
+
+    assert(lol_timer_loop_init(&loop) == 0);
+    start = lol_timer_now_ns();
+    lol_timer_init(&first, count_loop_timer, NULL);
+    lol_timer_loop_add_ms(&loop, &first, 20);
+    lol_timer_init(&cancelled, count_loop_timer, NULL);
+    lol_timer_loop_add_ms(&loop, &cancelled, 5);
+    assert(lol_timer_loop_cancel(&loop, &cancelled));
+    while (loop_fired == 0) {
+        assert(lol_timer_loop_wait(&loop, events, 4) >= 0);
+    }
+    assert(loop_fired == 1);
+    assert(lol_timer_now_ns() - start >= 20 * UINT64_C(1000000));
+
+    /* The loop sleeps for an hour unless the thread's timer wakes it. */
+    lol_timer_init(&hour, count_loop_timer, NULL);
+    lol_timer_loop_add_ms(&loop, &hour, 3600 * 1000);
+    assert(pthread_create(&thread, NULL, add_from_thread, NULL) == 0);
+    while (loop_fired == 1) {
+        assert(lol_timer_loop_wait(&loop, events, 4) >= 0);
+    }
+    assert(pthread_join(thread, NULL) == 0);
+    assert(loop_fired == 2);
+    assert(lol_timer_loop_cancel(&loop, &hour));
+    lol_timer_loop_destroy(&loop);
+}
+
+static void test_sleep_and_timeouts(void) {
+    uint64_t start = lol_timer_now_ns();
+    int handles[3];
+
+    lol_sleep_ms(5);
+    assert(lol_timer_now_ns() - start >= 5 * UINT64_C(1000000));
+
+    handles[0] = lol_timeout_start(1);
+    handles[1] = lol_timeout_start(3600 * 1000);
+    assert(handles[0] >= 0 && handles[1] >= 0);
+    while (!lol_timeout_expired(handles[0])) {
+        lol_sleep_ms(1);
+    }
+    assert(!lol_timeout_expired(handles[1]));
+    lol_timeout_cancel(handles[0]);
+    lol_timeout_cancel(handles[1]);
+    /* Stale handles count as expired, and cancelling them does nothing. */
+    assert(lol_timeout_expired(handles[1]));
+    lol_timeout_cancel(handles[1]);
+    handles[2] = lol_timeout_start(3600 * 1000);
+    assert(handles[2] >= 0 && handles[2] != handles[1]);
+    assert(!lol_timeout_expired(handles[2]));
+    assert(lol_timeout_expired(handles[1]));
+    lol_timeout_cancel(handles[2]);
+}
+
+/* A sleeping fiber does not hold its worker. */
+static int ticks = 0;
+
+static void sleep_then_count(void *arg) {
+    (void)arg;
+    lol_sleep_ms(20);
+    __atomic_add_fetch(&ticks, 1, __ATOMIC_RELAXED);
+}
+
+static void test_fiber_sleep(void) {
+    struct lol_fiber *fibers[50];
+    uint64_t start = lol_timer_now_ns();
+    int i = 0;
+
+    for (i = 0; i < 50; ++i) {
+        fibers[i] = lol_fiber_spawn(sleep_then_count, NULL);
+        assert(fibers[i] != NULL);
+    }
+    for (i = 0; i < 50; ++i) {
+        lol_fiber_join(fibers[i]);
+    }
+    assert(ticks == 50);
+    /* They slept at the same time, even on one worker. */
+    assert(lol_timer_now_ns() - start < 50 * 20 * UINT64_C(1000000));
+}
+
+int main(void) {
+    test_wheel();
+    test_wheel_past();
+    test_loop();
+    test_sleep_and_timeouts();
+    test_fiber_sleep();
+    return 0;
+}